@@ -0,0 +1,860 @@
+#include <strsafe.h>
+
+#include "common.h"
+#include <winsock2.h>
+#include <afunix.h>
+#include "Admin.h"
+#include "HttpSendRecv.h"
+#include "RoomManager.h"
+#include "RoomIndex.h"
+#include "RoomNumber.h"
+#include "RoomSnapshot.h"
+#include "Compression.h"
+#include "Random.h"
+#include "Metrics.h"
+#include "LockProfile.h"
+#include "Trace.h"
+#include "Profiler.h"
+#include "Config.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+#define HANDOFF_ROOMS_BATCH 1024 // room numbers looked up at a time by handoff
+#define HANDOFF_LISTEN_TIMEOUT 10000 // ms the new process has to add the URLs, the server answers 503 meanwhile
+
+// Where the replies of a command go.
+typedef struct _ADMIN_CLIENT
+{
+    SOCKET Socket; // INVALID_SOCKET for the console
+} ADMIN_CLIENT, * PADMIN_CLIENT;
+
+typedef VOID(*ADMIN_COMMAND_PROC)(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[]);
+
+typedef struct _ADMIN_COMMAND
+{
+    LPCWSTR Name;
+    LPCWSTR Usage;
+    ADMIN_COMMAND_PROC Proc;
+} ADMIN_COMMAND;
+
+typedef struct _LINE_READER
+{
+    SOCKET Socket;
+    int cbUsed; // bytes in Buffer
+    int cbLine; // the line returned last, with its line feed. dropped on the next call
+    CHAR Buffer[ADMIN_LINE_MAXLEN];
+} LINE_READER, * PLINE_READER;
+
+static HANDLE hStopEvent = NULL;
+static SRWLOCK CommandLock = SRWLOCK_INIT; // one command at a time, from either thread
+static SOCKET ListenSocket = INVALID_SOCKET;
+static SOCKET volatile ClientSocket = INVALID_SOCKET;
+static HANDLE hSocketThread = NULL;
+static BOOL bHandedOff = FALSE; // the socket path belongs to the next process now
+
+static PTP_TIMER pDrainTimer = NULL;
+static ULONGLONG DrainDeadline; // GetTickCount64
+
+// taken over from the previous process, given back when it exits.
+static PUINT pReservedList = NULL;
+static UINT ReservedCnt = 0;
+static UINT ReservedMax = 0;
+
+static VOID SendAll(_In_ SOCKET Socket, _In_reads_bytes_(cbLen) const CHAR* pData, _In_ int cbLen)
+{
+    while (cbLen > 0)
+    {
+        int cbSent = send(Socket, pData, cbLen, 0);
+        if (cbSent == SOCKET_ERROR)
+            return; // the client is gone, recv notices
+        pData += cbSent;
+        cbLen -= cbSent;
+    }
+}
+
+// Next line without its line feed. NULL when the peer is gone or the line doesn't fit.
+_Ret_maybenull_
+static PCHAR ReadLine(_Inout_ PLINE_READER pReader)
+{
+    pReader->cbUsed -= pReader->cbLine;
+    MoveMemory(pReader->Buffer, pReader->Buffer + pReader->cbLine, pReader->cbUsed);
+    pReader->cbLine = 0;
+
+    for (;;)
+    {
+        PCHAR pEnd = memchr(pReader->Buffer, '\n', pReader->cbUsed);
+        if (pEnd)
+        {
+            *pEnd = '\0';
+            pReader->cbLine = (int)(pEnd - pReader->Buffer) + 1;
+            return pReader->Buffer;
+        }
+        if (pReader->cbUsed == sizeof(pReader->Buffer))
+            return NULL;
+
+        int cbRecv = recv(pReader->Socket, pReader->Buffer + pReader->cbUsed, sizeof(pReader->Buffer) - pReader->cbUsed, 0);
+        if (cbRecv <= 0)
+            return NULL;
+        pReader->cbUsed += cbRecv;
+    }
+}
+
+// One reply line, FormatMessage inserts as in Log.
+static VOID AdminPrint(_In_ PADMIN_CLIENT pClient, _In_z_ LPCWSTR Format, ...)
+{
+    LPWSTR pBuffer = NULL;
+    va_list args;
+
+    va_start(args, Format);
+    DWORD cchLen = FormatMessageW(
+        FORMAT_MESSAGE_FROM_STRING | FORMAT_MESSAGE_ALLOCATE_BUFFER,
+        Format,
+        0,
+        0,
+        (LPWSTR)&pBuffer,
+        0,
+        &args);
+    va_end(args);
+    if (!cchLen)
+        return;
+
+    if (pClient->Socket == INVALID_SOCKET)
+    {
+        wprintf(L"%s\n", pBuffer);
+    }
+    else
+    {
+        int cbLen = WideCharToMultiByte(CP_UTF8, 0, pBuffer, cchLen, NULL, 0, NULL, NULL);
+        PCHAR pUtf8 = HeapAlloc(GetProcessHeap(), 0, cbLen + 1);
+        if (pUtf8)
+        {
+            WideCharToMultiByte(CP_UTF8, 0, pBuffer, cchLen, pUtf8, cbLen, NULL, NULL);
+            pUtf8[cbLen] = '\n';
+            SendAll(pClient->Socket, pUtf8, cbLen + 1);
+            HeapFree(GetProcessHeap(), 0, pUtf8);
+        }
+    }
+    LocalFree(pBuffer);
+}
+
+static BOOL ParseRoomArg(_In_z_ LPCWSTR Arg, _Out_ UINT* pNumber)
+{
+    CHAR szName[ROOM_NAME_MAXLEN + 1];
+    *pNumber = 0;
+    if (!WideCharToMultiByte(CP_UTF8, 0, Arg, -1, szName, sizeof(szName), NULL, NULL))
+        return FALSE; // too long
+    return ParseRoomNumber(szName, pNumber);
+}
+
+static VOID CALLBACK DrainTimerCallback(
+    _Inout_ PTP_CALLBACK_INSTANCE Instance,
+    _Inout_opt_ PVOID Context,
+    _Inout_ PTP_TIMER Timer)
+{
+    UINT64 GameCnt = GetMetric(METRIC_GAMES_STARTED) - GetMetric(METRIC_GAMES_ENDED);
+    if (GameCnt == 0)
+    {
+        Log(LOG_INFO, L"drained, no game running. stopping.");
+        SetEvent(hStopEvent);
+    }
+    else if (GetTickCount64() >= DrainDeadline)
+    {
+        Log(LOG_WARNING, L"drain deadline passed with %1!I64u! games running, stopping.", GameCnt);
+        SetEvent(hStopEvent);
+    }
+}
+
+static BOOL StartDrain(_In_ UINT Seconds)
+{
+    if (!pDrainTimer)
+    {
+        pDrainTimer = CreateThreadpoolTimer(DrainTimerCallback, NULL, NULL);
+        if (!pDrainTimer)
+        {
+            LogErrorMessage(L"CreateThreadpoolTimer", GetLastError());
+            return FALSE;
+        }
+    }
+
+    bRoomDraining = TRUE;
+    DrainDeadline = GetTickCount64() + Seconds * 1000ULL;
+
+    // relative due time, in 100ns
+    LARGE_INTEGER DueTime;
+    DueTime.QuadPart = -(LONGLONG)DRAIN_CHECK_INTERVAL * 10000;
+    FILETIME ftDueTime = { DueTime.LowPart, (DWORD)DueTime.HighPart };
+    SetThreadpoolTimer(pDrainTimer, &ftDueTime, DRAIN_CHECK_INTERVAL, 0);
+
+    Log(LOG_WARNING, L"draining: no new rooms, stopping when no game is running or in %1!u! s.", Seconds);
+    return TRUE;
+}
+
+static VOID CancelDrain(VOID)
+{
+    if (pDrainTimer)
+        SetThreadpoolTimer(pDrainTimer, NULL, 0, 0);
+    bRoomDraining = FALSE;
+    Log(LOG_INFO, L"drain cancelled.");
+}
+
+static VOID AdminHelp(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[]);
+
+static VOID AdminStop(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    AdminPrint(pClient, L"stopping.");
+    SetEvent(hStopEvent);
+}
+
+static VOID AdminStats(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    AdminPrint(pClient, L"connections: %1!I64u!, rooms: %2!u!, games running: %3!I64u!, frames received: %4!I64u!, sent: %5!I64u!%6",
+        GetMetric(METRIC_CONNECTIONS_OPENED) - GetMetric(METRIC_CONNECTIONS_CLOSED),
+        GetRoomIndexCount(),
+        GetMetric(METRIC_GAMES_STARTED) - GetMetric(METRIC_GAMES_ENDED),
+        GetMetric(METRIC_FRAMES_RECEIVED),
+        GetMetric(METRIC_FRAMES_SENT),
+        bRoomDraining ? L", draining" : L"");
+
+    // the details go to the server log as before.
+    PrintCompressionStats();
+    PrintRoomStats();
+    PrintConnectionStats();
+}
+
+static VOID AdminRooms(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    UINT NumberList[ADMIN_ROOMS_PAGE];
+    PGAME_ROOM RoomList[ADMIN_ROOMS_PAGE];
+    CHAR szName[ROOM_NAME_MAXLEN + 1];
+    UINT MinNumber = 0;
+
+    if (ArgCnt > 1)
+    {
+        if (!ParseRoomArg(ArgList[1], &MinNumber))
+        {
+            AdminPrint(pClient, L"usage: rooms [after room]");
+            return;
+        }
+        MinNumber++;
+    }
+
+    UINT Cnt = EnumRoomIndex(MinNumber, ADMIN_ROOMS_PAGE, NumberList, RoomList);
+    for (UINT i = 0; i < Cnt; i++)
+    {
+        // read without the room's lock, only shown. the room may have closed or been reused since.
+        PGAME_ROOM pRoom = RoomList[i];
+        BOOL bGaming = pRoom->bGaming;
+        UINT WaitingCount = pRoom->WaitingCount;
+        UINT PlayingCount = pRoom->PlayingCount;
+        if (pRoom->RoomNumber != NumberList[i])
+            continue;
+
+        FormatRoomNumber(NumberList[i], szName);
+        AdminPrint(pClient, L"%1!-6S!  %2!-7s!  %3!u! online, %4!u! playing",
+            szName, bGaming ? L"gaming" : L"waiting", WaitingCount, bGaming ? PlayingCount : 0);
+    }
+
+    if (Cnt == ADMIN_ROOMS_PAGE)
+    {
+        FormatRoomNumber(NumberList[Cnt - 1], szName);
+        AdminPrint(pClient, L"more: rooms %1!S!", szName);
+    }
+    else
+    {
+        AdminPrint(pClient, L"%1!u! rooms open.", GetRoomIndexCount());
+    }
+}
+
+static VOID AdminRoom(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    UINT RoomNumber;
+    if (ArgCnt < 2 || !ParseRoomArg(ArgList[1], &RoomNumber))
+    {
+        AdminPrint(pClient, L"usage: room <room>");
+        return;
+    }
+
+    PGAME_ROOM pRoom = LookupRoomIndex(RoomNumber);
+    if (!pRoom || pRoom->RoomNumber != RoomNumber)
+    {
+        AdminPrint(pClient, L"room %1 is not open.", ArgList[1]);
+        return;
+    }
+
+    // same as AdminRooms, no lock. a name can be torn by a change in progress,
+    // pConnInfo stays readable: connections and rooms are slab memory, never given back.
+    BOOL bGaming = pRoom->bGaming;
+    UINT WaitingCount = min(pRoom->WaitingCount, ROOM_PLAYER_MAX);
+    AdminPrint(pClient, L"room %1: %2, version %3!u!, %4!u! online%5",
+        ArgList[1], bGaming ? L"gaming" : L"waiting", pRoom->StatusVersion, WaitingCount,
+        pRoom->Password[0] ? L", password" : L"");
+
+    for (UINT i = 0; i < WaitingCount; i++)
+    {
+        PLAYER_INFO Player = pRoom->WaitingList[i];
+        Player.NickName[PLAYER_NICK_MAXLEN] = '\0';
+        AdminPrint(pClient, L"  id %1!u!  conn %2!u!  %3!S!%4",
+            Player.GameID, Player.pConnInfo ? Player.pConnInfo->ConnId : 0, Player.NickName,
+            Player.bIsRoomOwner ? L"  (owner)" : L"");
+    }
+
+    PROOM_SNAPSHOT pSnapshot = ReferenceRoomSnapshot(pRoom);
+    if (pSnapshot)
+    {
+        AdminPrint(pClient, L"roomStatus %1!u!: %2!.*S!", pSnapshot->Version, pSnapshot->cbJsonLen, pSnapshot->Data);
+        ReleaseRoomSnapshot(pSnapshot);
+    }
+}
+
+static VOID AdminKick(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    UINT ConnId = ArgCnt > 1 ? wcstoul(ArgList[1], NULL, 10) : 0;
+    if (!ConnId)
+    {
+        AdminPrint(pClient, L"usage: kick <conn>, conn as shown by room");
+        return;
+    }
+
+    if (!KickConnection(ConnId))
+    {
+        AdminPrint(pClient, L"no connection %1!u!.", ConnId);
+        return;
+    }
+    Log(LOG_INFO, L"admin: kicked connection %1!u!.", ConnId);
+    AdminPrint(pClient, L"connection %1!u! disconnected.", ConnId);
+}
+
+static VOID AdminDrain(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    if (ArgCnt > 1 && wcscmp(ArgList[1], L"cancel") == 0)
+    {
+        CancelDrain();
+        AdminPrint(pClient, L"rooms can be created again.");
+        return;
+    }
+
+    UINT Seconds = ArgCnt > 1 ? wcstoul(ArgList[1], NULL, 10) : DRAIN_SECONDS_DEFAULT;
+    if (!Seconds)
+    {
+        AdminPrint(pClient, L"usage: drain [seconds|cancel]");
+        return;
+    }
+    if (!StartDrain(Seconds))
+    {
+        AdminPrint(pClient, L"drain didn't start, see the log.");
+        return;
+    }
+    AdminPrint(pClient, L"draining: %1!u! rooms open, %2!I64u! games running.",
+        GetRoomIndexCount(), GetMetric(METRIC_GAMES_STARTED) - GetMetric(METRIC_GAMES_ENDED));
+}
+
+// The running side of TakeOver, see Admin.h.
+static VOID AdminHandoff(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    static UINT NumberList[HANDOFF_ROOMS_BATCH];
+    static PGAME_ROOM RoomList[HANDOFF_ROOMS_BATCH];
+
+    if (pClient->Socket == INVALID_SOCKET)
+    {
+        AdminPrint(pClient, L"handoff is sent by a new process started with -takeover.");
+        return;
+    }
+    if (bHandedOff || !StartDrain(DRAIN_SECONDS_DEFAULT))
+    {
+        AdminPrint(pClient, L"error");
+        return;
+    }
+
+    AdminPrint(pClient, L"tick %1!u!", RoomConfig.FlushInterval);
+    AdminPrint(pClient, L"loglevel %1!d!", LogMinLevel);
+
+    // draining, no room opens meanwhile. codes go too, the new process must not draw one still shown here.
+    // passwords stay: the rooms stay in this process, which keeps checking them.
+    UINT MinNumber = 0;
+    UINT Cnt;
+    do
+    {
+        Cnt = EnumRoomIndex(MinNumber, HANDOFF_ROOMS_BATCH, NumberList, RoomList);
+        for (UINT i = 0; i < Cnt; i++)
+            AdminPrint(pClient, L"room %1!u!", NumberList[i]);
+        if (Cnt)
+            MinNumber = NumberList[Cnt - 1] + 1;
+    } while (Cnt == HANDOFF_ROOMS_BATCH && MinNumber != 0);
+
+    if (!StopListening())
+    {
+        CancelDrain();
+        AdminPrint(pClient, L"error");
+        return;
+    }
+    AdminPrint(pClient, L"release");
+
+    // the URLs must not be left with nobody, take them back if the new process couldn't add them in time.
+    // CommandLock is held, a new process that hangs mustn't keep the console waiting either.
+    DWORD Timeout = HANDOFF_LISTEN_TIMEOUT;
+    setsockopt(pClient->Socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&Timeout, sizeof(Timeout));
+    LINE_READER Reader = { pClient->Socket };
+    PCHAR pLine = ReadLine(&Reader);
+    int Error = pLine ? 0 : WSAGetLastError();
+    Timeout = 0;
+    setsockopt(pClient->Socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&Timeout, sizeof(Timeout));
+
+    if (!pLine || strcmp(pLine, "listening") != 0)
+    {
+        if (Error == WSAETIMEDOUT)
+            Log(LOG_ERROR, L"handoff failed, the new process didn't add the URLs within %1!u! ms.", HANDOFF_LISTEN_TIMEOUT);
+        else
+            Log(LOG_ERROR, L"handoff failed, the new process didn't take the URLs: %1!S!", pLine ? pLine : "disconnected");
+        CancelDrain();
+        if (StartListening())
+            Log(LOG_WARNING, L"listening again after the failed handoff.");
+        else // or the new process added them just too late, then it serves
+            Log(LOG_CRITICAL, L"couldn't take the URLs back after the failed handoff.");
+        AdminPrint(pClient, L"error");
+        return;
+    }
+
+    bHandedOff = TRUE;
+    Log(LOG_WARNING, L"handed off to the new process, serving the open rooms until drained.");
+}
+
+static VOID AdminLogLevel(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    static const LPCWSTR LevelName[] = { L"debug", L"info", L"warning", L"error", L"critical" };
+
+    if (ArgCnt > 1)
+    {
+        for (INT Level = LOG_DEBUG; Level <= LOG_CRITICAL; Level++)
+        {
+            if (_wcsicmp(ArgList[1], LevelName[Level]) == 0)
+            {
+                LogMinLevel = Level;
+                AdminPrint(pClient, L"log level is %1.", LevelName[Level]);
+                return;
+            }
+        }
+        AdminPrint(pClient, L"usage: loglevel [debug|info|warning|error|critical]");
+        return;
+    }
+    AdminPrint(pClient, L"log level is %1.", LevelName[LogMinLevel]);
+}
+
+static VOID AdminTick(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    if (ArgCnt < 2)
+    {
+        AdminPrint(pClient, L"room flush interval is %1!u! ms.", RoomConfig.FlushInterval);
+        return;
+    }
+    if (SetConfig(L"room_flush_interval", ArgList[1]))
+        AdminPrint(pClient, L"room flush interval is %1!u! ms for new rooms.", RoomConfig.FlushInterval);
+    else
+        AdminPrint(pClient, L"not changed, see the log.");
+}
+
+static VOID AdminSeed(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    if (ArgCnt < 2)
+    {
+        AdminPrint(pClient, L"usage: seed <number>");
+        return;
+    }
+    SetRandomSeed(_wcstoui64(ArgList[1], NULL, 10));
+}
+
+static VOID AdminLocks(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    if (ArgCnt > 1 && wcscmp(ArgList[1], L"on") == 0)
+        EnableLockProfile(TRUE);
+    else if (ArgCnt > 1 && wcscmp(ArgList[1], L"off") == 0)
+        EnableLockProfile(FALSE);
+    else
+        PrintLockProfile();
+}
+
+static VOID AdminProfile(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    UINT Seconds = ArgCnt > 1 ? wcstoul(ArgList[1], NULL, 10) : 0;
+    if (!Seconds)
+    {
+        AdminPrint(pClient, L"usage: profile <seconds>");
+        return;
+    }
+    if (!StartProfiler(Seconds))
+        AdminPrint(pClient, L"profiler didn't start, see the log.");
+}
+
+static VOID AdminTrace(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    LPCWSTR Arg = ArgCnt > 1 ? ArgList[1] : L"";
+    if (wcscmp(Arg, L"on") == 0)
+        EnableTrace(TRUE);
+    else if (wcscmp(Arg, L"off") == 0)
+        EnableTrace(FALSE);
+    else if (wcscmp(Arg, L"dump") == 0)
+        DumpTrace(NULL);
+    else if (wcscmp(Arg, L"slow") == 0 && ArgCnt > 2)
+    {
+        UINT SlowMs = wcstoul(ArgList[2], NULL, 10);
+        TraceSlowUs = SlowMs * 1000;
+        AdminPrint(pClient, L"messages slower than %1!u! ms dump traces, 0 never.", SlowMs);
+    }
+    else
+        AdminPrint(pClient, L"usage: trace on|off|dump|slow <ms>");
+}
+
+static VOID AdminConfig(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    if (ArgCnt > 1 && wcscmp(ArgList[1], L"reload") == 0 && !ReloadConfig())
+        AdminPrint(pClient, L"some settings weren't changed, see the log.");
+
+    const CONFIG_ENTRY* pEntry;
+    for (UINT i = 0; (pEntry = GetConfigEntry(i)) != NULL; i++)
+    {
+        WCHAR Value[64];
+        FormatConfigValue(pEntry, Value, _countof(Value));
+        AdminPrint(pClient, L"%1 = %2    ; %3%4", pEntry->Key, Value, pEntry->Help, pEntry->bReload ? L"" : L" (restart)");
+    }
+}
+
+static VOID AdminSet(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    if (ArgCnt < 3)
+    {
+        AdminPrint(pClient, L"usage: set <key> <value>");
+        return;
+    }
+    if (!SetConfig(ArgList[1], ArgList[2]))
+        AdminPrint(pClient, L"not changed, see the log.");
+}
+
+static const ADMIN_COMMAND CommandList[] = {
+    { L"help",     L"this list",                                          AdminHelp },
+    { L"stop",     L"stop the server",                                    AdminStop },
+    { L"stats",    L"summary here, details in the server log",            AdminStats },
+    { L"rooms",    L"[after room]  list open rooms, a page at a time",    AdminRooms },
+    { L"room",     L"<room>  players and roomStatus of a room",           AdminRoom },
+    { L"kick",     L"<conn>  disconnect a connection",                    AdminKick },
+    { L"drain",    L"[seconds|cancel]  refuse new rooms, stop when games are over", AdminDrain },
+    { L"handoff",  L"sent by a new process started with -takeover",       AdminHandoff },
+    { L"loglevel", L"[debug|info|warning|error|critical]  drop log messages below", AdminLogLevel },
+    { L"tick",     L"[ms]  room flush interval for new rooms",            AdminTick },
+    { L"seed",     L"<number>  seed the game random generator",           AdminSeed },
+    { L"locks",    L"[on|off]  lock contention profile, shown in the log", AdminLocks },
+    { L"profile",  L"<seconds>  sample the CPU, writes a .folded file",   AdminProfile },
+    { L"trace",    L"on|off|dump|slow <ms>  message span tracing",        AdminTrace },
+    { L"config",   L"[reload]  settings, reload reads the config file again", AdminConfig },
+    { L"set",      L"<key> <value>  change a setting until the next start", AdminSet },
+};
+
+static VOID AdminHelp(_In_ PADMIN_CLIENT pClient, _In_ UINT ArgCnt, _In_reads_(ArgCnt) LPWSTR ArgList[])
+{
+    for (UINT i = 0; i < _countof(CommandList); i++)
+        AdminPrint(pClient, L"%1!-9s! %2", CommandList[i].Name, CommandList[i].Usage);
+}
+
+static VOID ExecuteAdminCommand(_In_ PADMIN_CLIENT pClient, _Inout_z_ LPWSTR Line)
+{
+    LPWSTR ArgList[ADMIN_ARGS_MAX];
+    UINT ArgCnt = 0;
+    LPWSTR Context = NULL;
+
+    for (LPWSTR Token = wcstok_s(Line, L" \t\r\n", &Context);
+        Token && ArgCnt < ADMIN_ARGS_MAX;
+        Token = wcstok_s(NULL, L" \t\r\n", &Context))
+        ArgList[ArgCnt++] = Token;
+    if (!ArgCnt)
+        return;
+
+    for (UINT i = 0; i < _countof(CommandList); i++)
+    {
+        if (wcscmp(ArgList[0], CommandList[i].Name) == 0)
+        {
+            AcquireSRWLockExclusive(&CommandLock);
+            CommandList[i].Proc(pClient, ArgCnt, ArgList);
+            ReleaseSRWLockExclusive(&CommandLock);
+            return;
+        }
+    }
+    AdminPrint(pClient, L"unknown command: %1, see help.", ArgList[0]);
+}
+
+static DWORD WINAPI ConsoleThread(_In_ LPVOID lpParameter)
+{
+    ADMIN_CLIENT Console = { INVALID_SOCKET };
+    WCHAR Line[ADMIN_LINE_MAXLEN];
+
+    while (fgetws(Line, _countof(Line), stdin))
+        ExecuteAdminCommand(&Console, Line);
+
+    Log(LOG_INFO, L"console input closed, the admin socket still takes commands.");
+    return 0;
+}
+
+static VOID ServeAdminClient(_In_ SOCKET Socket)
+{
+    ADMIN_CLIENT Client = { Socket };
+    LINE_READER Reader = { Socket };
+    WCHAR Line[ADMIN_LINE_MAXLEN];
+    PCHAR pLine;
+
+    while ((pLine = ReadLine(&Reader)) != NULL)
+    {
+        if (MultiByteToWideChar(CP_UTF8, 0, pLine, -1, Line, _countof(Line)))
+            ExecuteAdminCommand(&Client, Line);
+    }
+    if (Reader.cbUsed == sizeof(Reader.Buffer))
+        AdminPrint(&Client, L"line too long.");
+}
+
+static DWORD WINAPI AdminSocketThread(_In_ LPVOID lpParameter)
+{
+    for (;;)
+    {
+        SOCKET Socket = accept(ListenSocket, NULL, NULL);
+        if (Socket == INVALID_SOCKET)
+        {
+            if (WaitForSingleObject(hStopEvent, 0) != WAIT_OBJECT_0)
+                LogErrorMessage(L"accept", WSAGetLastError());
+            break;
+        }
+
+        ClientSocket = Socket;
+        ServeAdminClient(Socket);
+        ClientSocket = INVALID_SOCKET;
+        closesocket(Socket);
+    }
+    return 0;
+}
+
+static BOOL StartAdminSocket(VOID)
+{
+    WSADATA WsaData;
+    SOCKADDR_UN Addr = { AF_UNIX };
+    BOOL bSuccess = FALSE;
+
+    int ret = WSAStartup(MAKEWORD(2, 2), &WsaData);
+    if (ret)
+    {
+        LogErrorMessage(L"WSAStartup", ret);
+        return FALSE;
+    }
+
+    __try
+    {
+        ListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (ListenSocket == INVALID_SOCKET)
+        {
+            LogErrorMessage(L"socket", WSAGetLastError());
+            __leave;
+        }
+
+        StringCchCopyA(Addr.sun_path, _countof(Addr.sun_path), ADMIN_SOCKET_PATH);
+        DeleteFileA(ADMIN_SOCKET_PATH); // left by a previous run, bind fails on an existing file
+        if (bind(ListenSocket, (SOCKADDR*)&Addr, sizeof(Addr)) == SOCKET_ERROR)
+        {
+            LogErrorMessage(L"bind", WSAGetLastError());
+            __leave;
+        }
+        if (listen(ListenSocket, 1) == SOCKET_ERROR)
+        {
+            LogErrorMessage(L"listen", WSAGetLastError());
+            __leave;
+        }
+
+        hSocketThread = CreateThread(NULL, 0, AdminSocketThread, NULL, 0, NULL);
+        if (!hSocketThread)
+        {
+            LogErrorMessage(L"CreateThread", GetLastError());
+            __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (ListenSocket != INVALID_SOCKET)
+                closesocket(ListenSocket);
+            ListenSocket = INVALID_SOCKET;
+            WSACleanup();
+        }
+    }
+    return bSuccess;
+}
+
+// Waits for the previous process to exit, its rooms are gone then.
+static DWORD WINAPI HandoffWatchThread(_In_ LPVOID lpParameter)
+{
+    SOCKET Socket = (SOCKET)lpParameter;
+    CHAR Buffer[64];
+
+    while (recv(Socket, Buffer, sizeof(Buffer), 0) > 0);
+    closesocket(Socket);
+
+    for (UINT i = 0; i < ReservedCnt; i++)
+        FreeRoomNumber(pReservedList[i]);
+    Log(LOG_INFO, L"the previous process is gone, %1!u! room numbers are free again.", ReservedCnt);
+
+    HeapFree(GetProcessHeap(), 0, pReservedList);
+    pReservedList = NULL;
+    ReservedCnt = 0;
+    WSACleanup();
+    return 0;
+}
+
+static VOID AddReservedNumber(_In_ UINT Number)
+{
+    if (ReservedCnt == ReservedMax)
+    {
+        UINT NewMax = ReservedMax ? ReservedMax * 2 : HANDOFF_ROOMS_BATCH;
+        PUINT pNewList = pReservedList
+            ? HeapReAlloc(GetProcessHeap(), 0, pReservedList, NewMax * sizeof(UINT))
+            : HeapAlloc(GetProcessHeap(), 0, NewMax * sizeof(UINT));
+        if (!pNewList)
+            return; // only a number the two processes may both show
+        pReservedList = pNewList;
+        ReservedMax = NewMax;
+    }
+
+    if (ReserveRoomNumber(Number))
+        pReservedList[ReservedCnt++] = Number;
+}
+
+BOOL TakeOver(VOID)
+{
+    WSADATA WsaData;
+    SOCKADDR_UN Addr = { AF_UNIX };
+    SOCKET Socket = INVALID_SOCKET;
+    BOOL bSuccess = FALSE;
+
+    int ret = WSAStartup(MAKEWORD(2, 2), &WsaData);
+    if (ret)
+    {
+        LogErrorMessage(L"WSAStartup", ret);
+        return FALSE;
+    }
+
+    __try
+    {
+        Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (Socket == INVALID_SOCKET)
+        {
+            LogErrorMessage(L"socket", WSAGetLastError());
+            __leave;
+        }
+
+        StringCchCopyA(Addr.sun_path, _countof(Addr.sun_path), ADMIN_SOCKET_PATH);
+        if (connect(Socket, (SOCKADDR*)&Addr, sizeof(Addr)) == SOCKET_ERROR)
+        {
+            LogErrorMessage(L"connect", WSAGetLastError());
+            __leave;
+        }
+
+        Log(LOG_INFO, L"taking over from the running process.");
+        SendAll(Socket, "handoff\n", sizeof("handoff\n") - 1);
+
+        LINE_READER Reader = { Socket };
+        PCHAR pLine;
+        while ((pLine = ReadLine(&Reader)) != NULL)
+        {
+            if (strncmp(pLine, "tick ", 5) == 0)
+                RoomConfig.FlushInterval = strtoul(pLine + 5, NULL, 10);
+            else if (strncmp(pLine, "loglevel ", 9) == 0)
+                LogMinLevel = (INT)strtoul(pLine + 9, NULL, 10);
+            else if (strncmp(pLine, "room ", 5) == 0)
+                AddReservedNumber(strtoul(pLine + 5, NULL, 10));
+            else
+                break;
+        }
+        if (!pLine || strcmp(pLine, "release") != 0)
+        {
+            Log(LOG_ERROR, L"the running process refused the handoff: %1!S!", pLine ? pLine : "disconnected");
+            __leave;
+        }
+
+        if (!StartListening())
+            __leave; // the running process takes its URLs back when we are gone
+        SendAll(Socket, "listening\n", sizeof("listening\n") - 1);
+
+        HANDLE hWatchThread = CreateThread(NULL, 0, HandoffWatchThread, (LPVOID)Socket, 0, NULL);
+        if (!hWatchThread)
+        {
+            LogErrorMessage(L"CreateThread", GetLastError());
+            __leave;
+        }
+        CloseHandle(hWatchThread);
+
+        Log(LOG_INFO, L"took over, %1!u! room numbers stay reserved until the previous process exits.", ReservedCnt);
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (Socket != INVALID_SOCKET)
+                closesocket(Socket);
+            for (UINT i = 0; i < ReservedCnt; i++)
+                FreeRoomNumber(pReservedList[i]);
+            ReservedCnt = 0;
+            WSACleanup();
+        }
+    }
+    return bSuccess;
+}
+
+VOID RunAdmin(VOID)
+{
+    hStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!hStopEvent)
+    {
+        LogErrorMessage(L"CreateEventW", GetLastError());
+        return;
+    }
+
+    if (StartAdminSocket())
+        Log(LOG_INFO, L"admin socket listening on %1!S!.", ADMIN_SOCKET_PATH);
+    else
+        Log(LOG_WARNING, L"no admin socket, commands are taken on the console only.");
+
+    // left blocked on stdin when stopping, it goes with the process.
+    HANDLE hConsoleThread = CreateThread(NULL, 0, ConsoleThread, NULL, 0, NULL);
+    if (hConsoleThread)
+        CloseHandle(hConsoleThread);
+    else
+        LogErrorMessage(L"CreateThread", GetLastError());
+
+    WaitForSingleObject(hStopEvent, INFINITE);
+}
+
+VOID StopAdmin(VOID)
+{
+    if (ListenSocket != INVALID_SOCKET)
+    {
+        closesocket(ListenSocket); // fails the accept
+        SOCKET Socket = ClientSocket;
+        if (Socket != INVALID_SOCKET)
+            shutdown(Socket, SD_BOTH);
+
+        WaitForSingleObject(hSocketThread, INFINITE);
+        CloseHandle(hSocketThread);
+        if (!bHandedOff)
+            DeleteFileA(ADMIN_SOCKET_PATH);
+        WSACleanup();
+
+        ListenSocket = INVALID_SOCKET;
+        hSocketThread = NULL;
+    }
+    if (pDrainTimer)
+    {
+        SetThreadpoolTimer(pDrainTimer, NULL, 0, 0);
+        WaitForThreadpoolTimerCallbacks(pDrainTimer, TRUE);
+        CloseThreadpoolTimer(pDrainTimer);
+        pDrainTimer = NULL;
+    }
+    if (hStopEvent)
+    {
+        CloseHandle(hStopEvent);
+        hStopEvent = NULL;
+    }
+}
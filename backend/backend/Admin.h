@@ -0,0 +1,33 @@
+#pragma once
+#include "common.h"
+
+// Admin commands, typed on the console or sent as lines to a Unix domain socket (e.g. "ncat -U backend-admin.sock").
+// One client at a time on the socket, each line is a command and gets its reply lines back.
+// Room state is read without taking room locks (see EnumRoomIndex and ReferenceRoomSnapshot),
+// so looking at a busy server doesn't slow it down. "help" lists the commands.
+
+#define ADMIN_SOCKET_PATH "backend-admin.sock" // in the working directory, access follows its ACL
+#define ADMIN_LINE_MAXLEN 256
+#define ADMIN_ARGS_MAX 4
+#define ADMIN_ROOMS_PAGE 20
+
+// "drain" refuses new rooms, then stops the server once no game is running or after this long.
+#define DRAIN_SECONDS_DEFAULT 3600
+#define DRAIN_CHECK_INTERVAL 1000 // ms
+
+// Restarting without dropping games: start the new build with -takeover in the same directory.
+// It connects to the admin socket and sends "handoff". The running process drains, sends its settings
+// and open room numbers and codes (the new process keeps them out of use until then), and removes its URLs.
+// The new process adds them and answers "listening". http.sys answers new requests with 503 between
+// the two, a local round trip. If no answer comes within a few seconds the running process adds its URLs
+// back and stays. Connections can't move between processes: the old one keeps serving its games until
+// they finish, as with "drain". Rooms still waiting close with it, their players reconnect.
+// Room passwords aren't sent: a room never moves, the process that has it is the one checking them.
+//
+// http.sys owns the listening sockets, there is nothing like SCM_RIGHTS to pass. The URLs are what moves.
+BOOL TakeOver(VOID);
+
+// Serve admin commands until one of them is "stop" or a drain ends. The console and the socket each get a thread.
+VOID RunAdmin(VOID);
+
+VOID StopAdmin(VOID);
@@ -0,0 +1,99 @@
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "MessageSchema.h"
+#include "BinaryHandler.h"
+#include "MessageHandler.h"
+#include "Trace.h"
+
+BOOL ParseAndDispatchBinaryMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PBYTE pMessage, _In_ ULONG cbMessageLen)
+{
+    INBOUND_MESSAGE Message;
+    TRACE_SPAN Span;
+
+    if (cbMessageLen < 2 || pMessage[0] != BIN_PROTOCOL_VERSION)
+        return FALSE;
+
+    // same schema and handlers as json, see MessageSchema.inl
+    TraceBegin(&Span, pConnInfo);
+    const MESSAGE_SCHEMA* pSchema = DecodeBinaryMessage(pMessage[1], pMessage + 2, cbMessageLen - 2, &Message);
+    TraceEnd(&Span, TRACE_CAT_PARSE, "DecodeBinaryMessage");
+    if (!pSchema) // malformed, oversized or unknown type
+        return FALSE;
+
+    return DispatchInboundMessage(pConnInfo, pSchema, &Message);
+}
+
+VOID BinWriterInit(_Out_ PBIN_WRITER pWriter, _In_ BIN_OUT_TYPE Type)
+{
+    // Buffer is left uninitialized, only cbLen bytes are ever sent.
+    pWriter->Type = Type;
+    pWriter->cbLen = 0;
+    pWriter->bOverflow = FALSE;
+    BinWriteByte(pWriter, BIN_PROTOCOL_VERSION);
+    BinWriteByte(pWriter, (BYTE)Type);
+}
+
+VOID BinWriteByte(_Inout_ PBIN_WRITER pWriter, _In_ BYTE Value)
+{
+    if (pWriter->cbLen >= BIN_MESSAGE_MAXLEN)
+    {
+        pWriter->bOverflow = TRUE;
+        return;
+    }
+    pWriter->Buffer[pWriter->cbLen++] = Value;
+}
+
+VOID BinWriteVarint(_Inout_ PBIN_WRITER pWriter, _In_ UINT32 Value)
+{
+    while (Value >= 0x80)
+    {
+        BinWriteByte(pWriter, (BYTE)(Value | 0x80));
+        Value >>= 7;
+    }
+    BinWriteByte(pWriter, (BYTE)Value);
+}
+
+VOID BinWriteString(_Inout_ PBIN_WRITER pWriter, _In_opt_z_ const CHAR* String)
+{
+    SIZE_T cbLen = String ? strlen(String) : 0;
+    if (cbLen > BIN_MESSAGE_MAXLEN)
+    {
+        pWriter->bOverflow = TRUE;
+        return;
+    }
+
+    BinWriteVarint(pWriter, (UINT32)cbLen);
+    if (cbLen > BIN_MESSAGE_MAXLEN - pWriter->cbLen)
+    {
+        pWriter->bOverflow = TRUE;
+        return;
+    }
+    memcpy(pWriter->Buffer + pWriter->cbLen, String, cbLen);
+    pWriter->cbLen += (ULONG)cbLen;
+}
+
+VOID SendBinaryCompleteCallback(_In_ PCONNECTION_INFO pConnInfo, _In_ _Frees_ptr_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    HeapFree(GetProcessHeap(), 0, pWebsockSendBuf); // data is in the same allocation
+}
+
+// NOTE: network error is not considered as an server error and will not return FALSE.
+BOOL SendBinaryMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const BIN_WRITER* pWriter)
+{
+    if (pWriter->bOverflow)
+        return FALSE;
+
+    PWEBSOCK_SEND_BUF pWebsockSendbuf = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(WEBSOCK_SEND_BUF) + pWriter->cbLen);
+    if (!pWebsockSendbuf)
+        return FALSE;
+
+    memcpy(pWebsockSendbuf + 1, pWriter->Buffer, pWriter->cbLen);
+    pWebsockSendbuf->BufferType = WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE;
+    pWebsockSendbuf->MessageType = (BYTE)pWriter->Type;
+    pWebsockSendbuf->Callback = SendBinaryCompleteCallback;
+    pWebsockSendbuf->WebsockBuf.Data.pbBuffer = (PBYTE)(pWebsockSendbuf + 1);
+    pWebsockSendbuf->WebsockBuf.Data.ulBufferLength = pWriter->cbLen;
+
+    WebsockSendMessage(pConnInfo, pWebsockSendbuf);
+    return TRUE;
+}
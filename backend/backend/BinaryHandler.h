@@ -0,0 +1,76 @@
+#pragma once
+#include "common.h"
+#include "HttpSendRecv.h"
+
+// Binary wire format, used when the client negotiated SUBPROTOCOL_BINARY.
+//
+// Every frame starts with a fixed 2 byte header: [version][type]
+// Integers are LEB128 varints, strings are a varint length followed by UTF-8 bytes (no trailing zero),
+// bools are a single 0 / 1 byte.
+//
+// Client -> server: [version][type][varint field mask][fields]
+//     type is the position of the message in MessageSchema.inl, bit i of the field mask tells
+//     field i of the message is present, present fields follow in schema order.
+// Server -> client: [version][BIN_OUT_*][payload]
+//     the payload of each type is documented next to its sender in MessageSender.c
+
+#define BIN_PROTOCOL_VERSION 1
+#define BIN_MESSAGE_MAXLEN 2048 // large enough for any outbound message
+
+// Outbound message types. Values are part of the protocol, only append.
+typedef enum _BIN_OUT_TYPE
+{
+    // replies: [result] then the reply fields on success, [string reason] on failure.
+    BIN_OUT_CREATE_ROOM = 1,
+    BIN_OUT_JOIN_ROOM,
+    BIN_OUT_LEAVE_ROOM,
+    BIN_OUT_START_GAME,
+    BIN_OUT_PLAYER_SELECT_TEAM,
+    BIN_OUT_PLAYER_CONFIRM_TEAM,
+    BIN_OUT_PLAYER_VOTE_TEAM,
+    BIN_OUT_PLAYER_CONDUCT_MISSION,
+    BIN_OUT_PLAYER_FAIRY_INSPECT,
+    BIN_OUT_PLAYER_ASSASSINATE,
+    BIN_OUT_PLAYER_TEXT_MESSAGE,
+    BIN_OUT_COMMAND_ERROR, // [varint index], no result byte
+
+    // events
+    BIN_OUT_BEGIN_GAME = 0x20,
+    BIN_OUT_ROLE_HINT,
+    BIN_OUT_SET_LEADER,
+    BIN_OUT_ROOM_STATUS,
+    BIN_OUT_SELECT_TEAM,
+    BIN_OUT_CONFIRM_TEAM,
+    BIN_OUT_VOTE_TEAM_PROGRESS,
+    BIN_OUT_VOTE_TEAM,
+    BIN_OUT_MISSION_RESULT_PROGRESS,
+    BIN_OUT_MISSION_RESULT,
+    BIN_OUT_FAIRY_INSPECT,
+    BIN_OUT_ASSASSINATE,
+    BIN_OUT_END_GAME,
+    BIN_OUT_TEXT_MESSAGE,
+    BIN_OUT_ROOM_STATUS_DELTA,
+
+    // several messages in one frame, see SendBatch.h
+    BIN_OUT_BATCH = 0x40,
+} BIN_OUT_TYPE;
+
+typedef struct _BIN_WRITER
+{
+    BIN_OUT_TYPE Type;
+    ULONG cbLen;
+    BOOL bOverflow; // set when a write didn't fit, the message is dropped
+    BYTE Buffer[BIN_MESSAGE_MAXLEN];
+} BIN_WRITER, * PBIN_WRITER;
+
+VOID BinWriterInit(_Out_ PBIN_WRITER pWriter, _In_ BIN_OUT_TYPE Type);
+
+VOID BinWriteByte(_Inout_ PBIN_WRITER pWriter, _In_ BYTE Value);
+
+VOID BinWriteVarint(_Inout_ PBIN_WRITER pWriter, _In_ UINT32 Value);
+
+VOID BinWriteString(_Inout_ PBIN_WRITER pWriter, _In_opt_z_ const CHAR* String);
+
+BOOL ParseAndDispatchBinaryMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PBYTE pMessage, _In_ ULONG cbMessageLen);
+
+BOOL SendBinaryMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const BIN_WRITER* pWriter);
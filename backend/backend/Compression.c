@@ -0,0 +1,214 @@
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "BinaryHandler.h"
+#include "Deflate.h"
+#include "Compression.h"
+#include "Metrics.h"
+
+COMPRESSION_CONFIG CompressionConfig =
+{
+    12,                 // WindowBits: 4KB covers several roomStatus messages
+    TRUE,               // bContextTakeover
+    64,                 // Threshold
+    64 * 1024 * 1024,   // MemoryBudget
+};
+
+// Preset history of every connection with context takeover. Part of the protocol: clients must prime
+// their inflater with exactly these bytes. Most frequent strings last, they are the cheapest to reach.
+static const CHAR CompressionDictionary[] =
+    "\"type\":\"createRoom\",\"joinRoom\",\"leaveRoom\",\"startGame\",\"roleHint\",\"HintList\":[{\"HintType\":\"GOOD\",\"BAD\",\"MERLIN_OR_MORGANA\","
+    "\"beginGame\",\"role\":\"MERLIN\",\"PERCIVAL\",\"ASSASSIN\",\"MORDRED\",\"OBERON\",\"MORGANA\",\"LOYALIST\",\"MINIONS\",\"fairyID\":"
+    "\"endGame\",\"win\":false,\"roleList\":[{\"assassinate\",\"fairyInspect\",\"missionResult\",\"missionSuccess\":true,\"perform\":\"screw\":"
+    "\"missionResultProgress\",\"decided\":[\"voteTeamProgress\",\"voted\":[\"voteTeam\",\"voteResult\":\"voteList\":[{\"vote\":"
+    "\"textMessage\",\"message\":\"setLeader\",\"selectTeam\",\"team\":[\"confirmTeam\"}"
+    "\"result\":\"success\"}\"result\":\"fail\",\"reason\":\"playerSelectTeam\",\"playerConfirmTeam\",\"playerVoteTeam\",\"playerConductMission\","
+    "{\"type\":\"roomStatus\",\"playerList\":[{\"name\":\"\",\"ID\":1,\"avatar\":\"\",\"isOwner\":false,\"online\":true},{\"name\":\"";
+
+// the only counter shared by all threads: the budget check needs the exact total.
+static LONG64 volatile CompressionMemoryUsed = 0;
+static LARGE_INTEGER PerfFrequency;
+
+// history-less stream of each thread, for connections without context takeover
+static __declspec(thread) PDEFLATE_STREAM pScratchStream = NULL;
+
+VOID InitCompression(VOID)
+{
+    QueryPerformanceFrequency(&PerfFrequency);
+
+    if (CompressionConfig.WindowBits < DEFLATE_MIN_WINDOW_BITS)
+        CompressionConfig.WindowBits = DEFLATE_MIN_WINDOW_BITS;
+    if (CompressionConfig.WindowBits > DEFLATE_MAX_WINDOW_BITS)
+        CompressionConfig.WindowBits = DEFLATE_MAX_WINDOW_BITS;
+
+    Log(LOG_INFO, L"compression: window bits %1!u!, context takeover %2!u!, threshold %3!u! bytes, memory budget %4!I64u! bytes",
+        CompressionConfig.WindowBits, CompressionConfig.bContextTakeover, CompressionConfig.Threshold, (UINT64)CompressionConfig.MemoryBudget);
+}
+
+static const WCHAR* GetOutboundTypeName(_In_ UINT Type)
+{
+    static const WCHAR* NameTable[256] =
+    {
+        [BIN_OUT_CREATE_ROOM] = L"createRoom",
+        [BIN_OUT_JOIN_ROOM] = L"joinRoom",
+        [BIN_OUT_LEAVE_ROOM] = L"leaveRoom",
+        [BIN_OUT_START_GAME] = L"startGame",
+        [BIN_OUT_PLAYER_SELECT_TEAM] = L"playerSelectTeam",
+        [BIN_OUT_PLAYER_CONFIRM_TEAM] = L"playerConfirmTeam",
+        [BIN_OUT_PLAYER_VOTE_TEAM] = L"playerVoteTeam",
+        [BIN_OUT_PLAYER_CONDUCT_MISSION] = L"playerConductMission",
+        [BIN_OUT_PLAYER_FAIRY_INSPECT] = L"playerFairyInspect",
+        [BIN_OUT_PLAYER_ASSASSINATE] = L"playerAssassinate",
+        [BIN_OUT_PLAYER_TEXT_MESSAGE] = L"playerTextMessage",
+        [BIN_OUT_COMMAND_ERROR] = L"commandError",
+        [BIN_OUT_BEGIN_GAME] = L"beginGame",
+        [BIN_OUT_ROLE_HINT] = L"roleHint",
+        [BIN_OUT_SET_LEADER] = L"setLeader",
+        [BIN_OUT_ROOM_STATUS] = L"roomStatus",
+        [BIN_OUT_SELECT_TEAM] = L"selectTeam",
+        [BIN_OUT_CONFIRM_TEAM] = L"confirmTeam",
+        [BIN_OUT_VOTE_TEAM_PROGRESS] = L"voteTeamProgress",
+        [BIN_OUT_VOTE_TEAM] = L"voteTeam",
+        [BIN_OUT_MISSION_RESULT_PROGRESS] = L"missionResultProgress",
+        [BIN_OUT_MISSION_RESULT] = L"missionResult",
+        [BIN_OUT_FAIRY_INSPECT] = L"fairyInspect",
+        [BIN_OUT_ASSASSINATE] = L"assassinate",
+        [BIN_OUT_END_GAME] = L"endGame",
+        [BIN_OUT_TEXT_MESSAGE] = L"textMessage",
+        [BIN_OUT_ROOM_STATUS_DELTA] = L"roomStatusDelta",
+        [BIN_OUT_BATCH] = L"batch",
+    };
+    return NameTable[Type & 0xFF] ? NameTable[Type & 0xFF] : L"unknown";
+}
+
+// the stream to compress the next message of pConnInfo with, NULL if out of memory.
+static PDEFLATE_STREAM GetDeflateStream(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    if (pConnInfo->pDeflate)
+        return pConnInfo->pDeflate;
+
+    if (CompressionConfig.bContextTakeover && !pConnInfo->bCompressNoContext)
+    {
+        SIZE_T cbState = DeflateStateSize(CompressionConfig.WindowBits);
+        if (InterlockedAdd64(&CompressionMemoryUsed, cbState) <= (LONG64)CompressionConfig.MemoryBudget)
+        {
+            pConnInfo->pDeflate = HeapAlloc(GetProcessHeap(), 0, cbState);
+            if (pConnInfo->pDeflate)
+            {
+                DeflateInit(pConnInfo->pDeflate, CompressionConfig.WindowBits);
+                DeflateReset(pConnInfo->pDeflate, (const BYTE*)CompressionDictionary, sizeof(CompressionDictionary) - 1);
+                return pConnInfo->pDeflate;
+            }
+        }
+        InterlockedAdd64(&CompressionMemoryUsed, -(LONG64)cbState);
+
+        // out of budget, this connection goes on without history. its inflater doesn't care.
+        Log(LOG_WARNING, L"compression memory budget exhausted, compressing without context takeover");
+        pConnInfo->bCompressNoContext = TRUE;
+    }
+
+    // window bits may change at runtime, so the scratch stream is sized for the largest window.
+    if (!pScratchStream)
+    {
+        pScratchStream = HeapAlloc(GetProcessHeap(), 0, DeflateStateSize(DEFLATE_MAX_WINDOW_BITS));
+        if (!pScratchStream)
+            return NULL;
+    }
+    DeflateInit(pScratchStream, CompressionConfig.WindowBits); // no dictionary: the inflater's history is the previous messages
+    return pScratchStream;
+}
+
+VOID CompressedSendCompleteCallback(_In_ PCONNECTION_INFO pConnInfo, _In_ _Frees_ptr_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    HeapFree(GetProcessHeap(), 0, pWebsockSendBuf); // data is in the same allocation
+}
+
+_Ret_maybenull_
+PWEBSOCK_SEND_BUF CompressSendBuf(_Inout_ PCONNECTION_INFO pConnInfo, _In_ _Frees_ptr_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    const BYTE* pRaw = pWebsockSendBuf->WebsockBuf.Data.pbBuffer;
+    ULONG cbRaw = pWebsockSendBuf->WebsockBuf.Data.ulBufferLength;
+    PDEFLATE_STREAM pStream = NULL;
+    PWEBSOCK_SEND_BUF pCompressed = NULL;
+    LARGE_INTEGER StartTime, EndTime;
+
+    QueryPerformanceCounter(&StartTime);
+
+    if (cbRaw >= CompressionConfig.Threshold)
+        pStream = GetDeflateStream(pConnInfo);
+
+    pCompressed = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(WEBSOCK_SEND_BUF) + 1 + (pStream ? DEFLATE_BOUND(cbRaw) : cbRaw));
+    if (pCompressed)
+    {
+        PBYTE pOut = (PBYTE)(pCompressed + 1);
+        ULONG cbOut;
+
+        if (pStream)
+        {
+            pOut[0] = COMPRESS_FLAG_DEFLATE;
+            cbOut = 1 + DeflateCompress(pStream, pRaw, cbRaw, pOut + 1);
+        }
+        else
+        {
+            pOut[0] = COMPRESS_FLAG_RAW;
+            memcpy(pOut + 1, pRaw, cbRaw);
+            cbOut = 1 + cbRaw;
+        }
+
+        pCompressed->BufferType = WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE;
+        pCompressed->MessageType = pWebsockSendBuf->MessageType;
+        pCompressed->Callback = CompressedSendCompleteCallback;
+        pCompressed->WebsockBuf.Data.pbBuffer = pOut;
+        pCompressed->WebsockBuf.Data.ulBufferLength = cbOut;
+
+        QueryPerformanceCounter(&EndTime);
+
+        PCOMPRESSION_STATS pStats = &GetThreadCompressionStats()[pWebsockSendBuf->MessageType & (METRICS_OUT_TYPE_CNT - 1)];
+        pStats->Messages++;
+        pStats->Deflated += pStream != NULL;
+        pStats->RawBytes += cbRaw;
+        pStats->WireBytes += cbOut;
+        pStats->Ticks += EndTime.QuadPart - StartTime.QuadPart;
+    }
+
+    pWebsockSendBuf->Callback(pConnInfo, pWebsockSendBuf); // done with the original
+    return pCompressed;
+}
+
+VOID FreeConnCompression(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    if (!pConnInfo->pDeflate)
+        return;
+
+    InterlockedAdd64(&CompressionMemoryUsed, -(LONG64)DeflateStateSize(pConnInfo->pDeflate->WindowBits));
+    HeapFree(GetProcessHeap(), 0, pConnInfo->pDeflate);
+    pConnInfo->pDeflate = NULL;
+}
+
+LONG64 GetCompressionMemoryUsed(VOID)
+{
+    return CompressionMemoryUsed;
+}
+
+VOID PrintCompressionStats(VOID)
+{
+    static COMPRESSION_STATS SumList[METRICS_OUT_TYPE_CNT]; // too large for the stack, admin commands run one at a time
+
+    Log(LOG_INFO, L"compression state in use: %1!I64d! bytes", CompressionMemoryUsed);
+
+    SumCompressionStats(SumList);
+    for (UINT i = 0; i < _countof(SumList); i++)
+    {
+        const COMPRESSION_STATS* pStats = &SumList[i];
+        if (!pStats->Messages)
+            continue;
+
+        Log(LOG_INFO, L"%1: %2!I64u! messages (%3!I64u! deflated), %4!I64u! -> %5!I64u! bytes, saved %6!I64d! bytes, cpu %7!I64u! us",
+            GetOutboundTypeName(i),
+            pStats->Messages,
+            pStats->Deflated,
+            pStats->RawBytes,
+            pStats->WireBytes,
+            (LONG64)(pStats->RawBytes - pStats->WireBytes),
+            pStats->Ticks * 1000000 / (UINT64)PerfFrequency.QuadPart);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "common.h"
+#include "HttpSendRecv.h"
+
+// Message compression for connections that negotiated one of the ".deflate" subprotocols.
+//
+// websocket.dll can't negotiate extensions nor set RSV1, so RFC 7692 permessage-deflate is done in-band:
+// such connections only receive binary frames, the first byte is COMPRESS_FLAG_* followed by the
+// message (json text or binary protocol, whichever was negotiated).
+// Deflated messages are raw DEFLATE without the trailing 00 00 FF FF, just like RFC 7692.
+// The client inflates every deflated message with one raw inflater kept for the whole connection,
+// primed with CompressionDictionary (see Compression.c) before the first message.
+
+#define COMPRESS_FLAG_RAW     0
+#define COMPRESS_FLAG_DEFLATE 1
+
+typedef struct _COMPRESSION_CONFIG
+{
+    UINT WindowBits;        // DEFLATE_MIN_WINDOW_BITS ~ DEFLATE_MAX_WINDOW_BITS, memory per connection is about 4 << WindowBits
+    BOOL bContextTakeover;  // keep history across messages of a connection
+    UINT Threshold;         // messages shorter than this are sent raw
+    SIZE_T MemoryBudget;    // compressor state kept by all connections together, beyond this connections compress without history
+} COMPRESSION_CONFIG, * PCOMPRESSION_CONFIG;
+
+extern COMPRESSION_CONFIG CompressionConfig;
+
+// Counted by each thread in its metrics block, see GetThreadCompressionStats.
+typedef struct _COMPRESSION_STATS
+{
+    UINT64 Messages;
+    UINT64 Deflated;    // messages at or over the threshold
+    UINT64 RawBytes;
+    UINT64 WireBytes;   // including the flag byte
+    UINT64 Ticks;       // QueryPerformanceCounter ticks spent
+} COMPRESSION_STATS, * PCOMPRESSION_STATS;
+
+VOID InitCompression(VOID);
+
+// Turn pWebsockSendBuf into a compressed frame for pConnInfo. The original buffer is released.
+// Must be called with pConnInfo->SendLock held, in the order frames are sent.
+// Returns NULL if out of memory.
+_Ret_maybenull_
+PWEBSOCK_SEND_BUF CompressSendBuf(_Inout_ PCONNECTION_INFO pConnInfo, _In_ _Frees_ptr_ PWEBSOCK_SEND_BUF pWebsockSendBuf);
+
+VOID FreeConnCompression(_Inout_ PCONNECTION_INFO pConnInfo);
+
+// Compressor state kept by all connections, in bytes.
+LONG64 GetCompressionMemoryUsed(VOID);
+
+// Log bytes saved and cpu spent for each message type.
+VOID PrintCompressionStats(VOID);
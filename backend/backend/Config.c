@@ -0,0 +1,260 @@
+#include <strsafe.h>
+
+#include "common.h"
+#include "Config.h"
+#include "HttpSendRecv.h"
+#include "RoomManager.h"
+#include "SlabPool.h"
+#include "Deflate.h"
+#include "Compression.h"
+#include "Trace.h"
+
+#define CONFIG_SECTION_MAXLEN 32767 // characters GetPrivateProfileSection returns at most
+
+#define CONFIG_NUMBER(Key, Variable, Min, Max, bReload, Help) \
+    { Key, (PVOID)&(Variable), sizeof(Variable), FALSE, Min, Max, bReload, Help },
+#define CONFIG_STRING(Key, Variable, bReload, Help) \
+    { Key, (PVOID)&(Variable), sizeof(Variable), TRUE, 0, 0, bReload, Help },
+static const CONFIG_ENTRY ConfigList[] = {
+#include "Config.inl"
+};
+#undef CONFIG_NUMBER
+#undef CONFIG_STRING
+
+static WCHAR ConfigPath[MAX_PATH];
+static int ConfigArgCnt;
+static WCHAR** ConfigArgList;
+
+static UINT64 GetConfigNumber(_In_ const CONFIG_ENTRY* pEntry)
+{
+    if (pEntry->cbValue == sizeof(UINT64))
+        return *(UINT64 volatile*)pEntry->pValue;
+    return *(UINT volatile*)pEntry->pValue;
+}
+
+static VOID SetConfigNumber(_In_ const CONFIG_ENTRY* pEntry, _In_ UINT64 Value)
+{
+    if (pEntry->cbValue == sizeof(UINT64))
+        *(UINT64 volatile*)pEntry->pValue = Value;
+    else
+        *(UINT volatile*)pEntry->pValue = (UINT)Value;
+}
+
+_Ret_maybenull_
+static const CONFIG_ENTRY* FindConfigEntry(_In_z_ LPCWSTR Key)
+{
+    for (UINT i = 0; i < _countof(ConfigList); i++)
+    {
+        if (_wcsicmp(ConfigList[i].Key, Key) == 0)
+            return &ConfigList[i];
+    }
+    return NULL;
+}
+
+static LPWSTR TrimSpace(_Inout_z_ LPWSTR Text)
+{
+    while (*Text == L' ' || *Text == L'\t')
+        Text++;
+
+    SIZE_T cchLen = wcslen(Text);
+    while (cchLen && (Text[cchLen - 1] == L' ' || Text[cchLen - 1] == L'\t' || Text[cchLen - 1] == L'\r'))
+        Text[--cchLen] = L'\0';
+    return Text;
+}
+
+// bRunning: leave the settings that can't change while running, warn if they would.
+static BOOL SetConfigEntry(_In_ const CONFIG_ENTRY* pEntry, _In_z_ LPCWSTR Value, _In_z_ LPCWSTR Source, _In_ BOOL bRunning)
+{
+    if (pEntry->bString)
+    {
+        UINT cchMax = pEntry->cbValue / sizeof(WCHAR);
+        if (wcslen(Value) >= cchMax)
+        {
+            Log(LOG_ERROR, L"%1: %2 is longer than %3!u! characters.", Source, pEntry->Key, cchMax - 1);
+            return FALSE;
+        }
+        if (wcscmp(Value, (LPCWSTR)pEntry->pValue) == 0)
+            return TRUE;
+        if (bRunning && !pEntry->bReload)
+        {
+            Log(LOG_WARNING, L"%1: %2 takes effect on the next start.", Source, pEntry->Key);
+            return FALSE;
+        }
+
+        StringCchCopyW((LPWSTR)pEntry->pValue, cchMax, Value);
+        Log(LOG_INFO, L"%1: %2 = %3", Source, pEntry->Key, Value);
+        return TRUE;
+    }
+
+    LPWSTR pEnd = NULL;
+    UINT64 Number = _wcstoui64(Value, &pEnd, 0);
+    if (!Value[0] || Value[0] == L'-' || *pEnd || Number < pEntry->Min || Number > pEntry->Max)
+    {
+        Log(LOG_ERROR, L"%1: %2 must be a number from %3!I64u! to %4!I64u!, not \"%5\".",
+            Source, pEntry->Key, pEntry->Min, pEntry->Max, Value);
+        return FALSE;
+    }
+    if (Number == GetConfigNumber(pEntry))
+        return TRUE;
+    if (bRunning && !pEntry->bReload)
+    {
+        Log(LOG_WARNING, L"%1: %2 takes effect on the next start.", Source, pEntry->Key);
+        return FALSE;
+    }
+
+    SetConfigNumber(pEntry, Number);
+    Log(LOG_INFO, L"%1: %2 = %3!I64u!", Source, pEntry->Key, Number);
+    return TRUE;
+}
+
+// "key = value", from the file or the command line.
+static BOOL ApplyConfigLine(_In_z_ LPCWSTR Line, _In_z_ LPCWSTR Source, _In_ BOOL bRunning)
+{
+    WCHAR Buffer[CONFIG_STRING_MAXLEN + 64];
+    if (FAILED(StringCchCopyW(Buffer, _countof(Buffer), Line)))
+    {
+        Log(LOG_ERROR, L"%1: line too long: %2", Source, Line);
+        return FALSE;
+    }
+
+    LPWSTR pValue = wcschr(Buffer, L'=');
+    if (!pValue)
+    {
+        Log(LOG_ERROR, L"%1: expected key=value, not \"%2\".", Source, Line);
+        return FALSE;
+    }
+    *pValue++ = L'\0';
+
+    LPWSTR Key = TrimSpace(Buffer);
+    const CONFIG_ENTRY* pEntry = FindConfigEntry(Key);
+    if (!pEntry)
+    {
+        Log(LOG_ERROR, L"%1: unknown setting %2.", Source, Key);
+        return FALSE;
+    }
+    return SetConfigEntry(pEntry, TrimSpace(pValue), Source, bRunning);
+}
+
+// Given as "key=..." on the command line, which wins over the file.
+static BOOL IsConfigOverridden(_In_z_ LPCWSTR Line)
+{
+    SIZE_T cchKey = wcscspn(Line, L" \t=");
+    for (int i = 1; i < ConfigArgCnt; i++)
+    {
+        LPCWSTR Arg = ConfigArgList[i];
+        if (_wcsnicmp(Arg, Line, cchKey) == 0 && wcscspn(Arg, L" \t=") == cchKey)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL ReadConfigFile(_In_ BOOL bRunning)
+{
+    if (GetFileAttributesW(ConfigPath) == INVALID_FILE_ATTRIBUTES)
+    {
+        Log(LOG_INFO, L"no config file %1, using defaults.", ConfigPath);
+        return TRUE;
+    }
+
+    LPWSTR pSection = HeapAlloc(GetProcessHeap(), 0, CONFIG_SECTION_MAXLEN * sizeof(WCHAR));
+    if (!pSection)
+    {
+        Log(LOG_ERROR, L"failed to allocate memory for the config file.");
+        return FALSE;
+    }
+
+    BOOL bSuccess = TRUE;
+    DWORD cchLen = GetPrivateProfileSectionW(CONFIG_SECTION, pSection, CONFIG_SECTION_MAXLEN, ConfigPath);
+    if (cchLen == CONFIG_SECTION_MAXLEN - 2)
+    {
+        Log(LOG_ERROR, L"%1: section [%2] is too long.", ConfigPath, CONFIG_SECTION);
+        bSuccess = FALSE;
+    }
+
+    // "key=value\0key=value\0\0", comment lines included.
+    for (LPCWSTR pLine = pSection; *pLine; pLine += wcslen(pLine) + 1)
+    {
+        if (*pLine == L';' || *pLine == L'#')
+            continue;
+        if (bRunning && IsConfigOverridden(pLine))
+            continue;
+        if (!ApplyConfigLine(pLine, ConfigPath, bRunning))
+        {
+            bSuccess = FALSE;
+            if (!bRunning)
+                break; // fails the start. when reloading, the other lines still apply
+        }
+    }
+
+    HeapFree(GetProcessHeap(), 0, pSection);
+    return bSuccess;
+}
+
+BOOL LoadConfig(_In_ int argc, _In_reads_(argc) WCHAR* argv[])
+{
+    LPCWSTR FileName = CONFIG_FILE_DEFAULT;
+
+    ConfigArgCnt = argc;
+    ConfigArgList = argv;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (wcscmp(argv[i], L"-config") == 0)
+            FileName = argv[i + 1];
+    }
+
+    if (!GetFullPathNameW(FileName, _countof(ConfigPath), ConfigPath, NULL))
+    {
+        LogErrorMessage(L"GetFullPathNameW", GetLastError());
+        return FALSE;
+    }
+    if (!ReadConfigFile(FALSE))
+        return FALSE;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == L'-')
+        {
+            if (wcscmp(argv[i], L"-config") == 0)
+                i++; // its file name
+            continue; // the rest are for main
+        }
+        if (!ApplyConfigLine(argv[i], L"command line", FALSE))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL ReloadConfig(VOID)
+{
+    BOOL bSuccess = ReadConfigFile(TRUE);
+    ApplyHttpServerConfig();
+    return bSuccess;
+}
+
+BOOL SetConfig(_In_z_ LPCWSTR Key, _In_z_ LPCWSTR Value)
+{
+    const CONFIG_ENTRY* pEntry = FindConfigEntry(Key);
+    if (!pEntry)
+    {
+        Log(LOG_ERROR, L"admin: unknown setting %1.", Key);
+        return FALSE;
+    }
+    if (!SetConfigEntry(pEntry, Value, L"admin", TRUE))
+        return FALSE;
+
+    ApplyHttpServerConfig();
+    return TRUE;
+}
+
+const CONFIG_ENTRY* GetConfigEntry(_In_ UINT Index)
+{
+    return Index < _countof(ConfigList) ? &ConfigList[Index] : NULL;
+}
+
+VOID FormatConfigValue(_In_ const CONFIG_ENTRY* pEntry, _Out_writes_z_(cchBuffer) LPWSTR Buffer, _In_ UINT cchBuffer)
+{
+    if (pEntry->bString)
+        StringCchCopyW(Buffer, cchBuffer, (LPCWSTR)pEntry->pValue); // cut if too long
+    else
+        StringCchPrintfW(Buffer, cchBuffer, L"%llu", GetConfigNumber(pEntry));
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "common.h"
+
+// Settings of every module in one place, see Config.inl for the list. The variables stay with their modules
+// (HttpServerConfig, RoomConfig, CompressionConfig...) and keep their compiled-in values as defaults.
+//
+// Read from the [backend] section of CONFIG_FILE_DEFAULT ("key = value" lines), then from "key=value"
+// command line arguments, which win. "-config <file>" reads another file.
+// "config reload" on the admin console reads the file again (the command line still wins), settings that
+// can't change while running keep their value until a restart.
+
+#define CONFIG_FILE_DEFAULT L"backend.ini"
+#define CONFIG_SECTION L"backend"
+#define CONFIG_STRING_MAXLEN 256 // in characters, with the terminator
+
+typedef struct _CONFIG_ENTRY
+{
+    LPCWSTR Key;
+    PVOID pValue;
+    UINT cbValue;  // size of the variable
+    BOOL bString;  // a WCHAR array of cbValue bytes, otherwise an unsigned number of cbValue bytes
+    UINT64 Min;
+    UINT64 Max;
+    BOOL bReload;  // can change while running
+    LPCWSTR Help;
+} CONFIG_ENTRY, * PCONFIG_ENTRY;
+
+// Before the modules are initialized. FALSE if a value is malformed or out of range, the message is logged.
+// argv is kept for ReloadConfig.
+BOOL LoadConfig(_In_ int argc, _In_reads_(argc) WCHAR* argv[]);
+
+// Read the file and the command line again. Values that are malformed, or can't change while running,
+// are logged and left as they are. FALSE if any was.
+BOOL ReloadConfig(VOID);
+
+// One value, as if it came from the command line. Only for settings that can change while running.
+BOOL SetConfig(_In_z_ LPCWSTR Key, _In_z_ LPCWSTR Value);
+
+// The Index-th setting, NULL past the last one.
+_Ret_maybenull_
+const CONFIG_ENTRY* GetConfigEntry(_In_ UINT Index);
+
+// The value as it would be written in the file. Strings longer than the buffer are cut.
+VOID FormatConfigValue(_In_ const CONFIG_ENTRY* pEntry, _Out_writes_z_(cchBuffer) LPWSTR Buffer, _In_ UINT cchBuffer);
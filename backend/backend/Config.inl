@@ -0,0 +1,28 @@
+// Settings read from the config file and the command line, see Config.h. Included by Config.c
+// with a definition of CONFIG_NUMBER and CONFIG_STRING. No include guard on purpose.
+//
+// CONFIG_NUMBER(L"key", Variable, Min, Max, bReload, L"help")  -> a UINT, INT, BOOL or SIZE_T variable
+// CONFIG_STRING(L"key", Variable, bReload, L"help")            -> a WCHAR array
+// bReload: takes effect while running ("config reload" / "set"), otherwise on the next start.
+
+CONFIG_STRING(L"listen_url",                   HttpServerConfig.ListenUrl,                    FALSE, L"URL prefix, /api and /metrics are served under it")
+CONFIG_NUMBER(L"requests_per_processor",       HttpServerConfig.RequestsPerProcessor, 1, 64,   FALSE, L"HTTP receives posted at start, per processor")
+CONFIG_NUMBER(L"outstanding_requests",         HttpServerConfig.OutstandingRequests,  1, 4096, FALSE, L"HTTP receives posted at start if the processors can't be counted")
+CONFIG_NUMBER(L"request_buffer_size",          HttpServerConfig.RequestBufferSize, 1024, 65536, TRUE, L"bytes for request headers, for receives posted afterwards")
+CONFIG_NUMBER(L"request_queue_length",         HttpServerConfig.QueueLength,         1, 65535, TRUE, L"requests http.sys queues before answering 503")
+CONFIG_NUMBER(L"worker_threads_min",           HttpServerConfig.WorkerThreadsMin,     0, 512,  TRUE, L"I/O worker threads kept, 0 for the pool default")
+CONFIG_NUMBER(L"worker_threads_max",           HttpServerConfig.WorkerThreadsMax,     0, 512,  TRUE, L"I/O worker threads at most, 0 for the pool default")
+CONFIG_NUMBER(L"receive_depth_min",            HttpServerConfig.ReceiveDepthMin,      1, 65536, TRUE, L"HTTP receives kept posted at least")
+CONFIG_NUMBER(L"receive_depth_max",            HttpServerConfig.ReceiveDepthMax,      1, 65536, TRUE, L"HTTP receives kept posted at most, grown to on bursts")
+CONFIG_NUMBER(L"websocket_receive_buffer",     HttpServerConfig.WebsockRecvBufferSize, 256, 65536, TRUE, L"bytes websocket.dll receives into per connection, for connections afterwards")
+CONFIG_NUMBER(L"websocket_send_buffer",        HttpServerConfig.WebsockSendBufferSize, 256, 65536, TRUE, L"bytes websocket.dll keeps for frame headers per connection, for connections afterwards")
+CONFIG_NUMBER(L"room_limit",                   RoomConfig.RoomLimit,                  0, MAXUINT, TRUE, L"open rooms at most, 0 for no limit")
+CONFIG_NUMBER(L"room_player_limit",            RoomConfig.PlayerLimit, ROOM_PLAYER_MIN, ROOM_PLAYER_MAX, TRUE, L"players a room takes, for joins afterwards")
+CONFIG_NUMBER(L"room_flush_interval",          RoomConfig.FlushInterval,              0, 1000, TRUE, L"ms roomStatus changes are merged over, for rooms created afterwards")
+CONFIG_NUMBER(L"slab_size",                    SlabSize,                           4096, 16 * 1024 * 1024, FALSE, L"bytes pools grow by")
+CONFIG_NUMBER(L"compression_window_bits",      CompressionConfig.WindowBits, DEFLATE_MIN_WINDOW_BITS, DEFLATE_MAX_WINDOW_BITS, FALSE, L"deflate window")
+CONFIG_NUMBER(L"compression_context_takeover", CompressionConfig.bContextTakeover,    0, 1,    FALSE, L"keep deflate history across messages")
+CONFIG_NUMBER(L"compression_threshold",        CompressionConfig.Threshold,           0, 1024 * 1024, TRUE, L"messages shorter than this are sent raw")
+CONFIG_NUMBER(L"compression_memory_budget",    CompressionConfig.MemoryBudget,        0, MAXUINT, TRUE, L"bytes of deflate history kept by all connections")
+CONFIG_NUMBER(L"log_level",                    LogMinLevel,               LOG_DEBUG, LOG_CRITICAL, TRUE, L"0 debug, 1 info, 2 warning, 3 error, 4 critical")
+CONFIG_NUMBER(L"trace_slow_us",                TraceSlowUs,                           0, MAXUINT, TRUE, L"messages slower than this dump traces, 0 never")
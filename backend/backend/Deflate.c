@@ -0,0 +1,242 @@
+#include "common.h"
+#include "Deflate.h"
+
+#define HASH_SIZE (1 << DEFLATE_HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 32 // hash chain entries tried per position, trades ratio for speed
+
+static const USHORT LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const USHORT DistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE DistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+typedef struct _BIT_WRITER
+{
+    PBYTE pOut;
+    ULONG cbOut;
+    UINT64 Bits;
+    UINT BitCnt;
+} BIT_WRITER, * PBIT_WRITER;
+
+// deflate packs bits from the least significant end
+static VOID PutBits(_Inout_ PBIT_WRITER pWriter, _In_ UINT Value, _In_ UINT BitCnt)
+{
+    pWriter->Bits |= (UINT64)Value << pWriter->BitCnt;
+    pWriter->BitCnt += BitCnt;
+    while (pWriter->BitCnt >= 8)
+    {
+        pWriter->pOut[pWriter->cbOut++] = (BYTE)pWriter->Bits;
+        pWriter->Bits >>= 8;
+        pWriter->BitCnt -= 8;
+    }
+}
+
+static VOID AlignToByte(_Inout_ PBIT_WRITER pWriter)
+{
+    if (pWriter->BitCnt)
+        PutBits(pWriter, 0, 8 - pWriter->BitCnt);
+}
+
+// huffman codes are stored starting from their most significant bit
+static VOID PutHuffman(_Inout_ PBIT_WRITER pWriter, _In_ UINT Code, _In_ UINT BitCnt)
+{
+    UINT Reversed = 0;
+    for (UINT i = 0; i < BitCnt; i++)
+    {
+        Reversed = (Reversed << 1) | (Code & 1);
+        Code >>= 1;
+    }
+    PutBits(pWriter, Reversed, BitCnt);
+}
+
+// literal / length symbol with the fixed code of RFC 1951 3.2.6
+static VOID PutSymbol(_Inout_ PBIT_WRITER pWriter, _In_ UINT Symbol)
+{
+    if (Symbol <= 143)
+        PutHuffman(pWriter, 0x30 + Symbol, 8);
+    else if (Symbol <= 255)
+        PutHuffman(pWriter, 0x190 + Symbol - 144, 9);
+    else if (Symbol <= 279)
+        PutHuffman(pWriter, Symbol - 256, 7);
+    else
+        PutHuffman(pWriter, 0xC0 + Symbol - 280, 8);
+}
+
+static VOID PutMatch(_Inout_ PBIT_WRITER pWriter, _In_ UINT Length, _In_ UINT Distance)
+{
+    UINT i = _countof(LengthBase) - 1;
+    while (LengthBase[i] > Length)
+        i--;
+    PutSymbol(pWriter, 257 + i);
+    PutBits(pWriter, Length - LengthBase[i], LengthExtra[i]);
+
+    i = _countof(DistBase) - 1;
+    while (DistBase[i] > Distance)
+        i--;
+    PutHuffman(pWriter, i, 5);
+    PutBits(pWriter, Distance - DistBase[i], DistExtra[i]);
+}
+
+static UINT Hash3(_In_reads_(3) const BYTE* p)
+{
+    return (((UINT)p[0] << 16 | (UINT)p[1] << 8 | p[2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// add every position below Pos that has 3 bytes of lookahead to the hash chains.
+static VOID InsertUpTo(_Inout_ PDEFLATE_STREAM pStream, _In_ UINT Pos)
+{
+    while (pStream->HashedUpTo < Pos && pStream->HashedUpTo + MIN_MATCH <= pStream->cbWindow)
+    {
+        UINT Cur = pStream->HashedUpTo++;
+        if (Cur == 0) // 0 is nil in the chains
+            continue;
+        UINT Hash = Hash3(pStream->Window + Cur);
+        pStream->Prev[Cur & (pStream->WindowSize - 1)] = pStream->Head[Hash];
+        pStream->Head[Hash] = (USHORT)Cur;
+    }
+}
+
+// drop the oldest WindowSize bytes of history.
+static VOID SlideWindow(_Inout_ PDEFLATE_STREAM pStream)
+{
+    UINT WindowSize = pStream->WindowSize;
+
+    memmove(pStream->Window, pStream->Window + WindowSize, pStream->cbWindow - WindowSize);
+    pStream->cbWindow -= WindowSize;
+    pStream->HashedUpTo = pStream->HashedUpTo > WindowSize ? pStream->HashedUpTo - WindowSize : 0;
+
+    for (UINT i = 0; i < HASH_SIZE; i++)
+        pStream->Head[i] = pStream->Head[i] >= WindowSize ? (USHORT)(pStream->Head[i] - WindowSize) : 0;
+    for (UINT i = 0; i < WindowSize; i++)
+        pStream->Prev[i] = pStream->Prev[i] >= WindowSize ? (USHORT)(pStream->Prev[i] - WindowSize) : 0;
+}
+
+static UINT FindMatch(_In_ PDEFLATE_STREAM pStream, _In_ UINT Pos, _In_ UINT End, _Out_ UINT* pDistance)
+{
+    const BYTE* pCur = pStream->Window + Pos;
+    UINT MaxLen = min(MAX_MATCH, End - Pos);
+    UINT BestLen = 0;
+    UINT Candidate = pStream->Head[Hash3(pCur)];
+
+    *pDistance = 0;
+    for (UINT Chain = 0; Chain < MAX_CHAIN && Candidate && Candidate < Pos; Chain++)
+    {
+        UINT Distance = Pos - Candidate;
+        if (Distance > pStream->WindowSize)
+            break;
+
+        const BYTE* pCand = pStream->Window + Candidate;
+        if (pCand[BestLen] == pCur[BestLen])
+        {
+            UINT Len = 0;
+            while (Len < MaxLen && pCand[Len] == pCur[Len])
+                Len++;
+            if (Len > BestLen)
+            {
+                BestLen = Len;
+                *pDistance = Distance;
+                if (Len == MaxLen)
+                    break;
+            }
+        }
+
+        UINT Next = pStream->Prev[Candidate & (pStream->WindowSize - 1)];
+        if (Next >= Candidate) // stale entry
+            break;
+        Candidate = Next;
+    }
+    return BestLen >= MIN_MATCH ? BestLen : 0;
+}
+
+SIZE_T DeflateStateSize(_In_ UINT WindowBits)
+{
+    SIZE_T WindowSize = (SIZE_T)1 << WindowBits;
+    return sizeof(DEFLATE_STREAM) + 2 * WindowSize + WindowSize * sizeof(USHORT);
+}
+
+VOID DeflateInit(_Out_ PDEFLATE_STREAM pStream, _In_ UINT WindowBits)
+{
+    pStream->WindowBits = WindowBits;
+    pStream->WindowSize = 1u << WindowBits;
+    pStream->Window = (PBYTE)(pStream + 1);
+    pStream->Prev = (USHORT*)(pStream->Window + 2 * pStream->WindowSize);
+    DeflateReset(pStream, NULL, 0);
+}
+
+VOID DeflateReset(_Inout_ PDEFLATE_STREAM pStream, _In_reads_bytes_opt_(cbDictionary) const BYTE* pDictionary, _In_ UINT cbDictionary)
+{
+    pStream->cbWindow = 0;
+    pStream->HashedUpTo = 0;
+    ZeroMemory(pStream->Head, sizeof(pStream->Head));
+
+    if (pDictionary && cbDictionary)
+    {
+        // only the tail within reach matters
+        if (cbDictionary > pStream->WindowSize)
+        {
+            pDictionary += cbDictionary - pStream->WindowSize;
+            cbDictionary = pStream->WindowSize;
+        }
+        memcpy(pStream->Window, pDictionary, cbDictionary);
+        pStream->cbWindow = cbDictionary;
+        InsertUpTo(pStream, cbDictionary);
+    }
+}
+
+ULONG DeflateCompress(
+    _Inout_ PDEFLATE_STREAM pStream,
+    _In_reads_bytes_(cbInput) const BYTE* pInput,
+    _In_ ULONG cbInput,
+    _Out_writes_bytes_to_(DEFLATE_BOUND(cbInput), return) PBYTE pOut)
+{
+    BIT_WRITER Writer = { pOut, 0, 0, 0 };
+    ULONG Offset = 0;
+
+    // one block with fixed codes, not the final one
+    PutBits(&Writer, 0, 1);
+    PutBits(&Writer, 1, 2);
+
+    // feed at most WindowSize bytes at a time so a slide always leaves room
+    while (Offset < cbInput)
+    {
+        UINT cbChunk = min(pStream->WindowSize, cbInput - Offset);
+        if (pStream->cbWindow + cbChunk > 2 * pStream->WindowSize)
+            SlideWindow(pStream);
+
+        memcpy(pStream->Window + pStream->cbWindow, pInput + Offset, cbChunk);
+        UINT Pos = pStream->cbWindow;
+        UINT End = Pos + cbChunk;
+        pStream->cbWindow = End;
+        Offset += cbChunk;
+
+        while (Pos < End)
+        {
+            UINT Distance;
+            UINT Len = 0;
+
+            InsertUpTo(pStream, Pos); // including the tail of the last message, now that it has lookahead
+            if (Pos + MIN_MATCH <= End)
+                Len = FindMatch(pStream, Pos, End, &Distance);
+
+            if (Len)
+            {
+                PutMatch(&Writer, Len, Distance);
+                Pos += Len;
+            }
+            else
+            {
+                PutSymbol(&Writer, pStream->Window[Pos]);
+                Pos++;
+            }
+        }
+        InsertUpTo(pStream, End);
+    }
+
+    PutSymbol(&Writer, 256); // end of block
+
+    // sync flush: empty stored block, its 00 00 FF FF is left to the receiver.
+    PutBits(&Writer, 0, 3);
+    AlignToByte(&Writer);
+    return Writer.cbOut;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "common.h"
+
+// Raw DEFLATE (RFC 1951) compressor for short messages.
+// Fixed Huffman codes only: messages are small, a dynamic code table would cost more than it saves.
+// Every call ends with a sync flush, so each message can be inflated as soon as it arrives
+// by one inflater kept for the whole stream.
+
+#define DEFLATE_MIN_WINDOW_BITS 8
+#define DEFLATE_MAX_WINDOW_BITS 15
+#define DEFLATE_HASH_BITS 12
+
+typedef struct _DEFLATE_STREAM
+{
+    UINT WindowBits;
+    UINT WindowSize;    // max distance of a match, 1 << WindowBits
+    UINT cbWindow;      // bytes of history in Window
+    UINT HashedUpTo;    // positions below this are in the hash chains already
+    PBYTE Window;       // 2 * WindowSize bytes, slides down by WindowSize when full
+    USHORT* Prev;       // WindowSize entries, previous position with the same hash
+    USHORT Head[1 << DEFLATE_HASH_BITS]; // latest position of each hash, 0 is nil
+} DEFLATE_STREAM, * PDEFLATE_STREAM;
+
+// Bytes needed by DeflateInit for the given window bits (stream and buffers in one block)
+SIZE_T DeflateStateSize(_In_ UINT WindowBits);
+
+// pStream points to DeflateStateSize(WindowBits) bytes.
+VOID DeflateInit(_Out_ PDEFLATE_STREAM pStream, _In_ UINT WindowBits);
+
+// Forget the history, optionally starting over with a preset dictionary.
+VOID DeflateReset(_Inout_ PDEFLATE_STREAM pStream, _In_reads_bytes_opt_(cbDictionary) const BYTE* pDictionary, _In_ UINT cbDictionary);
+
+// Worst case output size of DeflateCompress.
+#define DEFLATE_BOUND(cbInput) ((cbInput) + (cbInput) / 8 + 16)
+
+// Compress one message, matches may reach back into earlier messages.
+// The trailing empty stored block of the sync flush (00 00 FF FF) is not written, as in RFC 7692.
+// pOut must hold DEFLATE_BOUND(cbInput) bytes. Returns the output size.
+ULONG DeflateCompress(
+    _Inout_ PDEFLATE_STREAM pStream,
+    _In_reads_bytes_(cbInput) const BYTE* pInput,
+    _In_ ULONG cbInput,
+    _Out_writes_bytes_to_(DEFLATE_BOUND(cbInput), return) PBYTE pOut);
@@ -1,836 +1,1563 @@
-#include "common.h"
-#include "HttpIOPack.h"
-#include "HttpSendRecv.h"
-#include "WebsockEvent.h"
-
-static USHORT g_usSwitchingProtocolsCode = 101;
-static CHAR g_szSwitchingProtocolsReason[] = "Switching Protocols";
-
-static USHORT g_usEntityTooLargeCode = 413;
-static CHAR g_szEntityTooLargeReason[] = "Request Entity Too Large";
-static CHAR g_szEntityTooLargeMessage[] = "Large buffer support is not implemented.";
-
-static USHORT g_usUpgradeRequiredCode = 426;
-static CHAR g_szUpgradeRequiredReason[] = "Upgrade Required";
-static CHAR g_szUpgradeRequiredMessage[] = "This API only supports websocket. Upgrade required.";
-
-
-#define REQUEST_BUFFER_SIZE 4096 // extra buffer we provided store entity etc...
-
-typedef struct _HTTP_RESPONSE_IODATA
-{
-    HTTP_RESPONSE HttpResponse;
-    HTTP_DATA_CHUNK HttpDataChunk;
-} HTTP_RESPONSE_IODATA, * PHTTP_RESPONSE_IODATA;
-
-typedef struct _HTTP_UPGRADE_WS_IODATA
-{
-    HTTP_REQUEST_ID RequestID;
-    HTTP_RESPONSE HttpResponse;
-    WEB_SOCKET_HANDLE hWebSock;
-} HTTP_UPGRADE_WS_IODATA, * PHTTP_UPGRADE_WS_IODATA;
-
-typedef struct _HTTP_RECV_WEBSOCK_IODATA
-{
-    PCONNECTION_INFO pConnInfo;
-    PVOID pWebsockContext;
-} HTTP_RECV_WEBSOCK_IODATA, * PHTTP_RECV_WEBSOCK_IODATA;
-
-typedef struct _HTTP_SEND_WEBSOCK_IODATA
-{
-    PCONNECTION_INFO pConnInfo;
-    HTTP_DATA_CHUNK DataChunk;
-    PVOID pWebsockContext;
-} HTTP_SEND_WEBSOCK_IODATA, * PHTTP_SEND_WEBSOCK_IODATA;
-
-static VOID CALLBACK ServerHTTPCompletionCallback(
-    _Inout_     PTP_CALLBACK_INSTANCE Instance,
-    _In_opt_    PVOID                 Context,
-    _In_opt_    PVOID                 Overlapped,
-    _In_        ULONG                 IoResult,
-    _In_        ULONG_PTR             BytesTransferred,
-    _Inout_     PTP_IO                Io
-);
-
-static BOOL AsyncRecvHttpRequest(VOID);
-
-static BOOL AsyncSendHttpResponse(
-    _In_ HTTP_REQUEST_ID RequestID,
-    _In_ USHORT StatusCode,
-    _In_ PCSTR pGlobalReason,
-    _In_ USHORT ReasonLen,
-    _In_opt_ PVOID pGlobalBodyBuffer,
-    _In_ ULONG BufferLen);
-
-static BOOL AsyncSendUpgradeToWebsocket(_In_ PHTTP_REQUEST pHttpRequest);
-
-static BOOL AsyncRecvWebsockData(
-    _In_ PCONNECTION_INFO pConnInfo,
-    _In_ PVOID Buffer,
-    _In_ ULONG BufferLen,
-    _In_ PVOID pWebsockContext);
-
-static BOOL AsyncSendWebsockData(
-    _In_ PCONNECTION_INFO pConnInfo,
-    _In_ PVOID Buffer,
-    _In_ ULONG BufferLen,
-    _In_ PVOID pWebsockContext);
-
-static VOID RunWebsockAction(_Inout_ PCONNECTION_INFO pConnInfo);
-
-static VOID RecvRequestCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io);
-
-static VOID SendResponseCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io);
-
-static VOID SendUpgradeWebsockCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io);
-
-static VOID RecvWebsockDataCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io);
-
-static VOID SendWebsockDataCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io);
-
-static BOOL bServerRunning = FALSE;
-static HANDLE hReqHandle = NULL;
-static HTTP_SERVER_SESSION_ID ServerSessionID = 0;
-static HTTP_URL_GROUP_ID UrlGroupID = 0;
-static PTP_IO pHTTPRequestIO = NULL;
-
-BOOL StartHTTPServer(DWORD RequestCount)
-{
-    HTTPAPI_VERSION HttpApiVersion = HTTPAPI_VERSION_2;
-    ULONG ret;
-
-    BOOL bSuccess = FALSE;
-
-    ret = HttpInitialize(HttpApiVersion, HTTP_INITIALIZE_SERVER, NULL);
-    if (ret != NO_ERROR)
-    {
-        LogErrorMessage(L"HttpInitialize", ret);
-        return bSuccess;
-    }
-
-    bServerRunning = TRUE;
-    __try
-    {
-        ret = HttpCreateRequestQueue(HttpApiVersion, NULL, NULL, 0, &hReqHandle);
-        if (ret != NO_ERROR)
-        {
-            LogErrorMessage(L"HttpCreateRequestQueue", ret);
-            __leave;
-        }
-
-        ret = HttpCreateServerSession(HttpApiVersion, &ServerSessionID, 0);
-        if (ret != NO_ERROR)
-        {
-            LogErrorMessage(L"HttpCreateServerSession", ret);
-            __leave;
-        }
-
-        ret = HttpCreateUrlGroup(ServerSessionID, &UrlGroupID, 0);
-        if (ret != NO_ERROR)
-        {
-            LogErrorMessage(L"HttpCreateUrlGroup", ret);
-            __leave;
-        }
-
-        WCHAR WebsocketListenURL[] = L"http://+:80/api";
-        Log(LOG_INFO, L"listening on URL %1 for Websocket API", WebsocketListenURL);
-        ret = HttpAddUrlToUrlGroup(UrlGroupID, WebsocketListenURL, 0, 0);
-        if (ret != NO_ERROR)
-        {
-            LogErrorMessage(L"HttpAddUrlToUrlGroup", ret);
-            __leave;
-        }
-
-        HTTP_BINDING_INFO BindingInfo = { 0 };
-        BindingInfo.Flags.Present = 1;
-        BindingInfo.RequestQueueHandle = hReqHandle;
-
-        ret = HttpSetUrlGroupProperty(UrlGroupID, HttpServerBindingProperty, &BindingInfo, sizeof(BindingInfo));
-        if (ret != NO_ERROR)
-        {
-            LogErrorMessage(L"HttpSetUrlGroupProperty", ret);
-            __leave;
-        }
-
-        // bind to thread pool
-        pHTTPRequestIO = CreateThreadpoolIo(hReqHandle, ServerHTTPCompletionCallback, NULL, NULL);
-        if (!pHTTPRequestIO)
-        {
-            LogErrorMessage(L"CreateThreadpoolIo", GetLastError());
-            __leave;
-        }
-
-        for (DWORD i = 0; i < RequestCount; i++)
-        {
-            if (!AsyncRecvHttpRequest())
-            {
-                __leave;
-            }
-        }
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            StopHTTPServer();
-        }
-    }
-    return bSuccess;
-}
-
-VOID StopHTTPServer(VOID)
-{
-    bServerRunning = FALSE;
-
-    if (pHTTPRequestIO) CloseThreadpoolIo(pHTTPRequestIO);
-    if (UrlGroupID) HttpCloseUrlGroup(UrlGroupID);
-    if (HttpCloseServerSession) HttpCloseServerSession(ServerSessionID);
-    if (hReqHandle)
-    {
-        HttpShutdownRequestQueue(hReqHandle);
-        HttpCloseRequestQueue(hReqHandle);
-    }
-    HttpTerminate(HTTP_INITIALIZE_SERVER, NULL);
-
-    pHTTPRequestIO = NULL;
-    UrlGroupID = 0;
-    ServerSessionID = 0;
-    hReqHandle = NULL;
-}
-
-static VOID CALLBACK ServerHTTPCompletionCallback(
-    _Inout_     PTP_CALLBACK_INSTANCE Instance,
-    _In_opt_    PVOID                 Context,
-    _In_opt_    PVOID                 Overlapped,
-    _In_        ULONG                 IoResult,
-    _In_        ULONG_PTR             BytesTransferred,
-    _Inout_     PTP_IO                Io
-)
-{
-    if (!Overlapped)
-    {
-        LogErrorMessage(L"ServerHTTPCompletionCallback", IoResult);
-        return;
-    }
-
-    PHTTP_IOPACK pHttpIoPack = (PHTTP_IOPACK)Overlapped;
-    pHttpIoPack->Callback(pHttpIoPack, IoResult, BytesTransferred, Io);
-}
-
-VOID ConnInfoAddRef(_Inout_ PCONNECTION_INFO pConnInfo)
-{
-    InterlockedIncrement64(&pConnInfo->RefCnt);
-}
-
-VOID ConnInfoRelease(_Pre_valid_ _Post_maybenull_ PCONNECTION_INFO pConnInfo)
-{
-    LONG64 NewCnt = InterlockedDecrement64(&pConnInfo->RefCnt);
-    if (NewCnt == 0)
-    {
-        WebsockEventDisconnect(pConnInfo);
-        WebSocketDeleteHandle(pConnInfo->hWebSock);
-        HeapFree(GetProcessHeap(), 0, pConnInfo);
-        pConnInfo = NULL;
-    }
-}
-
-VOID ConnInfoCleanup(_Inout_ PCONNECTION_INFO pConnInfo)
-{
-    if (pConnInfo->pRoom)
-        LeaveRoom(pConnInfo);
-}
-
-static BOOL AsyncRecvHttpRequest(VOID)
-{
-    PHTTP_IOPACK pHttpIoPack = NULL;
-    BOOL bSuccess = FALSE;
-
-    StartThreadpoolIo(pHTTPRequestIO);
-    __try
-    {
-        pHttpIoPack = AllocHttpIOPack(RecvRequestCallback, sizeof(HTTP_REQUEST) + REQUEST_BUFFER_SIZE);
-        if (!pHttpIoPack)
-            __leave;
-
-        PHTTP_REQUEST pHttpRequest = (PHTTP_REQUEST)(pHttpIoPack + 1);
-        ULONG ret = HttpReceiveHttpRequest(hReqHandle, HTTP_NULL_ID, 0, pHttpRequest, sizeof(HTTP_REQUEST) + REQUEST_BUFFER_SIZE, NULL, (LPOVERLAPPED)pHttpIoPack);
-        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
-        {
-            LogErrorMessage(L"HttpReceiveHttpRequest", ret);
-            __leave;
-        }
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
-            CancelThreadpoolIo(pHTTPRequestIO);
-        }
-    }
-    return bSuccess;
-}
-
-static BOOL AsyncSendHttpResponse(
-    _In_ HTTP_REQUEST_ID RequestID,
-    _In_ USHORT StatusCode,
-    _In_ PCSTR pGlobalReason,
-    _In_ USHORT ReasonLen,
-    _In_opt_ PVOID pGlobalBodyBuffer,
-    _In_ ULONG BufferLen)
-{
-    PHTTP_IOPACK pHttpIoPack = NULL;
-    BOOL bSuccess = FALSE;
-
-    StartThreadpoolIo(pHTTPRequestIO);
-    __try
-    {
-        pHttpIoPack = AllocHttpIOPack(SendResponseCallback, sizeof(HTTP_RESPONSE_IODATA));
-        if (!pHttpIoPack)__leave;
-
-        PHTTP_RESPONSE_IODATA pData = (PHTTP_RESPONSE_IODATA)(pHttpIoPack + 1);
-
-        pData->HttpResponse.StatusCode = StatusCode;
-        pData->HttpResponse.pReason = pGlobalReason;
-        pData->HttpResponse.ReasonLength = ReasonLen;
-
-        if (pGlobalBodyBuffer)
-        {
-            pData->HttpDataChunk.DataChunkType = HttpDataChunkFromMemory;
-            pData->HttpDataChunk.FromMemory.pBuffer = pGlobalBodyBuffer;
-            pData->HttpDataChunk.FromMemory.BufferLength = BufferLen;
-            pData->HttpResponse.EntityChunkCount = 1;
-            pData->HttpResponse.pEntityChunks = &pData->HttpDataChunk;
-        }
-
-        ULONG ret = HttpSendHttpResponse(hReqHandle, RequestID, 0, &pData->HttpResponse, NULL, NULL, NULL, 0, (LPOVERLAPPED)pHttpIoPack, NULL);
-        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
-        {
-            LogErrorMessage(L"HttpSendHttpResponse", ret);
-            __leave;
-        }
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
-            CancelThreadpoolIo(pHTTPRequestIO);
-        }
-    }
-    return bSuccess;
-}
-
-static BOOL AsyncSendUpgradeToWebsocket(_In_ PHTTP_REQUEST pHttpRequest)
-{
-    PWEB_SOCKET_HTTP_HEADER pWebSockReqHeaders = NULL;
-    WEB_SOCKET_HANDLE serverHandle = NULL;
-
-    ULONG serverAdditionalHeaderCount = 0;
-    WEB_SOCKET_HTTP_HEADER* serverAdditionalHeaders = NULL;
-    HRESULT hr = S_OK;
-    PHTTP_IOPACK pHttpIoPack = NULL;
-    PHTTP_UNKNOWN_HEADER pUnknownHeaders = NULL;
-
-    BOOL bSuccess = FALSE;
-
-    StartThreadpoolIo(pHTTPRequestIO);
-    __try
-    {
-        hr = WebSocketCreateServerHandle(NULL, 0, &serverHandle);
-        if (FAILED(hr))
-            __leave;
-
-        // Copy headers received to pass to WebSocketBeginServerHandshake.
-        // the following header will be copied:
-        // Connection Upgrade Host
-        // and all headers in unknown headers.
-        pWebSockReqHeaders = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (3 + (SIZE_T)pHttpRequest->Headers.UnknownHeaderCount) * sizeof(WEB_SOCKET_HTTP_HEADER));
-        if (!pWebSockReqHeaders) __leave;
-
-        static CHAR szConnection[] = "Connection";
-        static CHAR szUpgrade[] = "Upgrade";
-        static CHAR szHost[] = "Host";
-        pWebSockReqHeaders[0].pcName = szConnection;
-        pWebSockReqHeaders[0].ulNameLength = _countof(szConnection) - 1;
-        pWebSockReqHeaders[0].pcValue = (PCHAR)pHttpRequest->Headers.KnownHeaders[HttpHeaderConnection].pRawValue;
-        pWebSockReqHeaders[0].ulValueLength = pHttpRequest->Headers.KnownHeaders[HttpHeaderConnection].RawValueLength;
-
-        pWebSockReqHeaders[1].pcName = szUpgrade;
-        pWebSockReqHeaders[1].ulNameLength = _countof(szUpgrade) - 1;
-        pWebSockReqHeaders[1].pcValue = (PCHAR)pHttpRequest->Headers.KnownHeaders[HttpHeaderUpgrade].pRawValue;
-        pWebSockReqHeaders[1].ulValueLength = pHttpRequest->Headers.KnownHeaders[HttpHeaderUpgrade].RawValueLength;
-
-        pWebSockReqHeaders[2].pcName = szHost;
-        pWebSockReqHeaders[2].ulNameLength = _countof(szHost) - 1;
-        pWebSockReqHeaders[2].pcValue = (PCHAR)pHttpRequest->Headers.KnownHeaders[HttpHeaderHost].pRawValue;
-        pWebSockReqHeaders[2].ulValueLength = pHttpRequest->Headers.KnownHeaders[HttpHeaderHost].RawValueLength;
-
-        for (USHORT i = 0; i < pHttpRequest->Headers.UnknownHeaderCount; i++)
-        {
-            pWebSockReqHeaders[i + 3].pcName = (PCHAR)pHttpRequest->Headers.pUnknownHeaders[i].pName;
-            pWebSockReqHeaders[i + 3].ulNameLength = pHttpRequest->Headers.pUnknownHeaders[i].NameLength;
-            pWebSockReqHeaders[i + 3].pcValue = (PCHAR)pHttpRequest->Headers.pUnknownHeaders[i].pRawValue;
-            pWebSockReqHeaders[i + 3].ulValueLength = pHttpRequest->Headers.pUnknownHeaders[i].RawValueLength;
-        }
-
-        hr = WebSocketBeginServerHandshake(
-            serverHandle,
-            NULL,
-            NULL,
-            0,
-            pWebSockReqHeaders,
-            3 + pHttpRequest->Headers.UnknownHeaderCount,
-            &serverAdditionalHeaders,
-            &serverAdditionalHeaderCount);
-
-        if (FAILED(hr))
-            __leave;
-
-        pHttpIoPack = AllocHttpIOPack(SendUpgradeWebsockCallback, sizeof(HTTP_UPGRADE_WS_IODATA));
-        if (!pHttpIoPack)
-            __leave;
-
-        PHTTP_UPGRADE_WS_IODATA pData = (PHTTP_UPGRADE_WS_IODATA)(pHttpIoPack + 1);
-
-        pData->HttpResponse.StatusCode = g_usSwitchingProtocolsCode;
-        pData->HttpResponse.pReason = g_szSwitchingProtocolsReason;
-        pData->HttpResponse.ReasonLength = _countof(g_szSwitchingProtocolsReason) - 1;
-
-        pUnknownHeaders = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, serverAdditionalHeaderCount * sizeof(HTTP_UNKNOWN_HEADER));
-        if (!pUnknownHeaders)
-            __leave;
-
-        // TODO: the code below is a little bit hacky
-        // I have no idea but HttpSendHttpResponse eats my "Connection" header
-        // so I have to add it into unknown headers.
-        // and if I don't specify "Upgrade" header in known headers, HttpSendHttpResponse will return 87 ERROR_INVALID_PARAMETER
-        INT AddedUnknownHeadersCnt = 0;
-        for (ULONG i = 0; i < serverAdditionalHeaderCount; i++)
-        {
-            static char szUpgrade[] = "Upgrade";
-            if (_strnicmp(serverAdditionalHeaders[i].pcName, szUpgrade, _countof(szUpgrade) - 1) == 0) // Don't add "Upgrade" header twice. we will add it known headers later.
-                continue;
-
-            pUnknownHeaders[AddedUnknownHeadersCnt].NameLength = (USHORT)serverAdditionalHeaders[i].ulNameLength;
-            pUnknownHeaders[AddedUnknownHeadersCnt].pName = serverAdditionalHeaders[i].pcName;
-            pUnknownHeaders[AddedUnknownHeadersCnt].RawValueLength = (USHORT)serverAdditionalHeaders[i].ulValueLength;
-            pUnknownHeaders[AddedUnknownHeadersCnt].pRawValue = serverAdditionalHeaders[i].pcValue;
-            AddedUnknownHeadersCnt++;
-        }
-        pData->HttpResponse.Headers.pUnknownHeaders = pUnknownHeaders;
-        pData->HttpResponse.Headers.UnknownHeaderCount = AddedUnknownHeadersCnt;
-
-        static char szWebSocket[] = "WebSocket";
-        pData->HttpResponse.Headers.KnownHeaders[HttpHeaderUpgrade].pRawValue = szWebSocket;
-        pData->HttpResponse.Headers.KnownHeaders[HttpHeaderUpgrade].RawValueLength = _countof(szWebSocket) - 1;
-
-        pData->RequestID = pHttpRequest->RequestId;
-        pData->hWebSock = serverHandle;
-
-        ULONG ret = HttpSendHttpResponse(
-            hReqHandle,
-            pHttpRequest->RequestId,
-            HTTP_SEND_RESPONSE_FLAG_OPAQUE | HTTP_SEND_RESPONSE_FLAG_MORE_DATA,
-            &pData->HttpResponse,
-            NULL,
-            NULL,
-            NULL,
-            0,
-            (LPOVERLAPPED)pHttpIoPack,
-            NULL);
-        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
-        {
-            LogErrorMessage(L"HttpSendHttpResponse", ret);
-            __leave;
-        }
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (pWebSockReqHeaders) HeapFree(GetProcessHeap(), 0, pWebSockReqHeaders);
-
-        if (!bSuccess)
-        {
-            if (serverAdditionalHeaders)
-            {
-                WebSocketEndServerHandshake(serverHandle);
-            }
-            if (serverHandle)
-            {
-                WebSocketDeleteHandle(serverHandle);
-            }
-            if (pHttpIoPack)
-            {
-                FreeHttpIOPack(pHttpIoPack);
-            }
-            if (pUnknownHeaders)
-            {
-                HeapFree(GetProcessHeap(), 0, pUnknownHeaders);
-            }
-            CancelThreadpoolIo(pHTTPRequestIO);
-        }
-    }
-    return bSuccess;
-}
-
-static BOOL AsyncRecvWebsockData(
-    _In_ PCONNECTION_INFO pConnInfo,
-    _In_ PVOID Buffer,
-    _In_ ULONG BufferLen,
-    _In_ PVOID pWebsockContext)
-{
-    PHTTP_IOPACK pHttpIoPack = NULL;
-    BOOL bSuccess = FALSE;
-
-    StartThreadpoolIo(pHTTPRequestIO);
-    __try
-    {
-        pHttpIoPack = AllocHttpIOPack(RecvWebsockDataCallback, sizeof(HTTP_RECV_WEBSOCK_IODATA));
-        if (!pHttpIoPack)
-            __leave;
-
-        PHTTP_RECV_WEBSOCK_IODATA pData = (PHTTP_RECV_WEBSOCK_IODATA)(pHttpIoPack + 1);
-        pData->pConnInfo = pConnInfo;
-        pData->pWebsockContext = pWebsockContext;
-
-        ULONG ret = HttpReceiveRequestEntityBody(hReqHandle, pConnInfo->RequestID, 0, Buffer, BufferLen, NULL, (LPOVERLAPPED)pHttpIoPack);
-        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
-        {
-            if (ret != ERROR_HANDLE_EOF) // handle in the same way, but supress the error message.
-            {
-                LogErrorMessage(L"HttpReceiveRequestEntityBody", ret);
-            }
-            __leave;
-        }
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
-            CancelThreadpoolIo(pHTTPRequestIO);
-        }
-    }
-    return bSuccess;
-}
-
-static BOOL AsyncSendWebsockData(
-    _In_ PCONNECTION_INFO pConnInfo,
-    _In_ PVOID Buffer,
-    _In_ ULONG BufferLen,
-    _In_ PVOID pWebsockContext)
-{
-    PHTTP_IOPACK pHttpIoPack = NULL;
-    BOOL bSuccess = FALSE;
-
-    StartThreadpoolIo(pHTTPRequestIO);
-    __try
-    {
-        pHttpIoPack = AllocHttpIOPack(SendWebsockDataCallback, sizeof(HTTP_SEND_WEBSOCK_IODATA));
-        if (!pHttpIoPack)
-            __leave;
-
-        PHTTP_SEND_WEBSOCK_IODATA pData = (PHTTP_SEND_WEBSOCK_IODATA)(pHttpIoPack + 1);
-        pData->pConnInfo = pConnInfo;
-        pData->pWebsockContext = pWebsockContext;
-        pData->DataChunk.DataChunkType = HttpDataChunkFromMemory;
-        pData->DataChunk.FromMemory.pBuffer = Buffer;
-        pData->DataChunk.FromMemory.BufferLength = BufferLen;
-
-        ULONG ret = HttpSendResponseEntityBody(hReqHandle, pConnInfo->RequestID, HTTP_SEND_RESPONSE_FLAG_MORE_DATA, 1, &(pData->DataChunk), NULL, NULL, 0, (LPOVERLAPPED)pHttpIoPack, NULL);
-        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
-        {
-            LogErrorMessage(L"HttpSendResponseEntityBody", ret);
-            __leave;
-        }
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
-            CancelThreadpoolIo(pHTTPRequestIO);
-        }
-    }
-    return bSuccess;
-}
-
-static VOID RunWebsockAction(_Inout_ PCONNECTION_INFO pConnInfo)
-{
-    WEB_SOCKET_HANDLE hWebSock = pConnInfo->hWebSock;
-    HTTP_REQUEST_ID RequestID = pConnInfo->RequestID;
-
-    WEB_SOCKET_BUFFER Buffer = { 0 };
-    ULONG BufferCnt;
-    WEB_SOCKET_ACTION Action;
-    WEB_SOCKET_BUFFER_TYPE BufferType;
-    PVOID pWebsockContext;
-    PWEBSOCK_SEND_BUF pWebsockSendBuf; // We use this to store buffer when sending... not used when recving
-
-    do
-    {
-        BufferCnt = 1;
-        HRESULT hr = WebSocketGetAction(hWebSock, WEB_SOCKET_ALL_ACTION_QUEUE, &Buffer, &BufferCnt, &Action, &BufferType, &pWebsockSendBuf, &pWebsockContext);
-        if (FAILED(hr))
-            WebSocketAbortHandle(hWebSock);
-
-        switch (Action)
-        {
-        case WEB_SOCKET_NO_ACTION:
-            break;
-
-        case WEB_SOCKET_RECEIVE_FROM_NETWORK_ACTION:
-            if (AsyncRecvWebsockData(pConnInfo, Buffer.Data.pbBuffer, Buffer.Data.ulBufferLength, pWebsockContext))
-                return; // the rest is handled when completion
-            ConnInfoCleanup(pConnInfo);
-            WebSocketAbortHandle(hWebSock);
-            break;
-
-        case WEB_SOCKET_SEND_TO_NETWORK_ACTION:
-            if (AsyncSendWebsockData(pConnInfo, Buffer.Data.pbBuffer, Buffer.Data.ulBufferLength, pWebsockContext))
-                return; // the rest is handled when completion
-
-            WebSocketAbortHandle(hWebSock);
-            break;
-
-        case WEB_SOCKET_INDICATE_SEND_COMPLETE_ACTION:
-            pWebsockSendBuf->Callback(pConnInfo, pWebsockSendBuf);
-            break;
-
-        case WEB_SOCKET_INDICATE_RECEIVE_COMPLETE_ACTION:
-            if (BufferCnt == 1)
-            {
-                WebsockEventRecv(pConnInfo, BufferType, &Buffer);
-                hr = WebSocketReceive(hWebSock, NULL, NULL);
-                if (FAILED(hr))
-                {
-                    WebSocketAbortHandle(hWebSock);
-                    break;
-                }
-            }
-            break;
-        }
-        WebSocketCompleteAction(hWebSock, pWebsockContext, 0);
-    } while (Action != WEB_SOCKET_NO_ACTION);
-
-    ConnInfoRelease(pConnInfo);
-}
-
-static VOID RecvRequestCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io)
-{
-    if (bServerRunning)
-    {
-        PHTTP_REQUEST pHttpRequest = (PHTTP_REQUEST)(pHttpIoPack + 1);
-        switch (IoResult)
-        {
-        case NO_ERROR:
-        {
-            BOOL bSuccess = AsyncSendUpgradeToWebsocket(pHttpRequest);
-
-            if (!bSuccess)
-            {
-                AsyncSendHttpResponse(
-                    pHttpRequest->RequestId,
-                    g_usUpgradeRequiredCode,
-                    g_szUpgradeRequiredReason,
-                    (USHORT)strlen(g_szUpgradeRequiredReason),
-                    g_szUpgradeRequiredMessage,
-                    (USHORT)strlen(g_szUpgradeRequiredMessage));
-            }
-            break;
-        }
-        case ERROR_MORE_DATA:
-
-            AsyncSendHttpResponse(
-                pHttpRequest->RequestId,
-                g_usEntityTooLargeCode,
-                g_szEntityTooLargeReason,
-                (USHORT)strlen(g_szEntityTooLargeReason),
-                g_szEntityTooLargeMessage,
-                (USHORT)strlen(g_szEntityTooLargeMessage));
-
-            break;
-        }
-
-        AsyncRecvHttpRequest();
-    }
-    FreeHttpIOPack(pHttpIoPack);
-}
-
-static VOID SendResponseCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io)
-{
-    if (IoResult != NO_ERROR)
-    {
-        LogErrorMessage(L"SendResponseCallback", IoResult);
-    }
-    FreeHttpIOPack(pHttpIoPack);
-}
-
-static VOID SendUpgradeWebsockCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io)
-{
-    PHTTP_UPGRADE_WS_IODATA pData = (PHTTP_UPGRADE_WS_IODATA)(pHttpIoPack + 1);
-    BOOL bSuccess = FALSE;
-    PCONNECTION_INFO pConnInfo = NULL;
-    HeapFree(GetProcessHeap(), 0, pData->HttpResponse.Headers.pUnknownHeaders);
-
-    __try
-    {
-        if (FAILED(WebSocketEndServerHandshake(pData->hWebSock)))
-            __leave;
-
-        if (!bServerRunning)
-            __leave;
-
-        if (IoResult != NO_ERROR)
-        {
-            LogErrorMessage(L"SendUpgradeWebsockCallback", IoResult);
-            __leave;
-        }
-
-        pConnInfo = (PCONNECTION_INFO)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(CONNECTION_INFO));
-        if (!pConnInfo)
-            __leave;
-
-        pConnInfo->hWebSock = pData->hWebSock;
-        pConnInfo->RequestID = pData->RequestID;
-        pConnInfo->RefCnt = 1;
-
-        WebsockEventConnect(pConnInfo);
-
-        if (FAILED(WebSocketReceive(pData->hWebSock, NULL, NULL)))
-            __leave;
-
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (bSuccess)
-        {
-            RunWebsockAction(pConnInfo);
-        }
-        else
-        {
-            if (pConnInfo)
-            {
-                WebsockEventDisconnect(pConnInfo);
-                HeapFree(GetProcessHeap(), 0, pConnInfo);
-            }
-            WebSocketDeleteHandle(pData->hWebSock); // no operations should be queued, no need to abort.
-        }
-    }
-    FreeHttpIOPack(pHttpIoPack);
-}
-
-static VOID RecvWebsockDataCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io)
-{
-    PHTTP_RECV_WEBSOCK_IODATA pData = (PHTTP_RECV_WEBSOCK_IODATA)(pHttpIoPack + 1);
-
-    WEB_SOCKET_HANDLE hWebSock = pData->pConnInfo->hWebSock;
-    HTTP_REQUEST_ID RequestID = pData->pConnInfo->RequestID;
-
-    WebSocketCompleteAction(hWebSock, pData->pWebsockContext, (ULONG)BytesTransferred);
-
-    if (IoResult != NO_ERROR)
-    {
-        if (IoResult != ERROR_HANDLE_EOF) // handle in the same way, but supress the error message.
-        {
-            LogErrorMessage(L"RecvWebsockDataCallback", IoResult);
-        }
-        WebSocketAbortHandle(hWebSock);
-        ConnInfoCleanup(pData->pConnInfo);
-    }
-
-    RunWebsockAction(pData->pConnInfo);
-
-    FreeHttpIOPack(pHttpIoPack);
-}
-
-static VOID SendWebsockDataCallback(
-    _In_ PHTTP_IOPACK pHttpIoPack,
-    _In_ ULONG IoResult,
-    _In_ ULONG_PTR BytesTransferred,
-    _Inout_ PTP_IO Io)
-{
-    PHTTP_SEND_WEBSOCK_IODATA pData = (PHTTP_SEND_WEBSOCK_IODATA)(pHttpIoPack + 1);
-
-    WEB_SOCKET_HANDLE hWebSock = pData->pConnInfo->hWebSock;
-    HTTP_REQUEST_ID RequestID = pData->pConnInfo->RequestID;
-
-    WebSocketCompleteAction(hWebSock, pData->pWebsockContext, (ULONG)BytesTransferred);
-
-    if (IoResult != NO_ERROR)
-    {
-        LogErrorMessage(L"SendWebsockDataCallback", IoResult);
-        WebSocketAbortHandle(hWebSock);
-    }
-
-    RunWebsockAction(pData->pConnInfo);
-
-    FreeHttpIOPack(pHttpIoPack);
-}
-
-BOOL WebsockSendMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
-{
-    ConnInfoAddRef(pConnInfo);
-    HRESULT hr = WebSocketSend(pConnInfo->hWebSock, WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE, &(pWebsockSendBuf->WebsockBuf), pWebsockSendBuf);
-    if (FAILED(hr))
-        WebSocketAbortHandle(pConnInfo->hWebSock);
-    // RunWebsockAction should be executed no matter whether WebSocketSend succeeded.
-    // because we increased RefCnt. 
-    RunWebsockAction(pConnInfo);
-    return SUCCEEDED(S_OK);
-}
-
-BOOL WebsockDisconnect(_In_ PCONNECTION_INFO pConnInfo)
-{
-    WebSocketAbortHandle(pConnInfo->hWebSock);
-    ULONG ret = HttpCancelHttpRequest(hReqHandle, pConnInfo->RequestID, NULL);
-    if (ret != NO_ERROR)
-    {
-        LogErrorMessage(L"HttpCancelHttpRequest", ret);
-        return FALSE;
-    }
-    return TRUE;
-}
+#include <strsafe.h>
+#include "common.h"
+#include "HttpIOPack.h"
+#include "HttpSendRecv.h"
+#include "WebsockEvent.h"
+#include "Compression.h"
+#include "SendBatch.h"
+#include "SlabPool.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Probes.h"
+
+static USHORT g_usSwitchingProtocolsCode = 101;
+static CHAR g_szSwitchingProtocolsReason[] = "Switching Protocols";
+
+static USHORT g_usEntityTooLargeCode = 413;
+static CHAR g_szEntityTooLargeReason[] = "Request Entity Too Large";
+static CHAR g_szEntityTooLargeMessage[] = "Large buffer support is not implemented.";
+
+static USHORT g_usUpgradeRequiredCode = 426;
+static CHAR g_szUpgradeRequiredReason[] = "Upgrade Required";
+static CHAR g_szUpgradeRequiredMessage[] = "This API only supports websocket. Upgrade required.";
+
+static USHORT g_usOKCode = 200;
+static CHAR g_szOKReason[] = "OK";
+static CHAR g_szMetricsContentType[] = "text/plain; version=0.0.4";
+
+typedef struct _HTTP_RECV_REQUEST_IODATA HTTP_RECV_REQUEST_IODATA, * PHTTP_RECV_REQUEST_IODATA;
+
+typedef struct _HTTP_RECV_REQUEST_IODATA
+{
+    PHTTP_RECV_REQUEST_IODATA pPrev; // on RecvList while posted
+    PHTTP_RECV_REQUEST_IODATA pNext;
+    BOOL bCancelled; // over the depth, not counted in RecvPostedCnt any more
+    HTTP_REQUEST HttpRequest; // followed by HttpServerConfig.RequestBufferSize bytes
+} HTTP_RECV_REQUEST_IODATA, * PHTTP_RECV_REQUEST_IODATA;
+
+typedef struct _HTTP_RESPONSE_IODATA
+{
+    HTTP_RESPONSE HttpResponse;
+    HTTP_DATA_CHUNK HttpDataChunk;
+    PVOID pHeapBody; // freed when sent, NULL if the body is static
+} HTTP_RESPONSE_IODATA, * PHTTP_RESPONSE_IODATA;
+
+typedef struct _HTTP_UPGRADE_WS_IODATA
+{
+    HTTP_REQUEST_ID RequestID;
+    HTTP_RESPONSE HttpResponse;
+    WEB_SOCKET_HANDLE hWebSock;
+    UINT Protocol;
+    BOOL bCompress;
+} HTTP_UPGRADE_WS_IODATA, * PHTTP_UPGRADE_WS_IODATA;
+
+typedef struct _HTTP_RECV_WEBSOCK_IODATA
+{
+    PCONNECTION_INFO pConnInfo;
+    PVOID pWebsockContext;
+} HTTP_RECV_WEBSOCK_IODATA, * PHTTP_RECV_WEBSOCK_IODATA;
+
+typedef struct _HTTP_SEND_WEBSOCK_IODATA
+{
+    PCONNECTION_INFO pConnInfo;
+    HTTP_DATA_CHUNK DataChunk;
+    PVOID pWebsockContext;
+} HTTP_SEND_WEBSOCK_IODATA, * PHTTP_SEND_WEBSOCK_IODATA;
+
+static VOID CALLBACK ServerHTTPCompletionCallback(
+    _Inout_     PTP_CALLBACK_INSTANCE Instance,
+    _In_opt_    PVOID                 Context,
+    _In_opt_    PVOID                 Overlapped,
+    _In_        ULONG                 IoResult,
+    _In_        ULONG_PTR             BytesTransferred,
+    _Inout_     PTP_IO                Io
+);
+
+static BOOL AsyncRecvHttpRequest(VOID);
+
+static BOOL AsyncSendHttpResponse(
+    _In_ HTTP_REQUEST_ID RequestID,
+    _In_ USHORT StatusCode,
+    _In_ PCSTR pGlobalReason,
+    _In_ USHORT ReasonLen,
+    _In_opt_ PVOID pGlobalBodyBuffer,
+    _In_ ULONG BufferLen);
+
+static BOOL AsyncSendMetrics(_In_ HTTP_REQUEST_ID RequestID);
+
+static BOOL AsyncSendUpgradeToWebsocket(_In_ PHTTP_REQUEST pHttpRequest);
+
+static BOOL AsyncRecvWebsockData(
+    _In_ PCONNECTION_INFO pConnInfo,
+    _In_ PVOID Buffer,
+    _In_ ULONG BufferLen,
+    _In_ PVOID pWebsockContext);
+
+static BOOL AsyncSendWebsockData(
+    _In_ PCONNECTION_INFO pConnInfo,
+    _In_ PVOID Buffer,
+    _In_ ULONG BufferLen,
+    _In_ PVOID pWebsockContext);
+
+static VOID RunWebsockAction(_Inout_ PCONNECTION_INFO pConnInfo);
+
+static VOID RecvRequestCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io);
+
+static VOID SendResponseCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io);
+
+static VOID SendUpgradeWebsockCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io);
+
+static VOID RecvWebsockDataCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io);
+
+static VOID SendWebsockDataCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io);
+
+HTTP_SERVER_CONFIG HttpServerConfig =
+{
+    L"http://+:80",     // ListenUrl
+    2,                  // RequestsPerProcessor
+    8,                  // OutstandingRequests
+    4096,               // RequestBufferSize: extra buffer we provided store entity etc...
+    1000,               // QueueLength: the http.sys default
+    0,                  // WorkerThreadsMin
+    0,                  // WorkerThreadsMax
+    4,                  // ReceiveDepthMin
+    1024,               // ReceiveDepthMax
+    256,                // WebsockRecvBufferSize: the least websocket.dll takes, idle connections keep it
+    256,                // WebsockSendBufferSize: frame headers and control frames, payloads are sent from our buffers
+};
+
+static BOOL bServerRunning = FALSE;
+static HANDLE hReqHandle = NULL;
+static HTTP_SERVER_SESSION_ID ServerSessionID = 0;
+static HTTP_URL_GROUP_ID UrlGroupID = 0;
+static PTP_IO pHTTPRequestIO = NULL;
+static PTP_POOL pWorkerPool = NULL; // runs the I/O completions, sized by HttpServerConfig
+static TP_CALLBACK_ENVIRON WorkerEnviron;
+static SLAB_POOL ConnPool; // CONNECTION_INFO
+static LONG volatile LastConnId;
+static SRWLOCK ConnListLock = SRWLOCK_INIT;
+static PCONNECTION_INFO pConnListHead; // upgraded connections, for KickConnection
+
+// adaptive receive depth, see StartHTTPServer in HttpSendRecv.h
+static SRWLOCK RecvListLock = SRWLOCK_INIT;
+static PHTTP_RECV_REQUEST_IODATA pRecvListHead; // posted receives, to cancel those over the depth
+static LONG volatile RecvPostedCnt;
+static LONG volatile RecvDepth;
+static LONG volatile RecvLowWater;    // fewest receives left posted since the last adjustment
+static LONG volatile RecvArrivalCnt;  // requests received since the last adjustment
+static LONG volatile RecvExhaustCnt;  // of which took the last posted receive
+static LONG64 volatile RecvAwayTicks; // QueryPerformanceCounter ticks from completions to their reposts
+static LARGE_INTEGER RecvTickFrequency;
+static PTP_TIMER pRecvDepthTimer = NULL;
+
+static VOID RefillHttpReceives(VOID);
+static VOID CALLBACK RecvDepthTimerCallback(
+    _Inout_ PTP_CALLBACK_INSTANCE Instance,
+    _Inout_opt_ PVOID Context,
+    _Inout_ PTP_TIMER Timer);
+
+// HTTP_REQUEST.UrlContext, which of ListenUrlList the request came in on.
+#define URL_CONTEXT_API     1
+#define URL_CONTEXT_METRICS 2
+
+// under HttpServerConfig.ListenUrl, same request queue. told apart by UrlContext in RecvRequestCallback.
+static const struct
+{
+    LPCWSTR Path;
+    HTTP_URL_CONTEXT Context;
+    LPCWSTR Use;
+} ListenUrlList[] = {
+    { L"/api",     URL_CONTEXT_API,     L"Websocket API" },
+    { L"/metrics", URL_CONTEXT_METRICS, L"metrics" },
+};
+
+BOOL StartHTTPServer(DWORD RequestCount, BOOL bListen)
+{
+    HTTPAPI_VERSION HttpApiVersion = HTTPAPI_VERSION_2;
+    ULONG ret;
+
+    BOOL bSuccess = FALSE;
+
+    ret = HttpInitialize(HttpApiVersion, HTTP_INITIALIZE_SERVER, NULL);
+    if (ret != NO_ERROR)
+    {
+        LogErrorMessage(L"HttpInitialize", ret);
+        return bSuccess;
+    }
+    InitSlabPool(&ConnPool, L"connection", sizeof(CONNECTION_INFO));
+
+    bServerRunning = TRUE;
+    __try
+    {
+        ret = HttpCreateRequestQueue(HttpApiVersion, NULL, NULL, 0, &hReqHandle);
+        if (ret != NO_ERROR)
+        {
+            LogErrorMessage(L"HttpCreateRequestQueue", ret);
+            __leave;
+        }
+
+        ret = HttpCreateServerSession(HttpApiVersion, &ServerSessionID, 0);
+        if (ret != NO_ERROR)
+        {
+            LogErrorMessage(L"HttpCreateServerSession", ret);
+            __leave;
+        }
+
+        ret = HttpCreateUrlGroup(ServerSessionID, &UrlGroupID, 0);
+        if (ret != NO_ERROR)
+        {
+            LogErrorMessage(L"HttpCreateUrlGroup", ret);
+            __leave;
+        }
+
+        HTTP_BINDING_INFO BindingInfo = { 0 };
+        BindingInfo.Flags.Present = 1;
+        BindingInfo.RequestQueueHandle = hReqHandle;
+
+        ret = HttpSetUrlGroupProperty(UrlGroupID, HttpServerBindingProperty, &BindingInfo, sizeof(BindingInfo));
+        if (ret != NO_ERROR)
+        {
+            LogErrorMessage(L"HttpSetUrlGroupProperty", ret);
+            __leave;
+        }
+
+        // a pool of our own, so its size can be set
+        pWorkerPool = CreateThreadpool(NULL);
+        if (!pWorkerPool)
+        {
+            LogErrorMessage(L"CreateThreadpool", GetLastError());
+            __leave;
+        }
+        InitializeThreadpoolEnvironment(&WorkerEnviron);
+        SetThreadpoolCallbackPool(&WorkerEnviron, pWorkerPool);
+        ApplyHttpServerConfig();
+
+        // bind to thread pool
+        pHTTPRequestIO = CreateThreadpoolIo(hReqHandle, ServerHTTPCompletionCallback, NULL, &WorkerEnviron);
+        if (!pHTTPRequestIO)
+        {
+            LogErrorMessage(L"CreateThreadpoolIo", GetLastError());
+            __leave;
+        }
+
+        QueryPerformanceFrequency(&RecvTickFrequency);
+        RecvDepth = (LONG)max(HttpServerConfig.ReceiveDepthMin, min(RequestCount, HttpServerConfig.ReceiveDepthMax));
+        RefillHttpReceives();
+        if (RecvPostedCnt == 0)
+            __leave;
+        RecvLowWater = RecvPostedCnt;
+
+        pRecvDepthTimer = CreateThreadpoolTimer(RecvDepthTimerCallback, NULL, &WorkerEnviron);
+        if (!pRecvDepthTimer)
+        {
+            LogErrorMessage(L"CreateThreadpoolTimer", GetLastError());
+            __leave;
+        }
+        LARGE_INTEGER DueTime;
+        DueTime.QuadPart = -(LONGLONG)RECV_DEPTH_INTERVAL * 10000;
+        FILETIME ftDueTime = { DueTime.LowPart, (DWORD)DueTime.HighPart };
+        SetThreadpoolTimer(pRecvDepthTimer, &ftDueTime, RECV_DEPTH_INTERVAL, RECV_DEPTH_INTERVAL / 10);
+
+        if (bListen && !StartListening())
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            StopHTTPServer();
+        }
+    }
+    return bSuccess;
+}
+
+BOOL StartListening(VOID)
+{
+    LPCWSTR Prefix = HttpServerConfig.ListenUrl;
+    SIZE_T cchPrefix = wcslen(Prefix);
+    BOOL bSlash = cchPrefix && Prefix[cchPrefix - 1] == L'/';
+
+    for (UINT i = 0; i < _countof(ListenUrlList); i++)
+    {
+        WCHAR Url[CONFIG_STRING_MAXLEN + 16];
+        StringCchPrintfW(Url, _countof(Url), L"%s%s", Prefix, ListenUrlList[i].Path + bSlash);
+
+        Log(LOG_INFO, L"listening on URL %1 for %2", Url, ListenUrlList[i].Use);
+        ULONG ret = HttpAddUrlToUrlGroup(UrlGroupID, Url, ListenUrlList[i].Context, 0);
+        if (ret != NO_ERROR)
+        {
+            LogErrorMessage(L"HttpAddUrlToUrlGroup", ret);
+            StopListening();
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+BOOL StopListening(VOID)
+{
+    ULONG ret = HttpRemoveUrlFromUrlGroup(UrlGroupID, NULL, HTTP_URL_FLAG_REMOVE_ALL);
+    if (ret != NO_ERROR)
+    {
+        LogErrorMessage(L"HttpRemoveUrlFromUrlGroup", ret);
+        return FALSE;
+    }
+    Log(LOG_INFO, L"stopped listening, requests already received carry on.");
+    return TRUE;
+}
+
+VOID StopHTTPServer(VOID)
+{
+    bServerRunning = FALSE;
+
+    if (pRecvDepthTimer)
+    {
+        SetThreadpoolTimer(pRecvDepthTimer, NULL, 0, 0);
+        WaitForThreadpoolTimerCallbacks(pRecvDepthTimer, TRUE);
+        CloseThreadpoolTimer(pRecvDepthTimer);
+        pRecvDepthTimer = NULL;
+    }
+    if (pHTTPRequestIO) CloseThreadpoolIo(pHTTPRequestIO);
+    if (pWorkerPool)
+    {
+        DestroyThreadpoolEnvironment(&WorkerEnviron);
+        CloseThreadpool(pWorkerPool); // released once the I/O above is done with it
+    }
+    if (UrlGroupID) HttpCloseUrlGroup(UrlGroupID);
+    if (HttpCloseServerSession) HttpCloseServerSession(ServerSessionID);
+    if (hReqHandle)
+    {
+        HttpShutdownRequestQueue(hReqHandle);
+        HttpCloseRequestQueue(hReqHandle);
+    }
+    HttpTerminate(HTTP_INITIALIZE_SERVER, NULL);
+
+    pHTTPRequestIO = NULL;
+    pWorkerPool = NULL;
+    UrlGroupID = 0;
+    ServerSessionID = 0;
+    hReqHandle = NULL;
+}
+
+VOID ApplyHttpServerConfig(VOID)
+{
+    UINT ThreadsMin = HttpServerConfig.WorkerThreadsMin;
+    UINT ThreadsMax = HttpServerConfig.WorkerThreadsMax;
+
+    if (pWorkerPool)
+    {
+        if (ThreadsMax && ThreadsMin > ThreadsMax)
+        {
+            Log(LOG_WARNING, L"worker_threads_min %1!u! is over worker_threads_max %2!u!, worker pool unchanged.", ThreadsMin, ThreadsMax);
+        }
+        else
+        {
+            if (ThreadsMax)
+                SetThreadpoolThreadMaximum(pWorkerPool, ThreadsMax);
+            if (ThreadsMin && !SetThreadpoolThreadMinimum(pWorkerPool, ThreadsMin))
+                LogErrorMessage(L"SetThreadpoolThreadMinimum", GetLastError());
+        }
+    }
+
+    if (hReqHandle)
+    {
+        ULONG QueueLength = HttpServerConfig.QueueLength;
+        ULONG ret = HttpSetRequestQueueProperty(hReqHandle, HttpServerQueueLengthProperty, &QueueLength, sizeof(QueueLength), 0, NULL);
+        if (ret != NO_ERROR)
+            LogErrorMessage(L"HttpSetRequestQueueProperty", ret);
+    }
+}
+
+static VOID CALLBACK ServerHTTPCompletionCallback(
+    _Inout_     PTP_CALLBACK_INSTANCE Instance,
+    _In_opt_    PVOID                 Context,
+    _In_opt_    PVOID                 Overlapped,
+    _In_        ULONG                 IoResult,
+    _In_        ULONG_PTR             BytesTransferred,
+    _Inout_     PTP_IO                Io
+)
+{
+    if (!Overlapped)
+    {
+        LogErrorMessage(L"ServerHTTPCompletionCallback", IoResult);
+        return;
+    }
+
+    PHTTP_IOPACK pHttpIoPack = (PHTTP_IOPACK)Overlapped;
+    BeginConnRefScope();
+    pHttpIoPack->Callback(pHttpIoPack, IoResult, BytesTransferred, Io);
+    EndConnRefScope();
+}
+
+VOID PrintConnectionStats(VOID)
+{
+    PrintSlabPoolStats(&ConnPool);
+    Log(LOG_INFO, L"HTTP receives: %1!d! posted, depth %2!d!.", RecvPostedCnt, RecvDepth);
+}
+
+UINT GetHttpReceiveDepth(VOID)
+{
+    return (UINT)RecvDepth;
+}
+
+UINT GetHttpReceivesPosted(VOID)
+{
+    return (UINT)max(0, RecvPostedCnt);
+}
+
+// Releases made inside a scope are kept in the thread's table and published together when the scope ends,
+// a later AddRef of the same connection in the scope only cancels one of them, no interlocked operation at all.
+// Only releases are deferred: the published count is never lower than the real one, so a reference that
+// leaves the thread with an async I/O is always counted. AddRef of a connection without deferred releases
+// is atomic.
+typedef struct _CONN_REF_ENTRY
+{
+    PCONNECTION_INFO pConnInfo;
+    LONG64 ReleaseCnt;
+} CONN_REF_ENTRY, * PCONN_REF_ENTRY;
+
+typedef struct _CONN_REF_SCOPE
+{
+    UINT Depth;
+    UINT EntryCnt;
+    CONN_REF_ENTRY EntryList[CONN_REF_SCOPE_MAX];
+} CONN_REF_SCOPE, * PCONN_REF_SCOPE;
+
+static __declspec(thread) CONN_REF_SCOPE ThreadRefScope;
+
+static PCONN_REF_ENTRY FindConnRefEntry(_In_ PCONNECTION_INFO pConnInfo)
+{
+    for (UINT i = 0; i < ThreadRefScope.EntryCnt; i++)
+    {
+        if (ThreadRefScope.EntryList[i].pConnInfo == pConnInfo)
+            return &ThreadRefScope.EntryList[i];
+    }
+    return NULL;
+}
+
+static VOID LinkConnInfo(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    AcquireSRWLockExclusive(&ConnListLock);
+    pConnInfo->pPrevConn = NULL;
+    pConnInfo->pNextConn = pConnListHead;
+    if (pConnListHead)
+        pConnListHead->pPrevConn = pConnInfo;
+    pConnListHead = pConnInfo;
+    ReleaseSRWLockExclusive(&ConnListLock);
+}
+
+static VOID UnlinkConnInfo(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    AcquireSRWLockExclusive(&ConnListLock);
+    if (pConnInfo->pPrevConn)
+        pConnInfo->pPrevConn->pNextConn = pConnInfo->pNextConn;
+    else
+        pConnListHead = pConnInfo->pNextConn;
+    if (pConnInfo->pNextConn)
+        pConnInfo->pNextConn->pPrevConn = pConnInfo->pPrevConn;
+    ReleaseSRWLockExclusive(&ConnListLock);
+}
+
+static VOID FreeConnInfo(_In_ _Frees_ptr_ PCONNECTION_INFO pConnInfo)
+{
+    // before the handle goes, KickConnection may be using it under the shared lock.
+    UnlinkConnInfo(pConnInfo);
+    WebsockEventDisconnect(pConnInfo);
+    WebSocketDeleteHandle(pConnInfo->hWebSock);
+    FreeConnCompression(pConnInfo);
+    SlabFree(&ConnPool, pConnInfo);
+}
+
+VOID BeginConnRefScope(VOID)
+{
+    ThreadRefScope.Depth++;
+}
+
+VOID EndConnRefScope(VOID)
+{
+    if (--ThreadRefScope.Depth)
+        return;
+
+    // releases done while publishing (e.g. LeaveRoom of a freed connection) are not deferred, Depth is 0
+    while (ThreadRefScope.EntryCnt)
+    {
+        CONN_REF_ENTRY Entry = ThreadRefScope.EntryList[--ThreadRefScope.EntryCnt];
+        if (Entry.ReleaseCnt && InterlockedAdd64(&Entry.pConnInfo->RefCnt, -Entry.ReleaseCnt) == 0)
+            FreeConnInfo(Entry.pConnInfo);
+    }
+}
+
+VOID ConnInfoAddRef(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    if (ThreadRefScope.Depth)
+    {
+        PCONN_REF_ENTRY pEntry = FindConnRefEntry(pConnInfo);
+        if (pEntry && pEntry->ReleaseCnt)
+        {
+            pEntry->ReleaseCnt--;
+            return;
+        }
+    }
+    InterlockedIncrement64(&pConnInfo->RefCnt);
+}
+
+VOID ConnInfoRelease(_Pre_valid_ _Post_maybenull_ PCONNECTION_INFO pConnInfo)
+{
+    if (ThreadRefScope.Depth)
+    {
+        PCONN_REF_ENTRY pEntry = FindConnRefEntry(pConnInfo);
+        if (!pEntry && ThreadRefScope.EntryCnt < CONN_REF_SCOPE_MAX)
+        {
+            pEntry = &ThreadRefScope.EntryList[ThreadRefScope.EntryCnt++];
+            pEntry->pConnInfo = pConnInfo;
+            pEntry->ReleaseCnt = 0;
+        }
+        if (pEntry)
+        {
+            pEntry->ReleaseCnt++;
+            return;
+        }
+    }
+
+    LONG64 NewCnt = InterlockedDecrement64(&pConnInfo->RefCnt);
+    if (NewCnt == 0)
+    {
+        FreeConnInfo(pConnInfo);
+        pConnInfo = NULL;
+    }
+}
+
+VOID ConnInfoCleanup(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    if (pConnInfo->pRoom)
+        LeaveRoom(pConnInfo);
+}
+
+static VOID LinkRecvRequest(_Inout_ PHTTP_RECV_REQUEST_IODATA pData)
+{
+    AcquireSRWLockExclusive(&RecvListLock);
+    pData->pPrev = NULL;
+    pData->pNext = pRecvListHead;
+    if (pRecvListHead)
+        pRecvListHead->pPrev = pData;
+    pRecvListHead = pData;
+    pData->bCancelled = FALSE;
+    InterlockedIncrement(&RecvPostedCnt);
+    ReleaseSRWLockExclusive(&RecvListLock);
+}
+
+// Receives left posted, -1 if this one was cancelled (and isn't counted any more).
+static LONG UnlinkRecvRequest(_Inout_ PHTTP_RECV_REQUEST_IODATA pData)
+{
+    LONG Remaining = -1;
+
+    AcquireSRWLockExclusive(&RecvListLock);
+    if (pData->pPrev)
+        pData->pPrev->pNext = pData->pNext;
+    else
+        pRecvListHead = pData->pNext;
+    if (pData->pNext)
+        pData->pNext->pPrev = pData->pPrev;
+    if (!pData->bCancelled)
+        Remaining = InterlockedDecrement(&RecvPostedCnt);
+    ReleaseSRWLockExclusive(&RecvListLock);
+    return Remaining;
+}
+
+static BOOL AsyncRecvHttpRequest(VOID)
+{
+    PHTTP_IOPACK pHttpIoPack = NULL;
+    PHTTP_RECV_REQUEST_IODATA pData = NULL;
+    BOOL bSuccess = FALSE;
+    ULONG cbRequest = sizeof(HTTP_REQUEST) + HttpServerConfig.RequestBufferSize; // read once, can change meanwhile
+
+    StartThreadpoolIo(pHTTPRequestIO);
+    __try
+    {
+        pHttpIoPack = AllocHttpIOPack(RecvRequestCallback, offsetof(HTTP_RECV_REQUEST_IODATA, HttpRequest) + cbRequest);
+        if (!pHttpIoPack)
+            __leave;
+
+        // linked first, the completion may run before HttpReceiveHttpRequest returns.
+        pData = (PHTTP_RECV_REQUEST_IODATA)(pHttpIoPack + 1);
+        LinkRecvRequest(pData);
+
+        ULONG ret = HttpReceiveHttpRequest(hReqHandle, HTTP_NULL_ID, 0, &pData->HttpRequest, cbRequest, NULL, (LPOVERLAPPED)pHttpIoPack);
+        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
+        {
+            LogErrorMessage(L"HttpReceiveHttpRequest", ret);
+            __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pData) UnlinkRecvRequest(pData);
+            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
+            CancelThreadpoolIo(pHTTPRequestIO);
+        }
+    }
+    return bSuccess;
+}
+
+// Post receives up to the depth. Threads refilling at once may overshoot by a few,
+// the next adjustment cancels them.
+static VOID RefillHttpReceives(VOID)
+{
+    while (bServerRunning && RecvPostedCnt < RecvDepth)
+    {
+        if (!AsyncRecvHttpRequest())
+            break;
+    }
+}
+
+static VOID CancelExcessReceives(VOID)
+{
+    AcquireSRWLockExclusive(&RecvListLock);
+    for (PHTTP_RECV_REQUEST_IODATA pData = pRecvListHead; pData && RecvPostedCnt > RecvDepth; pData = pData->pNext)
+    {
+        if (pData->bCancelled)
+            continue;
+
+        pData->bCancelled = TRUE;
+        InterlockedDecrement(&RecvPostedCnt);
+        // one that completed meanwhile is served as usual, CancelIoEx just finds nothing.
+        CancelIoEx(hReqHandle, &((PHTTP_IOPACK)pData - 1)->Overlapped);
+    }
+    ReleaseSRWLockExclusive(&RecvListLock);
+}
+
+// A request took the last posted receive.
+static VOID GrowRecvDepth(VOID)
+{
+    LONG Depth = RecvDepth;
+    LONG DepthMax = (LONG)max(HttpServerConfig.ReceiveDepthMin, HttpServerConfig.ReceiveDepthMax);
+
+    // losing the race means another completion grew it already.
+    if (Depth < DepthMax)
+        InterlockedCompareExchange(&RecvDepth, min(Depth * 2, DepthMax), Depth);
+}
+
+static VOID CALLBACK RecvDepthTimerCallback(
+    _Inout_ PTP_CALLBACK_INSTANCE Instance,
+    _Inout_opt_ PVOID Context,
+    _Inout_ PTP_TIMER Timer)
+{
+    LONG Arrivals = InterlockedExchange(&RecvArrivalCnt, 0);
+    LONG Exhausted = InterlockedExchange(&RecvExhaustCnt, 0);
+    LONG64 AwayTicks = InterlockedExchange64(&RecvAwayTicks, 0);
+    LONG LowWater = InterlockedExchange(&RecvLowWater, RecvPostedCnt);
+    LONG Depth = RecvDepth;
+    LONG DepthMin = (LONG)HttpServerConfig.ReceiveDepthMin;
+    LONG DepthMax = (LONG)max(HttpServerConfig.ReceiveDepthMin, HttpServerConfig.ReceiveDepthMax);
+
+    // Little's law: receives away at once = arrival rate x time away, summed in AwayTicks. twice that for bursts.
+    LONG64 IntervalTicks = max(1, RecvTickFrequency.QuadPart * RECV_DEPTH_INTERVAL / 1000);
+    LONG Needed = (LONG)min(DepthMax, 2 * ((AwayTicks + IntervalTicks - 1) / IntervalTicks));
+
+    LONG NewDepth = Depth;
+    if (!Exhausted && LowWater > 0)
+        NewDepth = Depth - (LowWater + 1) / 2; // spare for the whole interval
+    NewDepth = max(NewDepth, Needed);
+    NewDepth = max(DepthMin, min(NewDepth, DepthMax)); // the bounds may have been reloaded
+
+    if (Exhausted && Depth >= DepthMax)
+        Log(LOG_WARNING, L"%1!d! of %2!d! requests waited in the http.sys queue, receive_depth_max %3!d! is reached.", Exhausted, Arrivals, DepthMax);
+
+    if (NewDepth != Depth)
+    {
+        InterlockedCompareExchange(&RecvDepth, NewDepth, Depth); // a completion growing it meanwhile wins
+        Log(LOG_DEBUG, L"HTTP receive depth %1!d! -> %2!d!, %3!d! requests, %4!d! spare.", Depth, NewDepth, Arrivals, LowWater);
+    }
+
+    if (RecvPostedCnt < RecvDepth)
+        RefillHttpReceives(); // bounds raised
+    else
+        CancelExcessReceives();
+}
+
+static BOOL AsyncSendHttpResponse(
+    _In_ HTTP_REQUEST_ID RequestID,
+    _In_ USHORT StatusCode,
+    _In_ PCSTR pGlobalReason,
+    _In_ USHORT ReasonLen,
+    _In_opt_ PVOID pGlobalBodyBuffer,
+    _In_ ULONG BufferLen)
+{
+    PHTTP_IOPACK pHttpIoPack = NULL;
+    BOOL bSuccess = FALSE;
+
+    StartThreadpoolIo(pHTTPRequestIO);
+    __try
+    {
+        pHttpIoPack = AllocHttpIOPack(SendResponseCallback, sizeof(HTTP_RESPONSE_IODATA));
+        if (!pHttpIoPack)__leave;
+
+        PHTTP_RESPONSE_IODATA pData = (PHTTP_RESPONSE_IODATA)(pHttpIoPack + 1);
+
+        pData->HttpResponse.StatusCode = StatusCode;
+        pData->HttpResponse.pReason = pGlobalReason;
+        pData->HttpResponse.ReasonLength = ReasonLen;
+
+        if (pGlobalBodyBuffer)
+        {
+            pData->HttpDataChunk.DataChunkType = HttpDataChunkFromMemory;
+            pData->HttpDataChunk.FromMemory.pBuffer = pGlobalBodyBuffer;
+            pData->HttpDataChunk.FromMemory.BufferLength = BufferLen;
+            pData->HttpResponse.EntityChunkCount = 1;
+            pData->HttpResponse.pEntityChunks = &pData->HttpDataChunk;
+        }
+
+        ULONG ret = HttpSendHttpResponse(hReqHandle, RequestID, 0, &pData->HttpResponse, NULL, NULL, NULL, 0, (LPOVERLAPPED)pHttpIoPack, NULL);
+        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
+        {
+            LogErrorMessage(L"HttpSendHttpResponse", ret);
+            __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
+            CancelThreadpoolIo(pHTTPRequestIO);
+        }
+    }
+    return bSuccess;
+}
+
+// Prometheus text of FormatMetrics.
+static BOOL AsyncSendMetrics(_In_ HTTP_REQUEST_ID RequestID)
+{
+    PHTTP_IOPACK pHttpIoPack = NULL;
+    PCHAR pBody = NULL;
+    BOOL bSuccess = FALSE;
+
+    StartThreadpoolIo(pHTTPRequestIO);
+    __try
+    {
+        ULONG cbBody;
+        pBody = FormatMetrics(&cbBody);
+        if (!pBody)
+            __leave;
+
+        pHttpIoPack = AllocHttpIOPack(SendResponseCallback, sizeof(HTTP_RESPONSE_IODATA));
+        if (!pHttpIoPack)
+            __leave;
+
+        PHTTP_RESPONSE_IODATA pData = (PHTTP_RESPONSE_IODATA)(pHttpIoPack + 1);
+
+        pData->HttpResponse.StatusCode = g_usOKCode;
+        pData->HttpResponse.pReason = g_szOKReason;
+        pData->HttpResponse.ReasonLength = (USHORT)strlen(g_szOKReason);
+        pData->HttpResponse.Headers.KnownHeaders[HttpHeaderContentType].pRawValue = g_szMetricsContentType;
+        pData->HttpResponse.Headers.KnownHeaders[HttpHeaderContentType].RawValueLength = (USHORT)strlen(g_szMetricsContentType);
+
+        pData->pHeapBody = pBody;
+        pData->HttpDataChunk.DataChunkType = HttpDataChunkFromMemory;
+        pData->HttpDataChunk.FromMemory.pBuffer = pBody;
+        pData->HttpDataChunk.FromMemory.BufferLength = cbBody;
+        pData->HttpResponse.EntityChunkCount = 1;
+        pData->HttpResponse.pEntityChunks = &pData->HttpDataChunk;
+
+        ULONG ret = HttpSendHttpResponse(hReqHandle, RequestID, 0, &pData->HttpResponse, NULL, NULL, NULL, 0, (LPOVERLAPPED)pHttpIoPack, NULL);
+        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
+        {
+            LogErrorMessage(L"HttpSendHttpResponse", ret);
+            __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
+            if (pBody) HeapFree(GetProcessHeap(), 0, pBody);
+            CancelThreadpoolIo(pHTTPRequestIO);
+        }
+    }
+    return bSuccess;
+}
+
+// Is the request for /metrics? Matched by the URL it came in on, so it works under any listen_url prefix.
+static BOOL IsMetricsRequest(_In_ PHTTP_REQUEST pHttpRequest)
+{
+    return pHttpRequest->Verb == HttpVerbGET && pHttpRequest->UrlContext == URL_CONTEXT_METRICS;
+}
+
+// Is Token one of the comma separated values in a Sec-WebSocket-Protocol header?
+static BOOL HasSubprotocol(_In_reads_(cbValue) PCSTR pValue, _In_ USHORT cbValue, _In_z_ PCSTR Token)
+{
+    SIZE_T cbToken = strlen(Token);
+    USHORT i = 0;
+    while (i < cbValue)
+    {
+        while (i < cbValue && (pValue[i] == ' ' || pValue[i] == '\t' || pValue[i] == ','))
+            i++;
+        USHORT Start = i;
+        while (i < cbValue && pValue[i] != ',' && pValue[i] != ' ' && pValue[i] != '\t')
+            i++;
+        if (i - Start == cbToken && memcmp(pValue + Start, Token, cbToken) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Subprotocols we accept, in order of preference.
+static const struct
+{
+    PCSTR Name;
+    UINT Protocol;
+    BOOL bCompress;
+} SubprotocolList[] =
+{
+    { SUBPROTOCOL_BINARY_DEFLATE, WIRE_PROTOCOL_BINARY, TRUE },
+    { SUBPROTOCOL_BINARY,         WIRE_PROTOCOL_BINARY, FALSE },
+    { SUBPROTOCOL_JSON_DEFLATE,   WIRE_PROTOCOL_JSON,   TRUE },
+    { SUBPROTOCOL_JSON,           WIRE_PROTOCOL_JSON,   FALSE },
+};
+
+// Choose the subprotocol to answer with. Returns NULL if the client didn't offer one of ours.
+static PCSTR SelectSubprotocol(_In_ PHTTP_REQUEST pHttpRequest, _Out_ UINT* pProtocol, _Out_ BOOL* pbCompress)
+{
+    static CHAR szSecWebsocketProtocol[] = "Sec-WebSocket-Protocol";
+
+    *pProtocol = WIRE_PROTOCOL_JSON;
+    *pbCompress = FALSE;
+    for (UINT i = 0; i < _countof(SubprotocolList); i++)
+    {
+        for (USHORT j = 0; j < pHttpRequest->Headers.UnknownHeaderCount; j++) // the header may be repeated
+        {
+            PHTTP_UNKNOWN_HEADER pHeader = &pHttpRequest->Headers.pUnknownHeaders[j];
+            if (pHeader->NameLength != _countof(szSecWebsocketProtocol) - 1 ||
+                _strnicmp(pHeader->pName, szSecWebsocketProtocol, _countof(szSecWebsocketProtocol) - 1) != 0)
+                continue;
+
+            if (HasSubprotocol(pHeader->pRawValue, pHeader->RawValueLength, SubprotocolList[i].Name))
+            {
+                *pProtocol = SubprotocolList[i].Protocol;
+                *pbCompress = SubprotocolList[i].bCompress;
+                return SubprotocolList[i].Name;
+            }
+        }
+    }
+    return NULL;
+}
+
+static BOOL AsyncSendUpgradeToWebsocket(_In_ PHTTP_REQUEST pHttpRequest)
+{
+    PWEB_SOCKET_HTTP_HEADER pWebSockReqHeaders = NULL;
+    WEB_SOCKET_HANDLE serverHandle = NULL;
+
+    ULONG serverAdditionalHeaderCount = 0;
+    WEB_SOCKET_HTTP_HEADER* serverAdditionalHeaders = NULL;
+    HRESULT hr = S_OK;
+    PHTTP_IOPACK pHttpIoPack = NULL;
+    PHTTP_UNKNOWN_HEADER pUnknownHeaders = NULL;
+    UINT Protocol;
+    BOOL bCompress;
+    PCSTR pSubprotocol = SelectSubprotocol(pHttpRequest, &Protocol, &bCompress);
+
+    BOOL bSuccess = FALSE;
+
+    // for this connection's lifetime, read once.
+    ULONG cbRecvBuffer = HttpServerConfig.WebsockRecvBufferSize;
+    ULONG cbSendBuffer = HttpServerConfig.WebsockSendBufferSize;
+    WEB_SOCKET_PROPERTY PropertyList[] = {
+        { WEB_SOCKET_RECEIVE_BUFFER_SIZE_PROPERTY_TYPE, &cbRecvBuffer, sizeof(cbRecvBuffer) },
+        { WEB_SOCKET_SEND_BUFFER_SIZE_PROPERTY_TYPE,    &cbSendBuffer, sizeof(cbSendBuffer) },
+    };
+
+    StartThreadpoolIo(pHTTPRequestIO);
+    __try
+    {
+        hr = WebSocketCreateServerHandle(PropertyList, _countof(PropertyList), &serverHandle);
+        if (FAILED(hr))
+            __leave;
+
+        // Copy headers received to pass to WebSocketBeginServerHandshake.
+        // the following header will be copied:
+        // Connection Upgrade Host
+        // and all headers in unknown headers.
+        pWebSockReqHeaders = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (3 + (SIZE_T)pHttpRequest->Headers.UnknownHeaderCount) * sizeof(WEB_SOCKET_HTTP_HEADER));
+        if (!pWebSockReqHeaders) __leave;
+
+        static CHAR szConnection[] = "Connection";
+        static CHAR szUpgrade[] = "Upgrade";
+        static CHAR szHost[] = "Host";
+        pWebSockReqHeaders[0].pcName = szConnection;
+        pWebSockReqHeaders[0].ulNameLength = _countof(szConnection) - 1;
+        pWebSockReqHeaders[0].pcValue = (PCHAR)pHttpRequest->Headers.KnownHeaders[HttpHeaderConnection].pRawValue;
+        pWebSockReqHeaders[0].ulValueLength = pHttpRequest->Headers.KnownHeaders[HttpHeaderConnection].RawValueLength;
+
+        pWebSockReqHeaders[1].pcName = szUpgrade;
+        pWebSockReqHeaders[1].ulNameLength = _countof(szUpgrade) - 1;
+        pWebSockReqHeaders[1].pcValue = (PCHAR)pHttpRequest->Headers.KnownHeaders[HttpHeaderUpgrade].pRawValue;
+        pWebSockReqHeaders[1].ulValueLength = pHttpRequest->Headers.KnownHeaders[HttpHeaderUpgrade].RawValueLength;
+
+        pWebSockReqHeaders[2].pcName = szHost;
+        pWebSockReqHeaders[2].ulNameLength = _countof(szHost) - 1;
+        pWebSockReqHeaders[2].pcValue = (PCHAR)pHttpRequest->Headers.KnownHeaders[HttpHeaderHost].pRawValue;
+        pWebSockReqHeaders[2].ulValueLength = pHttpRequest->Headers.KnownHeaders[HttpHeaderHost].RawValueLength;
+
+        for (USHORT i = 0; i < pHttpRequest->Headers.UnknownHeaderCount; i++)
+        {
+            pWebSockReqHeaders[i + 3].pcName = (PCHAR)pHttpRequest->Headers.pUnknownHeaders[i].pName;
+            pWebSockReqHeaders[i + 3].ulNameLength = pHttpRequest->Headers.pUnknownHeaders[i].NameLength;
+            pWebSockReqHeaders[i + 3].pcValue = (PCHAR)pHttpRequest->Headers.pUnknownHeaders[i].pRawValue;
+            pWebSockReqHeaders[i + 3].ulValueLength = pHttpRequest->Headers.pUnknownHeaders[i].RawValueLength;
+        }
+
+        hr = WebSocketBeginServerHandshake(
+            serverHandle,
+            pSubprotocol,
+            NULL,
+            0,
+            pWebSockReqHeaders,
+            3 + pHttpRequest->Headers.UnknownHeaderCount,
+            &serverAdditionalHeaders,
+            &serverAdditionalHeaderCount);
+
+        if (FAILED(hr))
+            __leave;
+
+        pHttpIoPack = AllocHttpIOPack(SendUpgradeWebsockCallback, sizeof(HTTP_UPGRADE_WS_IODATA));
+        if (!pHttpIoPack)
+            __leave;
+
+        PHTTP_UPGRADE_WS_IODATA pData = (PHTTP_UPGRADE_WS_IODATA)(pHttpIoPack + 1);
+
+        pData->HttpResponse.StatusCode = g_usSwitchingProtocolsCode;
+        pData->HttpResponse.pReason = g_szSwitchingProtocolsReason;
+        pData->HttpResponse.ReasonLength = _countof(g_szSwitchingProtocolsReason) - 1;
+
+        pUnknownHeaders = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, serverAdditionalHeaderCount * sizeof(HTTP_UNKNOWN_HEADER));
+        if (!pUnknownHeaders)
+            __leave;
+
+        // TODO: the code below is a little bit hacky
+        // I have no idea but HttpSendHttpResponse eats my "Connection" header
+        // so I have to add it into unknown headers.
+        // and if I don't specify "Upgrade" header in known headers, HttpSendHttpResponse will return 87 ERROR_INVALID_PARAMETER
+        INT AddedUnknownHeadersCnt = 0;
+        for (ULONG i = 0; i < serverAdditionalHeaderCount; i++)
+        {
+            static char szUpgrade[] = "Upgrade";
+            if (_strnicmp(serverAdditionalHeaders[i].pcName, szUpgrade, _countof(szUpgrade) - 1) == 0) // Don't add "Upgrade" header twice. we will add it known headers later.
+                continue;
+
+            pUnknownHeaders[AddedUnknownHeadersCnt].NameLength = (USHORT)serverAdditionalHeaders[i].ulNameLength;
+            pUnknownHeaders[AddedUnknownHeadersCnt].pName = serverAdditionalHeaders[i].pcName;
+            pUnknownHeaders[AddedUnknownHeadersCnt].RawValueLength = (USHORT)serverAdditionalHeaders[i].ulValueLength;
+            pUnknownHeaders[AddedUnknownHeadersCnt].pRawValue = serverAdditionalHeaders[i].pcValue;
+            AddedUnknownHeadersCnt++;
+        }
+        pData->HttpResponse.Headers.pUnknownHeaders = pUnknownHeaders;
+        pData->HttpResponse.Headers.UnknownHeaderCount = AddedUnknownHeadersCnt;
+
+        static char szWebSocket[] = "WebSocket";
+        pData->HttpResponse.Headers.KnownHeaders[HttpHeaderUpgrade].pRawValue = szWebSocket;
+        pData->HttpResponse.Headers.KnownHeaders[HttpHeaderUpgrade].RawValueLength = _countof(szWebSocket) - 1;
+
+        pData->RequestID = pHttpRequest->RequestId;
+        pData->hWebSock = serverHandle;
+        pData->Protocol = Protocol;
+        pData->bCompress = bCompress;
+
+        ULONG ret = HttpSendHttpResponse(
+            hReqHandle,
+            pHttpRequest->RequestId,
+            HTTP_SEND_RESPONSE_FLAG_OPAQUE | HTTP_SEND_RESPONSE_FLAG_MORE_DATA,
+            &pData->HttpResponse,
+            NULL,
+            NULL,
+            NULL,
+            0,
+            (LPOVERLAPPED)pHttpIoPack,
+            NULL);
+        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
+        {
+            LogErrorMessage(L"HttpSendHttpResponse", ret);
+            __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (pWebSockReqHeaders) HeapFree(GetProcessHeap(), 0, pWebSockReqHeaders);
+
+        if (!bSuccess)
+        {
+            if (serverAdditionalHeaders)
+            {
+                WebSocketEndServerHandshake(serverHandle);
+            }
+            if (serverHandle)
+            {
+                WebSocketDeleteHandle(serverHandle);
+            }
+            if (pHttpIoPack)
+            {
+                FreeHttpIOPack(pHttpIoPack);
+            }
+            if (pUnknownHeaders)
+            {
+                HeapFree(GetProcessHeap(), 0, pUnknownHeaders);
+            }
+            CancelThreadpoolIo(pHTTPRequestIO);
+        }
+    }
+    return bSuccess;
+}
+
+static BOOL AsyncRecvWebsockData(
+    _In_ PCONNECTION_INFO pConnInfo,
+    _In_ PVOID Buffer,
+    _In_ ULONG BufferLen,
+    _In_ PVOID pWebsockContext)
+{
+    PHTTP_IOPACK pHttpIoPack = NULL;
+    BOOL bSuccess = FALSE;
+
+    StartThreadpoolIo(pHTTPRequestIO);
+    __try
+    {
+        pHttpIoPack = AllocHttpIOPack(RecvWebsockDataCallback, sizeof(HTTP_RECV_WEBSOCK_IODATA));
+        if (!pHttpIoPack)
+            __leave;
+
+        PHTTP_RECV_WEBSOCK_IODATA pData = (PHTTP_RECV_WEBSOCK_IODATA)(pHttpIoPack + 1);
+        pData->pConnInfo = pConnInfo;
+        pData->pWebsockContext = pWebsockContext;
+
+        ULONG ret = HttpReceiveRequestEntityBody(hReqHandle, pConnInfo->RequestID, 0, Buffer, BufferLen, NULL, (LPOVERLAPPED)pHttpIoPack);
+        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
+        {
+            if (ret != ERROR_HANDLE_EOF) // handle in the same way, but supress the error message.
+            {
+                LogErrorMessage(L"HttpReceiveRequestEntityBody", ret);
+            }
+            __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
+            CancelThreadpoolIo(pHTTPRequestIO);
+        }
+    }
+    return bSuccess;
+}
+
+static BOOL AsyncSendWebsockData(
+    _In_ PCONNECTION_INFO pConnInfo,
+    _In_ PVOID Buffer,
+    _In_ ULONG BufferLen,
+    _In_ PVOID pWebsockContext)
+{
+    PHTTP_IOPACK pHttpIoPack = NULL;
+    BOOL bSuccess = FALSE;
+
+    StartThreadpoolIo(pHTTPRequestIO);
+    __try
+    {
+        pHttpIoPack = AllocHttpIOPack(SendWebsockDataCallback, sizeof(HTTP_SEND_WEBSOCK_IODATA));
+        if (!pHttpIoPack)
+            __leave;
+
+        PHTTP_SEND_WEBSOCK_IODATA pData = (PHTTP_SEND_WEBSOCK_IODATA)(pHttpIoPack + 1);
+        pData->pConnInfo = pConnInfo;
+        pData->pWebsockContext = pWebsockContext;
+        pData->DataChunk.DataChunkType = HttpDataChunkFromMemory;
+        pData->DataChunk.FromMemory.pBuffer = Buffer;
+        pData->DataChunk.FromMemory.BufferLength = BufferLen;
+
+        ULONG ret = HttpSendResponseEntityBody(hReqHandle, pConnInfo->RequestID, HTTP_SEND_RESPONSE_FLAG_MORE_DATA, 1, &(pData->DataChunk), NULL, NULL, 0, (LPOVERLAPPED)pHttpIoPack, NULL);
+        if (ret != NO_ERROR && ret != ERROR_IO_PENDING)
+        {
+            LogErrorMessage(L"HttpSendResponseEntityBody", ret);
+            __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pHttpIoPack) FreeHttpIOPack(pHttpIoPack);
+            CancelThreadpoolIo(pHTTPRequestIO);
+        }
+    }
+    return bSuccess;
+}
+
+static VOID RunWebsockAction(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    WEB_SOCKET_HANDLE hWebSock = pConnInfo->hWebSock;
+    HTTP_REQUEST_ID RequestID = pConnInfo->RequestID;
+
+    WEB_SOCKET_BUFFER Buffer = { 0 };
+    ULONG BufferCnt;
+    WEB_SOCKET_ACTION Action;
+    WEB_SOCKET_BUFFER_TYPE BufferType;
+    PVOID pWebsockContext;
+    PWEBSOCK_SEND_BUF pWebsockSendBuf; // We use this to store buffer when sending... not used when recving
+    TRACE_SPAN Span;
+
+    do
+    {
+        BufferCnt = 1;
+        TraceBegin(&Span, pConnInfo);
+        HRESULT hr = WebSocketGetAction(hWebSock, WEB_SOCKET_ALL_ACTION_QUEUE, &Buffer, &BufferCnt, &Action, &BufferType, &pWebsockSendBuf, &pWebsockContext);
+        TraceEnd(&Span, TRACE_CAT_WEBSOCKET, "WebSocketGetAction");
+        if (FAILED(hr))
+            WebSocketAbortHandle(hWebSock);
+
+        switch (Action)
+        {
+        case WEB_SOCKET_NO_ACTION:
+            break;
+
+        case WEB_SOCKET_RECEIVE_FROM_NETWORK_ACTION:
+            if (AsyncRecvWebsockData(pConnInfo, Buffer.Data.pbBuffer, Buffer.Data.ulBufferLength, pWebsockContext))
+                return; // the rest is handled when completion
+            ConnInfoCleanup(pConnInfo);
+            WebSocketAbortHandle(hWebSock);
+            break;
+
+        case WEB_SOCKET_SEND_TO_NETWORK_ACTION:
+            if (AsyncSendWebsockData(pConnInfo, Buffer.Data.pbBuffer, Buffer.Data.ulBufferLength, pWebsockContext))
+                return; // the rest is handled when completion
+
+            WebSocketAbortHandle(hWebSock);
+            break;
+
+        case WEB_SOCKET_INDICATE_SEND_COMPLETE_ACTION:
+            CountMetric(METRIC_FRAMES_SENT);
+            PROBE_SEND_COMPLETE(pConnInfo, pWebsockSendBuf);
+            TraceBegin(&Span, pConnInfo);
+            pWebsockSendBuf->Callback(pConnInfo, pWebsockSendBuf);
+            TraceEnd(&Span, TRACE_CAT_SEND, "sendComplete");
+            break;
+
+        case WEB_SOCKET_INDICATE_RECEIVE_COMPLETE_ACTION:
+            if (BufferCnt == 1)
+            {
+                WebsockEventRecv(pConnInfo, BufferType, &Buffer);
+                hr = WebSocketReceive(hWebSock, NULL, NULL);
+                if (FAILED(hr))
+                {
+                    WebSocketAbortHandle(hWebSock);
+                    break;
+                }
+            }
+            break;
+        }
+        WebSocketCompleteAction(hWebSock, pWebsockContext, 0);
+    } while (Action != WEB_SOCKET_NO_ACTION);
+
+    ConnInfoRelease(pConnInfo);
+}
+
+static VOID RecvRequestCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io)
+{
+    PHTTP_RECV_REQUEST_IODATA pData = (PHTTP_RECV_REQUEST_IODATA)(pHttpIoPack + 1);
+    LONG Remaining = UnlinkRecvRequest(pData);
+
+    // aborted: cancelled over the depth, or the server is stopping.
+    if (bServerRunning && IoResult != ERROR_OPERATION_ABORTED)
+    {
+        LARGE_INTEGER StartTick, EndTick;
+        QueryPerformanceCounter(&StartTick);
+
+        InterlockedIncrement(&RecvArrivalCnt);
+        if (Remaining == 0)
+        {
+            // the ones behind this request wait in the http.sys queue until a receive is posted.
+            CountMetric(METRIC_RECV_QUEUE_FULL);
+            InterlockedIncrement(&RecvExhaustCnt);
+            GrowRecvDepth();
+        }
+        if (Remaining >= 0 && Remaining < RecvLowWater)
+            RecvLowWater = Remaining; // racing another completion only leaves it a little high
+
+        PHTTP_REQUEST pHttpRequest = &pData->HttpRequest;
+        switch (IoResult)
+        {
+        case NO_ERROR:
+        {
+            if (IsMetricsRequest(pHttpRequest))
+            {
+                AsyncSendMetrics(pHttpRequest->RequestId);
+                break;
+            }
+
+            PROBE_CONN_ACCEPT(pHttpRequest->RequestId);
+            BOOL bSuccess = AsyncSendUpgradeToWebsocket(pHttpRequest);
+
+            if (!bSuccess)
+            {
+                AsyncSendHttpResponse(
+                    pHttpRequest->RequestId,
+                    g_usUpgradeRequiredCode,
+                    g_szUpgradeRequiredReason,
+                    (USHORT)strlen(g_szUpgradeRequiredReason),
+                    g_szUpgradeRequiredMessage,
+                    (USHORT)strlen(g_szUpgradeRequiredMessage));
+            }
+            break;
+        }
+        case ERROR_MORE_DATA:
+
+            AsyncSendHttpResponse(
+                pHttpRequest->RequestId,
+                g_usEntityTooLargeCode,
+                g_szEntityTooLargeReason,
+                (USHORT)strlen(g_szEntityTooLargeReason),
+                g_szEntityTooLargeMessage,
+                (USHORT)strlen(g_szEntityTooLargeMessage));
+
+            break;
+        }
+
+        RefillHttpReceives();
+        QueryPerformanceCounter(&EndTick);
+        InterlockedExchangeAdd64(&RecvAwayTicks, EndTick.QuadPart - StartTick.QuadPart);
+    }
+    FreeHttpIOPack(pHttpIoPack);
+}
+
+static VOID SendResponseCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io)
+{
+    PHTTP_RESPONSE_IODATA pData = (PHTTP_RESPONSE_IODATA)(pHttpIoPack + 1);
+    if (IoResult != NO_ERROR)
+    {
+        LogErrorMessage(L"SendResponseCallback", IoResult);
+    }
+    if (pData->pHeapBody)
+        HeapFree(GetProcessHeap(), 0, pData->pHeapBody);
+    FreeHttpIOPack(pHttpIoPack);
+}
+
+static VOID SendUpgradeWebsockCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io)
+{
+    PHTTP_UPGRADE_WS_IODATA pData = (PHTTP_UPGRADE_WS_IODATA)(pHttpIoPack + 1);
+    BOOL bSuccess = FALSE;
+    PCONNECTION_INFO pConnInfo = NULL;
+    HeapFree(GetProcessHeap(), 0, pData->HttpResponse.Headers.pUnknownHeaders);
+
+    __try
+    {
+        if (FAILED(WebSocketEndServerHandshake(pData->hWebSock)))
+            __leave;
+
+        if (!bServerRunning)
+            __leave;
+
+        if (IoResult != NO_ERROR)
+        {
+            LogErrorMessage(L"SendUpgradeWebsockCallback", IoResult);
+            __leave;
+        }
+
+        pConnInfo = (PCONNECTION_INFO)SlabAlloc(&ConnPool);
+        if (!pConnInfo)
+            __leave;
+
+        pConnInfo->hWebSock = pData->hWebSock;
+        pConnInfo->RequestID = pData->RequestID;
+        pConnInfo->ConnId = (UINT)InterlockedIncrement(&LastConnId);
+        pConnInfo->RefCnt = 1;
+        pConnInfo->Protocol = (BYTE)pData->Protocol;
+        pConnInfo->bCompress = (BOOLEAN)pData->bCompress;
+        PROBE_CONN_UPGRADED(pConnInfo);
+
+        WebsockEventConnect(pConnInfo);
+
+        if (FAILED(WebSocketReceive(pData->hWebSock, NULL, NULL)))
+            __leave;
+
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (bSuccess)
+        {
+            LinkConnInfo(pConnInfo);
+            RunWebsockAction(pConnInfo);
+        }
+        else
+        {
+            if (pConnInfo)
+            {
+                WebsockEventDisconnect(pConnInfo);
+                SlabFree(&ConnPool, pConnInfo);
+            }
+            WebSocketDeleteHandle(pData->hWebSock); // no operations should be queued, no need to abort.
+        }
+    }
+    FreeHttpIOPack(pHttpIoPack);
+}
+
+static VOID RecvWebsockDataCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io)
+{
+    PHTTP_RECV_WEBSOCK_IODATA pData = (PHTTP_RECV_WEBSOCK_IODATA)(pHttpIoPack + 1);
+    TRACE_SPAN Span;
+    TraceBegin(&Span, pData->pConnInfo);
+
+    WEB_SOCKET_HANDLE hWebSock = pData->pConnInfo->hWebSock;
+    HTTP_REQUEST_ID RequestID = pData->pConnInfo->RequestID;
+
+    WebSocketCompleteAction(hWebSock, pData->pWebsockContext, (ULONG)BytesTransferred);
+
+    if (IoResult != NO_ERROR)
+    {
+        if (IoResult != ERROR_HANDLE_EOF) // handle in the same way, but supress the error message.
+        {
+            LogErrorMessage(L"RecvWebsockDataCallback", IoResult);
+        }
+        WebSocketAbortHandle(hWebSock);
+        ConnInfoCleanup(pData->pConnInfo);
+    }
+
+    RunWebsockAction(pData->pConnInfo);
+
+    FreeHttpIOPack(pHttpIoPack);
+    TraceEnd(&Span, TRACE_CAT_IO, "recvCompletion");
+}
+
+static VOID SendWebsockDataCallback(
+    _In_ PHTTP_IOPACK pHttpIoPack,
+    _In_ ULONG IoResult,
+    _In_ ULONG_PTR BytesTransferred,
+    _Inout_ PTP_IO Io)
+{
+    PHTTP_SEND_WEBSOCK_IODATA pData = (PHTTP_SEND_WEBSOCK_IODATA)(pHttpIoPack + 1);
+    TRACE_SPAN Span;
+    TraceBegin(&Span, pData->pConnInfo);
+
+    WEB_SOCKET_HANDLE hWebSock = pData->pConnInfo->hWebSock;
+    HTTP_REQUEST_ID RequestID = pData->pConnInfo->RequestID;
+
+    WebSocketCompleteAction(hWebSock, pData->pWebsockContext, (ULONG)BytesTransferred);
+
+    if (IoResult != NO_ERROR)
+    {
+        LogErrorMessage(L"SendWebsockDataCallback", IoResult);
+        WebSocketAbortHandle(hWebSock);
+    }
+
+    RunWebsockAction(pData->pConnInfo);
+
+    FreeHttpIOPack(pHttpIoPack);
+    TraceEnd(&Span, TRACE_CAT_IO, "sendCompletion");
+}
+
+VOID WebsockQueueSend(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    HRESULT hr;
+    ULONG cbFrame = 0; // taken before sending, another thread may complete and free the frame right away
+    TRACE_SPAN Span;
+
+    ConnInfoAddRef(pConnInfo);
+    if (pConnInfo->bCompress)
+    {
+        // compress and queue atomically, or the client would inflate messages out of order.
+        AcquireSRWLockExclusive(&pConnInfo->SendLock);
+        TraceBegin(&Span, pConnInfo);
+        pWebsockSendBuf = CompressSendBuf(pConnInfo, pWebsockSendBuf);
+        TraceEnd(&Span, TRACE_CAT_SERIALIZE, "compress");
+        if (pWebsockSendBuf)
+        {
+            cbFrame = pWebsockSendBuf->WebsockBuf.Data.ulBufferLength;
+            TraceBegin(&Span, pConnInfo);
+            hr = WebSocketSend(pConnInfo->hWebSock, pWebsockSendBuf->BufferType, &(pWebsockSendBuf->WebsockBuf), pWebsockSendBuf);
+            TraceEnd(&Span, TRACE_CAT_WEBSOCKET, "WebSocketSend");
+        }
+        else
+        {
+            hr = E_OUTOFMEMORY;
+        }
+        ReleaseSRWLockExclusive(&pConnInfo->SendLock);
+    }
+    else
+    {
+        cbFrame = pWebsockSendBuf->WebsockBuf.Data.ulBufferLength;
+        TraceBegin(&Span, pConnInfo);
+        hr = WebSocketSend(pConnInfo->hWebSock, pWebsockSendBuf->BufferType, &(pWebsockSendBuf->WebsockBuf), pWebsockSendBuf);
+        TraceEnd(&Span, TRACE_CAT_WEBSOCKET, "WebSocketSend");
+    }
+    if (FAILED(hr))
+    {
+        WebSocketAbortHandle(pConnInfo->hWebSock);
+        return;
+    }
+    CountMetric(METRIC_FRAMES_QUEUED);
+    AddMetric(METRIC_BYTES_QUEUED, cbFrame);
+}
+
+// Flushes noted while the thread holds a room lock, see BeginFlushDefer.
+#define FLUSH_DEFER_CONN_MAX 16 // connections one hold notes flushes for, those of more go to a worker
+
+typedef struct _FLUSH_DEFER_ENTRY
+{
+    PCONNECTION_INFO pConnInfo;
+    UINT FlushCnt; // one per WebsockQueueSend, each holds the reference it took
+} FLUSH_DEFER_ENTRY;
+
+typedef struct _FLUSH_DEFER
+{
+    UINT Depth;
+    UINT EntryCnt;
+    FLUSH_DEFER_ENTRY EntryList[FLUSH_DEFER_CONN_MAX];
+} FLUSH_DEFER;
+
+static __declspec(thread) FLUSH_DEFER ThreadFlushDefer;
+
+static VOID CALLBACK DeferredFlushCallback(_Inout_ PTP_CALLBACK_INSTANCE Instance, _Inout_opt_ PVOID Context)
+{
+    RunWebsockAction(Context);
+}
+
+VOID BeginFlushDefer(VOID)
+{
+    ThreadFlushDefer.Depth++;
+}
+
+VOID EndFlushDefer(VOID)
+{
+    if (--ThreadFlushDefer.Depth)
+        return;
+
+    // running the actions may handle a received message, which can hold a room and defer again.
+    while (ThreadFlushDefer.EntryCnt)
+    {
+        FLUSH_DEFER_ENTRY Entry = ThreadFlushDefer.EntryList[--ThreadFlushDefer.EntryCnt];
+        while (Entry.FlushCnt--)
+            RunWebsockAction(Entry.pConnInfo);
+    }
+}
+
+VOID WebsockFlushSend(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    if (ThreadFlushDefer.Depth)
+    {
+        UINT i;
+        for (i = 0; i < ThreadFlushDefer.EntryCnt; i++)
+        {
+            if (ThreadFlushDefer.EntryList[i].pConnInfo == pConnInfo)
+                break;
+        }
+        if (i == ThreadFlushDefer.EntryCnt && i < FLUSH_DEFER_CONN_MAX)
+        {
+            ThreadFlushDefer.EntryList[i].pConnInfo = pConnInfo;
+            ThreadFlushDefer.EntryList[i].FlushCnt = 0;
+            ThreadFlushDefer.EntryCnt++;
+        }
+        if (i < ThreadFlushDefer.EntryCnt)
+        {
+            ThreadFlushDefer.EntryList[i].FlushCnt++;
+            return;
+        }
+
+        // no room to note it, a worker runs it without this thread's locks.
+        if (TrySubmitThreadpoolCallback(DeferredFlushCallback, pConnInfo, &WorkerEnviron))
+            return;
+
+        // the message is queued already, running the actions here could deadlock on the room.
+        Log(LOG_ERROR, L"Failed to defer a websocket flush. disconnecting...");
+        WebSocketAbortHandle(pConnInfo->hWebSock);
+        ConnInfoRelease(pConnInfo);
+        return;
+    }
+
+    // RunWebsockAction should be executed no matter whether WebSocketSend succeeded.
+    // because we increased RefCnt. 
+    RunWebsockAction(pConnInfo);
+}
+
+BOOL WebsockSendMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    CountMessageOut(pWebsockSendBuf->MessageType);
+    if (pConnInfo->bBatchEvents && HoldBatchedSend(pConnInfo, pWebsockSendBuf))
+        return TRUE; // goes out with the batch, see SendBatch.h
+
+    WebsockQueueSend(pConnInfo, pWebsockSendBuf);
+    WebsockFlushSend(pConnInfo);
+    return SUCCEEDED(S_OK);
+}
+
+BOOL WebsockDisconnect(_In_ PCONNECTION_INFO pConnInfo)
+{
+    WebSocketAbortHandle(pConnInfo->hWebSock);
+    ULONG ret = HttpCancelHttpRequest(hReqHandle, pConnInfo->RequestID, NULL);
+    if (ret != NO_ERROR)
+    {
+        LogErrorMessage(L"HttpCancelHttpRequest", ret);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL KickConnection(_In_ UINT ConnId)
+{
+    BOOL bFound = FALSE;
+
+    // a walk per kick, kicks are rare and by hand.
+    AcquireSRWLockShared(&ConnListLock);
+    for (PCONNECTION_INFO pConnInfo = pConnListHead; pConnInfo; pConnInfo = pConnInfo->pNextConn)
+    {
+        if (pConnInfo->ConnId == ConnId)
+        {
+            WebsockDisconnect(pConnInfo);
+            bFound = TRUE;
+            break;
+        }
+    }
+    ReleaseSRWLockShared(&ConnListLock);
+    return bFound;
+}
@@ -1,36 +1,146 @@
-#pragma once
-#include "common.h"
-#include <Websocket.h>
-#include <http.h>
-#include "RoomManager.h"
-
-typedef struct _CONNECTION_INFO
-{
-    WEB_SOCKET_HANDLE hWebSock;
-    HTTP_REQUEST_ID RequestID;
-    LONG64 volatile RefCnt;
-
-    // Game related information. all rest information below is valid only if pRoom is not NULL
-    // all rest index needs to acquire the room's lock in order to modify.
-    // (the one who hold's the room's lock also can modify other's index in the same room
-    PGAME_ROOM pRoom;
-    UINT WaitingIndex; // the index of pRoom->WaitingList field
-    UINT PlayingIndex; // the index of pRoom->PlayingList field
-} CONNECTION_INFO, * PCONNECTION_INFO;
-
-typedef struct _WEBSOCK_SENDBUF WEBSOCK_SEND_BUF, * PWEBSOCK_SEND_BUF;
-typedef VOID(*WEBSOCK_SEND_CALLBACK)(PCONNECTION_INFO pConnInfo, PWEBSOCK_SEND_BUF WebsockSendBuf);
-
-typedef struct _WEBSOCK_SENDBUF
-{
-    WEB_SOCKET_BUFFER WebsockBuf;
-    WEBSOCK_SEND_CALLBACK Callback;
-}WEBSOCK_SEND_BUF, *PWEBSOCK_SEND_BUF;
-
-BOOL StartHTTPServer(DWORD RequestCount);
-
-VOID StopHTTPServer(VOID);
-
-BOOL WebsockSendMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pWebsockSendBuf);
-
-BOOL WebsockDisconnect(_In_ PCONNECTION_INFO pConnInfo);
+#pragma once
+#include "common.h"
+#include <Websocket.h>
+#include <http.h>
+#include "RoomManager.h"
+#include "Deflate.h"
+#include "Config.h"
+
+// Wire protocols, negotiated with Sec-WebSocket-Protocol when upgrading.
+// JSON is used if the client offers neither.
+#define WIRE_PROTOCOL_JSON   0
+#define WIRE_PROTOCOL_BINARY 1
+
+#define SUBPROTOCOL_JSON   "avalon.json"
+#define SUBPROTOCOL_BINARY "avalon.bin.v1"
+
+// same as above, with compressed frames. see Compression.h
+#define SUBPROTOCOL_JSON_DEFLATE   "avalon.json.deflate"
+#define SUBPROTOCOL_BINARY_DEFLATE "avalon.bin.v1.deflate"
+
+typedef struct _WEBSOCK_SENDBUF WEBSOCK_SEND_BUF, * PWEBSOCK_SEND_BUF;
+typedef struct _WEBSOCK_ASSEMBLY WEBSOCK_ASSEMBLY, * PWEBSOCK_ASSEMBLY; // see WebsockEvent.c
+
+#define CONN_REF_SCOPE_MAX 16 // connections one ConnRefScope defers releases for, releases of more are atomic
+
+// Two cache lines, most connections sit idle in a lobby. Flags are whole bytes, not bit fields:
+// they are written by different threads.
+typedef struct DECLSPEC_CACHEALIGN _CONNECTION_INFO
+{
+    WEB_SOCKET_HANDLE hWebSock;
+    HTTP_REQUEST_ID RequestID;
+    struct _CONNECTION_INFO* pPrevConn; // list of upgraded connections, under ConnListLock
+    struct _CONNECTION_INFO* pNextConn;
+    PDEFLATE_STREAM pDeflate; // compressor state with history, NULL until the first compressed message. under SendLock
+    PWEBSOCK_ASSEMBLY pAssembly; // a message arriving in fragments, NULL between messages
+
+    // Game related information. all rest information below is valid only if pRoom is not NULL
+    // all rest index needs to acquire the room's lock in order to modify.
+    // (the one who hold's the room's lock also can modify other's index in the same room
+    PGAME_ROOM pRoom;
+
+    UINT ConnId; // numbers the connection in traces and the admin console
+    BYTE Protocol; // WIRE_PROTOCOL_*, fixed after upgrade
+    BOOLEAN bCompress; // negotiated a ".deflate" subprotocol, fixed after upgrade
+    BOOLEAN bBatchEvents; // asked for batched frames, see SendBatch.h
+    BOOLEAN bRoomStatusDelta; // receives roomStatusDelta instead of full roomStatus, see SyncRoomStatus
+
+    // on its own cache line: written by every sender, the fields above are mostly read
+    DECLSPEC_CACHEALIGN LONG64 volatile RefCnt;
+    SRWLOCK SendLock; // keeps compressor state in the same order as frames on the wire, compressed connections only
+    SRWLOCK BatchLock; // guards the held messages below
+    PWEBSOCK_SEND_BUF pBatchHead; // messages held for the batch, oldest first
+    PWEBSOCK_SEND_BUF pBatchTail;
+    UINT WaitingIndex; // the index of pRoom->WaitingList field, under the room's lock as pRoom
+    UINT PlayingIndex; // the index of pRoom->PlayingList field
+    BOOL bCompressNoContext; // over memory budget, compress without history
+} CONNECTION_INFO, * PCONNECTION_INFO;
+
+typedef VOID(*WEBSOCK_SEND_CALLBACK)(PCONNECTION_INFO pConnInfo, PWEBSOCK_SEND_BUF WebsockSendBuf);
+
+typedef struct _WEBSOCK_SENDBUF
+{
+    WEB_SOCKET_BUFFER WebsockBuf;
+    WEB_SOCKET_BUFFER_TYPE BufferType; // UTF8 or binary message
+    BYTE MessageType; // BIN_OUT_*, for statistics
+    WEBSOCK_SEND_CALLBACK Callback;
+    PWEBSOCK_SEND_BUF pNext; // while held for a batch
+}WEBSOCK_SEND_BUF, *PWEBSOCK_SEND_BUF;
+
+typedef struct _HTTP_SERVER_CONFIG
+{
+    WCHAR ListenUrl[CONFIG_STRING_MAXLEN]; // prefix of the URLs served, see ListenUrlList
+    UINT RequestsPerProcessor; // HTTP receives kept posted, per processor
+    UINT OutstandingRequests;  // same, when the processors can't be counted
+    UINT RequestBufferSize;    // bytes for headers and such after HTTP_REQUEST
+    UINT QueueLength;          // requests http.sys queues before answering 503
+    UINT WorkerThreadsMin;     // threads of the pool running I/O completions, 0 leaves the pool's default
+    UINT WorkerThreadsMax;
+    UINT ReceiveDepthMin;      // bounds of the receives kept posted, adapted to the arrivals
+    UINT ReceiveDepthMax;
+    UINT WebsockRecvBufferSize; // websocket.dll buffers of each connection, longer messages arrive in fragments
+    UINT WebsockSendBufferSize;
+} HTTP_SERVER_CONFIG, * PHTTP_SERVER_CONFIG;
+
+extern HTTP_SERVER_CONFIG HttpServerConfig;
+
+// The HTTP receives kept posted start at RequestCount and follow the arrivals within ReceiveDepthMin/Max:
+// doubled as soon as a request takes the last one (the next ones wait in the http.sys queue),
+// lowered every RECV_DEPTH_INTERVAL by half of what stayed unused, not below what the arrival rate
+// times the time a receive is away takes (Little's law). Receives over the depth are cancelled,
+// their buffers freed.
+#define RECV_DEPTH_INTERVAL 1000 // ms
+
+// bListen FALSE leaves the URLs to a later StartListening, for taking them over from another process.
+BOOL StartHTTPServer(DWORD RequestCount, BOOL bListen);
+
+BOOL StartListening(VOID);
+
+// Remove the URLs, so new requests go to whoever adds them next.
+// Requests already received carry on, websocket connections included.
+BOOL StopListening(VOID);
+
+VOID StopHTTPServer(VOID);
+
+// Apply what can change while running: worker threads and queue length. See Config.h.
+VOID ApplyHttpServerConfig(VOID);
+
+VOID PrintConnectionStats(VOID);
+
+// Receives the transport aims to keep posted.
+UINT GetHttpReceiveDepth(VOID);
+
+// Receives posted now, not completed.
+UINT GetHttpReceivesPosted(VOID);
+
+// Between these, ConnInfoRelease of this thread is deferred until the outermost EndConnRefScope,
+// so AddRef / Release pairs on the same connection (one per message sent) cost no interlocked operations.
+// Every I/O completion runs in a scope.
+VOID BeginConnRefScope(VOID);
+
+VOID EndConnRefScope(VOID);
+
+VOID ConnInfoAddRef(_Inout_ PCONNECTION_INFO pConnInfo);
+
+VOID ConnInfoRelease(_Pre_valid_ _Post_maybenull_ PCONNECTION_INFO pConnInfo);
+
+BOOL WebsockSendMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pWebsockSendBuf);
+
+// WebsockSendMessage in two steps, for senders that need to queue under a lock:
+// WebsockQueueSend hands the message to websocket.dll and takes a reference on pConnInfo,
+// WebsockFlushSend must follow (outside the lock) to do the I/O and drop that reference.
+VOID WebsockQueueSend(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pWebsockSendBuf);
+
+VOID WebsockFlushSend(_Inout_ PCONNECTION_INFO pConnInfo);
+
+// Around holding a room lock. In between, WebsockFlushSend of this thread only notes the connection:
+// running its websocket actions may handle a received message, which would lock the room again.
+// The messages are queued in order as usual, the I/O runs when the outermost EndFlushDefer returns.
+VOID BeginFlushDefer(VOID);
+
+VOID EndFlushDefer(VOID);
+
+BOOL WebsockDisconnect(_In_ PCONNECTION_INFO pConnInfo);
+
+// Disconnect the connection numbered ConnId, FALSE if there is none.
+BOOL KickConnection(_In_ UINT ConnId);
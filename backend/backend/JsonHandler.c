@@ -1,107 +1,108 @@
-#include "common.h"
-#include "yyjson.h"
-#include "HttpSendRecv.h"
-#include "MessageHandler.h"
-
-typedef BOOL(*MESSAGE_HANDLER)(PCONNECTION_INFO pConnInfo, yyjson_val* pJsonRoot);
-
-BOOL ParseAndDispatchJsonMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PBYTE pJsonMessage, _In_ ULONG cbMessageLen)
-{
-    yyjson_doc* JsonDoc = yyjson_read(pJsonMessage, cbMessageLen, 0);
-    if (!JsonDoc) return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_val* pType = yyjson_obj_get(JsonDoc->root, "type");
-        if (!pType)
-            __leave;
-
-        const char* pTypeStr = yyjson_get_str(pType);
-        if (!pTypeStr)
-            __leave;
-
-        // dispatch message by type.
-        
-        // TODO: this process could be slow.
-        // consider using a Trie (or what ever data structure) to optimize
-
-        struct 
-        { 
-            char* TypeName;
-            MESSAGE_HANDLER HandlerProc;
-        } HandlerList[] = 
-        { 
-            { "createRoom",   HandleCreateRoom },
-            { "joinRoom",     HandleJoinRoom },
-            { "changeAvatar", HandleChangeAvatar },
-            { "leaveRoom",    HandleLeaveRoom },
-            { "startGame",    HandleStartGame },
-            { "playerSelectTeam",     HandlePlayerSelectTeam },
-            { "playerConfirmTeam",    HandlePlayerConfirmTeam },
-            { "playerVoteTeam",       HandlePlayerVoteTeam },
-            { "playerConductMission", HandlePlayerConductMission },
-            { "playerFairyInspect",   HandlePlayerFairyInspect },
-            { "playerAssassinate",    HandlePlayerAssassinate },
-            { "playerTextMessage",    HandlePlayerTextMessage }
-        };
-
-        for (SIZE_T i = 0; i < _countof(HandlerList); i++)
-        {
-            if (strcmp(pTypeStr, HandlerList[i].TypeName) == 0)
-            {
-                bSuccess = HandlerList[i].HandlerProc(pConnInfo, JsonDoc->root);
-                break;
-            }
-        }
-        // unknown type
-    }
-    __finally
-    {
-        yyjson_doc_free(JsonDoc);
-    }
-    return bSuccess;
-}
-
-VOID SendJsonCompleteCallback(_In_ PCONNECTION_INFO pConnInfo, _In_ _Frees_ptr_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
-{
-    free(pWebsockSendBuf->WebsockBuf.Data.pbBuffer); // string allocated from yyjson_mut_write
-    HeapFree(GetProcessHeap(), 0, pWebsockSendBuf);
-}
-
-// NOTE: network error is not considered as an server error and will not return FALSE.
-BOOL SendJsonMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_mut_doc* JsonDoc)
-{
-    SIZE_T JsonLen;
-    BOOL bSuccess = FALSE;
-    PWEBSOCK_SEND_BUF pWebsockSendbuf = NULL;
-
-    char* JsonString = yyjson_mut_write(JsonDoc, 0, &JsonLen);
-    if (!JsonString)
-        return FALSE;
-
-    __try
-    {
-        pWebsockSendbuf = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(WEBSOCK_SEND_BUF));
-        if (!pWebsockSendbuf)
-            __leave;
-
-        pWebsockSendbuf->Callback = SendJsonCompleteCallback;
-        pWebsockSendbuf->WebsockBuf.Data.pbBuffer = JsonString;
-        pWebsockSendbuf->WebsockBuf.Data.ulBufferLength = (ULONG)JsonLen;
-
-        WebsockSendMessage(pConnInfo, pWebsockSendbuf);
-
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            if (pWebsockSendbuf)
-                HeapFree(GetProcessHeap(), 0, pWebsockSendbuf);
-            free(JsonString);
-        }
-    }
-    return bSuccess;
-}
+#include "common.h"
+#include "yyjson.h"
+#include "HttpSendRecv.h"
+#include "MessageSchema.h"
+#include "MessageHandler.h"
+#include "MessageSender.h"
+#include "Trace.h"
+
+// A JSON array of messages in one frame, handled in order.
+// Malformed ones are answered with commandError and skipped instead of dropping the connection.
+// The client gets batched frames from now on, so the replies come back in one frame (see SendBatch.h).
+static BOOL ParseAndDispatchJsonCommands(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PBYTE pJsonArray, _In_ ULONG cbArrayLen)
+{
+    JSON_SPAN SpanList[INBOUND_COMMANDS_MAX];
+    UINT Count;
+    INBOUND_MESSAGE Message;
+    BOOL bSuccess = TRUE;
+    TRACE_SPAN Span;
+
+    TraceBegin(&Span, pConnInfo);
+    BOOL bSplit = SplitJsonArray(pJsonArray, cbArrayLen, SpanList, INBOUND_COMMANDS_MAX, &Count);
+    TraceEnd(&Span, TRACE_CAT_PARSE, "SplitJsonArray");
+    if (!bSplit)
+        return FALSE;
+
+    pConnInfo->bBatchEvents = TRUE;
+
+    for (UINT i = 0; i < Count && bSuccess; i++)
+    {
+        TraceBegin(&Span, pConnInfo);
+        const MESSAGE_SCHEMA* pSchema = DecodeJsonMessage(SpanList[i].pStart, SpanList[i].cbLen, &Message);
+        TraceEnd(&Span, TRACE_CAT_PARSE, "DecodeJsonMessage");
+        if (!pSchema)
+        {
+            bSuccess = ReplyCommandError(pConnInfo, i);
+            continue;
+        }
+        bSuccess = DispatchInboundMessage(pConnInfo, pSchema, &Message);
+    }
+
+    return bSuccess;
+}
+
+BOOL ParseAndDispatchJsonMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PBYTE pJsonMessage, _In_ ULONG cbMessageLen)
+{
+    INBOUND_MESSAGE Message;
+    TRACE_SPAN Span;
+
+    if (cbMessageLen && pJsonMessage[0] == '[')
+        return ParseAndDispatchJsonCommands(pConnInfo, pJsonMessage, cbMessageLen);
+
+    // decode into typed message by schema, see MessageSchema.inl
+    TraceBegin(&Span, pConnInfo);
+    const MESSAGE_SCHEMA* pSchema = DecodeJsonMessage(pJsonMessage, cbMessageLen, &Message);
+    TraceEnd(&Span, TRACE_CAT_PARSE, "DecodeJsonMessage");
+    if (!pSchema) // malformed, oversized or unknown type
+        return FALSE;
+
+    return DispatchInboundMessage(pConnInfo, pSchema, &Message);
+}
+
+VOID SendJsonCompleteCallback(_In_ PCONNECTION_INFO pConnInfo, _In_ _Frees_ptr_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    free(pWebsockSendBuf->WebsockBuf.Data.pbBuffer); // string allocated from yyjson_mut_write
+    HeapFree(GetProcessHeap(), 0, pWebsockSendBuf);
+}
+
+// NOTE: network error is not considered as an server error and will not return FALSE.
+BOOL SendJsonMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_mut_doc* JsonDoc, _In_ UINT MessageType)
+{
+    SIZE_T JsonLen;
+    BOOL bSuccess = FALSE;
+    PWEBSOCK_SEND_BUF pWebsockSendbuf = NULL;
+
+    TRACE_SPAN Span;
+    TraceBegin(&Span, pConnInfo);
+    char* JsonString = yyjson_mut_write(JsonDoc, 0, &JsonLen);
+    TraceEnd(&Span, TRACE_CAT_SERIALIZE, "yyjson_mut_write");
+    if (!JsonString)
+        return FALSE;
+
+    __try
+    {
+        pWebsockSendbuf = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(WEBSOCK_SEND_BUF));
+        if (!pWebsockSendbuf)
+            __leave;
+
+        pWebsockSendbuf->BufferType = WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE;
+        pWebsockSendbuf->MessageType = (BYTE)MessageType;
+        pWebsockSendbuf->Callback = SendJsonCompleteCallback;
+        pWebsockSendbuf->WebsockBuf.Data.pbBuffer = JsonString;
+        pWebsockSendbuf->WebsockBuf.Data.ulBufferLength = (ULONG)JsonLen;
+
+        WebsockSendMessage(pConnInfo, pWebsockSendbuf);
+
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pWebsockSendbuf)
+                HeapFree(GetProcessHeap(), 0, pWebsockSendbuf);
+            free(JsonString);
+        }
+    }
+    return bSuccess;
+}
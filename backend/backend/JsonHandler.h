@@ -1,7 +1,8 @@
-#include "common.h"
-#include "HttpSendRecv.h"
-#include "yyjson.h"
-
-BOOL ParseAndDispatchJsonMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PBYTE pJsonMessage, _In_ ULONG cbMessageLen);
-
-BOOL SendJsonMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_mut_doc* JsonDoc);
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "yyjson.h"
+
+BOOL ParseAndDispatchJsonMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PBYTE pJsonMessage, _In_ ULONG cbMessageLen);
+
+// MessageType is the BIN_OUT_* type of the same message, for statistics.
+BOOL SendJsonMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_mut_doc* JsonDoc, _In_ UINT MessageType);
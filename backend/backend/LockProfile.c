@@ -0,0 +1,325 @@
+#include "common.h"
+#include "LockProfile.h"
+#include "Metrics.h"
+
+typedef struct _LOCK_SITE
+{
+    PCSTR volatile Function; // set last when the site is added, NULL while the slot is free
+    UINT Line;
+    BOOL bExclusive;
+    PCSTR LockName;
+} LOCK_SITE, * PLOCK_SITE;
+
+// Locks the thread holds, for their hold time.
+typedef struct _LOCK_HELD
+{
+    PSRWLOCK pLock;
+    UINT SiteIndex;
+    LONG Generation; // ProfileGeneration when acquired
+    LONG64 AcquireTick;
+} LOCK_HELD, * PLOCK_HELD;
+
+typedef struct _LOCK_HELD_LIST
+{
+    UINT Cnt;
+    LOCK_HELD List[LOCK_HELD_MAX];
+} LOCK_HELD_LIST, * PLOCK_HELD_LIST;
+
+volatile BOOL bLockProfiling = FALSE;
+
+// bumped when profiling is turned on, locks still listed from an earlier run were released unprofiled.
+static volatile LONG ProfileGeneration;
+
+// open addressing by function and line, sites are never removed.
+static LOCK_SITE SiteList[LOCK_SITE_MAX];
+static SRWLOCK SiteLock = SRWLOCK_INIT; // adding sites only
+static LARGE_INTEGER TickFrequency;
+
+static __declspec(thread) LOCK_HELD_LIST ThreadHeld;
+
+VOID InitLockProfile(VOID)
+{
+    QueryPerformanceFrequency(&TickFrequency);
+}
+
+VOID EnableLockProfile(_In_ BOOL bEnable)
+{
+    if (bEnable)
+        InterlockedIncrement(&ProfileGeneration);
+    bLockProfiling = bEnable;
+    Log(LOG_INFO, L"lock profiling is %1.", bEnable ? L"on" : L"off");
+}
+
+static BOOL IsLockSite(_In_ const LOCK_SITE* pSite, _In_z_ PCSTR Function, _In_ UINT Line, _In_ BOOL bExclusive)
+{
+    return pSite->Function == Function && pSite->Line == Line && pSite->bExclusive == bExclusive;
+}
+
+// Index of the site in SiteList, added on its first acquire. LOCK_SITE_MAX if the list is full.
+static UINT FindLockSite(_In_z_ PCSTR LockName, _In_z_ PCSTR Function, _In_ UINT Line, _In_ BOOL bExclusive)
+{
+    UINT Hash = (Line * 0x9E3779B1u) ^ (UINT)(ULONG_PTR)Function ^ bExclusive;
+
+    for (UINT i = 0; i < LOCK_SITE_MAX; i++)
+    {
+        PLOCK_SITE pSite = &SiteList[(Hash + i) & (LOCK_SITE_MAX - 1)];
+        if (!pSite->Function)
+            break;
+        if (IsLockSite(pSite, Function, Line, bExclusive))
+            return (UINT)(pSite - SiteList);
+    }
+
+    UINT SiteIndex = LOCK_SITE_MAX;
+    AcquireSRWLockExclusive(&SiteLock);
+    for (UINT i = 0; i < LOCK_SITE_MAX; i++)
+    {
+        PLOCK_SITE pSite = &SiteList[(Hash + i) & (LOCK_SITE_MAX - 1)];
+        if (pSite->Function && !IsLockSite(pSite, Function, Line, bExclusive))
+            continue;
+
+        if (!pSite->Function)
+        {
+            pSite->Line = Line;
+            pSite->bExclusive = bExclusive;
+            pSite->LockName = LockName;
+            InterlockedExchangePointer((PVOID volatile*)&pSite->Function, (PVOID)Function);
+        }
+        SiteIndex = (UINT)(pSite - SiteList);
+        break;
+    }
+    ReleaseSRWLockExclusive(&SiteLock);
+    return SiteIndex;
+}
+
+// Bucket i holds times up to 4^i us.
+static UINT GetLockHistBucket(_In_ LONG64 Ticks)
+{
+    UINT64 Us = (UINT64)Ticks * 1000000 / TickFrequency.QuadPart;
+    if (Us <= 1)
+        return 0;
+    if (Us > (1ULL << (2 * (LOCK_HIST_BUCKETS - 2))))
+        return LOCK_HIST_BUCKETS - 1;
+
+    DWORD HighBit;
+    BitScanReverse(&HighBit, (ULONG)(Us - 1));
+    return (HighBit + 2) / 2;
+}
+
+VOID AcquireProfiledLock(_Inout_ PSRWLOCK pLock, _In_ BOOL bExclusive, _In_z_ PCSTR LockName, _In_z_ PCSTR Function, _In_ UINT Line)
+{
+    LARGE_INTEGER StartTick, EndTick;
+    BOOL bContended = FALSE;
+    UINT SiteIndex = FindLockSite(LockName, Function, Line, bExclusive);
+
+    QueryPerformanceCounter(&StartTick);
+    if (!(bExclusive ? TryAcquireSRWLockExclusive(pLock) : TryAcquireSRWLockShared(pLock)))
+    {
+        bContended = TRUE;
+        if (bExclusive)
+            AcquireSRWLockExclusive(pLock);
+        else
+            AcquireSRWLockShared(pLock);
+    }
+    QueryPerformanceCounter(&EndTick);
+
+    if (SiteIndex == LOCK_SITE_MAX)
+        return;
+
+    PLOCK_SITE_STATS pStats = &GetThreadLockStats()[SiteIndex];
+    LONG64 WaitTicks = EndTick.QuadPart - StartTick.QuadPart;
+    pStats->AcquireCnt++;
+    pStats->ContendedCnt += bContended;
+    pStats->WaitTicks += WaitTicks;
+    pStats->WaitHist[GetLockHistBucket(WaitTicks)]++;
+
+    // forget locks of an earlier run first, their release wasn't seen.
+    PLOCK_HELD_LIST pHeld = &ThreadHeld;
+    LONG Generation = ProfileGeneration;
+    UINT Cnt = 0;
+    for (UINT i = 0; i < pHeld->Cnt; i++)
+    {
+        if (pHeld->List[i].Generation == Generation)
+            pHeld->List[Cnt++] = pHeld->List[i];
+    }
+    pHeld->Cnt = Cnt;
+
+    if (pHeld->Cnt < LOCK_HELD_MAX)
+    {
+        PLOCK_HELD pEntry = &pHeld->List[pHeld->Cnt++];
+        pEntry->pLock = pLock;
+        pEntry->SiteIndex = SiteIndex;
+        pEntry->Generation = Generation;
+        pEntry->AcquireTick = EndTick.QuadPart;
+    }
+}
+
+VOID ReleaseProfiledLock(_Inout_ PSRWLOCK pLock, _In_ BOOL bExclusive)
+{
+    PLOCK_HELD_LIST pHeld = &ThreadHeld;
+
+    // usually the last one taken.
+    for (UINT i = pHeld->Cnt; i-- > 0;)
+    {
+        if (pHeld->List[i].pLock != pLock)
+            continue;
+
+        LARGE_INTEGER Tick;
+        QueryPerformanceCounter(&Tick);
+        LONG64 HoldTicks = Tick.QuadPart - pHeld->List[i].AcquireTick;
+
+        PLOCK_SITE_STATS pStats = &GetThreadLockStats()[pHeld->List[i].SiteIndex];
+        pStats->HoldTicks += HoldTicks;
+        pStats->HoldHist[GetLockHistBucket(HoldTicks)]++;
+
+        pHeld->List[i] = pHeld->List[--pHeld->Cnt];
+        break;
+    }
+
+    if (bExclusive)
+        ReleaseSRWLockExclusive(pLock);
+    else
+        ReleaseSRWLockShared(pLock);
+}
+
+// "&pRoom->PlayerListLock" -> "PlayerListLock"
+static PCSTR GetShortLockName(_In_z_ PCSTR LockName)
+{
+    PCSTR pName = LockName;
+    for (PCSTR p = LockName; *p; p++)
+    {
+        if (*p == '&' || *p == '>' || *p == '.' || *p == '(' || *p == ' ')
+            pName = p + 1;
+    }
+    return pName;
+}
+
+static UINT64 TicksToUs(_In_ UINT64 Ticks)
+{
+    return Ticks * 1000000 / TickFrequency.QuadPart;
+}
+
+// Upper bound of the bucket the Percent-th percentile falls in, in us. The last bucket has none, 4 times the one before it is given.
+static UINT64 GetLockHistPercentile(_In_reads_(LOCK_HIST_BUCKETS) const UINT64 Hist[], _In_ UINT64 Count, _In_ UINT Percent)
+{
+    UINT64 Cumulative = 0;
+    for (UINT i = 0; i < LOCK_HIST_BUCKETS - 1; i++)
+    {
+        Cumulative += Hist[i];
+        if (Cumulative * 100 >= Count * Percent)
+            return 1ULL << (2 * i);
+    }
+    return 1ULL << (2 * (LOCK_HIST_BUCKETS - 1));
+}
+
+VOID PrintLockProfile(VOID)
+{
+    static LOCK_SITE_STATS SumList[LOCK_SITE_MAX]; // too large for the stack, only the console thread prints
+    UINT RankList[LOCK_SITE_MAX];
+    UINT RankCnt = 0;
+
+    SumLockStats(SumList);
+
+    // by total wait, the most contended first.
+    for (UINT i = 0; i < LOCK_SITE_MAX; i++)
+    {
+        if (!SiteList[i].Function || !SumList[i].AcquireCnt)
+            continue;
+
+        UINT j = RankCnt++;
+        for (; j > 0 && SumList[RankList[j - 1]].WaitTicks < SumList[i].WaitTicks; j--)
+            RankList[j] = RankList[j - 1];
+        RankList[j] = i;
+    }
+
+    Log(LOG_INFO, L"lock profiling is %1, %2!u! sites:", bLockProfiling ? L"on" : L"off", RankCnt);
+    for (UINT i = 0; i < RankCnt; i++)
+    {
+        const LOCK_SITE* pSite = &SiteList[RankList[i]];
+        const LOCK_SITE_STATS* pStats = &SumList[RankList[i]];
+        UINT64 HoldCnt = 0;
+        for (UINT j = 0; j < LOCK_HIST_BUCKETS; j++)
+            HoldCnt += pStats->HoldHist[j];
+
+        Log(LOG_INFO, L"%1!S! %2!S!:%3!u! (%4): %5!I64u! acquires, %6!I64u! contended, wait %7!I64u! us total, p99 <= %8!I64u! us, hold %9!I64u! us total, p99 <= %10!I64u! us",
+            GetShortLockName(pSite->LockName), pSite->Function, pSite->Line, pSite->bExclusive ? L"exclusive" : L"shared",
+            pStats->AcquireCnt, pStats->ContendedCnt,
+            TicksToUs(pStats->WaitTicks), GetLockHistPercentile(pStats->WaitHist, pStats->AcquireCnt, 99),
+            TicksToUs(pStats->HoldTicks), GetLockHistPercentile(pStats->HoldHist, HoldCnt, 99));
+    }
+}
+
+static VOID WriteLockLabels(_Inout_ PMETRICS_WRITER pWriter, _In_ const LOCK_SITE* pSite)
+{
+    WriteMetrics(pWriter, "lock=\"%s\",site=\"%s:%u\",mode=\"%s\"",
+        GetShortLockName(pSite->LockName), pSite->Function, pSite->Line, pSite->bExclusive ? "exclusive" : "shared");
+}
+
+static VOID WriteLockHistogram(
+    _Inout_ PMETRICS_WRITER pWriter,
+    _In_z_ PCSTR Name,
+    _In_ const LOCK_SITE* pSite,
+    _In_reads_(LOCK_HIST_BUCKETS) const UINT64 Hist[],
+    _In_ UINT64 Ticks)
+{
+    UINT64 Cumulative = 0;
+    for (UINT i = 0; i < LOCK_HIST_BUCKETS; i++)
+    {
+        Cumulative += Hist[i];
+        WriteMetrics(pWriter, "avalon_%s_bucket{", Name);
+        WriteLockLabels(pWriter, pSite);
+        if (i < LOCK_HIST_BUCKETS - 1)
+            WriteMetrics(pWriter, ",le=\"%g\"} %llu\n", (double)(1ULL << (2 * i)) / 1000000, Cumulative);
+        else
+            WriteMetrics(pWriter, ",le=\"+Inf\"} %llu\n", Cumulative);
+    }
+    WriteMetrics(pWriter, "avalon_%s_sum{", Name);
+    WriteLockLabels(pWriter, pSite);
+    WriteMetrics(pWriter, "} %.6f\n", (double)Ticks / TickFrequency.QuadPart);
+    WriteMetrics(pWriter, "avalon_%s_count{", Name);
+    WriteLockLabels(pWriter, pSite);
+    WriteMetrics(pWriter, "} %llu\n", Cumulative);
+}
+
+VOID WriteLockMetrics(_Inout_ PMETRICS_WRITER pWriter)
+{
+    static LOCK_SITE_STATS SumList[LOCK_SITE_MAX];
+    static SRWLOCK SumLock = SRWLOCK_INIT; // for SumList, scrapes may run at the same time
+
+    AcquireSRWLockExclusive(&SumLock);
+    SumLockStats(SumList);
+
+    WriteMetricHeader(pWriter, "lock_acquires_total", "counter", "Profiled lock acquires, by site.");
+    for (UINT i = 0; i < LOCK_SITE_MAX; i++)
+    {
+        if (!SiteList[i].Function)
+            continue;
+        WriteMetrics(pWriter, "avalon_lock_acquires_total{");
+        WriteLockLabels(pWriter, &SiteList[i]);
+        WriteMetrics(pWriter, "} %llu\n", SumList[i].AcquireCnt);
+    }
+
+    WriteMetricHeader(pWriter, "lock_contended_total", "counter", "Profiled lock acquires that had to wait, by site.");
+    for (UINT i = 0; i < LOCK_SITE_MAX; i++)
+    {
+        if (!SiteList[i].Function)
+            continue;
+        WriteMetrics(pWriter, "avalon_lock_contended_total{");
+        WriteLockLabels(pWriter, &SiteList[i]);
+        WriteMetrics(pWriter, "} %llu\n", SumList[i].ContendedCnt);
+    }
+
+    WriteMetricHeader(pWriter, "lock_wait_seconds", "histogram", "Time waited to acquire a profiled lock, by site.");
+    for (UINT i = 0; i < LOCK_SITE_MAX; i++)
+    {
+        if (SiteList[i].Function)
+            WriteLockHistogram(pWriter, "lock_wait_seconds", &SiteList[i], SumList[i].WaitHist, SumList[i].WaitTicks);
+    }
+
+    WriteMetricHeader(pWriter, "lock_hold_seconds", "histogram", "Time a profiled lock was held, by the site that acquired it.");
+    for (UINT i = 0; i < LOCK_SITE_MAX; i++)
+    {
+        if (SiteList[i].Function)
+            WriteLockHistogram(pWriter, "lock_hold_seconds", &SiteList[i], SumList[i].HoldHist, SumList[i].HoldTicks);
+    }
+    ReleaseSRWLockExclusive(&SumLock);
+}
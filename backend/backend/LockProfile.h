@@ -0,0 +1,56 @@
+#pragma once
+#include "common.h"
+
+// Contention profiler for SRW locks.
+//
+// Locks taken through the macros below record, per call site, how long the acquire waited and
+// how long the lock was held, into the metrics block of the thread (see Metrics.h).
+// While profiling is off the macros cost one predictable branch on a global flag, besides the lock itself.
+// A site is the function and line of the acquire, the lock is named by the expression that took it.
+
+#define LOCK_SITE_MAX 64      // sites profiled, acquires at more sites are not recorded. power of 2
+#define LOCK_HELD_MAX 8       // locks one thread holds at the same time whose hold time is recorded
+#define LOCK_HIST_BUCKETS 12  // bucket i counts times up to 4^i us, the last one everything longer
+
+typedef struct _LOCK_SITE_STATS
+{
+    UINT64 AcquireCnt;
+    UINT64 ContendedCnt; // acquires that had to wait
+    UINT64 WaitTicks;    // QueryPerformanceCounter ticks
+    UINT64 HoldTicks;
+    UINT64 WaitHist[LOCK_HIST_BUCKETS];
+    UINT64 HoldHist[LOCK_HIST_BUCKETS];
+} LOCK_SITE_STATS, * PLOCK_SITE_STATS;
+
+extern volatile BOOL bLockProfiling;
+
+VOID InitLockProfile(VOID);
+
+VOID EnableLockProfile(_In_ BOOL bEnable);
+
+VOID AcquireProfiledLock(_Inout_ PSRWLOCK pLock, _In_ BOOL bExclusive, _In_z_ PCSTR LockName, _In_z_ PCSTR Function, _In_ UINT Line);
+
+VOID ReleaseProfiledLock(_Inout_ PSRWLOCK pLock, _In_ BOOL bExclusive);
+
+// Use instead of AcquireSRWLock* / ReleaseSRWLock* on the locks to profile.
+#define AcquireLockExclusive(pLock) AcquireLockExclusiveAt((pLock), #pLock, __FUNCTION__, __LINE__)
+#define AcquireLockShared(pLock) AcquireLockSharedAt((pLock), #pLock, __FUNCTION__, __LINE__)
+
+// Same, with the site given by the caller: for helpers that lock on behalf of their caller.
+#define AcquireLockExclusiveAt(pLock, LockName, Function, Line) \
+    (bLockProfiling ? AcquireProfiledLock((pLock), TRUE, (LockName), (Function), (Line)) : AcquireSRWLockExclusive(pLock))
+#define AcquireLockSharedAt(pLock, LockName, Function, Line) \
+    (bLockProfiling ? AcquireProfiledLock((pLock), FALSE, (LockName), (Function), (Line)) : AcquireSRWLockShared(pLock))
+
+#define ReleaseLockExclusive(pLock) \
+    (bLockProfiling ? ReleaseProfiledLock((pLock), TRUE) : ReleaseSRWLockExclusive(pLock))
+#define ReleaseLockShared(pLock) \
+    (bLockProfiling ? ReleaseProfiledLock((pLock), FALSE) : ReleaseSRWLockShared(pLock))
+
+// Log the sites ranked by total wait time.
+VOID PrintLockProfile(VOID);
+
+// Append the lock metrics to a /metrics response, see FormatMetrics.
+typedef struct _METRICS_WRITER METRICS_WRITER, * PMETRICS_WRITER;
+
+VOID WriteLockMetrics(_Inout_ PMETRICS_WRITER pWriter);
@@ -1,174 +1,131 @@
-#include "common.h"
-#include "HttpSendRecv.h"
-#include "yyjson.h"
-#include "MessageSender.h"
-#include "RoomManager.h"
-#include "MessageHandler.h"
-
-BOOL HandleCreateRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val *pJsonRoot)
-{
-    yyjson_val* pName = yyjson_obj_get(pJsonRoot, "name");
-    if (!pName)
-        return FALSE;
-    const char* pNameStr = yyjson_get_str(pName);
-    if (!pNameStr)
-        return FALSE;
-
-    yyjson_val* pPassword = yyjson_obj_get(pJsonRoot, "password");
-    const char* pPasswordStr = NULL;
-    if (pPassword)
-        pPasswordStr = yyjson_get_str(pPassword);
-
-    return CreateRoom(pConnInfo, pNameStr, pPasswordStr);
-}
-
-BOOL HandleJoinRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    yyjson_val* pName = yyjson_obj_get(pJsonRoot, "name");
-    if (!pName)
-        return FALSE;
-    const char* pNameStr = yyjson_get_str(pName);
-    if (!pNameStr)
-        return FALSE;
-
-    yyjson_val* pPassword = yyjson_obj_get(pJsonRoot, "password");
-    const char* pPasswordStr = NULL;
-    if (pPassword)
-        pPasswordStr = yyjson_get_str(pPassword);
-
-    yyjson_val* pRoomNumber = yyjson_obj_get(pJsonRoot, "roomNumber");
-    if (!pRoomNumber)
-        return FALSE;
-    const char* pRoomNumberStr = yyjson_get_str(pRoomNumber);
-    if (!pRoomNumberStr)
-        return FALSE;
-
-    UINT RoomNumber = 0;
-    for (UINT i = 0; pRoomNumberStr[i]; i++)
-    {
-        if (!isdigit(pRoomNumberStr[i]))
-        {
-            ReplyJoinRoom(pConnInfo, FALSE, 0, "incorrect room number");
-            return TRUE;
-        }
-        RoomNumber *= 10;
-        RoomNumber += pRoomNumberStr[i] - '0';
-        if (RoomNumber > ROOM_NUMBER_MAX)
-        {
-            ReplyJoinRoom(pConnInfo, FALSE, 0, "incorrect room number");
-            return TRUE;
-        }
-    }
-    if (RoomNumber < ROOM_NUMBER_MIN)
-    {
-        ReplyJoinRoom(pConnInfo, FALSE, 0, "incorrect room number");
-        return TRUE;
-    }
-
-    return JoinRoom(RoomNumber - ROOM_NUMBER_MIN, pConnInfo, pNameStr, pPasswordStr);
-}
-
-BOOL HandleChangeAvatar(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    yyjson_val* pAvatar = yyjson_obj_get(pJsonRoot, "avatar");
-    if (!pAvatar)
-        return FALSE;
-    const char* pAvatarStr = yyjson_get_str(pAvatar);
-    if (!pAvatarStr)
-        return FALSE;
-
-    return ChangeAvatar(pConnInfo, pAvatarStr);
-}
-
-BOOL HandleLeaveRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    if (!pConnInfo->pRoom)
-    {
-        return ReplyLeaveRoom(pConnInfo, FALSE, "You are not in a room.");
-    }
-
-    LeaveRoom(pConnInfo);
-    return ReplyLeaveRoom(pConnInfo, TRUE, NULL);
-}
-
-BOOL HandleStartGame(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    return StartGame(pConnInfo);
-}
-
-BOOL HandlePlayerSelectTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    yyjson_val *pTeam = yyjson_obj_get(pJsonRoot, "team");
-    if (!yyjson_is_arr(pTeam))
-        return FALSE;
-
-    UINT TeamArr[ROOM_PLAYER_MAX] = { 0 };
-
-    yyjson_val* val;
-    yyjson_arr_iter iter;
-    SIZE_T Size = unsafe_yyjson_get_len(pTeam);
-    if (Size > ROOM_PLAYER_MAX)
-        return FALSE;
-    yyjson_arr_iter_init(pTeam, &iter);
-    while ((val = yyjson_arr_iter_next(&iter))) {
-        if (!yyjson_is_uint(val))
-            return FALSE;
-        TeamArr[iter.idx] = (UINT)yyjson_get_uint(val);
-    }
-
-    return PlayerSelectTeam(pConnInfo, (UINT)Size, TeamArr);
-}
-
-BOOL HandlePlayerConfirmTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    return PlayerConfirmTeam(pConnInfo);
-}
-
-BOOL HandlePlayerVoteTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    yyjson_val* pVote = yyjson_obj_get(pJsonRoot, "vote");
-    if (!yyjson_is_bool(pVote))
-        return FALSE;
-
-    BOOL bVote = unsafe_yyjson_get_bool(pVote);
-    return PlayerVoteTeam(pConnInfo, bVote);
-}
-
-BOOL HandlePlayerConductMission(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    yyjson_val* pPerform = yyjson_obj_get(pJsonRoot, "perform");
-    if (!yyjson_is_bool(pPerform))
-        return FALSE;
-
-    BOOL bPerfrom = unsafe_yyjson_get_bool(pPerform);
-    return PlayerConductMission(pConnInfo, bPerfrom);
-}
-
-BOOL HandlePlayerFairyInspect(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    yyjson_val* pID = yyjson_obj_get(pJsonRoot, "ID");
-    if (!yyjson_is_uint(pID))
-        return FALSE;
-
-    UINT ID = (UINT)unsafe_yyjson_get_uint(pID);
-    return PlayerFairyInspect(pConnInfo, ID);
-}
-
-BOOL HandlePlayerAssassinate(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    yyjson_val *pID = yyjson_obj_get(pJsonRoot, "ID");
-    if (!yyjson_is_uint(pID))
-        return FALSE;
-
-    UINT ID = (UINT)yyjson_get_uint(pID);
-    return PlayerAssassinate(pConnInfo, ID);
-}
-
-BOOL HandlePlayerTextMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot)
-{
-    yyjson_val* pMessage = yyjson_obj_get(pJsonRoot, "message");
-    if (!yyjson_is_str(pMessage))
-        return FALSE;
-
-    return PlayerTextMessage(pConnInfo, yyjson_get_str(pMessage));
-}
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "MessageSender.h"
+#include "RoomManager.h"
+#include "RoomNumber.h"
+#include "MessageHandler.h"
+#include "Trace.h"
+#include "Probes.h"
+
+BOOL DispatchInboundMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MESSAGE_SCHEMA* pSchema, _In_ const INBOUND_MESSAGE* pMessage)
+{
+    TRACE_SPAN Span;
+
+    PROBE_DISPATCH_START(pConnInfo, pSchema);
+    TraceBegin(&Span, pConnInfo);
+    BOOL bSuccess = pSchema->HandlerProc(pConnInfo, pMessage);
+    TraceEnd(&Span, TRACE_CAT_HANDLER, pSchema->TypeName);
+    PROBE_DISPATCH_END(pConnInfo, pSchema, bSuccess);
+    return bSuccess;
+}
+
+// The length limits are the MaxLen of the fields in MessageSchema.inl, longer strings arrive cut and marked.
+
+BOOL HandleCreateRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_CREATE_ROOM* pMessage)
+{
+    if (MESSAGE_FIELD_OVERSIZE(pMessage, CREATE_ROOM, Name))
+        return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "Nick name too long.");
+    if (MESSAGE_FIELD_OVERSIZE(pMessage, CREATE_ROOM, Password))
+        return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "Password too long.");
+
+    const char* pPasswordStr = NULL;
+    if (MESSAGE_FIELD_PRESENT(pMessage, CREATE_ROOM, Password))
+        pPasswordStr = pMessage->Password;
+
+    return CreateRoom(pConnInfo, pMessage->Name, pPasswordStr);
+}
+
+BOOL HandleJoinRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_JOIN_ROOM* pMessage)
+{
+    if (MESSAGE_FIELD_OVERSIZE(pMessage, JOIN_ROOM, Name))
+        return ReplyJoinRoom(pConnInfo, FALSE, 0, "Nick name too long.");
+    if (MESSAGE_FIELD_OVERSIZE(pMessage, JOIN_ROOM, Password)) // no room has a password that long
+        return ReplyJoinRoom(pConnInfo, FALSE, 0, "Wrong password.");
+
+    const char* pPasswordStr = NULL;
+    if (MESSAGE_FIELD_PRESENT(pMessage, JOIN_ROOM, Password))
+        pPasswordStr = pMessage->Password;
+
+    UINT RoomNumber;
+    if (MESSAGE_FIELD_OVERSIZE(pMessage, JOIN_ROOM, RoomNumber) || !ParseRoomNumber(pMessage->RoomNumber, &RoomNumber))
+    {
+        ReplyJoinRoom(pConnInfo, FALSE, 0, "incorrect room number");
+        return TRUE;
+    }
+
+    return JoinRoom(RoomNumber, pConnInfo, pMessage->Name, pPasswordStr);
+}
+
+BOOL HandleChangeAvatar(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_CHANGE_AVATAR* pMessage)
+{
+    if (MESSAGE_FIELD_OVERSIZE(pMessage, CHANGE_AVATAR, Avatar)) // ignored, changeAvatar has no reply yet.
+        return TRUE;
+
+    return ChangeAvatar(pConnInfo, pMessage->Avatar);
+}
+
+BOOL HandleLeaveRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_LEAVE_ROOM* pMessage)
+{
+    if (!pConnInfo->pRoom)
+    {
+        return ReplyLeaveRoom(pConnInfo, FALSE, "You are not in a room.");
+    }
+
+    LeaveRoom(pConnInfo);
+    return ReplyLeaveRoom(pConnInfo, TRUE, NULL);
+}
+
+BOOL HandleStartGame(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_START_GAME* pMessage)
+{
+    return StartGame(pConnInfo);
+}
+
+BOOL HandlePlayerSelectTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_SELECT_TEAM* pMessage)
+{
+    // element count is limited to ROOM_PLAYER_MAX by the schema.
+    return PlayerSelectTeam(pConnInfo, pMessage->TeamCnt, pMessage->Team);
+}
+
+BOOL HandlePlayerConfirmTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_CONFIRM_TEAM* pMessage)
+{
+    return PlayerConfirmTeam(pConnInfo);
+}
+
+BOOL HandlePlayerVoteTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_VOTE_TEAM* pMessage)
+{
+    return PlayerVoteTeam(pConnInfo, pMessage->bVote);
+}
+
+BOOL HandlePlayerConductMission(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_CONDUCT_MISSION* pMessage)
+{
+    return PlayerConductMission(pConnInfo, pMessage->bPerform);
+}
+
+BOOL HandlePlayerFairyInspect(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_FAIRY_INSPECT* pMessage)
+{
+    return PlayerFairyInspect(pConnInfo, pMessage->ID);
+}
+
+BOOL HandlePlayerAssassinate(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_ASSASSINATE* pMessage)
+{
+    return PlayerAssassinate(pConnInfo, pMessage->ID);
+}
+
+BOOL HandlePlayerTextMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_TEXT_MESSAGE* pMessage)
+{
+    if (MESSAGE_FIELD_OVERSIZE(pMessage, PLAYER_TEXT_MESSAGE, Message))
+        return ReplyPlayerTextMessage(pConnInfo, FALSE, "Message too long.");
+
+    return PlayerTextMessage(pConnInfo, pMessage->Message);
+}
+
+BOOL HandleRoomStatusSync(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_ROOM_STATUS_SYNC* pMessage)
+{
+    return SyncRoomStatus(pConnInfo);
+}
+
+BOOL HandleBatchEvents(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_BATCH_EVENTS* pMessage)
+{
+    pConnInfo->bBatchEvents = TRUE;
+    return TRUE;
+}
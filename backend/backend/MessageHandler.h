@@ -1,28 +1,35 @@
-#pragma once
-#include "common.h"
-#include "HttpSendRecv.h"
-#include "yyjson.h"
-
-BOOL HandleCreateRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandleJoinRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandleChangeAvatar(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandleLeaveRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandleStartGame(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandlePlayerSelectTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandlePlayerConfirmTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandlePlayerVoteTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandlePlayerConductMission(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandlePlayerFairyInspect(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandlePlayerAssassinate(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
-
-BOOL HandlePlayerTextMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ yyjson_val* pJsonRoot);
+#pragma once
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "MessageSchema.h"
+
+// Run the schema's handler on a decoded message, traced and probed.
+BOOL DispatchInboundMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MESSAGE_SCHEMA* pSchema, _In_ const INBOUND_MESSAGE* pMessage);
+
+BOOL HandleCreateRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_CREATE_ROOM* pMessage);
+
+BOOL HandleJoinRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_JOIN_ROOM* pMessage);
+
+BOOL HandleChangeAvatar(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_CHANGE_AVATAR* pMessage);
+
+BOOL HandleLeaveRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_LEAVE_ROOM* pMessage);
+
+BOOL HandleStartGame(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_START_GAME* pMessage);
+
+BOOL HandlePlayerSelectTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_SELECT_TEAM* pMessage);
+
+BOOL HandlePlayerConfirmTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_CONFIRM_TEAM* pMessage);
+
+BOOL HandlePlayerVoteTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_VOTE_TEAM* pMessage);
+
+BOOL HandlePlayerConductMission(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_CONDUCT_MISSION* pMessage);
+
+BOOL HandlePlayerFairyInspect(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_FAIRY_INSPECT* pMessage);
+
+BOOL HandlePlayerAssassinate(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_ASSASSINATE* pMessage);
+
+BOOL HandlePlayerTextMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_PLAYER_TEXT_MESSAGE* pMessage);
+
+BOOL HandleRoomStatusSync(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_ROOM_STATUS_SYNC* pMessage);
+
+BOOL HandleBatchEvents(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const MSG_BATCH_EVENTS* pMessage);
@@ -0,0 +1,917 @@
+#include "common.h"
+#include "MessageSchema.h"
+#include "MessageHandler.h"
+#include "Metrics.h"
+
+#define JSON_MAX_DEPTH 16       // nesting allowed inside values we skip
+#define JSON_KEY_MAXLEN 32      // longer keys can't match any field and are skipped
+
+// Generate the field table of each message: <TYPE>_FIELDS
+#define MESSAGE_BEGIN(Type, Handler, Name) static const MESSAGE_FIELD Type##_FIELDS[] = {
+#define FIELD_STRING(Type, Member, Key, MaxLen, Flags) { Key, sizeof(Key) - 1, FIELD_TYPE_STRING, Flags, MaxLen, offsetof(MSG_##Type, Member), 0 },
+#define FIELD_BOOL(Type, Member, Key, Flags) { Key, sizeof(Key) - 1, FIELD_TYPE_BOOL, Flags, 0, offsetof(MSG_##Type, Member), 0 },
+#define FIELD_UINT(Type, Member, Key, Flags) { Key, sizeof(Key) - 1, FIELD_TYPE_UINT, Flags, 0, offsetof(MSG_##Type, Member), 0 },
+#define FIELD_UINT_ARRAY(Type, Member, Key, MaxCnt, Flags) { Key, sizeof(Key) - 1, FIELD_TYPE_UINT_ARRAY, Flags, MaxCnt, offsetof(MSG_##Type, Member), offsetof(MSG_##Type, Member##Cnt) },
+#define MESSAGE_END(Type) { NULL } };
+#include "MessageSchema.inl"
+#undef MESSAGE_BEGIN
+#undef FIELD_STRING
+#undef FIELD_BOOL
+#undef FIELD_UINT
+#undef FIELD_UINT_ARRAY
+#undef MESSAGE_END
+
+// Generate the dispatch table
+#define MESSAGE_BEGIN(Type, Handler, Name) { Name, sizeof(Name) - 1, Type##_FIELDS, (MESSAGE_HANDLER)Handle##Handler },
+#define FIELD_STRING(Type, Member, Key, MaxLen, Flags)
+#define FIELD_BOOL(Type, Member, Key, Flags)
+#define FIELD_UINT(Type, Member, Key, Flags)
+#define FIELD_UINT_ARRAY(Type, Member, Key, MaxCnt, Flags)
+#define MESSAGE_END(Type)
+static const MESSAGE_SCHEMA MessageSchemaList[] =
+{
+#include "MessageSchema.inl"
+};
+#undef MESSAGE_BEGIN
+#undef FIELD_STRING
+#undef FIELD_BOOL
+#undef FIELD_UINT
+#undef FIELD_UINT_ARRAY
+#undef MESSAGE_END
+
+_Ret_maybenull_
+const MESSAGE_SCHEMA* GetMessageSchema(_In_ UINT TypeIndex)
+{
+    return TypeIndex < _countof(MessageSchemaList) ? &MessageSchemaList[TypeIndex] : NULL;
+}
+
+typedef struct _JSON_SCANNER
+{
+    const BYTE* pCur;
+    const BYTE* pEnd;
+} JSON_SCANNER, * PJSON_SCANNER;
+
+static BOOL SkipValue(_Inout_ PJSON_SCANNER pScanner, _In_ UINT Depth);
+
+static VOID InitScanner(_Out_ PJSON_SCANNER pScanner, _In_ const BYTE* pJson, _In_ ULONG cbJson)
+{
+    pScanner->pCur = pJson;
+    pScanner->pEnd = pJson + cbJson;
+}
+
+static VOID SkipWhitespace(_Inout_ PJSON_SCANNER pScanner)
+{
+    while (pScanner->pCur < pScanner->pEnd)
+    {
+        BYTE c = *pScanner->pCur;
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            break;
+        pScanner->pCur++;
+    }
+}
+
+// returns the next non-whitespace char without consuming it, 0 at the end of input.
+static BYTE PeekChar(_Inout_ PJSON_SCANNER pScanner)
+{
+    SkipWhitespace(pScanner);
+    return pScanner->pCur < pScanner->pEnd ? *pScanner->pCur : 0;
+}
+
+static BOOL ConsumeChar(_Inout_ PJSON_SCANNER pScanner, _In_ BYTE c)
+{
+    if (PeekChar(pScanner) != c)
+        return FALSE;
+    pScanner->pCur++;
+    return TRUE;
+}
+
+static BOOL ConsumeLiteral(_Inout_ PJSON_SCANNER pScanner, _In_z_ const CHAR* pLiteral, _In_ SIZE_T cbLiteral)
+{
+    if ((SIZE_T)(pScanner->pEnd - pScanner->pCur) < cbLiteral)
+        return FALSE;
+    if (memcmp(pScanner->pCur, pLiteral, cbLiteral) != 0)
+        return FALSE;
+    pScanner->pCur += cbLiteral;
+    return TRUE;
+}
+
+// returns the length of a valid UTF-8 multi-byte sequence at p, 0 if invalid.
+static UINT GetUtf8SequenceLength(_In_ const BYTE* p, _In_ const BYTE* pEnd)
+{
+    BYTE c = p[0];
+    BYTE Min = 0x80, Max = 0xBF; // valid range of the second byte
+    UINT Len;
+
+    if (c >= 0xC2 && c <= 0xDF) Len = 2;
+    else if (c == 0xE0) { Len = 3; Min = 0xA0; }
+    else if (c == 0xED) { Len = 3; Max = 0x9F; } // no surrogates
+    else if (c >= 0xE1 && c <= 0xEF) Len = 3;
+    else if (c == 0xF0) { Len = 4; Min = 0x90; }
+    else if (c >= 0xF1 && c <= 0xF3) Len = 4;
+    else if (c == 0xF4) { Len = 4; Max = 0x8F; } // up to U+10FFFF
+    else return 0;
+
+    if ((SIZE_T)(pEnd - p) < Len)
+        return 0;
+    if (p[1] < Min || p[1] > Max)
+        return 0;
+    for (UINT i = 2; i < Len; i++)
+    {
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+    }
+    return Len;
+}
+
+static UINT EncodeUtf8(_In_ UINT CodePoint, _Out_writes_(4) BYTE* pOut)
+{
+    if (CodePoint < 0x80)
+    {
+        pOut[0] = (BYTE)CodePoint;
+        return 1;
+    }
+    if (CodePoint < 0x800)
+    {
+        pOut[0] = (BYTE)(0xC0 | (CodePoint >> 6));
+        pOut[1] = (BYTE)(0x80 | (CodePoint & 0x3F));
+        return 2;
+    }
+    if (CodePoint < 0x10000)
+    {
+        pOut[0] = (BYTE)(0xE0 | (CodePoint >> 12));
+        pOut[1] = (BYTE)(0x80 | ((CodePoint >> 6) & 0x3F));
+        pOut[2] = (BYTE)(0x80 | (CodePoint & 0x3F));
+        return 3;
+    }
+    pOut[0] = (BYTE)(0xF0 | (CodePoint >> 18));
+    pOut[1] = (BYTE)(0x80 | ((CodePoint >> 12) & 0x3F));
+    pOut[2] = (BYTE)(0x80 | ((CodePoint >> 6) & 0x3F));
+    pOut[3] = (BYTE)(0x80 | (CodePoint & 0x3F));
+    return 4;
+}
+
+static BOOL ScanHex4(_Inout_ PJSON_SCANNER pScanner, _Out_ UINT* pValue)
+{
+    UINT Value = 0;
+    if (pScanner->pEnd - pScanner->pCur < 4)
+        return FALSE;
+    for (UINT i = 0; i < 4; i++)
+    {
+        BYTE c = *pScanner->pCur++;
+        Value <<= 4;
+        if (c >= '0' && c <= '9') Value |= c - '0';
+        else if (c >= 'a' && c <= 'f') Value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') Value |= c - 'A' + 10;
+        else return FALSE;
+    }
+    *pValue = Value;
+    return TRUE;
+}
+
+// decode one escape sequence, the scanner is right after the backslash.
+static BOOL ScanEscape(_Inout_ PJSON_SCANNER pScanner, _Out_writes_(4) BYTE* pOut, _Out_ UINT* pcbOut)
+{
+    if (pScanner->pCur >= pScanner->pEnd)
+        return FALSE;
+
+    *pcbOut = 1;
+    switch (*pScanner->pCur++)
+    {
+    case '"':  pOut[0] = '"';  return TRUE;
+    case '\\': pOut[0] = '\\'; return TRUE;
+    case '/':  pOut[0] = '/';  return TRUE;
+    case 'b':  pOut[0] = '\b'; return TRUE;
+    case 'f':  pOut[0] = '\f'; return TRUE;
+    case 'n':  pOut[0] = '\n'; return TRUE;
+    case 'r':  pOut[0] = '\r'; return TRUE;
+    case 't':  pOut[0] = '\t'; return TRUE;
+    case 'u':
+    {
+        UINT CodePoint, Low;
+        if (!ScanHex4(pScanner, &CodePoint))
+            return FALSE;
+        if (CodePoint >= 0xD800 && CodePoint <= 0xDBFF)
+        {
+            // high surrogate, must be followed by an escaped low surrogate.
+            if (!ConsumeLiteral(pScanner, "\\u", 2) || !ScanHex4(pScanner, &Low))
+                return FALSE;
+            if (Low < 0xDC00 || Low > 0xDFFF)
+                return FALSE;
+            CodePoint = 0x10000 + ((CodePoint - 0xD800) << 10) + (Low - 0xDC00);
+        }
+        else if (CodePoint >= 0xDC00 && CodePoint <= 0xDFFF)
+        {
+            return FALSE;
+        }
+        if (CodePoint == 0) // we hand out zero terminated strings
+            return FALSE;
+        *pcbOut = EncodeUtf8(CodePoint, pOut);
+        return TRUE;
+    }
+    default:
+        return FALSE;
+    }
+}
+
+// printable ASCII that stands for itself inside a JSON string.
+static BOOL IsPlainAscii(_In_ BYTE c)
+{
+    return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+#define BYTES_OF(c) (0x0101010101010101ull * (BYTE)(c))
+
+// The high bit of each of the 8 bytes in Word that isn't plain ASCII. Borrows only spread
+// upwards from such a byte, so the lowest bit set is exact, the ones above may not be.
+static UINT64 GetNonPlainBytes(_In_ UINT64 Word)
+{
+    UINT64 Control = Word - BYTES_OF(0x20);
+    UINT64 Quote = (Word ^ BYTES_OF('"')) - BYTES_OF(1);
+    UINT64 Backslash = (Word ^ BYTES_OF('\\')) - BYTES_OF(1);
+    return (Control | Quote | Backslash | Word) & BYTES_OF(0x80);
+}
+
+// skip plain ASCII from p, 8 bytes at a time while they last. Every Windows target is little-endian,
+// the first byte of the input is the lowest of Word.
+static const BYTE* SkipPlainAscii(_In_ const BYTE* p, _In_ const BYTE* pEnd)
+{
+    while (pEnd - p >= 8)
+    {
+        UINT64 Word;
+        DWORD Index;
+        memcpy(&Word, p, sizeof(Word));
+
+        UINT64 Mask = GetNonPlainBytes(Word);
+        if (!Mask)
+        {
+            p += 8;
+            continue;
+        }
+        // no 64-bit bit scan on x86.
+        if (!BitScanForward(&Index, (ULONG)Mask))
+        {
+            BitScanForward(&Index, (ULONG)(Mask >> 32));
+            Index += 32;
+        }
+        return p + Index / 8;
+    }
+    while (p < pEnd && IsPlainAscii(*p))
+        p++;
+    return p;
+}
+
+// Scan a string into pOut (may be NULL to skip it). *pcbLen receives the decoded length.
+// A string longer than cbOutMax is still scanned to its end, pOut keeps what fits
+// without cutting a UTF-8 sequence.
+static BOOL ScanString(
+    _Inout_ PJSON_SCANNER pScanner,
+    _Out_writes_opt_(cbOutMax + 1) CHAR* pOut,
+    _In_ UINT cbOutMax,
+    _Out_opt_ UINT* pcbLen)
+{
+    const BYTE* p;
+    const BYTE* pEnd = pScanner->pEnd;
+    UINT cbLen = 0;
+    UINT cbStored = 0;
+
+    if (!ConsumeChar(pScanner, '"'))
+        return FALSE;
+
+    // the position stays in a local, writes through pOut may alias the scanner.
+    p = pScanner->pCur;
+    for (;;)
+    {
+        const BYTE* pRun = p;
+        BYTE Utf8[4];
+        UINT cbRun;
+
+        // a run of plain ASCII is appended at once, most strings are just that. ASCII can be cut anywhere.
+        p = SkipPlainAscii(p, pEnd);
+        cbRun = (UINT)(p - pRun);
+        if (pOut && cbStored == cbLen)
+        {
+            UINT cbCopy = min(cbRun, cbOutMax - cbStored);
+            memcpy(pOut + cbStored, pRun, cbCopy);
+            cbStored += cbCopy;
+        }
+        cbLen += cbRun;
+
+        if (p >= pEnd)
+            return FALSE;
+
+        BYTE c = *p;
+        if (c == '"')
+        {
+            pScanner->pCur = p + 1;
+            if (pOut)
+                pOut[cbStored] = '\0';
+            if (pcbLen)
+                *pcbLen = cbLen;
+            return TRUE;
+        }
+
+        if (c == '\\')
+        {
+            pScanner->pCur = p + 1;
+            if (!ScanEscape(pScanner, Utf8, &cbRun))
+                return FALSE;
+            p = pScanner->pCur;
+            pRun = Utf8;
+        }
+        else if (c < 0x20)
+        {
+            return FALSE;
+        }
+        else
+        {
+            cbRun = GetUtf8SequenceLength(p, pEnd);
+            if (!cbRun)
+                return FALSE;
+            pRun = p;
+            p += cbRun;
+        }
+
+        if (pOut && cbStored == cbLen && cbRun <= cbOutMax - cbStored)
+        {
+            memcpy(pOut + cbStored, pRun, cbRun);
+            cbStored += cbRun;
+        }
+        cbLen += cbRun;
+    }
+}
+
+// scan a non-negative integer without fraction or exponent that fits in 32 bits.
+static BOOL ScanUint(_Inout_ PJSON_SCANNER pScanner, _Out_ UINT* pValue)
+{
+    UINT64 Value = 0;
+    const BYTE* pStart;
+
+    SkipWhitespace(pScanner);
+    pStart = pScanner->pCur;
+    while (pScanner->pCur < pScanner->pEnd && *pScanner->pCur >= '0' && *pScanner->pCur <= '9')
+    {
+        Value = Value * 10 + (*pScanner->pCur - '0');
+        if (Value > MAXUINT32)
+            return FALSE;
+        pScanner->pCur++;
+    }
+    if (pScanner->pCur == pStart)
+        return FALSE;
+    if (*pStart == '0' && pScanner->pCur - pStart > 1) // no leading zeros in json
+        return FALSE;
+    if (pScanner->pCur < pScanner->pEnd)
+    {
+        BYTE c = *pScanner->pCur;
+        if (c == '.' || c == 'e' || c == 'E')
+            return FALSE;
+    }
+    *pValue = (UINT)Value;
+    return TRUE;
+}
+
+static BOOL ScanBool(_Inout_ PJSON_SCANNER pScanner, _Out_ BOOL* pValue)
+{
+    BYTE c = PeekChar(pScanner);
+    if (c == 't' && ConsumeLiteral(pScanner, "true", 4))
+    {
+        *pValue = TRUE;
+        return TRUE;
+    }
+    if (c == 'f' && ConsumeLiteral(pScanner, "false", 5))
+    {
+        *pValue = FALSE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL SkipDigits(_Inout_ PJSON_SCANNER pScanner)
+{
+    const BYTE* pStart = pScanner->pCur;
+    while (pScanner->pCur < pScanner->pEnd && *pScanner->pCur >= '0' && *pScanner->pCur <= '9')
+        pScanner->pCur++;
+    return pScanner->pCur != pStart;
+}
+
+static BOOL SkipNumber(_Inout_ PJSON_SCANNER pScanner)
+{
+    SkipWhitespace(pScanner);
+    if (pScanner->pCur < pScanner->pEnd && *pScanner->pCur == '-')
+        pScanner->pCur++;
+    if (!SkipDigits(pScanner))
+        return FALSE;
+    if (pScanner->pCur < pScanner->pEnd && *pScanner->pCur == '.')
+    {
+        pScanner->pCur++;
+        if (!SkipDigits(pScanner))
+            return FALSE;
+    }
+    if (pScanner->pCur < pScanner->pEnd && (*pScanner->pCur == 'e' || *pScanner->pCur == 'E'))
+    {
+        pScanner->pCur++;
+        if (pScanner->pCur < pScanner->pEnd && (*pScanner->pCur == '+' || *pScanner->pCur == '-'))
+            pScanner->pCur++;
+        if (!SkipDigits(pScanner))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// skip the rest of an array or object, the opening bracket is consumed already.
+static BOOL SkipContainer(_Inout_ PJSON_SCANNER pScanner, _In_ BYTE Close, _In_ UINT Depth)
+{
+    if (ConsumeChar(pScanner, Close))
+        return TRUE;
+
+    for (;;)
+    {
+        if (Close == '}')
+        {
+            if (!ScanString(pScanner, NULL, 0, NULL) || !ConsumeChar(pScanner, ':'))
+                return FALSE;
+        }
+        if (!SkipValue(pScanner, Depth))
+            return FALSE;
+        if (ConsumeChar(pScanner, ','))
+            continue;
+        return ConsumeChar(pScanner, Close);
+    }
+}
+
+static BOOL SkipValue(_Inout_ PJSON_SCANNER pScanner, _In_ UINT Depth)
+{
+    switch (PeekChar(pScanner))
+    {
+    case '"':
+        return ScanString(pScanner, NULL, 0, NULL);
+    case '{':
+    case '[':
+    {
+        BYTE Close = *pScanner->pCur == '{' ? '}' : ']';
+        if (Depth >= JSON_MAX_DEPTH)
+            return FALSE;
+        pScanner->pCur++;
+        return SkipContainer(pScanner, Close, Depth + 1);
+    }
+    case 't':
+        return ConsumeLiteral(pScanner, "true", 4);
+    case 'f':
+        return ConsumeLiteral(pScanner, "false", 5);
+    case 'n':
+        return ConsumeLiteral(pScanner, "null", 4);
+    default:
+        return SkipNumber(pScanner);
+    }
+}
+
+// Scan a string that is only compared: a key or the message type. Without escapes it stays where it is
+// and *ppName points into the input, otherwise it is decoded into Buffer.
+static BOOL ScanName(
+    _Inout_ PJSON_SCANNER pScanner,
+    _Out_writes_(JSON_KEY_MAXLEN + 1) CHAR Buffer[],
+    _Outptr_ const CHAR** ppName,
+    _Out_ UINT* pcbName)
+{
+    *ppName = Buffer;
+    if (PeekChar(pScanner) != '"')
+        return FALSE;
+
+    const BYTE* pStart = pScanner->pCur + 1;
+    const BYTE* p = SkipPlainAscii(pStart, pScanner->pEnd);
+    if (p < pScanner->pEnd && *p == '"')
+    {
+        *ppName = (const CHAR*)pStart;
+        *pcbName = (UINT)(p - pStart);
+        pScanner->pCur = p + 1;
+        return TRUE;
+    }
+    return ScanString(pScanner, Buffer, JSON_KEY_MAXLEN, pcbName);
+}
+
+// scan a member key and the following colon.
+static BOOL ScanKey(
+    _Inout_ PJSON_SCANNER pScanner,
+    _Out_writes_(JSON_KEY_MAXLEN + 1) CHAR Buffer[],
+    _Outptr_ const CHAR** ppKey,
+    _Out_ UINT* pcbKey)
+{
+    return ScanName(pScanner, Buffer, ppKey, pcbKey) && ConsumeChar(pScanner, ':');
+}
+
+static BOOL IsKey(_In_ const CHAR Key[], _In_ UINT cbKey, _In_z_ const CHAR* pName, _In_ UINT cbName)
+{
+    return cbKey == cbName && memcmp(Key, pName, cbName) == 0;
+}
+
+static BOOL ScanMessageType(_Inout_ PJSON_SCANNER pScanner, _Outptr_result_maybenull_ const MESSAGE_SCHEMA** ppSchema)
+{
+    CHAR Buffer[JSON_KEY_MAXLEN + 1];
+    const CHAR* pTypeName;
+    UINT cbTypeName;
+
+    *ppSchema = NULL;
+    if (!ScanName(pScanner, Buffer, &pTypeName, &cbTypeName))
+        return FALSE;
+
+    for (SIZE_T i = 0; i < _countof(MessageSchemaList); i++)
+    {
+        if (IsKey(pTypeName, cbTypeName, MessageSchemaList[i].TypeName, MessageSchemaList[i].TypeNameLen))
+        {
+            *ppSchema = &MessageSchemaList[i];
+            return TRUE;
+        }
+    }
+    return FALSE; // unknown type
+}
+
+// cheap pass over the root object that only looks for "type".
+static BOOL FindMessageType(
+    _In_reads_bytes_(cbJson) const BYTE* pJson,
+    _In_ ULONG cbJson,
+    _Outptr_result_maybenull_ const MESSAGE_SCHEMA** ppSchema)
+{
+    JSON_SCANNER Scanner;
+    CHAR Buffer[JSON_KEY_MAXLEN + 1];
+    const CHAR* pKey;
+    UINT cbKey;
+
+    *ppSchema = NULL;
+    InitScanner(&Scanner, pJson, cbJson);
+    if (!ConsumeChar(&Scanner, '{'))
+        return FALSE;
+
+    do
+    {
+        if (!ScanKey(&Scanner, Buffer, &pKey, &cbKey))
+            return FALSE;
+        if (IsKey(pKey, cbKey, "type", 4))
+            return ScanMessageType(&Scanner, ppSchema);
+        if (!SkipValue(&Scanner, 0))
+            return FALSE;
+    } while (ConsumeChar(&Scanner, ','));
+
+    return FALSE;
+}
+
+// *pbOversize is set when a string was cut to the MaxLen of the field.
+static BOOL ScanField(
+    _Inout_ PJSON_SCANNER pScanner,
+    _In_ const MESSAGE_FIELD* pField,
+    _Inout_ PINBOUND_MESSAGE pMessage,
+    _Out_ BOOL* pbOversize)
+{
+    PBYTE pValue = (PBYTE)pMessage + pField->Offset;
+
+    *pbOversize = FALSE;
+    switch (pField->Type)
+    {
+    case FIELD_TYPE_STRING:
+    {
+        UINT cbLen;
+        if (!ScanString(pScanner, (CHAR*)pValue, pField->MaxLen, &cbLen))
+            return FALSE;
+        *pbOversize = cbLen > pField->MaxLen;
+        return TRUE;
+    }
+
+    case FIELD_TYPE_BOOL:
+        return ScanBool(pScanner, (BOOL*)pValue);
+
+    case FIELD_TYPE_UINT:
+        return ScanUint(pScanner, (UINT*)pValue);
+
+    case FIELD_TYPE_UINT_ARRAY:
+    {
+        UINT32* pArray = (UINT32*)pValue;
+        UINT* pCount = (UINT*)((PBYTE)pMessage + pField->CountOffset);
+
+        *pCount = 0;
+        if (!ConsumeChar(pScanner, '['))
+            return FALSE;
+        if (ConsumeChar(pScanner, ']'))
+            return TRUE;
+        do
+        {
+            if (*pCount == pField->MaxLen)
+                return FALSE; // too many elements
+            if (!ScanUint(pScanner, &pArray[*pCount]))
+                return FALSE;
+            (*pCount)++;
+        } while (ConsumeChar(pScanner, ','));
+        return ConsumeChar(pScanner, ']');
+    }
+    }
+    return FALSE;
+}
+
+// Scan the members of the root object into pMessage, up to and including the closing brace.
+// bFirstMember is FALSE if a member was consumed already.
+static BOOL ScanMembers(
+    _Inout_ PJSON_SCANNER pScanner,
+    _In_ const MESSAGE_SCHEMA* pSchema,
+    _In_ BOOL bFirstMember,
+    _Inout_ PINBOUND_MESSAGE pMessage)
+{
+    CHAR Buffer[JSON_KEY_MAXLEN + 1];
+    const CHAR* pKey;
+    UINT cbKey;
+
+    if (ConsumeChar(pScanner, '}'))
+        return TRUE;
+    if (!bFirstMember && !ConsumeChar(pScanner, ','))
+        return FALSE;
+
+    do
+    {
+        const MESSAGE_FIELD* pField = NULL;
+        UINT FieldIndex;
+        BOOL bOversize;
+
+        if (!ScanKey(pScanner, Buffer, &pKey, &cbKey))
+            return FALSE;
+
+        for (FieldIndex = 0; pSchema->FieldList[FieldIndex].Key; FieldIndex++)
+        {
+            if (IsKey(pKey, cbKey, pSchema->FieldList[FieldIndex].Key, pSchema->FieldList[FieldIndex].KeyLen))
+            {
+                pField = &pSchema->FieldList[FieldIndex];
+                break;
+            }
+        }
+
+        if (pField)
+        {
+            if (!ScanField(pScanner, pField, pMessage, &bOversize))
+                return FALSE;
+            pMessage->FieldMask |= 1u << FieldIndex;
+            pMessage->OversizeMask |= (UINT)bOversize << FieldIndex;
+        }
+        else
+        {
+            // "type" or a field we don't know.
+            if (!SkipValue(pScanner, 0))
+                return FALSE;
+        }
+    } while (ConsumeChar(pScanner, ','));
+
+    return ConsumeChar(pScanner, '}');
+}
+
+static BOOL HasRequiredFields(_In_ const MESSAGE_SCHEMA* pSchema, _In_ const INBOUND_MESSAGE* pMessage)
+{
+    for (UINT i = 0; pSchema->FieldList[i].Key; i++)
+    {
+        if (pSchema->FieldList[i].bRequired && !(pMessage->FieldMask & (1u << i)))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+_Ret_maybenull_
+const MESSAGE_SCHEMA* DecodeJsonMessage(
+    _In_reads_bytes_(cbMessageLen) const BYTE* pJsonMessage,
+    _In_ ULONG cbMessageLen,
+    _Out_ PINBOUND_MESSAGE pMessage)
+{
+    JSON_SCANNER Scanner;
+    const MESSAGE_SCHEMA* pSchema = NULL;
+    CHAR Buffer[JSON_KEY_MAXLEN + 1];
+    const CHAR* pKey;
+    UINT cbKey;
+    BOOL bFirstMember;
+
+    pMessage->FieldMask = 0;
+    pMessage->OversizeMask = 0;
+    if (cbMessageLen > INBOUND_MESSAGE_MAXLEN)
+        return NULL;
+
+    InitScanner(&Scanner, pJsonMessage, cbMessageLen);
+    if (!ConsumeChar(&Scanner, '{'))
+        return NULL;
+    if (!ScanKey(&Scanner, Buffer, &pKey, &cbKey))
+        return NULL;
+
+    if (IsKey(pKey, cbKey, "type", 4))
+    {
+        // usual case: "type" comes first, decode the rest in the same pass.
+        if (!ScanMessageType(&Scanner, &pSchema))
+            return NULL;
+        bFirstMember = FALSE;
+    }
+    else
+    {
+        // find out the type first, then start over.
+        if (!FindMessageType(pJsonMessage, cbMessageLen, &pSchema))
+            return NULL;
+        InitScanner(&Scanner, pJsonMessage, cbMessageLen);
+        ConsumeChar(&Scanner, '{');
+        bFirstMember = TRUE;
+    }
+
+    if (!ScanMembers(&Scanner, pSchema, bFirstMember, pMessage))
+        return NULL;
+
+    SkipWhitespace(&Scanner);
+    if (Scanner.pCur != Scanner.pEnd) // trailing garbage
+        return NULL;
+
+    if (!HasRequiredFields(pSchema, pMessage))
+        return NULL;
+    CountMessageIn((UINT)(pSchema - MessageSchemaList));
+    return pSchema;
+}
+
+typedef struct _BIN_READER
+{
+    const BYTE* pCur;
+    const BYTE* pEnd;
+} BIN_READER, * PBIN_READER;
+
+// LEB128, at most 5 bytes for 32 bits.
+static BOOL ReadVarint(_Inout_ PBIN_READER pReader, _Out_ UINT* pValue)
+{
+    UINT Value = 0;
+    for (UINT Shift = 0; Shift < 35; Shift += 7)
+    {
+        if (pReader->pCur >= pReader->pEnd)
+            return FALSE;
+        BYTE b = *pReader->pCur++;
+        if (Shift == 28 && b > 0x0F) // doesn't fit in 32 bits
+            return FALSE;
+        Value |= (UINT)(b & 0x7F) << Shift;
+        if (!(b & 0x80))
+        {
+            *pValue = Value;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// length prefixed UTF-8, no zero bytes allowed since we hand out zero terminated strings.
+// A string longer than cbOutMax is cut like ScanString does, *pbOversize is set then.
+static BOOL ReadString(_Inout_ PBIN_READER pReader, _Out_writes_(cbOutMax + 1) CHAR* pOut, _In_ UINT cbOutMax, _Out_ BOOL* pbOversize)
+{
+    UINT cbLen;
+    if (!ReadVarint(pReader, &cbLen))
+        return FALSE;
+    if ((SIZE_T)(pReader->pEnd - pReader->pCur) < cbLen)
+        return FALSE;
+
+    const BYTE* p = pReader->pCur;
+    const BYTE* pEnd = p + cbLen;
+    UINT cbKept = 0; // the longest prefix that fits and ends on a sequence boundary
+    while (p < pEnd)
+    {
+        UINT cbUtf8 = 1;
+        if (*p == 0)
+            return FALSE;
+        if (*p >= 0x80)
+        {
+            cbUtf8 = GetUtf8SequenceLength(p, pEnd);
+            if (!cbUtf8)
+                return FALSE;
+        }
+        p += cbUtf8;
+        if ((UINT)(p - pReader->pCur) <= cbOutMax)
+            cbKept = (UINT)(p - pReader->pCur);
+    }
+
+    memcpy(pOut, pReader->pCur, cbKept);
+    pOut[cbKept] = '\0';
+    *pbOversize = cbLen > cbOutMax;
+    pReader->pCur = pEnd;
+    return TRUE;
+}
+
+static BOOL ReadField(
+    _Inout_ PBIN_READER pReader,
+    _In_ const MESSAGE_FIELD* pField,
+    _Inout_ PINBOUND_MESSAGE pMessage,
+    _Out_ BOOL* pbOversize)
+{
+    PBYTE pValue = (PBYTE)pMessage + pField->Offset;
+
+    *pbOversize = FALSE;
+    switch (pField->Type)
+    {
+    case FIELD_TYPE_STRING:
+        return ReadString(pReader, (CHAR*)pValue, pField->MaxLen, pbOversize);
+
+    case FIELD_TYPE_BOOL:
+        if (pReader->pCur >= pReader->pEnd || *pReader->pCur > 1)
+            return FALSE;
+        *(BOOL*)pValue = *pReader->pCur++;
+        return TRUE;
+
+    case FIELD_TYPE_UINT:
+        return ReadVarint(pReader, (UINT*)pValue);
+
+    case FIELD_TYPE_UINT_ARRAY:
+    {
+        UINT32* pArray = (UINT32*)pValue;
+        UINT* pCount = (UINT*)((PBYTE)pMessage + pField->CountOffset);
+
+        if (!ReadVarint(pReader, pCount) || *pCount > pField->MaxLen)
+            return FALSE;
+        for (UINT i = 0; i < *pCount; i++)
+        {
+            if (!ReadVarint(pReader, &pArray[i]))
+                return FALSE;
+        }
+        return TRUE;
+    }
+    }
+    return FALSE;
+}
+
+_Ret_maybenull_
+const MESSAGE_SCHEMA* DecodeBinaryMessage(
+    _In_ UINT TypeIndex,
+    _In_reads_bytes_(cbPayloadLen) const BYTE* pPayload,
+    _In_ ULONG cbPayloadLen,
+    _Out_ PINBOUND_MESSAGE pMessage)
+{
+    BIN_READER Reader;
+    const MESSAGE_SCHEMA* pSchema;
+    UINT PresentMask;
+
+    pMessage->FieldMask = 0;
+    pMessage->OversizeMask = 0;
+    if (TypeIndex >= _countof(MessageSchemaList) || cbPayloadLen > INBOUND_MESSAGE_MAXLEN)
+        return NULL;
+    pSchema = &MessageSchemaList[TypeIndex];
+
+    Reader.pCur = pPayload;
+    Reader.pEnd = pPayload + cbPayloadLen;
+    if (!ReadVarint(&Reader, &PresentMask))
+        return NULL;
+
+    // present fields follow in schema order.
+    UINT FieldIndex;
+    for (FieldIndex = 0; pSchema->FieldList[FieldIndex].Key; FieldIndex++)
+    {
+        BOOL bOversize;
+        if (!(PresentMask & (1u << FieldIndex)))
+            continue;
+        if (!ReadField(&Reader, &pSchema->FieldList[FieldIndex], pMessage, &bOversize))
+            return NULL;
+        pMessage->FieldMask |= 1u << FieldIndex;
+        pMessage->OversizeMask |= (UINT)bOversize << FieldIndex;
+    }
+
+    if (PresentMask >> FieldIndex) // bits for fields we don't have
+        return NULL;
+    if (Reader.pCur != Reader.pEnd)
+        return NULL;
+
+    if (!HasRequiredFields(pSchema, pMessage))
+        return NULL;
+    CountMessageIn(TypeIndex);
+    return pSchema;
+}
+
+BOOL SplitJsonArray(
+    _In_reads_bytes_(cbArrayLen) const BYTE* pJsonArray,
+    _In_ ULONG cbArrayLen,
+    _Out_writes_to_(MaxCount, *pCount) PJSON_SPAN SpanList,
+    _In_ UINT MaxCount,
+    _Out_ UINT* pCount)
+{
+    JSON_SCANNER Scanner;
+
+    *pCount = 0;
+    if (cbArrayLen > INBOUND_COMMANDS_MAXLEN)
+        return FALSE;
+
+    InitScanner(&Scanner, pJsonArray, cbArrayLen);
+    if (!ConsumeChar(&Scanner, '['))
+        return FALSE;
+
+    if (!ConsumeChar(&Scanner, ']'))
+    {
+        for (;;)
+        {
+            if (*pCount == MaxCount)
+                return FALSE;
+
+            SkipWhitespace(&Scanner);
+            const BYTE* pStart = Scanner.pCur;
+            if (!SkipValue(&Scanner, 1))
+                return FALSE;
+
+            SpanList[*pCount].pStart = pStart;
+            SpanList[*pCount].cbLen = (ULONG)(Scanner.pCur - pStart);
+            (*pCount)++;
+
+            if (ConsumeChar(&Scanner, ','))
+                continue;
+            if (!ConsumeChar(&Scanner, ']'))
+                return FALSE;
+            break;
+        }
+    }
+
+    SkipWhitespace(&Scanner);
+    return Scanner.pCur == Scanner.pEnd; // no trailing garbage
+}
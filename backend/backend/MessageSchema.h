@@ -0,0 +1,161 @@
+#pragma once
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "RoomManager.h"
+
+// Inbound messages larger than this are rejected before scanning.
+#define INBOUND_MESSAGE_MAXLEN 4096
+
+// A frame may also carry a JSON array of messages, see SplitJsonArray.
+#define INBOUND_COMMANDS_MAX 16
+#define INBOUND_COMMANDS_MAXLEN (INBOUND_COMMANDS_MAX * INBOUND_MESSAGE_MAXLEN)
+
+#define FIELD_REQUIRED TRUE
+#define FIELD_OPTIONAL FALSE
+
+typedef enum _MESSAGE_FIELD_TYPE
+{
+    FIELD_TYPE_STRING,
+    FIELD_TYPE_BOOL,
+    FIELD_TYPE_UINT,
+    FIELD_TYPE_UINT_ARRAY,
+} MESSAGE_FIELD_TYPE;
+
+typedef struct _MESSAGE_FIELD
+{
+    const CHAR* Key;
+    UINT KeyLen;
+    MESSAGE_FIELD_TYPE Type;
+    BOOL bRequired;
+    UINT MaxLen;        // max bytes of a string (without trailing zero), max element count of an array
+    SIZE_T Offset;      // offset of the value in MSG_*
+    SIZE_T CountOffset; // offset of the element count in MSG_*, arrays only
+} MESSAGE_FIELD, * PMESSAGE_FIELD;
+
+// Generate the message type index: MESSAGE_TYPE_<TYPE>, also the binary type of the message
+#define MESSAGE_BEGIN(Type, Handler, Name) MESSAGE_TYPE_##Type,
+#define FIELD_STRING(Type, Member, Key, MaxLen, Flags)
+#define FIELD_BOOL(Type, Member, Key, Flags)
+#define FIELD_UINT(Type, Member, Key, Flags)
+#define FIELD_UINT_ARRAY(Type, Member, Key, MaxCnt, Flags)
+#define MESSAGE_END(Type)
+enum {
+#include "MessageSchema.inl"
+    MESSAGE_TYPE_COUNT
+};
+#undef MESSAGE_BEGIN
+#undef FIELD_STRING
+#undef FIELD_BOOL
+#undef FIELD_UINT
+#undef FIELD_UINT_ARRAY
+#undef MESSAGE_END
+
+// Generate the field index of each message: <TYPE>_FIELD_<Member>
+#define MESSAGE_BEGIN(Type, Handler, Name) enum {
+#define FIELD_STRING(Type, Member, Key, MaxLen, Flags) Type##_FIELD_##Member,
+#define FIELD_BOOL(Type, Member, Key, Flags) Type##_FIELD_##Member,
+#define FIELD_UINT(Type, Member, Key, Flags) Type##_FIELD_##Member,
+#define FIELD_UINT_ARRAY(Type, Member, Key, MaxCnt, Flags) Type##_FIELD_##Member,
+#define MESSAGE_END(Type) Type##_FIELD_COUNT };
+#include "MessageSchema.inl"
+#undef MESSAGE_BEGIN
+#undef FIELD_STRING
+#undef FIELD_BOOL
+#undef FIELD_UINT
+#undef FIELD_UINT_ARRAY
+#undef MESSAGE_END
+
+// Generate the message structs: MSG_<TYPE>
+// FieldMask has bit <TYPE>_FIELD_<Member> set for every field present in the message,
+// OversizeMask for every string that was longer than its MaxLen and is cut to it.
+// Members of fields that are not present are left undefined by the decoders.
+#define MESSAGE_BEGIN(Type, Handler, Name) typedef struct _MSG_##Type { UINT FieldMask; UINT OversizeMask;
+#define FIELD_STRING(Type, Member, Key, MaxLen, Flags) CHAR Member[(MaxLen) + 1];
+#define FIELD_BOOL(Type, Member, Key, Flags) BOOL Member;
+#define FIELD_UINT(Type, Member, Key, Flags) UINT Member;
+#define FIELD_UINT_ARRAY(Type, Member, Key, MaxCnt, Flags) UINT32 Member[MaxCnt]; UINT Member##Cnt;
+#define MESSAGE_END(Type) } MSG_##Type, * PMSG_##Type;
+#include "MessageSchema.inl"
+#undef MESSAGE_BEGIN
+#undef FIELD_STRING
+#undef FIELD_BOOL
+#undef FIELD_UINT
+#undef FIELD_UINT_ARRAY
+#undef MESSAGE_END
+
+// Storage large enough for any inbound message.
+#define MESSAGE_BEGIN(Type, Handler, Name) MSG_##Type Handler;
+#define FIELD_STRING(Type, Member, Key, MaxLen, Flags)
+#define FIELD_BOOL(Type, Member, Key, Flags)
+#define FIELD_UINT(Type, Member, Key, Flags)
+#define FIELD_UINT_ARRAY(Type, Member, Key, MaxCnt, Flags)
+#define MESSAGE_END(Type)
+typedef union _INBOUND_MESSAGE
+{
+    struct
+    {
+        UINT FieldMask; // shared by every MSG_* as its first members
+        UINT OversizeMask;
+    };
+#include "MessageSchema.inl"
+} INBOUND_MESSAGE, * PINBOUND_MESSAGE;
+#undef MESSAGE_BEGIN
+#undef FIELD_STRING
+#undef FIELD_BOOL
+#undef FIELD_UINT
+#undef FIELD_UINT_ARRAY
+#undef MESSAGE_END
+
+#define MESSAGE_FIELD_PRESENT(pMessage, Type, Member) (((pMessage)->FieldMask >> Type##_FIELD_##Member) & 1)
+
+// The string was longer than the MaxLen of its field, the member holds what fits.
+// Handlers answer with their own error, the limits are only those in MessageSchema.inl.
+#define MESSAGE_FIELD_OVERSIZE(pMessage, Type, Member) (((pMessage)->OversizeMask >> Type##_FIELD_##Member) & 1)
+
+typedef BOOL(*MESSAGE_HANDLER)(_Inout_ PCONNECTION_INFO pConnInfo, _In_ const VOID* pMessage);
+
+typedef struct _MESSAGE_SCHEMA
+{
+    const CHAR* TypeName;
+    UINT TypeNameLen;
+    const MESSAGE_FIELD* FieldList; // terminated by an entry with NULL Key
+    MESSAGE_HANDLER HandlerProc;
+} MESSAGE_SCHEMA, * PMESSAGE_SCHEMA;
+
+// Decode a JSON message straight into pMessage in one pass.
+// Field types and array sizes are checked while scanning, oversized strings are cut and marked in OversizeMask.
+// Returns the schema of the message (use its HandlerProc to dispatch), or NULL if the message is malformed.
+_Ret_maybenull_
+const MESSAGE_SCHEMA* DecodeJsonMessage(
+    _In_reads_bytes_(cbMessageLen) const BYTE* pJsonMessage,
+    _In_ ULONG cbMessageLen,
+    _Out_ PINBOUND_MESSAGE pMessage);
+
+// Decode the payload of a binary message (see BinaryHandler.h) into pMessage.
+// TypeIndex is the position of the message in MessageSchema.inl. Oversized strings are cut as by DecodeJsonMessage.
+// Returns the schema of the message, or NULL if the message is malformed.
+_Ret_maybenull_
+const MESSAGE_SCHEMA* DecodeBinaryMessage(
+    _In_ UINT TypeIndex,
+    _In_reads_bytes_(cbPayloadLen) const BYTE* pPayload,
+    _In_ ULONG cbPayloadLen,
+    _Out_ PINBOUND_MESSAGE pMessage);
+
+// Schema of the message type at TypeIndex (MESSAGE_TYPE_*), NULL past the last one.
+_Ret_maybenull_
+const MESSAGE_SCHEMA* GetMessageSchema(_In_ UINT TypeIndex);
+
+typedef struct _JSON_SPAN
+{
+    const BYTE* pStart;
+    ULONG cbLen;
+} JSON_SPAN, * PJSON_SPAN;
+
+// Split a JSON array of messages into the spans of its elements, each one is then decoded by DecodeJsonMessage.
+// Returns FALSE if the array is malformed or has more than MaxCount elements.
+BOOL SplitJsonArray(
+    _In_reads_bytes_(cbArrayLen) const BYTE* pJsonArray,
+    _In_ ULONG cbArrayLen,
+    _Out_writes_to_(MaxCount, *pCount) PJSON_SPAN SpanList,
+    _In_ UINT MaxCount,
+    _Out_ UINT* pCount);
@@ -0,0 +1,67 @@
+// Inbound message schema. Included several times by MessageSchema.h / MessageSchema.c
+// with different definitions of the macros below to generate the message structs,
+// the field tables and the dispatch table. No include guard on purpose.
+//
+// MESSAGE_BEGIN(TYPE, Handler, "jsonType")  -> MSG_TYPE, dispatched to Handle##Handler
+// FIELD_STRING(TYPE, Member, "key", MaxLen, Flags)      -> CHAR Member[MaxLen + 1], cut if longer, see MESSAGE_FIELD_OVERSIZE
+// FIELD_BOOL(TYPE, Member, "key", Flags)                -> BOOL Member
+// FIELD_UINT(TYPE, Member, "key", Flags)                -> UINT Member
+// FIELD_UINT_ARRAY(TYPE, Member, "key", MaxCnt, Flags)  -> UINT32 Member[MaxCnt], UINT Member##Cnt
+// MESSAGE_END(TYPE)
+//
+// The binary protocol identifies messages by their position in this list and fields by
+// their position in the message, so only append new messages and fields at the end.
+
+MESSAGE_BEGIN(CREATE_ROOM, CreateRoom, "createRoom")
+    FIELD_STRING(CREATE_ROOM, Name,     "name",     PLAYER_NICK_MAXLEN,   FIELD_REQUIRED)
+    FIELD_STRING(CREATE_ROOM, Password, "password", ROOM_PASSWORD_MAXLEN, FIELD_OPTIONAL)
+MESSAGE_END(CREATE_ROOM)
+
+MESSAGE_BEGIN(JOIN_ROOM, JoinRoom, "joinRoom")
+    FIELD_STRING(JOIN_ROOM, Name,       "name",       PLAYER_NICK_MAXLEN,   FIELD_REQUIRED)
+    FIELD_STRING(JOIN_ROOM, Password,   "password",   ROOM_PASSWORD_MAXLEN, FIELD_OPTIONAL)
+    FIELD_STRING(JOIN_ROOM, RoomNumber, "roomNumber", ROOM_NUMBER_MAXLEN,   FIELD_REQUIRED)
+MESSAGE_END(JOIN_ROOM)
+
+MESSAGE_BEGIN(CHANGE_AVATAR, ChangeAvatar, "changeAvatar")
+    FIELD_STRING(CHANGE_AVATAR, Avatar, "avatar", PLAYER_AVATAR_MAXLEN, FIELD_REQUIRED)
+MESSAGE_END(CHANGE_AVATAR)
+
+MESSAGE_BEGIN(LEAVE_ROOM, LeaveRoom, "leaveRoom")
+MESSAGE_END(LEAVE_ROOM)
+
+MESSAGE_BEGIN(START_GAME, StartGame, "startGame")
+MESSAGE_END(START_GAME)
+
+MESSAGE_BEGIN(PLAYER_SELECT_TEAM, PlayerSelectTeam, "playerSelectTeam")
+    FIELD_UINT_ARRAY(PLAYER_SELECT_TEAM, Team, "team", ROOM_PLAYER_MAX, FIELD_REQUIRED)
+MESSAGE_END(PLAYER_SELECT_TEAM)
+
+MESSAGE_BEGIN(PLAYER_CONFIRM_TEAM, PlayerConfirmTeam, "playerConfirmTeam")
+MESSAGE_END(PLAYER_CONFIRM_TEAM)
+
+MESSAGE_BEGIN(PLAYER_VOTE_TEAM, PlayerVoteTeam, "playerVoteTeam")
+    FIELD_BOOL(PLAYER_VOTE_TEAM, bVote, "vote", FIELD_REQUIRED)
+MESSAGE_END(PLAYER_VOTE_TEAM)
+
+MESSAGE_BEGIN(PLAYER_CONDUCT_MISSION, PlayerConductMission, "playerConductMission")
+    FIELD_BOOL(PLAYER_CONDUCT_MISSION, bPerform, "perform", FIELD_REQUIRED)
+MESSAGE_END(PLAYER_CONDUCT_MISSION)
+
+MESSAGE_BEGIN(PLAYER_FAIRY_INSPECT, PlayerFairyInspect, "playerFairyInspect")
+    FIELD_UINT(PLAYER_FAIRY_INSPECT, ID, "ID", FIELD_REQUIRED)
+MESSAGE_END(PLAYER_FAIRY_INSPECT)
+
+MESSAGE_BEGIN(PLAYER_ASSASSINATE, PlayerAssassinate, "playerAssassinate")
+    FIELD_UINT(PLAYER_ASSASSINATE, ID, "ID", FIELD_REQUIRED)
+MESSAGE_END(PLAYER_ASSASSINATE)
+
+MESSAGE_BEGIN(PLAYER_TEXT_MESSAGE, PlayerTextMessage, "playerTextMessage")
+    FIELD_STRING(PLAYER_TEXT_MESSAGE, Message, "message", PLAYER_MESSAGE_MAXLEN, FIELD_REQUIRED)
+MESSAGE_END(PLAYER_TEXT_MESSAGE)
+
+MESSAGE_BEGIN(ROOM_STATUS_SYNC, RoomStatusSync, "roomStatusSync")
+MESSAGE_END(ROOM_STATUS_SYNC)
+
+MESSAGE_BEGIN(BATCH_EVENTS, BatchEvents, "batchEvents")
+MESSAGE_END(BATCH_EVENTS)
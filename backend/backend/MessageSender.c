@@ -1,643 +1,1115 @@
-#include "common.h"
-#include "yyjson.h"
-#include "JsonHandler.h"
-#include "MessageSender.h"
-
-static const CHAR* GetRoleString(UINT Role)
-{
-    // correspond with the ROLE_* MACRO
-    // TODO: assert here
-    static const CHAR* RoleTable[] = { NULL, "MERLIN", "PERCIVAL", "ASSASSIN", "MORDRED", "OBERON", "MORGANA", "LOYALIST", "MINIONS" };
-    return RoleTable[Role];
-}
-
-static const CHAR* GetHintTypeString(UINT HintType)
-{
-    // correspond with the HINT_* MACRO
-    // TODO: assert here
-    static const CHAR* HintStrTable[] = { NULL, "GOOD", "BAD", "MERLIN_OR_MORGANA", "ASSASSIN", "MORDRED", "MORGANA", "MINIONS" };
-    return HintStrTable[HintType];
-}
-
-static BOOL ReplySimpleMessage(_In_ PCONNECTION_INFO pConnInfo, _In_z_ CHAR szType[], _In_ BOOL bResult, _In_opt_z_ CHAR Reason[])
-{
-    // Create a mutable doc
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", szType);
-        yyjson_mut_obj_add_str(doc, root, "result", bResult ? "success" : "fail");
-
-        if (!bResult)
-            yyjson_mut_obj_add_str(doc, root, "reason", Reason);
-
-        bSuccess = SendJsonMessage(pConnInfo, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-// Only sends to player online & gaming
-BOOL BroadcastGamingJsonMessage(_In_ PGAME_ROOM pRoom, _In_ yyjson_mut_doc* JsonDoc)
-{
-    for (UINT i = 0; i < pRoom->WaitingCount; i++) // this is also currently online user
-    {
-        if (!SendJsonMessage(pRoom->WaitingList[i].pConnInfo, JsonDoc))
-            return FALSE;
-    }
-    return TRUE;
-}
-
-BOOL ReplyCreateRoom(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_ UINT RoomNum, _In_ UINT ID, _In_opt_z_ CHAR* Reason)
-{
-    char szRoomNumber[10 + 1] = { 0 }; // MAXUINT32 tooks 10 char to store under decimal, without trailing zero.
-
-    // Create a mutable doc
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "createRoom");
-        yyjson_mut_obj_add_str(doc, root, "result", bResult ? "success" : "fail");
-
-        if (bResult)
-        {
-            sprintf_s(szRoomNumber, _countof(szRoomNumber), "%d", RoomNum + ROOM_NUMBER_MIN);
-            yyjson_mut_obj_add_str(doc, root, "roomNumber", szRoomNumber);
-            yyjson_mut_obj_add_uint(doc, root, "ID", ID);
-        }
-        else
-        {
-            yyjson_mut_obj_add_str(doc, root, "reason", Reason);
-        }
-
-        bSuccess = SendJsonMessage(pConnInfo, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL ReplyJoinRoom(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_ UINT ID, _In_opt_z_ CHAR* Reason)
-{
-    // Create a mutable doc
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "joinRoom");
-        yyjson_mut_obj_add_str(doc, root, "result", bResult ? "success" : "fail");
-
-        if (bResult)
-        {
-            yyjson_mut_obj_add_uint(doc, root, "ID", ID);
-        }
-        else
-        {
-            yyjson_mut_obj_add_str(doc, root, "reason", Reason);
-        }
-
-        bSuccess = SendJsonMessage(pConnInfo, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL ReplyLeaveRoom(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "leaveRoom", bResult, Reason);
-}
-
-BOOL ReplyStartGame(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "startGame", bResult, Reason);
-}
-
-BOOL ReplyPlayerSelectTeam(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "playerSelectTeam", bResult, Reason);
-}
-
-BOOL ReplyPlayerConfirmTeam(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "playerConfirmTeam", bResult, Reason);
-}
-
-BOOL ReplyPlayerVoteTeam(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "playerVoteTeam", bResult, Reason);
-}
-
-BOOL ReplyPlayerConductMission(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "playerConductMission", bResult, Reason);
-}
-
-BOOL ReplyPlayerFairyInspect(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "playerFairyInspect", bResult, Reason);
-}
-
-BOOL ReplyPlayerAssassinate(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "playerAssassinate", bResult, Reason);
-}
-
-BOOL ReplyPlayerTextMessage(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
-{
-    return ReplySimpleMessage(pConnInfo, "playerTextMessage", bResult, Reason);
-}
-
-BOOL SendBeginGame(_In_ PCONNECTION_INFO pConnInfo, _In_ UINT Role, _In_ BOOL bFairyEnabled, _In_ UINT FairyID)
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "beginGame");
-        yyjson_mut_obj_add_str(doc, root, "role", GetRoleString(Role));
-        if (bFairyEnabled)
-        {
-            yyjson_mut_obj_add_uint(doc, root, "fairyID", FairyID);
-        }
-        bSuccess = SendJsonMessage(pConnInfo, doc); 
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL SendRoleHint(_In_ PCONNECTION_INFO pConnInfo, _In_ UINT HintCnt, _In_ HINTLIST HintList[])
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "roleHint");
-
-        yyjson_mut_val* HintListVal = yyjson_mut_arr(doc);
-        if (!HintListVal)
-            __leave;
-
-        for (UINT i = 0; i < HintCnt; i++)
-        {
-            yyjson_mut_val* HintVal = yyjson_mut_arr_add_obj(doc, HintListVal);
-            yyjson_mut_obj_add_uint(doc, HintVal, "ID", HintList[i].ID);
-            yyjson_mut_obj_add_str(doc, HintVal, "HintType", GetHintTypeString(HintList[i].HintType));
-        }
-        yyjson_mut_obj_add_val(doc, root, "HintList", HintListVal);
-
-        bSuccess = SendJsonMessage(pConnInfo, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL SendSetLeader(_In_ PCONNECTION_INFO pConnInfo, _In_ UINT ID)
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "setLeader");
-        yyjson_mut_obj_add_uint(doc, root, "ID", ID);
-
-        bSuccess = SendJsonMessage(pConnInfo, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastRoomStatus(_In_ PGAME_ROOM pRoom)
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "roomStatus");
-
-        yyjson_mut_val* PlayerListVal = yyjson_mut_arr(doc);
-        if (!PlayerListVal)
-            __leave;
-
-        if (pRoom->bGaming)
-        {
-            for (UINT i = 0; i < pRoom->PlayingCount; i++)
-            {
-                yyjson_mut_val* Player = yyjson_mut_arr_add_obj(doc, PlayerListVal);
-                yyjson_mut_obj_add_str(doc, Player, "name", pRoom->PlayingList[i].NickName);
-                yyjson_mut_obj_add_uint(doc, Player, "ID", pRoom->PlayingList[i].GameID);
-                yyjson_mut_obj_add_str(doc, Player, "avatar", pRoom->PlayingList[i].Avatar);
-                yyjson_mut_obj_add_bool(doc, Player, "isOwner", pRoom->PlayingList[i].bIsRoomOwner);
-                yyjson_mut_obj_add_bool(doc, Player, "online", pRoom->PlayingList[i].pConnInfo != NULL);
-            }
-        }
-        else
-        {
-            for (UINT i = 0; i < pRoom->WaitingCount; i++)
-            {
-                yyjson_mut_val* Player = yyjson_mut_arr_add_obj(doc, PlayerListVal);
-                yyjson_mut_obj_add_str(doc, Player, "name", pRoom->WaitingList[i].NickName);
-                yyjson_mut_obj_add_uint(doc, Player, "ID", pRoom->WaitingList[i].GameID);
-                yyjson_mut_obj_add_str(doc, Player, "avatar", pRoom->WaitingList[i].Avatar);
-                yyjson_mut_obj_add_bool(doc, Player, "isOwner", pRoom->WaitingList[i].bIsRoomOwner);
-                yyjson_mut_obj_add_bool(doc, Player, "online", TRUE);
-            }
-        }
-        yyjson_mut_obj_add_val(doc, root, "playerList", PlayerListVal);
-
-        for (UINT i = 0; i < pRoom->WaitingCount; i++) // this is also currently online user
-        {
-            if (!SendJsonMessage(pRoom->WaitingList[i].pConnInfo, doc))
-                __leave;
-        }
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastSelectTeam(_In_ PGAME_ROOM pRoom, _In_ UINT TeamSize, _In_ UINT32 TeamArr[])
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "selectTeam");
-        yyjson_mut_val* TeamVal = yyjson_mut_arr_with_uint32(doc, TeamArr, TeamSize);
-        if (!TeamVal)
-            __leave;
-        yyjson_mut_obj_add_val(doc, root, "team", TeamVal);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastConfirmTeam(_In_ PGAME_ROOM pRoom)
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "confirmTeam");
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastVoteTeamProgress(_In_ PGAME_ROOM pRoom, _In_ UINT VotedCnt, _In_ UINT32 VotedIDList[])
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "voteTeamProgress");
-        yyjson_mut_val* VotedVal = yyjson_mut_arr_with_uint32(doc, VotedIDList, VotedCnt);
-        if (!VotedVal)
-            __leave;
-        yyjson_mut_obj_add_val(doc, root, "voted", VotedVal);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastVoteTeam(_In_ PGAME_ROOM pRoom, _In_ BOOL bVoteResult, _In_ UINT VoteListCnt, _In_ VOTELIST VoteList[])
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "voteTeam");
-        yyjson_mut_obj_add_bool(doc, root, "voteResult", bVoteResult);
-
-        yyjson_mut_val* VoteListVal = yyjson_mut_arr(doc);
-        if (!VoteListVal)
-            __leave;
-
-        for (UINT i = 0; i < VoteListCnt; i++)
-        {
-            yyjson_mut_val* VoteVal = yyjson_mut_arr_add_obj(doc, VoteListVal);
-            yyjson_mut_obj_add_uint(doc, VoteVal, "ID", VoteList[i].ID);
-            yyjson_mut_obj_add_bool(doc, VoteVal, "vote", VoteList[i].VoteResult);
-        }
-        yyjson_mut_obj_add_val(doc, root, "voteList", VoteListVal);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastMissionResultProgress(_In_ PGAME_ROOM pRoom, _In_ UINT DecidedCnt, _In_ UINT32 DecidedIDList[])
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "missionResultProgress");
-        yyjson_mut_val* DecidedVal = yyjson_mut_arr_with_uint32(doc, DecidedIDList, DecidedCnt);
-        if (!DecidedVal)
-            __leave;
-        yyjson_mut_obj_add_val(doc, root, "decided", DecidedVal);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastMissionResult(_In_ PGAME_ROOM pRoom, _In_ BOOL bMissionSuccess, _In_ UINT32 Perform, _In_ UINT32 Screw)
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "missionResult");
-        yyjson_mut_obj_add_bool(doc, root, "missionSuccess", bMissionSuccess);
-        yyjson_mut_obj_add_uint(doc, root, "perform", Perform);
-        yyjson_mut_obj_add_uint(doc, root, "screw", Screw);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastFairyInspect(_In_ PGAME_ROOM pRoom, _In_ UINT InspectID)
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "fairyInspect");
-        yyjson_mut_obj_add_uint(doc, root, "ID", InspectID);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastAssassinate(_In_ PGAME_ROOM pRoom, _In_ UINT AssassinateID)
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "assassinate");
-        yyjson_mut_obj_add_uint(doc, root, "ID", AssassinateID);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastEndGame(_In_ PGAME_ROOM pRoom, _In_ BOOL bWin, _In_z_ CHAR Reason[])
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "endGame");
-        yyjson_mut_obj_add_bool(doc, root, "win", bWin);
-        yyjson_mut_obj_add_str(doc, root, "reason", Reason);
-
-        yyjson_mut_val* RoleListVal = yyjson_mut_arr(doc);
-        if (!RoleListVal)
-            __leave;
-
-        for (UINT i = 0; i < pRoom->PlayingCount; i++)
-        {
-            yyjson_mut_val* RoleVal = yyjson_mut_arr_add_obj(doc, RoleListVal);
-            yyjson_mut_obj_add_uint(doc, RoleVal, "ID", pRoom->PlayingList[i].GameID);
-            yyjson_mut_obj_add_str(doc, RoleVal, "role", GetRoleString(pRoom->RoleList[i]));
-        }
-        yyjson_mut_obj_add_val(doc, root, "roleList", RoleListVal);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
-
-BOOL BroadcastTextMessage(_In_ PGAME_ROOM pRoom, _In_ UINT ID, _In_z_ CHAR Message[])
-{
-    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
-    if (!doc)
-        return FALSE;
-
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_mut_val* root = yyjson_mut_obj(doc);
-        if (!root)
-            __leave;
-
-        yyjson_mut_doc_set_root(doc, root);
-        yyjson_mut_obj_add_str(doc, root, "type", "textMessage");
-        yyjson_mut_obj_add_uint(doc, root, "ID", ID);
-        yyjson_mut_obj_add_str(doc, root, "message", Message);
-
-        bSuccess = BroadcastGamingJsonMessage(pRoom, doc);
-    }
-    __finally
-    {
-        // Free the doc
-        yyjson_mut_doc_free(doc);
-    }
-    return bSuccess;
-}
+#include "common.h"
+#include "yyjson.h"
+#include "JsonHandler.h"
+#include "BinaryHandler.h"
+#include "MessageSender.h"
+#include "RoomSnapshot.h"
+#include "RoomNumber.h"
+#include "Metrics.h"
+
+static const CHAR* GetRoleString(UINT Role)
+{
+    // correspond with the ROLE_* MACRO
+    // TODO: assert here
+    static const CHAR* RoleTable[] = { NULL, "MERLIN", "PERCIVAL", "ASSASSIN", "MORDRED", "OBERON", "MORGANA", "LOYALIST", "MINIONS" };
+    return RoleTable[Role];
+}
+
+static const CHAR* GetHintTypeString(UINT HintType)
+{
+    // correspond with the HINT_* MACRO
+    // TODO: assert here
+    static const CHAR* HintStrTable[] = { NULL, "GOOD", "BAD", "MERLIN_OR_MORGANA", "ASSASSIN", "MORDRED", "MORGANA", "MINIONS" };
+    return HintStrTable[HintType];
+}
+
+// Encodings a message is built in, one bit per WIRE_PROTOCOL_*.
+// Only the formats the recipients negotiated are built: the json doc is left NULL when nobody reads json,
+// the binary message keeps just its header (BinWriterInit, also the type counted for json) when nobody reads binary.
+#define WIRE_FORMAT_JSON   (1u << WIRE_PROTOCOL_JSON)
+#define WIRE_FORMAT_BINARY (1u << WIRE_PROTOCOL_BINARY)
+
+static UINT GetConnWireFormats(_In_ const CONNECTION_INFO* pConnInfo)
+{
+    return 1u << pConnInfo->Protocol;
+}
+
+// Formats of the online players of pRoom, who receive its broadcasts.
+static UINT GetRoomWireFormats(_In_ const GAME_ROOM* pRoom)
+{
+    UINT Formats = 0;
+    for (UINT i = 0; i < pRoom->WaitingCount && Formats != (WIRE_FORMAT_JSON | WIRE_FORMAT_BINARY); i++)
+        Formats |= GetConnWireFormats(pRoom->WaitingList[i].pConnInfo);
+    return Formats;
+}
+
+// Create the json doc of a message with its root object and "type",
+// or set *pDoc to NULL if Formats has no json. FALSE if out of memory.
+static BOOL NewJsonMessage(_In_ UINT Formats, _In_z_ const CHAR szType[], _Outptr_result_maybenull_ yyjson_mut_doc** pDoc, _Outptr_result_maybenull_ yyjson_mut_val** pRoot)
+{
+    *pDoc = NULL;
+    *pRoot = NULL;
+    if (!(Formats & WIRE_FORMAT_JSON))
+        return TRUE;
+
+    // Create a mutable doc
+    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
+    if (!doc)
+        return FALSE;
+
+    yyjson_mut_val* root = yyjson_mut_obj(doc);
+    if (!root)
+    {
+        yyjson_mut_doc_free(doc);
+        return FALSE;
+    }
+    yyjson_mut_doc_set_root(doc, root);
+    yyjson_mut_obj_add_str(doc, root, "type", szType);
+
+    *pDoc = doc;
+    *pRoot = root;
+    return TRUE;
+}
+
+// Send in the format pConnInfo negotiated, which must be one the message was built in.
+static BOOL SendWireMessage(_In_ PCONNECTION_INFO pConnInfo, _In_opt_ yyjson_mut_doc* JsonDoc, _In_ const BIN_WRITER* pBinMessage)
+{
+    if (pConnInfo->Protocol == WIRE_PROTOCOL_BINARY)
+        return SendBinaryMessage(pConnInfo, pBinMessage);
+    return SendJsonMessage(pConnInfo, JsonDoc, pBinMessage->Type);
+}
+
+// binary replies: [result] then the reply fields on success, [string reason] on failure.
+static VOID BinWriteReply(_Inout_ PBIN_WRITER pWriter, _In_ BOOL bResult, _In_opt_z_ CHAR Reason[])
+{
+    BinWriteByte(pWriter, bResult ? 1 : 0);
+    if (!bResult)
+        BinWriteString(pWriter, Reason);
+}
+
+static BOOL ReplySimpleMessage(_In_ PCONNECTION_INFO pConnInfo, _In_z_ CHAR szType[], _In_ BIN_OUT_TYPE BinType, _In_ BOOL bResult, _In_opt_z_ CHAR Reason[])
+{
+    UINT Formats = GetConnWireFormats(pConnInfo);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, szType, &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_str(doc, root, "result", bResult ? "success" : "fail");
+
+            if (!bResult)
+                yyjson_mut_obj_add_str(doc, root, "reason", Reason);
+        }
+
+        BinWriterInit(&BinMessage, BinType);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteReply(&BinMessage, bResult, Reason);
+        }
+
+        bSuccess = SendWireMessage(pConnInfo, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+// Only sends to player online & gaming
+BOOL BroadcastGamingMessage(_In_ PGAME_ROOM pRoom, _In_opt_ yyjson_mut_doc* JsonDoc, _In_ const BIN_WRITER* pBinMessage)
+{
+    CountBroadcast(pRoom->WaitingCount);
+    for (UINT i = 0; i < pRoom->WaitingCount; i++) // this is also currently online user
+    {
+        if (!SendWireMessage(pRoom->WaitingList[i].pConnInfo, JsonDoc, pBinMessage))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL ReplyCreateRoom(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_ UINT RoomNum, _In_ UINT ID, _In_opt_z_ CHAR* Reason)
+{
+    char szRoomNumber[ROOM_NAME_MAXLEN + 1] = { 0 };
+    UINT Formats = GetConnWireFormats(pConnInfo);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "createRoom", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_str(doc, root, "result", bResult ? "success" : "fail");
+
+            if (bResult)
+            {
+                FormatRoomNumber(RoomNum, szRoomNumber);
+                yyjson_mut_obj_add_str(doc, root, "roomNumber", szRoomNumber);
+                yyjson_mut_obj_add_uint(doc, root, "ID", ID);
+            }
+            else
+            {
+                yyjson_mut_obj_add_str(doc, root, "reason", Reason);
+            }
+        }
+
+        // binary: success -> [varint room number][varint ID]
+        //         room number is the shown number, or ROOM_CODE_FLAG | code for a room code (see RoomNumber.h)
+        BinWriterInit(&BinMessage, BIN_OUT_CREATE_ROOM);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteReply(&BinMessage, bResult, Reason);
+            if (bResult)
+            {
+                BinWriteVarint(&BinMessage, (RoomNum & ROOM_CODE_FLAG) ? RoomNum : RoomNum + ROOM_NUMBER_MIN);
+                BinWriteVarint(&BinMessage, ID);
+            }
+        }
+
+        bSuccess = SendWireMessage(pConnInfo, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL ReplyJoinRoom(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_ UINT ID, _In_opt_z_ CHAR* Reason)
+{
+    UINT Formats = GetConnWireFormats(pConnInfo);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "joinRoom", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_str(doc, root, "result", bResult ? "success" : "fail");
+
+            if (bResult)
+            {
+                yyjson_mut_obj_add_uint(doc, root, "ID", ID);
+            }
+            else
+            {
+                yyjson_mut_obj_add_str(doc, root, "reason", Reason);
+            }
+        }
+
+        // binary: success -> [varint ID]
+        BinWriterInit(&BinMessage, BIN_OUT_JOIN_ROOM);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteReply(&BinMessage, bResult, Reason);
+            if (bResult)
+                BinWriteVarint(&BinMessage, ID);
+        }
+
+        bSuccess = SendWireMessage(pConnInfo, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL ReplyLeaveRoom(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "leaveRoom", BIN_OUT_LEAVE_ROOM, bResult, Reason);
+}
+
+BOOL ReplyStartGame(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "startGame", BIN_OUT_START_GAME, bResult, Reason);
+}
+
+BOOL ReplyPlayerSelectTeam(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "playerSelectTeam", BIN_OUT_PLAYER_SELECT_TEAM, bResult, Reason);
+}
+
+BOOL ReplyPlayerConfirmTeam(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "playerConfirmTeam", BIN_OUT_PLAYER_CONFIRM_TEAM, bResult, Reason);
+}
+
+BOOL ReplyPlayerVoteTeam(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "playerVoteTeam", BIN_OUT_PLAYER_VOTE_TEAM, bResult, Reason);
+}
+
+BOOL ReplyPlayerConductMission(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "playerConductMission", BIN_OUT_PLAYER_CONDUCT_MISSION, bResult, Reason);
+}
+
+BOOL ReplyPlayerFairyInspect(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "playerFairyInspect", BIN_OUT_PLAYER_FAIRY_INSPECT, bResult, Reason);
+}
+
+BOOL ReplyPlayerAssassinate(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "playerAssassinate", BIN_OUT_PLAYER_ASSASSINATE, bResult, Reason);
+}
+
+BOOL ReplyPlayerTextMessage(_In_ PCONNECTION_INFO pConnInfo, _In_ BOOL bResult, _In_opt_z_ CHAR* Reason)
+{
+    return ReplySimpleMessage(pConnInfo, "playerTextMessage", BIN_OUT_PLAYER_TEXT_MESSAGE, bResult, Reason);
+}
+
+BOOL ReplyCommandError(_In_ PCONNECTION_INFO pConnInfo, _In_ UINT Index)
+{
+    UINT Formats = GetConnWireFormats(pConnInfo);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "commandError", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_uint(doc, root, "index", Index);
+        }
+
+        // binary: [varint index]
+        BinWriterInit(&BinMessage, BIN_OUT_COMMAND_ERROR);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, Index);
+        }
+
+        bSuccess = SendWireMessage(pConnInfo, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL SendBeginGame(_In_ PCONNECTION_INFO pConnInfo, _In_ UINT Role, _In_ BOOL bFairyEnabled, _In_ UINT FairyID)
+{
+    UINT Formats = GetConnWireFormats(pConnInfo);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "beginGame", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_str(doc, root, "role", GetRoleString(Role));
+            if (bFairyEnabled)
+            {
+                yyjson_mut_obj_add_uint(doc, root, "fairyID", FairyID);
+            }
+        }
+
+        // binary: [role][fairy enabled] ([varint fairy ID] if enabled)
+        BinWriterInit(&BinMessage, BIN_OUT_BEGIN_GAME);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteByte(&BinMessage, (BYTE)Role);
+            BinWriteByte(&BinMessage, bFairyEnabled ? 1 : 0);
+            if (bFairyEnabled)
+                BinWriteVarint(&BinMessage, FairyID);
+        }
+
+        bSuccess = SendWireMessage(pConnInfo, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL SendRoleHint(_In_ PCONNECTION_INFO pConnInfo, _In_ UINT HintCnt, _In_ HINTLIST HintList[])
+{
+    UINT Formats = GetConnWireFormats(pConnInfo);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "roleHint", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_val* HintListVal = yyjson_mut_arr(doc);
+            if (!HintListVal)
+                __leave;
+
+            for (UINT i = 0; i < HintCnt; i++)
+            {
+                yyjson_mut_val* HintVal = yyjson_mut_arr_add_obj(doc, HintListVal);
+                yyjson_mut_obj_add_uint(doc, HintVal, "ID", HintList[i].ID);
+                yyjson_mut_obj_add_str(doc, HintVal, "HintType", GetHintTypeString(HintList[i].HintType));
+            }
+            yyjson_mut_obj_add_val(doc, root, "HintList", HintListVal);
+        }
+
+        // binary: [varint count] then [varint ID][hint type] each
+        BinWriterInit(&BinMessage, BIN_OUT_ROLE_HINT);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, HintCnt);
+            for (UINT i = 0; i < HintCnt; i++)
+            {
+                BinWriteVarint(&BinMessage, HintList[i].ID);
+                BinWriteByte(&BinMessage, (BYTE)HintList[i].HintType);
+            }
+        }
+
+        bSuccess = SendWireMessage(pConnInfo, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL SendSetLeader(_In_ PCONNECTION_INFO pConnInfo, _In_ UINT ID)
+{
+    UINT Formats = GetConnWireFormats(pConnInfo);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "setLeader", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_uint(doc, root, "ID", ID);
+        }
+
+        // binary: [varint ID]
+        BinWriterInit(&BinMessage, BIN_OUT_SET_LEADER);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, ID);
+        }
+
+        bSuccess = SendWireMessage(pConnInfo, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+// one player of roomStatus, as a json object and binary: [varint ID][flags][string name][string avatar]
+// flags: bit 0 is room owner, bit 1 is online
+// doc or pBinMessage is NULL when that format isn't built.
+static VOID AddPlayerStatus(_Inout_opt_ yyjson_mut_doc* doc, _Inout_opt_ yyjson_mut_val* Player, _Inout_opt_ PBIN_WRITER pBinMessage, _In_ const PLAYER_INFO* pPlayer, _In_ BOOL bOnline)
+{
+    if (doc)
+    {
+        yyjson_mut_obj_add_str(doc, Player, "name", pPlayer->NickName);
+        yyjson_mut_obj_add_uint(doc, Player, "ID", pPlayer->GameID);
+        yyjson_mut_obj_add_str(doc, Player, "avatar", pPlayer->Avatar);
+        yyjson_mut_obj_add_bool(doc, Player, "isOwner", pPlayer->bIsRoomOwner);
+        yyjson_mut_obj_add_bool(doc, Player, "online", bOnline);
+    }
+
+    if (pBinMessage)
+    {
+        BinWriteVarint(pBinMessage, pPlayer->GameID);
+        BinWriteByte(pBinMessage, (pPlayer->bIsRoomOwner ? 1 : 0) | (bOnline ? 2 : 0));
+        BinWriteString(pBinMessage, pPlayer->NickName);
+        BinWriteString(pBinMessage, pPlayer->Avatar);
+    }
+}
+
+// Build the full roomStatus of pRoom into a new doc, NULL if out of memory.
+static yyjson_mut_doc* BuildRoomStatus(_In_ PGAME_ROOM pRoom, _Out_ PBIN_WRITER pBinMessage)
+{
+    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
+    if (!doc)
+        return NULL;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        yyjson_mut_val* root = yyjson_mut_obj(doc);
+        if (!root)
+            __leave;
+        yyjson_mut_doc_set_root(doc, root);
+        yyjson_mut_obj_add_str(doc, root, "type", "roomStatus");
+        yyjson_mut_obj_add_uint(doc, root, "version", pRoom->StatusVersion);
+
+        // binary: [varint count] then each player (see AddPlayerStatus), then [varint version]
+        BinWriterInit(pBinMessage, BIN_OUT_ROOM_STATUS);
+        BinWriteVarint(pBinMessage, pRoom->bGaming ? pRoom->PlayingCount : pRoom->WaitingCount);
+
+        yyjson_mut_val* PlayerListVal = yyjson_mut_arr(doc);
+        if (!PlayerListVal)
+            __leave;
+
+        if (pRoom->bGaming)
+        {
+            for (UINT i = 0; i < pRoom->PlayingCount; i++)
+            {
+                yyjson_mut_val* Player = yyjson_mut_arr_add_obj(doc, PlayerListVal);
+                AddPlayerStatus(doc, Player, pBinMessage, &pRoom->PlayingList[i], pRoom->PlayingList[i].pConnInfo != NULL);
+            }
+        }
+        else
+        {
+            for (UINT i = 0; i < pRoom->WaitingCount; i++)
+            {
+                yyjson_mut_val* Player = yyjson_mut_arr_add_obj(doc, PlayerListVal);
+                AddPlayerStatus(doc, Player, pBinMessage, &pRoom->WaitingList[i], TRUE);
+            }
+        }
+        yyjson_mut_obj_add_val(doc, root, "playerList", PlayerListVal);
+        BinWriteVarint(pBinMessage, pRoom->StatusVersion);
+
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            yyjson_mut_doc_free(doc);
+            doc = NULL;
+        }
+    }
+    return doc;
+}
+
+PROOM_SNAPSHOT BuildRoomSnapshot(_In_ PGAME_ROOM pRoom)
+{
+    BIN_WRITER BinMessage;
+    SIZE_T JsonLen;
+    char* JsonString = NULL;
+    PROOM_SNAPSHOT pSnapshot = NULL;
+
+    yyjson_mut_doc* doc = BuildRoomStatus(pRoom, &BinMessage);
+    if (!doc)
+        return NULL;
+
+    __try
+    {
+        if (BinMessage.bOverflow)
+            __leave;
+
+        JsonString = yyjson_mut_write(doc, 0, &JsonLen);
+        if (!JsonString)
+            __leave;
+
+        pSnapshot = HeapAlloc(GetProcessHeap(), 0, sizeof(ROOM_SNAPSHOT) + JsonLen + BinMessage.cbLen);
+        if (!pSnapshot)
+            __leave;
+
+        pSnapshot->RefCnt = 1;
+        pSnapshot->Version = pRoom->StatusVersion;
+        pSnapshot->cbJsonLen = (ULONG)JsonLen;
+        pSnapshot->cbBinLen = BinMessage.cbLen;
+        memcpy(pSnapshot->Data, JsonString, JsonLen);
+        memcpy(pSnapshot->Data + JsonLen, BinMessage.Buffer, BinMessage.cbLen);
+    }
+    __finally
+    {
+        free(JsonString); // allocated from yyjson_mut_write
+        yyjson_mut_doc_free(doc);
+    }
+    return pSnapshot;
+}
+
+BOOL SendRoomStatus(_In_ PCONNECTION_INFO pConnInfo, _In_ PGAME_ROOM pRoom)
+{
+    PROOM_SNAPSHOT pSnapshot = GetRoomSnapshot(pRoom);
+    if (!pSnapshot)
+        return FALSE;
+
+    BOOL bSuccess = SendRoomSnapshot(pConnInfo, pSnapshot);
+    ReleaseRoomSnapshot(pSnapshot);
+    return bSuccess;
+}
+
+BOOL BroadcastRoomStatus(_In_ PGAME_ROOM pRoom)
+{
+    PROOM_SNAPSHOT pSnapshot = GetRoomSnapshot(pRoom);
+    if (!pSnapshot)
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        CountBroadcast(pRoom->WaitingCount);
+        for (UINT i = 0; i < pRoom->WaitingCount; i++) // this is also currently online user
+        {
+            if (!SendRoomSnapshot(pRoom->WaitingList[i].pConnInfo, pSnapshot))
+                __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        ReleaseRoomSnapshot(pSnapshot);
+    }
+    return bSuccess;
+}
+
+static const CHAR* GetRoomDeltaString(UINT DeltaOp)
+{
+    // correspond with the ROOM_DELTA_* MACRO
+    static const CHAR* DeltaStrTable[] = { NULL, "playerAdded", "playerRemoved", "avatarChanged", "ownerChanged", "playerOffline" };
+    return DeltaStrTable[DeltaOp];
+}
+
+BOOL BroadcastRoomStatusDelta(_In_ PGAME_ROOM pRoom, _In_ UINT DeltaOp, _In_ const PLAYER_INFO* pPlayer, _In_opt_ PCONNECTION_INFO pExclude)
+{
+    UINT Formats = 0; // of the players who opted in
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+    PROOM_SNAPSHOT pSnapshot = NULL; // for players who didn't opt in, taken on first use
+
+    for (UINT i = 0; i < pRoom->WaitingCount; i++)
+    {
+        PCONNECTION_INFO pConnInfo = pRoom->WaitingList[i].pConnInfo;
+        if (pConnInfo != pExclude && pConnInfo->bRoomStatusDelta)
+            Formats |= GetConnWireFormats(pConnInfo);
+    }
+
+    if (!NewJsonMessage(Formats, "roomStatusDelta", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_uint(doc, root, "version", pRoom->StatusVersion);
+            yyjson_mut_obj_add_str(doc, root, "op", GetRoomDeltaString(DeltaOp));
+
+            switch (DeltaOp)
+            {
+            case ROOM_DELTA_PLAYER_ADDED:
+            {
+                yyjson_mut_val* Player = yyjson_mut_obj(doc);
+                if (!Player)
+                    __leave;
+                AddPlayerStatus(doc, Player, NULL, pPlayer, TRUE);
+                yyjson_mut_obj_add_val(doc, root, "player", Player);
+                break;
+            }
+            case ROOM_DELTA_AVATAR_CHANGED:
+                yyjson_mut_obj_add_uint(doc, root, "ID", pPlayer->GameID);
+                yyjson_mut_obj_add_str(doc, root, "avatar", pPlayer->Avatar);
+                break;
+            default:
+                yyjson_mut_obj_add_uint(doc, root, "ID", pPlayer->GameID);
+                break;
+            }
+        }
+
+        // binary: [varint version][op], then
+        //     playerAdded: the player as in roomStatus
+        //     avatarChanged: [varint ID][string avatar]
+        //     others: [varint ID]
+        BinWriterInit(&BinMessage, BIN_OUT_ROOM_STATUS_DELTA);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, pRoom->StatusVersion);
+            BinWriteByte(&BinMessage, (BYTE)DeltaOp);
+
+            switch (DeltaOp)
+            {
+            case ROOM_DELTA_PLAYER_ADDED:
+                AddPlayerStatus(NULL, NULL, &BinMessage, pPlayer, TRUE);
+                break;
+            case ROOM_DELTA_AVATAR_CHANGED:
+                BinWriteVarint(&BinMessage, pPlayer->GameID);
+                BinWriteString(&BinMessage, pPlayer->Avatar);
+                break;
+            default:
+                BinWriteVarint(&BinMessage, pPlayer->GameID);
+                break;
+            }
+        }
+
+        CountBroadcast(pRoom->WaitingCount - (pExclude ? 1 : 0));
+        for (UINT i = 0; i < pRoom->WaitingCount; i++) // this is also currently online user
+        {
+            PCONNECTION_INFO pConnInfo = pRoom->WaitingList[i].pConnInfo;
+            if (pConnInfo == pExclude)
+                continue;
+
+            if (pConnInfo->bRoomStatusDelta)
+            {
+                if (!SendWireMessage(pConnInfo, doc, &BinMessage))
+                    __leave;
+                continue;
+            }
+
+            if (!pSnapshot)
+            {
+                pSnapshot = GetRoomSnapshot(pRoom);
+                if (!pSnapshot)
+                    __leave;
+            }
+            if (!SendRoomSnapshot(pConnInfo, pSnapshot))
+                __leave;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+        if (pSnapshot)
+            ReleaseRoomSnapshot(pSnapshot);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastSelectTeam(_In_ PGAME_ROOM pRoom, _In_ UINT TeamSize, _In_ const UINT32 TeamArr[])
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "selectTeam", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_val* TeamVal = yyjson_mut_arr_with_uint32(doc, TeamArr, TeamSize);
+            if (!TeamVal)
+                __leave;
+            yyjson_mut_obj_add_val(doc, root, "team", TeamVal);
+        }
+
+        // binary: [varint count] then [varint ID] each
+        BinWriterInit(&BinMessage, BIN_OUT_SELECT_TEAM);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, TeamSize);
+            for (UINT i = 0; i < TeamSize; i++)
+                BinWriteVarint(&BinMessage, TeamArr[i]);
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastConfirmTeam(_In_ PGAME_ROOM pRoom)
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "confirmTeam", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        // binary: no payload
+        BinWriterInit(&BinMessage, BIN_OUT_CONFIRM_TEAM);
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastVoteTeamProgress(_In_ PGAME_ROOM pRoom, _In_ UINT VotedCnt, _In_ UINT32 VotedIDList[])
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "voteTeamProgress", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_val* VotedVal = yyjson_mut_arr_with_uint32(doc, VotedIDList, VotedCnt);
+            if (!VotedVal)
+                __leave;
+            yyjson_mut_obj_add_val(doc, root, "voted", VotedVal);
+        }
+
+        // binary: [varint count] then [varint ID] each
+        BinWriterInit(&BinMessage, BIN_OUT_VOTE_TEAM_PROGRESS);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, VotedCnt);
+            for (UINT i = 0; i < VotedCnt; i++)
+                BinWriteVarint(&BinMessage, VotedIDList[i]);
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastVoteTeam(_In_ PGAME_ROOM pRoom, _In_ BOOL bVoteResult, _In_ UINT VoteListCnt, _In_ VOTELIST VoteList[])
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "voteTeam", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_bool(doc, root, "voteResult", bVoteResult);
+
+            yyjson_mut_val* VoteListVal = yyjson_mut_arr(doc);
+            if (!VoteListVal)
+                __leave;
+
+            for (UINT i = 0; i < VoteListCnt; i++)
+            {
+                yyjson_mut_val* VoteVal = yyjson_mut_arr_add_obj(doc, VoteListVal);
+                yyjson_mut_obj_add_uint(doc, VoteVal, "ID", VoteList[i].ID);
+                yyjson_mut_obj_add_bool(doc, VoteVal, "vote", VoteList[i].VoteResult);
+            }
+            yyjson_mut_obj_add_val(doc, root, "voteList", VoteListVal);
+        }
+
+        // binary: [vote result][varint count][varint ID] each, then [varint approve bitset]
+        // bit i of the bitset is the vote of the i-th ID.
+        BinWriterInit(&BinMessage, BIN_OUT_VOTE_TEAM);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            UINT32 ApproveBits = 0;
+            BinWriteByte(&BinMessage, bVoteResult ? 1 : 0);
+            BinWriteVarint(&BinMessage, VoteListCnt);
+            for (UINT i = 0; i < VoteListCnt; i++)
+            {
+                BinWriteVarint(&BinMessage, VoteList[i].ID);
+                if (VoteList[i].VoteResult)
+                    ApproveBits |= 1u << i;
+            }
+            BinWriteVarint(&BinMessage, ApproveBits);
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastMissionResultProgress(_In_ PGAME_ROOM pRoom, _In_ UINT DecidedCnt, _In_ UINT32 DecidedIDList[])
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "missionResultProgress", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_val* DecidedVal = yyjson_mut_arr_with_uint32(doc, DecidedIDList, DecidedCnt);
+            if (!DecidedVal)
+                __leave;
+            yyjson_mut_obj_add_val(doc, root, "decided", DecidedVal);
+        }
+
+        // binary: [varint count] then [varint ID] each
+        BinWriterInit(&BinMessage, BIN_OUT_MISSION_RESULT_PROGRESS);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, DecidedCnt);
+            for (UINT i = 0; i < DecidedCnt; i++)
+                BinWriteVarint(&BinMessage, DecidedIDList[i]);
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastMissionResult(_In_ PGAME_ROOM pRoom, _In_ BOOL bMissionSuccess, _In_ UINT32 Perform, _In_ UINT32 Screw)
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "missionResult", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_bool(doc, root, "missionSuccess", bMissionSuccess);
+            yyjson_mut_obj_add_uint(doc, root, "perform", Perform);
+            yyjson_mut_obj_add_uint(doc, root, "screw", Screw);
+        }
+
+        // binary: [mission success][varint perform][varint screw]
+        BinWriterInit(&BinMessage, BIN_OUT_MISSION_RESULT);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteByte(&BinMessage, bMissionSuccess ? 1 : 0);
+            BinWriteVarint(&BinMessage, Perform);
+            BinWriteVarint(&BinMessage, Screw);
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastFairyInspect(_In_ PGAME_ROOM pRoom, _In_ UINT InspectID)
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "fairyInspect", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_uint(doc, root, "ID", InspectID);
+        }
+
+        // binary: [varint ID]
+        BinWriterInit(&BinMessage, BIN_OUT_FAIRY_INSPECT);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, InspectID);
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastAssassinate(_In_ PGAME_ROOM pRoom, _In_ UINT AssassinateID)
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "assassinate", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_uint(doc, root, "ID", AssassinateID);
+        }
+
+        // binary: [varint ID]
+        BinWriterInit(&BinMessage, BIN_OUT_ASSASSINATE);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, AssassinateID);
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastEndGame(_In_ PGAME_ROOM pRoom, _In_ BOOL bWin, _In_z_ CHAR Reason[])
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "endGame", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_bool(doc, root, "win", bWin);
+            yyjson_mut_obj_add_str(doc, root, "reason", Reason);
+
+            yyjson_mut_val* RoleListVal = yyjson_mut_arr(doc);
+            if (!RoleListVal)
+                __leave;
+
+            for (UINT i = 0; i < pRoom->PlayingCount; i++)
+            {
+                yyjson_mut_val* RoleVal = yyjson_mut_arr_add_obj(doc, RoleListVal);
+                yyjson_mut_obj_add_uint(doc, RoleVal, "ID", pRoom->PlayingList[i].GameID);
+                yyjson_mut_obj_add_str(doc, RoleVal, "role", GetRoleString(pRoom->RoleList[i]));
+            }
+            yyjson_mut_obj_add_val(doc, root, "roleList", RoleListVal);
+        }
+
+        // binary: [win][string reason][varint count] then [varint ID][role] each
+        BinWriterInit(&BinMessage, BIN_OUT_END_GAME);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteByte(&BinMessage, bWin ? 1 : 0);
+            BinWriteString(&BinMessage, Reason);
+            BinWriteVarint(&BinMessage, pRoom->PlayingCount);
+            for (UINT i = 0; i < pRoom->PlayingCount; i++)
+            {
+                BinWriteVarint(&BinMessage, pRoom->PlayingList[i].GameID);
+                BinWriteByte(&BinMessage, (BYTE)pRoom->RoleList[i]);
+            }
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
+
+BOOL BroadcastTextMessage(_In_ PGAME_ROOM pRoom, _In_ UINT ID, _In_z_ CHAR Message[])
+{
+    UINT Formats = GetRoomWireFormats(pRoom);
+    BIN_WRITER BinMessage;
+    yyjson_mut_doc* doc;
+    yyjson_mut_val* root;
+
+    if (!NewJsonMessage(Formats, "textMessage", &doc, &root))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (doc)
+        {
+            yyjson_mut_obj_add_uint(doc, root, "ID", ID);
+            yyjson_mut_obj_add_str(doc, root, "message", Message);
+        }
+
+        // binary: [varint ID][string message]
+        BinWriterInit(&BinMessage, BIN_OUT_TEXT_MESSAGE);
+        if (Formats & WIRE_FORMAT_BINARY)
+        {
+            BinWriteVarint(&BinMessage, ID);
+            BinWriteString(&BinMessage, Message);
+        }
+
+        bSuccess = BroadcastGamingMessage(pRoom, doc, &BinMessage);
+    }
+    __finally
+    {
+        // Free the doc
+        yyjson_mut_doc_free(doc);
+    }
+    return bSuccess;
+}
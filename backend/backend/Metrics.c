@@ -0,0 +1,311 @@
+#include <strsafe.h>
+
+#include "common.h"
+#include "Metrics.h"
+#include "SlabPool.h"
+#include "RoomIndex.h"
+#include "Compression.h"
+#include "BinaryHandler.h"
+#include "HttpSendRecv.h"
+
+typedef struct _METRICS_BLOCK METRICS_BLOCK, * PMETRICS_BLOCK;
+
+typedef struct DECLSPEC_CACHEALIGN _METRICS_BLOCK
+{
+    SLIST_ENTRY FreeEntry; // on RetiredBlocks after its thread exited
+    PMETRICS_BLOCK pNext;  // all blocks, never unlinked
+
+    UINT64 Counter[METRIC_ID_COUNT];
+    UINT64 MessagesIn[MESSAGE_TYPE_COUNT];
+    UINT64 MessagesOut[METRICS_OUT_TYPE_CNT];
+    UINT64 FanoutCnt[ROOM_PLAYER_MAX + 1]; // broadcasts by recipient count
+    LOCK_SITE_STATS LockSite[LOCK_SITE_MAX];
+    COMPRESSION_STATS Compression[METRICS_OUT_TYPE_CNT];
+} METRICS_BLOCK, * PMETRICS_BLOCK;
+
+static SLAB_POOL MetricsPool; // METRICS_BLOCK
+static PMETRICS_BLOCK volatile BlockList;
+static SLIST_HEADER RetiredBlocks;
+static DWORD MetricsFlsIndex = FLS_OUT_OF_INDEXES;
+
+// shared by threads that couldn't get a block of their own, counts may be lost there.
+static METRICS_BLOCK OverflowBlock;
+
+static __declspec(thread) PMETRICS_BLOCK ThreadMetrics;
+
+static const CHAR* const CounterNameList[] =
+{
+#define METRIC_COUNTER(Id, Name, Help) Name,
+#include "Metrics.inl"
+#undef METRIC_COUNTER
+};
+
+static const CHAR* const CounterHelpList[] =
+{
+#define METRIC_COUNTER(Id, Name, Help) Help,
+#include "Metrics.inl"
+#undef METRIC_COUNTER
+};
+
+// "type" of each outbound message, same as in its json.
+static const CHAR* const OutTypeNameList[METRICS_OUT_TYPE_CNT] =
+{
+    [BIN_OUT_CREATE_ROOM] = "createRoom",
+    [BIN_OUT_JOIN_ROOM] = "joinRoom",
+    [BIN_OUT_LEAVE_ROOM] = "leaveRoom",
+    [BIN_OUT_START_GAME] = "startGame",
+    [BIN_OUT_PLAYER_SELECT_TEAM] = "playerSelectTeam",
+    [BIN_OUT_PLAYER_CONFIRM_TEAM] = "playerConfirmTeam",
+    [BIN_OUT_PLAYER_VOTE_TEAM] = "playerVoteTeam",
+    [BIN_OUT_PLAYER_CONDUCT_MISSION] = "playerConductMission",
+    [BIN_OUT_PLAYER_FAIRY_INSPECT] = "playerFairyInspect",
+    [BIN_OUT_PLAYER_ASSASSINATE] = "playerAssassinate",
+    [BIN_OUT_PLAYER_TEXT_MESSAGE] = "playerTextMessage",
+    [BIN_OUT_COMMAND_ERROR] = "commandError",
+    [BIN_OUT_BEGIN_GAME] = "beginGame",
+    [BIN_OUT_ROLE_HINT] = "roleHint",
+    [BIN_OUT_SET_LEADER] = "setLeader",
+    [BIN_OUT_ROOM_STATUS] = "roomStatus",
+    [BIN_OUT_SELECT_TEAM] = "selectTeam",
+    [BIN_OUT_CONFIRM_TEAM] = "confirmTeam",
+    [BIN_OUT_VOTE_TEAM_PROGRESS] = "voteTeamProgress",
+    [BIN_OUT_VOTE_TEAM] = "voteTeam",
+    [BIN_OUT_MISSION_RESULT_PROGRESS] = "missionResultProgress",
+    [BIN_OUT_MISSION_RESULT] = "missionResult",
+    [BIN_OUT_FAIRY_INSPECT] = "fairyInspect",
+    [BIN_OUT_ASSASSINATE] = "assassinate",
+    [BIN_OUT_END_GAME] = "endGame",
+    [BIN_OUT_TEXT_MESSAGE] = "textMessage",
+    [BIN_OUT_ROOM_STATUS_DELTA] = "roomStatusDelta",
+};
+
+static VOID LinkMetricsBlock(_Inout_ PMETRICS_BLOCK pBlock)
+{
+    PMETRICS_BLOCK pHead;
+    do
+    {
+        pHead = BlockList;
+        pBlock->pNext = pHead;
+    } while (InterlockedCompareExchangePointer((PVOID volatile*)&BlockList, pBlock, pHead) != pHead);
+}
+
+// Runs on thread exit, the block keeps its counts for the next thread.
+static VOID NTAPI RetireMetricsBlock(_In_opt_ PVOID Data)
+{
+    PMETRICS_BLOCK pBlock = Data;
+    if (!pBlock)
+        return;
+    ThreadMetrics = NULL;
+    InterlockedPushEntrySList(&RetiredBlocks, &pBlock->FreeEntry);
+}
+
+VOID InitMetrics(VOID)
+{
+    InitSlabPool(&MetricsPool, L"metrics", sizeof(METRICS_BLOCK));
+    InitializeSListHead(&RetiredBlocks);
+    LinkMetricsBlock(&OverflowBlock);
+
+    MetricsFlsIndex = FlsAlloc(RetireMetricsBlock);
+    if (MetricsFlsIndex == FLS_OUT_OF_INDEXES)
+        LogErrorMessage(L"FlsAlloc", GetLastError()); // blocks of exited threads are not reused then
+}
+
+static PMETRICS_BLOCK AttachThreadMetrics(VOID)
+{
+    PMETRICS_BLOCK pBlock = (PMETRICS_BLOCK)InterlockedPopEntrySList(&RetiredBlocks);
+    if (!pBlock)
+    {
+        pBlock = SlabAlloc(&MetricsPool);
+        if (!pBlock)
+            return &OverflowBlock; // try again on the next count
+        LinkMetricsBlock(pBlock);
+    }
+    if (MetricsFlsIndex != FLS_OUT_OF_INDEXES)
+        FlsSetValue(MetricsFlsIndex, pBlock);
+    ThreadMetrics = pBlock;
+    return pBlock;
+}
+
+static PMETRICS_BLOCK GetThreadMetrics(VOID)
+{
+    PMETRICS_BLOCK pBlock = ThreadMetrics;
+    return pBlock ? pBlock : AttachThreadMetrics();
+}
+
+VOID AddMetric(_In_ METRIC_ID Id, _In_ UINT64 Value)
+{
+    GetThreadMetrics()->Counter[Id] += Value;
+}
+
+VOID CountMetric(_In_ METRIC_ID Id)
+{
+    GetThreadMetrics()->Counter[Id]++;
+}
+
+VOID CountMessageIn(_In_ UINT TypeIndex)
+{
+    GetThreadMetrics()->MessagesIn[TypeIndex]++;
+}
+
+VOID CountMessageOut(_In_ UINT Type)
+{
+    GetThreadMetrics()->MessagesOut[Type & (METRICS_OUT_TYPE_CNT - 1)]++;
+}
+
+VOID CountBroadcast(_In_ UINT RecipientCnt)
+{
+    PMETRICS_BLOCK pBlock = GetThreadMetrics();
+    pBlock->Counter[METRIC_BROADCASTS]++;
+    pBlock->FanoutCnt[min(RecipientCnt, ROOM_PLAYER_MAX)]++;
+}
+
+// Sum Count words at Offset of every block.
+static VOID SumMetrics(_In_ SIZE_T Offset, _In_ UINT Count, _Out_writes_(Count) UINT64 SumList[])
+{
+    ZeroMemory(SumList, Count * sizeof(UINT64));
+    for (PMETRICS_BLOCK pBlock = BlockList; pBlock; pBlock = pBlock->pNext)
+    {
+        const UINT64 volatile* pValue = (const UINT64 volatile*)((PBYTE)pBlock + Offset);
+        for (UINT i = 0; i < Count; i++)
+            SumList[i] += pValue[i];
+    }
+}
+
+UINT64 GetMetric(_In_ METRIC_ID Id)
+{
+    UINT64 Sum;
+    SumMetrics(offsetof(METRICS_BLOCK, Counter) + Id * sizeof(UINT64), 1, &Sum);
+    return Sum;
+}
+
+PLOCK_SITE_STATS GetThreadLockStats(VOID)
+{
+    return GetThreadMetrics()->LockSite;
+}
+
+VOID SumLockStats(_Out_writes_(LOCK_SITE_MAX) LOCK_SITE_STATS SumList[])
+{
+    SumMetrics(offsetof(METRICS_BLOCK, LockSite), sizeof(LOCK_SITE_STATS) * LOCK_SITE_MAX / sizeof(UINT64), (UINT64*)SumList);
+}
+
+PCOMPRESSION_STATS GetThreadCompressionStats(VOID)
+{
+    return GetThreadMetrics()->Compression;
+}
+
+VOID SumCompressionStats(_Out_writes_(METRICS_OUT_TYPE_CNT) COMPRESSION_STATS SumList[])
+{
+    SumMetrics(offsetof(METRICS_BLOCK, Compression), sizeof(COMPRESSION_STATS) * METRICS_OUT_TYPE_CNT / sizeof(UINT64), (UINT64*)SumList);
+}
+
+VOID WriteMetrics(_Inout_ PMETRICS_WRITER pWriter, _In_z_ _Printf_format_string_ PCSTR Format, ...)
+{
+    if (pWriter->bOverflow)
+        return;
+
+    va_list Args;
+    va_start(Args, Format);
+    PCHAR pEnd;
+    HRESULT hr = StringCchVPrintfExA(pWriter->pBuffer + pWriter->cbLen, METRICS_BUFFER_SIZE - pWriter->cbLen, &pEnd, NULL, 0, Format, Args);
+    va_end(Args);
+
+    if (FAILED(hr))
+    {
+        pWriter->bOverflow = TRUE;
+        return;
+    }
+    pWriter->cbLen = pEnd - pWriter->pBuffer;
+}
+
+VOID WriteMetricHeader(_Inout_ PMETRICS_WRITER pWriter, _In_z_ PCSTR Name, _In_z_ PCSTR Type, _In_z_ PCSTR Help)
+{
+    WriteMetrics(pWriter, "# HELP avalon_%s %s\n# TYPE avalon_%s %s\n", Name, Help, Name, Type);
+}
+
+static VOID WriteGauge(_Inout_ PMETRICS_WRITER pWriter, _In_z_ PCSTR Name, _In_z_ PCSTR Help, _In_ LONG64 Value)
+{
+    WriteMetricHeader(pWriter, Name, "gauge", Help);
+    WriteMetrics(pWriter, "avalon_%s %lld\n", Name, Value);
+}
+
+_Ret_maybenull_
+PCHAR FormatMetrics(_Out_ ULONG* pcbLen)
+{
+    UINT64 CounterList[METRIC_ID_COUNT];
+    UINT64 MessagesIn[MESSAGE_TYPE_COUNT];
+    UINT64 MessagesOut[METRICS_OUT_TYPE_CNT];
+    UINT64 FanoutCnt[ROOM_PLAYER_MAX + 1];
+    METRICS_WRITER Writer = { 0 };
+
+    *pcbLen = 0;
+    Writer.pBuffer = HeapAlloc(GetProcessHeap(), 0, METRICS_BUFFER_SIZE);
+    if (!Writer.pBuffer)
+        return NULL;
+
+    SumMetrics(offsetof(METRICS_BLOCK, Counter), METRIC_ID_COUNT, CounterList);
+    SumMetrics(offsetof(METRICS_BLOCK, MessagesIn), MESSAGE_TYPE_COUNT, MessagesIn);
+    SumMetrics(offsetof(METRICS_BLOCK, MessagesOut), METRICS_OUT_TYPE_CNT, MessagesOut);
+    SumMetrics(offsetof(METRICS_BLOCK, FanoutCnt), ROOM_PLAYER_MAX + 1, FanoutCnt);
+
+    for (UINT i = 0; i < METRIC_ID_COUNT; i++)
+    {
+        WriteMetricHeader(&Writer, CounterNameList[i], "counter", CounterHelpList[i]);
+        WriteMetrics(&Writer, "avalon_%s %llu\n", CounterNameList[i], CounterList[i]);
+    }
+
+    // gauges are the difference of two counters, or read from their owners.
+    WriteGauge(&Writer, "connections", "Live websocket connections.",
+        (LONG64)(CounterList[METRIC_CONNECTIONS_OPENED] - CounterList[METRIC_CONNECTIONS_CLOSED]));
+    WriteGauge(&Writer, "rooms", "Open rooms.", GetRoomIndexCount());
+    WriteGauge(&Writer, "rooms_in_game", "Rooms running a game.",
+        (LONG64)(CounterList[METRIC_GAMES_STARTED] - CounterList[METRIC_GAMES_ENDED]));
+    WriteGauge(&Writer, "send_queue_frames", "Frames queued in websocket.dll, not completed yet.",
+        (LONG64)(CounterList[METRIC_FRAMES_QUEUED] - CounterList[METRIC_FRAMES_SENT]));
+    WriteGauge(&Writer, "batch_held_messages", "Messages held for batched frames.",
+        (LONG64)(CounterList[METRIC_BATCH_HELD] - CounterList[METRIC_BATCH_RELEASED]));
+
+    WriteMetricHeader(&Writer, "messages_received_total", "counter", "Inbound messages decoded, by type.");
+    for (UINT i = 0; i < MESSAGE_TYPE_COUNT; i++)
+        WriteMetrics(&Writer, "avalon_messages_received_total{type=\"%s\"} %llu\n", GetMessageSchema(i)->TypeName, MessagesIn[i]);
+
+    WriteMetricHeader(&Writer, "messages_sent_total", "counter", "Outbound messages, by type. Before batching and compression.");
+    for (UINT i = 0; i < METRICS_OUT_TYPE_CNT; i++)
+    {
+        if (OutTypeNameList[i])
+            WriteMetrics(&Writer, "avalon_messages_sent_total{type=\"%s\"} %llu\n", OutTypeNameList[i], MessagesOut[i]);
+    }
+
+    // recipients are exact up to ROOM_PLAYER_MAX, a room has no more.
+    UINT64 Cumulative = 0, Sum = 0;
+    WriteMetricHeader(&Writer, "broadcast_recipients", "histogram", "Players a room message was sent to.");
+    for (UINT i = 0; i <= ROOM_PLAYER_MAX; i++)
+    {
+        Cumulative += FanoutCnt[i];
+        Sum += FanoutCnt[i] * i;
+        WriteMetrics(&Writer, "avalon_broadcast_recipients_bucket{le=\"%u\"} %llu\n", i, Cumulative);
+    }
+    WriteMetrics(&Writer, "avalon_broadcast_recipients_bucket{le=\"+Inf\"} %llu\n", Cumulative);
+    WriteMetrics(&Writer, "avalon_broadcast_recipients_sum %llu\n", Sum);
+    WriteMetrics(&Writer, "avalon_broadcast_recipients_count %llu\n", Cumulative);
+
+    WriteMetricHeader(&Writer, "pool_objects", "gauge", "Objects in use, by slab pool.");
+    for (PSLAB_POOL pPool = NextSlabPool(NULL); pPool; pPool = NextSlabPool(pPool))
+        WriteMetrics(&Writer, "avalon_pool_objects{pool=\"%ls\"} %lld\n", pPool->Name, pPool->InUseCnt);
+
+    WriteMetricHeader(&Writer, "pool_bytes", "gauge", "Memory of slabs, by slab pool.");
+    for (PSLAB_POOL pPool = NextSlabPool(NULL); pPool; pPool = NextSlabPool(pPool))
+        WriteMetrics(&Writer, "avalon_pool_bytes{pool=\"%ls\"} %llu\n", pPool->Name, (UINT64)pPool->SlabCnt * pPool->ObjectSize * pPool->ObjectsPerSlab);
+
+    WriteGauge(&Writer, "http_receive_depth", "HTTP receives the transport aims to keep posted, follows the arrivals.", GetHttpReceiveDepth());
+    WriteGauge(&Writer, "http_receives_posted", "HTTP receives posted, waiting for a request.", GetHttpReceivesPosted());
+
+    WriteGauge(&Writer, "compression_state_bytes", "Compressor state kept by connections.", GetCompressionMemoryUsed());
+
+    WriteLockMetrics(&Writer);
+
+    if (Writer.bOverflow)
+        Log(LOG_WARNING, L"metrics exceed %1!u! bytes, the rest is dropped.", METRICS_BUFFER_SIZE);
+
+    *pcbLen = (ULONG)Writer.cbLen;
+    return Writer.pBuffer;
+}
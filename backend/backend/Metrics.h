@@ -0,0 +1,68 @@
+#pragma once
+#include "common.h"
+#include "RoomManager.h"
+#include "MessageSchema.h"
+#include "LockProfile.h"
+#include "Compression.h"
+
+// Server metrics, served in Prometheus text format on /metrics (see FormatMetrics).
+//
+// Every thread counts into its own block with plain adds, the blocks are only summed when scraped,
+// so counting never writes a cache line another thread writes. A block is linked on the first count
+// of its thread and kept when the thread exits, the next new thread takes it over.
+// Sums read while others count may be a few counts behind (or torn on 32-bit builds).
+
+#define METRICS_BUFFER_SIZE (256 * 1024) // largest /metrics response
+#define METRICS_OUT_TYPE_CNT 256 // counted by BIN_OUT_* type
+
+#define METRIC_COUNTER(Id, Name, Help) METRIC_##Id,
+typedef enum _METRIC_ID
+{
+#include "Metrics.inl"
+    METRIC_ID_COUNT
+} METRIC_ID;
+#undef METRIC_COUNTER
+
+VOID InitMetrics(VOID);
+
+VOID AddMetric(_In_ METRIC_ID Id, _In_ UINT64 Value);
+
+VOID CountMetric(_In_ METRIC_ID Id);
+
+// A decoded inbound message, by MESSAGE_TYPE_*.
+VOID CountMessageIn(_In_ UINT TypeIndex);
+
+// An outbound message by BIN_OUT_* type, before batching and compression.
+VOID CountMessageOut(_In_ UINT Type);
+
+// A message sent to RecipientCnt players of a room.
+VOID CountBroadcast(_In_ UINT RecipientCnt);
+
+// Sum of a counter over all threads.
+UINT64 GetMetric(_In_ METRIC_ID Id);
+
+// The lock statistics of the calling thread, LOCK_SITE_MAX entries indexed by site. see LockProfile.h
+PLOCK_SITE_STATS GetThreadLockStats(VOID);
+
+VOID SumLockStats(_Out_writes_(LOCK_SITE_MAX) LOCK_SITE_STATS SumList[]);
+
+// The compression statistics of the calling thread, METRICS_OUT_TYPE_CNT entries indexed by BIN_OUT_* type.
+PCOMPRESSION_STATS GetThreadCompressionStats(VOID);
+
+VOID SumCompressionStats(_Out_writes_(METRICS_OUT_TYPE_CNT) COMPRESSION_STATS SumList[]);
+
+typedef struct _METRICS_WRITER
+{
+    PCHAR pBuffer;
+    SIZE_T cbLen;
+    BOOL bOverflow; // the rest didn't fit and was dropped
+} METRICS_WRITER, * PMETRICS_WRITER;
+
+VOID WriteMetrics(_Inout_ PMETRICS_WRITER pWriter, _In_z_ _Printf_format_string_ PCSTR Format, ...);
+
+// "# HELP" and "# TYPE" lines, Name without the "avalon_" prefix.
+VOID WriteMetricHeader(_Inout_ PMETRICS_WRITER pWriter, _In_z_ PCSTR Name, _In_z_ PCSTR Type, _In_z_ PCSTR Help);
+
+// Format every metric. Returns a buffer from the process heap (HeapFree it), NULL if out of memory.
+_Ret_maybenull_
+PCHAR FormatMetrics(_Out_ ULONG* pcbLen);
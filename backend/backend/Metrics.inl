@@ -0,0 +1,20 @@
+// Per-thread counters, see Metrics.h. Included several times by Metrics.h / Metrics.c
+// with different definitions of METRIC_COUNTER. No include guard on purpose.
+//
+// METRIC_COUNTER(ID, "name", "help")  -> METRIC_ID, exported as counter "avalon_<name>"
+
+METRIC_COUNTER(CONNECTIONS_OPENED,    "connections_opened_total",     "Websocket connections accepted.")
+METRIC_COUNTER(CONNECTIONS_CLOSED,    "connections_closed_total",     "Websocket connections released.")
+METRIC_COUNTER(FRAMES_RECEIVED,       "frames_received_total",        "Websocket messages received.")
+METRIC_COUNTER(BYTES_RECEIVED,        "received_bytes_total",         "Payload bytes of websocket messages received.")
+METRIC_COUNTER(FRAMES_QUEUED,         "frames_queued_total",          "Frames handed to websocket.dll for sending, after batching and compression.")
+METRIC_COUNTER(FRAMES_SENT,           "frames_sent_total",            "Queued frames whose send completed.")
+METRIC_COUNTER(BYTES_QUEUED,          "queued_bytes_total",           "Payload bytes of queued frames.")
+METRIC_COUNTER(BATCH_HELD,            "batch_held_messages_total",    "Messages held for a batched frame.")
+METRIC_COUNTER(BATCH_RELEASED,        "batch_released_messages_total", "Held messages that went out with their batch.")
+METRIC_COUNTER(BROADCASTS,            "broadcasts_total",             "Messages sent to a whole room.")
+METRIC_COUNTER(GAMES_STARTED,         "games_started_total",          "Games started.")
+METRIC_COUNTER(GAMES_ENDED,           "games_ended_total",            "Games ended, or closed with their room.")
+METRIC_COUNTER(ROOM_STATUS_CHANGES,   "room_status_changes_total",    "Room status changes.")
+METRIC_COUNTER(ROOM_STATUS_UPDATES,   "room_status_updates_total",    "Room status updates sent to rooms, changes are merged while a room coalesces.")
+METRIC_COUNTER(RECV_QUEUE_FULL,       "http_receive_queue_full_total", "Requests that took the last posted HTTP receive, the next ones waited in the http.sys queue.")
@@ -0,0 +1,19 @@
+#include "common.h"
+#include "Probes.h"
+
+TRACELOGGING_DEFINE_PROVIDER(
+    ProbeProvider,
+    "Avalon.Backend",
+    (0xe1c1d850, 0x5d61, 0x5b79, 0xbc, 0xda, 0xab, 0x79, 0xc1, 0xe9, 0xaa, 0x90));
+
+VOID InitProbes(VOID)
+{
+    HRESULT hr = TraceLoggingRegister(ProbeProvider);
+    if (FAILED(hr))
+        LogErrorMessage(L"TraceLoggingRegister", hr); // probes stay disabled
+}
+
+VOID StopProbes(VOID)
+{
+    TraceLoggingUnregister(ProbeProvider);
+}
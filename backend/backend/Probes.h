@@ -0,0 +1,105 @@
+#pragma once
+#include "common.h"
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+#include "HttpSendRecv.h"
+#include "MessageSchema.h"
+
+// Static probes on the transport and room hot paths, as TraceLogging events of the ETW provider
+// "Avalon.Backend" {e1c1d850-5d61-5b79-bcda-ab79c1e9aa90}, the GUID hashed from the name as EventSource does.
+// Any ETW consumer attaches to a running server, e.g.
+//     PerfView collect -OnlyProviders=*Avalon.Backend
+//     xperf -start avalon -on e1c1d850-5d61-5b79-bcda-ab79c1e9aa90 ... xperf -stop avalon -d probes.etl
+// WPA pairs the Dispatch start and stop events of a message into one duration.
+// While no session listens, a probe is one test of the provider's enable flag, its fields are not evaluated.
+// Connections are given by pointer and ConnId, rooms by number (MAXUINT outside a room).
+
+// keywords, to listen to part of the probes.
+#define PROBE_KEYWORD_TRANSPORT 0x1 // accept, upgrade, frames
+#define PROBE_KEYWORD_DISPATCH  0x2 // per message type
+#define PROBE_KEYWORD_ROOM      0x4 // rooms and games
+
+TRACELOGGING_DECLARE_PROVIDER(ProbeProvider);
+
+VOID InitProbes(VOID);
+
+VOID StopProbes(VOID);
+
+#define PROBE_ROOM_NUMBER(pConnInfo) ((pConnInfo)->pRoom ? (pConnInfo)->pRoom->RoomNumber : MAXUINT)
+
+// An upgrade request arrived, before the handshake.
+#define PROBE_CONN_ACCEPT(RequestID) \
+    TraceLoggingWrite(ProbeProvider, "ConnAccept", \
+        TraceLoggingKeyword(PROBE_KEYWORD_TRANSPORT), \
+        TraceLoggingUInt64((RequestID), "RequestID"))
+
+#define PROBE_CONN_UPGRADED(pConnInfo) \
+    TraceLoggingWrite(ProbeProvider, "ConnUpgraded", \
+        TraceLoggingKeyword(PROBE_KEYWORD_TRANSPORT), \
+        TraceLoggingPointer((pConnInfo), "Conn"), \
+        TraceLoggingUInt32((pConnInfo)->ConnId, "ConnId"), \
+        TraceLoggingUInt32((pConnInfo)->Protocol, "Protocol"), \
+        TraceLoggingBoolean((pConnInfo)->bCompress, "Compress"))
+
+#define PROBE_FRAME_RECV(pConnInfo, BufferType, cbFrame) \
+    TraceLoggingWrite(ProbeProvider, "FrameRecv", \
+        TraceLoggingKeyword(PROBE_KEYWORD_TRANSPORT), \
+        TraceLoggingPointer((pConnInfo), "Conn"), \
+        TraceLoggingUInt32((pConnInfo)->ConnId, "ConnId"), \
+        TraceLoggingUInt32(PROBE_ROOM_NUMBER(pConnInfo), "Room"), \
+        TraceLoggingUInt32((BufferType), "BufferType"), \
+        TraceLoggingUInt32((cbFrame), "Bytes"))
+
+// A frame websocket.dll is done with, before its callback frees it.
+#define PROBE_SEND_COMPLETE(pConnInfo, pWebsockSendBuf) \
+    TraceLoggingWrite(ProbeProvider, "SendComplete", \
+        TraceLoggingKeyword(PROBE_KEYWORD_TRANSPORT), \
+        TraceLoggingPointer((pConnInfo), "Conn"), \
+        TraceLoggingUInt32((pConnInfo)->ConnId, "ConnId"), \
+        TraceLoggingUInt32(PROBE_ROOM_NUMBER(pConnInfo), "Room"), \
+        TraceLoggingUInt8((pWebsockSendBuf)->MessageType, "MessageType"), \
+        TraceLoggingUInt32((pWebsockSendBuf)->WebsockBuf.Data.ulBufferLength, "Bytes"))
+
+#define PROBE_DISPATCH_START(pConnInfo, pSchema) \
+    TraceLoggingWrite(ProbeProvider, "Dispatch", \
+        TraceLoggingKeyword(PROBE_KEYWORD_DISPATCH), \
+        TraceLoggingOpcode(WINEVENT_OPCODE_START), \
+        TraceLoggingPointer((pConnInfo), "Conn"), \
+        TraceLoggingUInt32((pConnInfo)->ConnId, "ConnId"), \
+        TraceLoggingUInt32(PROBE_ROOM_NUMBER(pConnInfo), "Room"), \
+        TraceLoggingString((pSchema)->TypeName, "Type"))
+
+#define PROBE_DISPATCH_END(pConnInfo, pSchema, bSuccess) \
+    TraceLoggingWrite(ProbeProvider, "Dispatch", \
+        TraceLoggingKeyword(PROBE_KEYWORD_DISPATCH), \
+        TraceLoggingOpcode(WINEVENT_OPCODE_STOP), \
+        TraceLoggingPointer((pConnInfo), "Conn"), \
+        TraceLoggingUInt32((pConnInfo)->ConnId, "ConnId"), \
+        TraceLoggingUInt32(PROBE_ROOM_NUMBER(pConnInfo), "Room"), \
+        TraceLoggingString((pSchema)->TypeName, "Type"), \
+        TraceLoggingBoolean((bSuccess), "Success"))
+
+#define PROBE_ROOM_OPEN(pConnInfo, pRoom) \
+    TraceLoggingWrite(ProbeProvider, "RoomOpen", \
+        TraceLoggingKeyword(PROBE_KEYWORD_ROOM), \
+        TraceLoggingPointer((pConnInfo), "Conn"), \
+        TraceLoggingUInt32((pRoom)->RoomNumber, "Room"))
+
+#define PROBE_ROOM_CLOSE(pRoom) \
+    TraceLoggingWrite(ProbeProvider, "RoomClose", \
+        TraceLoggingKeyword(PROBE_KEYWORD_ROOM), \
+        TraceLoggingUInt32((pRoom)->RoomNumber, "Room"), \
+        TraceLoggingBoolean((pRoom)->bGaming, "InGame"))
+
+#define PROBE_GAME_START(pRoom) \
+    TraceLoggingWrite(ProbeProvider, "GameStart", \
+        TraceLoggingKeyword(PROBE_KEYWORD_ROOM), \
+        TraceLoggingUInt32((pRoom)->RoomNumber, "Room"), \
+        TraceLoggingUInt32((pRoom)->PlayingCount, "Players"))
+
+// bAborted: the room closed during the game.
+#define PROBE_GAME_END(pRoom, bAborted) \
+    TraceLoggingWrite(ProbeProvider, "GameEnd", \
+        TraceLoggingKeyword(PROBE_KEYWORD_ROOM), \
+        TraceLoggingUInt32((pRoom)->RoomNumber, "Room"), \
+        TraceLoggingBoolean((bAborted), "Aborted"))
@@ -0,0 +1,357 @@
+#include <strsafe.h>
+
+#include "common.h"
+#include <tlhelp32.h>
+#include <dbghelp.h>
+#include "Profiler.h"
+
+#pragma comment(lib, "dbghelp.lib")
+
+#define PROFILE_LINE_MAX (PROFILE_FRAMES_MAX * 320) // one folded stack
+#define PROFILE_SYMBOL_MAXLEN 256
+
+typedef struct _PROFILE_STACK
+{
+    UINT64 Hash;
+    UINT Count; // 0 while the slot is free
+    UINT Depth;
+    DWORD64 PcList[PROFILE_FRAMES_MAX]; // leaf first
+} PROFILE_STACK, * PPROFILE_STACK;
+
+typedef struct _PROFILE_THREAD
+{
+    DWORD ThreadId;
+    HANDLE hThread;
+    ULONG64 LastCycles; // QueryThreadCycleTime at the last tick, idle threads are not sampled
+    BOOL bSeen;         // still running at the last refresh
+} PROFILE_THREAD, * PPROFILE_THREAD;
+
+typedef struct _PROFILE_RUN
+{
+    UINT Seconds;
+    UINT SampleCnt;
+    UINT DroppedCnt;
+    UINT StackCnt;
+    UINT ThreadCnt;
+    PROFILE_THREAD ThreadList[PROFILE_THREADS_MAX];
+    PROFILE_STACK StackList[PROFILE_STACKS_MAX];
+} PROFILE_RUN, * PPROFILE_RUN;
+
+static LONG volatile bProfiling;
+
+// Threads of the process come and go with the thread pool, looked up once a second.
+static VOID RefreshProfileThreads(_Inout_ PPROFILE_RUN pRun)
+{
+    DWORD ProcessId = GetCurrentProcessId();
+    DWORD SelfId = GetCurrentThreadId();
+
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+        return; // keep the last list
+
+    for (UINT i = 0; i < pRun->ThreadCnt; i++)
+        pRun->ThreadList[i].bSeen = FALSE;
+
+    THREADENTRY32 Entry = { sizeof(Entry) };
+    for (BOOL bMore = Thread32First(hSnapshot, &Entry); bMore; bMore = Thread32Next(hSnapshot, &Entry))
+    {
+        if (Entry.th32OwnerProcessID != ProcessId || Entry.th32ThreadID == SelfId)
+            continue;
+
+        UINT i = 0;
+        for (; i < pRun->ThreadCnt && pRun->ThreadList[i].ThreadId != Entry.th32ThreadID; i++);
+        if (i < pRun->ThreadCnt)
+        {
+            pRun->ThreadList[i].bSeen = TRUE;
+            continue;
+        }
+        if (pRun->ThreadCnt == PROFILE_THREADS_MAX)
+            continue;
+
+        HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION, FALSE, Entry.th32ThreadID);
+        if (!hThread)
+            continue;
+
+        PPROFILE_THREAD pThread = &pRun->ThreadList[pRun->ThreadCnt++];
+        pThread->ThreadId = Entry.th32ThreadID;
+        pThread->hThread = hThread;
+        pThread->LastCycles = 0;
+        pThread->bSeen = TRUE;
+    }
+    CloseHandle(hSnapshot);
+
+    for (UINT i = 0; i < pRun->ThreadCnt;)
+    {
+        if (pRun->ThreadList[i].bSeen)
+        {
+            i++;
+            continue;
+        }
+        CloseHandle(pRun->ThreadList[i].hThread);
+        pRun->ThreadList[i] = pRun->ThreadList[--pRun->ThreadCnt];
+    }
+}
+
+// Unwind the suspended thread into PcList. Must not allocate or take a lock the thread may hold:
+// RtlLookupFunctionEntry only takes the function table lock, which is free unless modules are loading.
+static UINT CaptureThreadStack(_In_ HANDLE hThread, _Out_writes_to_(PROFILE_FRAMES_MAX, return) DWORD64 PcList[])
+{
+    CONTEXT Context;
+    UINT Depth = 0;
+
+#if defined(_M_X64)
+    Context.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    if (!GetThreadContext(hThread, &Context))
+        return 0;
+
+    __try
+    {
+        while (Depth < PROFILE_FRAMES_MAX && Context.Rip)
+        {
+            PcList[Depth++] = Context.Rip;
+
+            DWORD64 ImageBase;
+            PRUNTIME_FUNCTION pFunction = RtlLookupFunctionEntry(Context.Rip, &ImageBase, NULL);
+            if (!pFunction)
+            {
+                // leaf function without unwind data, the return address is on top.
+                Context.Rip = *(DWORD64*)Context.Rsp;
+                Context.Rsp += sizeof(DWORD64);
+                continue;
+            }
+
+            PVOID HandlerData;
+            DWORD64 EstablisherFrame;
+            RtlVirtualUnwind(UNW_FLAG_NHANDLER, ImageBase, Context.Rip, pFunction, &Context, &HandlerData, &EstablisherFrame, NULL);
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        // a stack in the middle of changing, keep the frames so far.
+    }
+#else
+    Context.ContextFlags = CONTEXT_CONTROL;
+    if (!GetThreadContext(hThread, &Context))
+        return 0;
+    PcList[Depth++] = Context.Eip;
+#endif
+    return Depth;
+}
+
+static VOID CountProfileStack(_Inout_ PPROFILE_RUN pRun, _In_reads_(Depth) const DWORD64 PcList[], _In_ UINT Depth)
+{
+    UINT64 Hash = 14695981039346656037ULL; // FNV-1a
+    for (UINT i = 0; i < Depth; i++)
+        Hash = (Hash ^ PcList[i]) * 1099511628211ULL;
+
+    pRun->SampleCnt++;
+    for (UINT i = 0; i < PROFILE_STACKS_MAX; i++)
+    {
+        PPROFILE_STACK pStack = &pRun->StackList[(Hash + i) & (PROFILE_STACKS_MAX - 1)];
+        if (!pStack->Count)
+        {
+            pStack->Hash = Hash;
+            pStack->Count = 1;
+            pStack->Depth = Depth;
+            memcpy(pStack->PcList, PcList, Depth * sizeof(DWORD64));
+            pRun->StackCnt++;
+            return;
+        }
+        if (pStack->Hash == Hash && pStack->Depth == Depth && !memcmp(pStack->PcList, PcList, Depth * sizeof(DWORD64)))
+        {
+            pStack->Count++;
+            return;
+        }
+    }
+    pRun->DroppedCnt++;
+}
+
+static VOID SampleProfileThreads(_Inout_ PPROFILE_RUN pRun)
+{
+    for (UINT i = 0; i < pRun->ThreadCnt; i++)
+    {
+        PPROFILE_THREAD pThread = &pRun->ThreadList[i];
+        ULONG64 Cycles;
+        if (!QueryThreadCycleTime(pThread->hThread, &Cycles) || Cycles == pThread->LastCycles)
+            continue; // waiting, no CPU used
+        pThread->LastCycles = Cycles;
+
+        DWORD64 PcList[PROFILE_FRAMES_MAX];
+        if (SuspendThread(pThread->hThread) == (DWORD)-1)
+            continue; // exited
+        UINT Depth = CaptureThreadStack(pThread->hThread, PcList);
+        ResumeThread(pThread->hThread);
+
+        if (Depth)
+            CountProfileStack(pRun, PcList, Depth);
+    }
+}
+
+// "module!function", or "module!0x<offset>" without symbols.
+static VOID FormatProfileFrame(_In_ HANDLE hProcess, _In_ DWORD64 Pc, _Out_writes_z_(cchFrame) PCHAR szFrame, _In_ SIZE_T cchFrame)
+{
+    DECLSPEC_ALIGN(8) BYTE SymbolBuffer[sizeof(SYMBOL_INFO) + PROFILE_SYMBOL_MAXLEN];
+    PSYMBOL_INFO pSymbol = (PSYMBOL_INFO)SymbolBuffer;
+    IMAGEHLP_MODULE64 Module = { sizeof(Module) };
+    DWORD64 Displacement;
+
+    pSymbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    pSymbol->MaxNameLen = PROFILE_SYMBOL_MAXLEN;
+
+    BOOL bModule = SymGetModuleInfo64(hProcess, Pc, &Module);
+    if (SymFromAddr(hProcess, Pc, &Displacement, pSymbol))
+        StringCchPrintfA(szFrame, cchFrame, "%s!%s", bModule ? Module.ModuleName : "?", pSymbol->Name);
+    else if (bModule)
+        StringCchPrintfA(szFrame, cchFrame, "%s!0x%llx", Module.ModuleName, Pc - Module.BaseOfImage);
+    else
+        StringCchPrintfA(szFrame, cchFrame, "0x%llx", Pc);
+}
+
+static VOID WriteProfile(_In_ const PROFILE_RUN* pRun)
+{
+    WCHAR FileName[MAX_PATH];
+    SYSTEMTIME Now;
+    GetLocalTime(&Now);
+    StringCchPrintfW(FileName, _countof(FileName), L"profile-%04u%02u%02u-%02u%02u%02u.folded",
+        Now.wYear, Now.wMonth, Now.wDay, Now.wHour, Now.wMinute, Now.wSecond);
+
+    HANDLE hProcess = GetCurrentProcess();
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    PCHAR pLine = NULL;
+    BOOL bSymbols = FALSE;
+    BOOL bSuccess = FALSE;
+
+    __try
+    {
+        pLine = HeapAlloc(GetProcessHeap(), 0, PROFILE_LINE_MAX);
+        if (!pLine)
+            __leave;
+
+        SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS);
+        bSymbols = SymInitialize(hProcess, NULL, TRUE);
+        if (!bSymbols)
+            LogErrorMessage(L"SymInitialize", GetLastError()); // addresses only
+
+        hFile = CreateFileW(FileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+        {
+            LogErrorMessage(L"CreateFileW", GetLastError());
+            __leave;
+        }
+
+        for (UINT i = 0; i < PROFILE_STACKS_MAX; i++)
+        {
+            const PROFILE_STACK* pStack = &pRun->StackList[i];
+            if (!pStack->Count)
+                continue;
+
+            // root first. return addresses point after the call, which may be the next function.
+            PCHAR pEnd = pLine;
+            SIZE_T cchRemaining = PROFILE_LINE_MAX;
+            for (UINT j = pStack->Depth; j-- > 0;)
+            {
+                CHAR szFrame[PROFILE_SYMBOL_MAXLEN + 64];
+                FormatProfileFrame(hProcess, j ? pStack->PcList[j] - 1 : pStack->PcList[j], szFrame, _countof(szFrame));
+                StringCchPrintfExA(pEnd, cchRemaining, &pEnd, &cchRemaining, 0, j ? "%s;" : "%s", szFrame);
+            }
+            StringCchPrintfExA(pEnd, cchRemaining, &pEnd, &cchRemaining, 0, " %u\n", pStack->Count);
+
+            DWORD cbWritten;
+            if (!WriteFile(hFile, pLine, (DWORD)(pEnd - pLine), &cbWritten, NULL))
+            {
+                LogErrorMessage(L"WriteFile", GetLastError());
+                __leave;
+            }
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(hFile);
+        if (bSymbols)
+            SymCleanup(hProcess);
+        if (pLine)
+            HeapFree(GetProcessHeap(), 0, pLine);
+    }
+
+    if (bSuccess)
+        Log(LOG_INFO, L"profile written to %1: %2!u! samples, %3!u! stacks, %4!u! dropped.",
+            FileName, pRun->SampleCnt, pRun->StackCnt, pRun->DroppedCnt);
+}
+
+static DWORD WINAPI ProfilerThread(_In_ LPVOID lpParameter)
+{
+    PPROFILE_RUN pRun = lpParameter;
+
+    // Sleep would tick at 64 Hz, the high resolution timer needs Windows 10 1803.
+    HANDLE hTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!hTimer)
+        hTimer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+
+    if (hTimer)
+    {
+        LARGE_INTEGER Interval;
+        Interval.QuadPart = -10000000LL / PROFILE_HZ; // relative, in 100ns
+
+        for (UINT Tick = 0; Tick < pRun->Seconds * PROFILE_HZ; Tick++)
+        {
+            if (Tick % PROFILE_HZ == 0)
+                RefreshProfileThreads(pRun);
+
+            // armed before sampling, so the rate doesn't depend on how long sampling takes.
+            SetWaitableTimer(hTimer, &Interval, 0, NULL, NULL, FALSE);
+            SampleProfileThreads(pRun);
+            WaitForSingleObject(hTimer, INFINITE);
+        }
+        CloseHandle(hTimer);
+    }
+    else
+    {
+        LogErrorMessage(L"CreateWaitableTimerExW", GetLastError());
+    }
+
+    for (UINT i = 0; i < pRun->ThreadCnt; i++)
+        CloseHandle(pRun->ThreadList[i].hThread);
+
+    WriteProfile(pRun);
+    VirtualFree(pRun, 0, MEM_RELEASE);
+    InterlockedExchange(&bProfiling, FALSE);
+    return 0;
+}
+
+BOOL StartProfiler(_In_ UINT Seconds)
+{
+    if (Seconds == 0 || Seconds > PROFILE_SECONDS_MAX)
+    {
+        Log(LOG_ERROR, L"profile for 1 to %1!u! seconds.", PROFILE_SECONDS_MAX);
+        return FALSE;
+    }
+    if (InterlockedCompareExchange(&bProfiling, TRUE, FALSE))
+    {
+        Log(LOG_WARNING, L"a profile is already running.");
+        return FALSE;
+    }
+
+    PPROFILE_RUN pRun = VirtualAlloc(NULL, sizeof(PROFILE_RUN), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!pRun)
+    {
+        LogErrorMessage(L"VirtualAlloc", GetLastError());
+        InterlockedExchange(&bProfiling, FALSE);
+        return FALSE;
+    }
+    pRun->Seconds = Seconds;
+
+    HANDLE hThread = CreateThread(NULL, 0, ProfilerThread, pRun, 0, NULL);
+    if (!hThread)
+    {
+        LogErrorMessage(L"CreateThread", GetLastError());
+        VirtualFree(pRun, 0, MEM_RELEASE);
+        InterlockedExchange(&bProfiling, FALSE);
+        return FALSE;
+    }
+    CloseHandle(hThread);
+
+    Log(LOG_INFO, L"profiling every thread for %1!u! s at %2!u! Hz.", Seconds, PROFILE_HZ);
+    return TRUE;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "common.h"
+
+// Sampling CPU profiler, writes folded stacks ("root;...;leaf count" per line) for flamegraph.pl,
+// speedscope or similar.
+//
+// A profiler thread wakes PROFILE_HZ times a second. Each time, every other thread of the process that used CPU
+// since the last tick is suspended, its stack unwound from its context, and resumed. Nothing is allocated
+// or locked while a thread is suspended. The stacks are counted by their return addresses and symbolized
+// with DbgHelp when the run ends, so the samples themselves stay cheap.
+// On 32-bit builds only the instruction pointer is sampled (there is no unwinder).
+
+#define PROFILE_HZ 99
+#define PROFILE_FRAMES_MAX 48    // deeper stacks are cut at the root end
+#define PROFILE_STACKS_MAX 16384 // distinct stacks kept, power of 2. samples of more are counted as dropped
+#define PROFILE_THREADS_MAX 256
+#define PROFILE_SECONDS_MAX 600
+
+// Profile for Seconds in the background, then write profile-<local time>.folded.
+// FALSE if a profile is already running or it couldn't start.
+BOOL StartProfiler(_In_ UINT Seconds);
@@ -0,0 +1,173 @@
+#include "common.h"
+#include "Random.h"
+#include <bcrypt.h>
+
+#pragma comment(lib, "bcrypt.lib")
+
+static __declspec(thread) CHACHA_STATE ThreadChaCha;
+
+// bumped by SetRandomSeed, threads rekey when they see a new one.
+static volatile LONG SeedGeneration = 1;
+static volatile LONG64 PinnedSeed;
+static volatile LONG PinnedStreamCnt;
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8);  \
+    c += d; b ^= c; b = ROTL32(b, 7);
+
+VOID ChaChaBlock(_Inout_ PCHACHA_STATE pState)
+{
+    UINT32 x[16];
+    memcpy(x, pState->Input, sizeof(x));
+
+    for (UINT i = 0; i < 10; i++) // 20 rounds
+    {
+        QUARTER_ROUND(x[0], x[4], x[8],  x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9],  x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8],  x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9],  x[14]);
+    }
+    for (UINT i = 0; i < 16; i++)
+        pState->Output[i] = x[i] + pState->Input[i];
+
+    pState->Input[12]++; // block counter
+    pState->OutputIndex = 0;
+    pState->BlockCnt++;
+}
+
+VOID ChaChaSetKey(_Out_ PCHACHA_STATE pState, _In_reads_(11) const UINT32* pKey)
+{
+    pState->Input[0] = 0x61707865; // "expand 32-byte k"
+    pState->Input[1] = 0x3320646e;
+    pState->Input[2] = 0x79622d32;
+    pState->Input[3] = 0x6b206574;
+    memcpy(&pState->Input[4], pKey, 8 * sizeof(UINT32));
+    pState->Input[12] = 0;
+    memcpy(&pState->Input[13], pKey + 8, 3 * sizeof(UINT32));
+    pState->OutputIndex = 16;
+    pState->BlockCnt = 0;
+}
+
+static BOOL ChaChaRekey(_Inout_ PCHACHA_STATE pState)
+{
+    UINT32 Key[11];
+    LONG Generation = SeedGeneration;
+    LONG64 Seed = PinnedSeed;
+
+    if (Seed)
+    {
+        // the seed in the key, the stream number in the nonce.
+        ZeroMemory(Key, sizeof(Key));
+        Key[0] = (UINT32)Seed;
+        Key[1] = (UINT32)((UINT64)Seed >> 32);
+        Key[8] = (UINT32)InterlockedIncrement(&PinnedStreamCnt);
+    }
+    else
+    {
+        NTSTATUS Status = BCryptGenRandom(NULL, (PUCHAR)Key, sizeof(Key), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+        if (!BCRYPT_SUCCESS(Status))
+        {
+            Log(LOG_ERROR, L"BCryptGenRandom failed with status 0x%1!08x!.", Status);
+            return FALSE;
+        }
+    }
+    ChaChaSetKey(pState, Key);
+    SecureZeroMemory(Key, sizeof(Key));
+    pState->Generation = Generation;
+    return TRUE;
+}
+
+BOOL RandomUInt32(_Out_ UINT* pValue)
+{
+    PCHACHA_STATE pState = &ThreadChaCha;
+
+    // a pinned seed is never rekeyed by count, the replay must not depend on how much was drawn.
+    if (pState->Generation != SeedGeneration ||
+        (pState->OutputIndex == 16 && pState->BlockCnt >= RANDOM_RESEED_BLOCKS && !PinnedSeed))
+    {
+        if (!ChaChaRekey(pState))
+            return FALSE;
+    }
+    if (pState->OutputIndex == 16)
+        ChaChaBlock(pState);
+
+    *pValue = pState->Output[pState->OutputIndex];
+    pState->Output[pState->OutputIndex++] = 0; // don't keep used output around
+    return TRUE;
+}
+
+// Next word of pStream, or of the thread's generator when no seed was pinned.
+static BOOL StreamRandomUInt32(_Inout_opt_ PRANDOM_STREAM pStream, _Out_ UINT* pValue)
+{
+    if (!pStream || !pStream->bPinned)
+        return RandomUInt32(pValue);
+
+    PCHACHA_STATE pState = &pStream->ChaCha;
+    if (pState->OutputIndex == 16)
+        ChaChaBlock(pState);
+    *pValue = pState->Output[pState->OutputIndex++];
+    return TRUE;
+}
+
+static BOOL DrawBelow(_Inout_opt_ PRANDOM_STREAM pStream, _In_ UINT Bound, _Out_ UINT* pValue)
+{
+    // reject the lowest 2^32 mod Bound values, what is left is a multiple of Bound.
+    UINT Threshold = (0u - Bound) % Bound;
+    UINT Value;
+    do
+    {
+        if (!StreamRandomUInt32(pStream, &Value))
+            return FALSE;
+    } while (Value < Threshold);
+
+    *pValue = Value % Bound;
+    return TRUE;
+}
+
+BOOL RandomBelow(_In_ UINT Bound, _Out_ UINT* pValue)
+{
+    return DrawBelow(NULL, Bound, pValue);
+}
+
+VOID InitGameRandom(_Out_ PRANDOM_STREAM pStream, _In_ UINT RoomNumber, _In_ UINT GameCnt)
+{
+    UINT32 Key[11];
+    LONG64 Seed = PinnedSeed;
+
+    pStream->bPinned = Seed != 0;
+    if (!Seed)
+        return;
+
+    // the seed in the key like the thread streams, the game in the nonce. Word 10 tells it from them.
+    ZeroMemory(Key, sizeof(Key));
+    Key[0] = (UINT32)Seed;
+    Key[1] = (UINT32)((UINT64)Seed >> 32);
+    Key[8] = RoomNumber;
+    Key[9] = GameCnt;
+    Key[10] = 1;
+    ChaChaSetKey(&pStream->ChaCha, Key);
+}
+
+BOOL StreamRandomBelow(_Inout_ PRANDOM_STREAM pStream, _In_ UINT Bound, _Out_ UINT* pValue)
+{
+    return DrawBelow(pStream, Bound, pValue);
+}
+
+VOID SetRandomSeed(_In_ UINT64 Seed)
+{
+    InterlockedExchange64(&PinnedSeed, (LONG64)Seed);
+    InterlockedExchange(&PinnedStreamCnt, 0);
+    InterlockedIncrement(&SeedGeneration);
+    if (Seed)
+        Log(LOG_INFO, L"random seed pinned to %1!I64u!.", Seed);
+    else
+        Log(LOG_INFO, L"random seed from the OS.");
+}
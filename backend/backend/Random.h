@@ -0,0 +1,51 @@
+#pragma once
+#include "common.h"
+
+// Per-thread ChaCha20 generator for roles, leaders and room numbers, replaces rand_s on these paths.
+//
+// Each thread keys its generator from the OS (BCryptGenRandom) on first use and again every
+// RANDOM_RESEED_BLOCKS blocks, everything in between is computed in user mode.
+
+#define RANDOM_RESEED_BLOCKS 16384 // 64 bytes each, 1MB of output per key
+
+typedef struct _CHACHA_STATE
+{
+    UINT32 Input[16];  // constants, key, block counter, nonce
+    UINT32 Output[16]; // the current block
+    UINT OutputIndex;  // next unused word of Output, 16 when used up
+    UINT BlockCnt;     // since keyed
+    LONG Generation;   // SeedGeneration when keyed
+} CHACHA_STATE, * PCHACHA_STATE;
+
+// Key and nonce: 8 + 3 words, the block counter starts at 0.
+VOID ChaChaSetKey(_Out_ PCHACHA_STATE pState, _In_reads_(11) const UINT32* pKey);
+
+// Compute the block of the counter into Output, then count it.
+VOID ChaChaBlock(_Inout_ PCHACHA_STATE pState);
+
+// The draws of one game: roles and the first leader.
+// With a pinned seed they come from a stream of their own, the room number and the room's game count
+// in its nonce, so a replay deals the same game whatever thread handles startGame and whatever the
+// other rooms drew before. Otherwise they are drawn from the thread's generator.
+typedef struct _RANDOM_STREAM
+{
+    BOOL bPinned;
+    CHACHA_STATE ChaCha;
+} RANDOM_STREAM, * PRANDOM_STREAM;
+
+// 32 uniformly distributed bits. FALSE only if the OS failed to provide a key.
+BOOL RandomUInt32(_Out_ UINT* pValue);
+
+// Uniform in [0, Bound), Bound must not be 0. Rejection sampling, no modulo bias.
+BOOL RandomBelow(_In_ UINT Bound, _Out_ UINT* pValue);
+
+// Key every thread from Seed instead of the OS, for replaying a test. Threads get their own
+// stream in the order they first draw after this, see RANDOM_STREAM for the draws of a game.
+// 0 goes back to OS keys.
+VOID SetRandomSeed(_In_ UINT64 Seed);
+
+// Stream of game GameCnt of room RoomNumber.
+VOID InitGameRandom(_Out_ PRANDOM_STREAM pStream, _In_ UINT RoomNumber, _In_ UINT GameCnt);
+
+// RandomBelow from pStream.
+BOOL StreamRandomBelow(_Inout_ PRANDOM_STREAM pStream, _In_ UINT Bound, _Out_ UINT* pValue);
@@ -0,0 +1,71 @@
+#include "common.h"
+#include "RoleHint.h"
+
+// hint type for [viewer role][target role], 0 if the target isn't shown.
+static const BYTE RoleHintTable[ROLE_CNT][ROLE_CNT] =
+{
+#define ROLE_HINT(Viewer, Target, HintType) [Viewer][Target] = HintType,
+#include "RoleHint.inl"
+#undef ROLE_HINT
+};
+
+// roles shown to each viewer role, all in one constant: bit (Viewer - 1) * 8 + (Target - 1).
+// ROLE_* are 1 to 8, so the 8 bits of every viewer fit.
+C_ASSERT(ROLE_CNT - 1 <= 8);
+#define ROLE_HINT(Viewer, Target, HintType) | (1ull << (((Viewer) - 1) * 8 + (Target) - 1))
+static const UINT64 RoleVisibleBits = 0
+#include "RoleHint.inl"
+    ;
+#undef ROLE_HINT
+
+// ROLE_BIT of each role shown to Viewer.
+static UINT GetVisibleRoles(_In_ UINT Viewer)
+{
+    return (UINT)((RoleVisibleBits >> ((Viewer - 1) * 8)) & 0xFF) << 1;
+}
+
+// Roles dealt to 5 to 10 players. 7 and 10 players add Oberon, 9 and 10 Mordred.
+static const BYTE RoleDeckList[ROOM_PLAYER_MAX - ROOM_PLAYER_MIN + 1][ROOM_PLAYER_MAX] =
+{
+    { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST,                                              ROLE_MORGANA,  ROLE_ASSASSIN },
+    { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST,                               ROLE_MORGANA,  ROLE_ASSASSIN },
+    { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST,                               ROLE_MORGANA,  ROLE_OBERON,   ROLE_ASSASSIN },
+    { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST,                ROLE_MORGANA,  ROLE_ASSASSIN, ROLE_MINIONS },
+    { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_MORDRED,  ROLE_MORGANA, ROLE_ASSASSIN },
+    { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_MORDRED,  ROLE_MORGANA, ROLE_OBERON,  ROLE_ASSASSIN },
+};
+
+VOID GetRoleDeck(_In_ UINT PlayerCnt, _Out_writes_(PlayerCnt) UINT RoleList[])
+{
+    for (UINT i = 0; i < PlayerCnt; i++)
+        RoleList[i] = RoleDeckList[PlayerCnt - ROOM_PLAYER_MIN][i];
+}
+
+UINT GetRoleHints(_In_ const GAME_ROOM* pRoom, _In_ UINT PlayingIndex, _Out_writes_to_(ROOM_PLAYER_MAX, return) HINTLIST HintList[])
+{
+    // players holding each role, one bit per PlayingIndex.
+    UINT RolePlayers[ROLE_CNT] = { 0 };
+    for (UINT i = 0; i < pRoom->PlayingCount; i++)
+        RolePlayers[pRoom->RoleList[i]] |= 1u << i;
+
+    UINT Role = pRoom->RoleList[PlayingIndex];
+    UINT Players = 0;
+    for (UINT Roles = GetVisibleRoles(Role); Roles; Roles &= Roles - 1)
+    {
+        DWORD Target;
+        BitScanForward(&Target, Roles);
+        Players |= RolePlayers[Target];
+    }
+    Players &= ~(1u << PlayingIndex); // the other minion, not yourself
+
+    UINT HintCnt = 0;
+    for (; Players; Players &= Players - 1)
+    {
+        DWORD Index;
+        BitScanForward(&Index, Players);
+        HintList[HintCnt].ID = pRoom->PlayingList[Index].GameID;
+        HintList[HintCnt].HintType = RoleHintTable[Role][pRoom->RoleList[Index]];
+        HintCnt++;
+    }
+    return HintCnt;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "common.h"
+#include "RoomManager.h"
+#include "MessageSender.h"
+
+// Role hints sent with beginGame, the rules are in RoleHint.inl.
+
+#define ROLE_CNT (ROLE_MINIONS + 1) // ROLE_* are 1 based
+#define ROLE_BIT(Role) (1u << (Role))
+
+// The roles dealt to PlayerCnt players, ROOM_PLAYER_MIN to ROOM_PLAYER_MAX. Shuffle them to assign.
+VOID GetRoleDeck(_In_ UINT PlayerCnt, _Out_writes_(PlayerCnt) UINT RoleList[]);
+
+// The hints for the player at PlayingIndex, which never include the player. Returns the count.
+// RoleList of the room must be assigned.
+UINT GetRoleHints(_In_ const GAME_ROOM* pRoom, _In_ UINT PlayingIndex, _Out_writes_to_(ROOM_PLAYER_MAX, return) HINTLIST HintList[]);
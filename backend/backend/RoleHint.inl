@@ -0,0 +1,32 @@
+// Which roles each role is told about when the game begins, and how they are shown.
+// Expanded by RoleHint.c into constant tables. No include guard on purpose.
+//
+// ROLE_HINT(Viewer, Target, HintType): players with role Viewer see the players with role Target as HintType.
+
+// Merlin sees every evil player but Mordred, without their roles.
+ROLE_HINT(ROLE_MERLIN,   ROLE_ASSASSIN, HINT_BAD)
+ROLE_HINT(ROLE_MERLIN,   ROLE_MORGANA,  HINT_BAD)
+ROLE_HINT(ROLE_MERLIN,   ROLE_OBERON,   HINT_BAD)
+ROLE_HINT(ROLE_MERLIN,   ROLE_MINIONS,  HINT_BAD)
+
+// Percival sees Merlin and Morgana, but not which is which.
+ROLE_HINT(ROLE_PERCIVAL, ROLE_MERLIN,   HINT_MERLIN_OR_MORGANA)
+ROLE_HINT(ROLE_PERCIVAL, ROLE_MORGANA,  HINT_MERLIN_OR_MORGANA)
+
+// Evil players but Oberon see each other. Oberon sees nobody.
+ROLE_HINT(ROLE_ASSASSIN, ROLE_MORDRED,  HINT_MORDRED)
+ROLE_HINT(ROLE_ASSASSIN, ROLE_MORGANA,  HINT_MORGANA)
+ROLE_HINT(ROLE_ASSASSIN, ROLE_MINIONS,  HINT_MINIONS)
+
+ROLE_HINT(ROLE_MORDRED,  ROLE_ASSASSIN, HINT_ASSASSIN)
+ROLE_HINT(ROLE_MORDRED,  ROLE_MORGANA,  HINT_MORGANA)
+ROLE_HINT(ROLE_MORDRED,  ROLE_MINIONS,  HINT_MINIONS)
+
+ROLE_HINT(ROLE_MORGANA,  ROLE_ASSASSIN, HINT_ASSASSIN)
+ROLE_HINT(ROLE_MORGANA,  ROLE_MORDRED,  HINT_MORDRED)
+ROLE_HINT(ROLE_MORGANA,  ROLE_MINIONS,  HINT_MINIONS)
+
+ROLE_HINT(ROLE_MINIONS,  ROLE_ASSASSIN, HINT_ASSASSIN)
+ROLE_HINT(ROLE_MINIONS,  ROLE_MORDRED,  HINT_MORDRED)
+ROLE_HINT(ROLE_MINIONS,  ROLE_MORGANA,  HINT_MORGANA)
+ROLE_HINT(ROLE_MINIONS,  ROLE_MINIONS,  HINT_MINIONS) // for a deck with two minions, none of GetRoleDeck has one yet
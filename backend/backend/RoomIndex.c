@@ -0,0 +1,327 @@
+#include "common.h"
+#include "RoomManager.h"
+#include "RoomIndex.h"
+
+#define SLOT_EMPTY   0xFFFFFFFF
+#define SLOT_REMOVED 0xFFFFFFFE // room numbers never get this high, see ROOM_CODE_FLAG
+
+#define READER_SHARD_CNT 16
+
+typedef struct _ROOM_SLOT
+{
+    UINT volatile Key;
+    PGAME_ROOM volatile pRoom; // written before Key when inserting, cleared after Key when removing
+} ROOM_SLOT, * PROOM_SLOT;
+
+typedef struct _ROOM_TABLE
+{
+    UINT Mask;    // capacity - 1, capacity is a power of 2
+    UINT Shift;   // 32 - log2(capacity), for the hash
+    UINT UsedCnt; // live and removed slots
+    ROOM_SLOT SlotList[];
+} ROOM_TABLE, * PROOM_TABLE;
+
+// Lookups in progress, counted per processor and per epoch parity.
+// A writer bumps the epoch and waits for the previous parity to drain before freeing a table.
+typedef struct DECLSPEC_CACHEALIGN _READER_SHARD
+{
+    LONG volatile Cnt[2];
+} READER_SHARD, * PREADER_SHARD;
+
+static PROOM_TABLE volatile pCurTable;
+static PROOM_TABLE volatile pOldTable; // being moved into pCurTable, NULL when not resizing
+static UINT MigrateCursor;
+static UINT LiveCnt;
+
+static LONG volatile ReaderEpoch;
+static READER_SHARD ReaderList[READER_SHARD_CNT];
+
+static UINT EnterReader(VOID)
+{
+    UINT Shard = GetCurrentProcessorNumber() % READER_SHARD_CNT;
+    for (;;)
+    {
+        LONG Epoch = ReaderEpoch;
+        InterlockedIncrement(&ReaderList[Shard].Cnt[Epoch & 1]);
+        if (ReaderEpoch == Epoch)
+            return (Shard << 1) | (Epoch & 1);
+
+        // a writer is waiting for this parity, count under the new one.
+        InterlockedDecrement(&ReaderList[Shard].Cnt[Epoch & 1]);
+    }
+}
+
+static VOID LeaveReader(_In_ UINT Token)
+{
+    InterlockedDecrement(&ReaderList[Token >> 1].Cnt[Token & 1]);
+}
+
+// Wait until every lookup that started before now has finished.
+static VOID WaitForReaders(VOID)
+{
+    LONG Parity = (InterlockedIncrement(&ReaderEpoch) - 1) & 1;
+    for (UINT s = 0; s < READER_SHARD_CNT; s++)
+    {
+        while (ReaderList[s].Cnt[Parity])
+            SwitchToThread();
+    }
+}
+
+static UINT HashRoomNumber(_In_ const ROOM_TABLE* pTable, _In_ UINT RoomNumber)
+{
+    return (RoomNumber * 0x9E3779B1u) >> pTable->Shift;
+}
+
+_Ret_maybenull_
+static PROOM_TABLE AllocRoomTable(_In_ UINT Capacity)
+{
+    PROOM_TABLE pTable = HeapAlloc(GetProcessHeap(), 0, sizeof(ROOM_TABLE) + Capacity * sizeof(ROOM_SLOT));
+    if (!pTable)
+    {
+        Log(LOG_ERROR, L"failed to allocate a room index of %1!u! slots.", Capacity);
+        return NULL;
+    }
+
+    DWORD Bits;
+    BitScanReverse(&Bits, Capacity);
+    pTable->Mask = Capacity - 1;
+    pTable->Shift = 32 - Bits;
+    pTable->UsedCnt = 0;
+    for (UINT i = 0; i < Capacity; i++)
+    {
+        pTable->SlotList[i].Key = SLOT_EMPTY;
+        pTable->SlotList[i].pRoom = NULL;
+    }
+    return pTable;
+}
+
+_Ret_maybenull_
+static PGAME_ROOM FindInTable(_In_ const ROOM_TABLE* pTable, _In_ UINT RoomNumber)
+{
+    UINT Index = HashRoomNumber(pTable, RoomNumber);
+    for (UINT i = 0; i <= pTable->Mask; i++, Index = (Index + 1) & pTable->Mask)
+    {
+        UINT Key = pTable->SlotList[Index].Key;
+        if (Key == SLOT_EMPTY)
+            break;
+        if (Key == RoomNumber)
+        {
+            PGAME_ROOM pRoom = pTable->SlotList[Index].pRoom;
+            if (pRoom)
+                return pRoom;
+        }
+    }
+    return NULL;
+}
+
+// Writer only, the table must have a free slot.
+static VOID AddToTable(_Inout_ PROOM_TABLE pTable, _In_ UINT RoomNumber, _In_ PGAME_ROOM pRoom)
+{
+    UINT Index = HashRoomNumber(pTable, RoomNumber);
+    while (pTable->SlotList[Index].Key != SLOT_EMPTY && pTable->SlotList[Index].Key != SLOT_REMOVED)
+        Index = (Index + 1) & pTable->Mask;
+
+    if (pTable->SlotList[Index].Key == SLOT_EMPTY)
+        pTable->UsedCnt++;
+    pTable->SlotList[Index].pRoom = pRoom;
+    pTable->SlotList[Index].Key = RoomNumber;
+}
+
+// Writer only.
+static VOID RemoveFromTable(_Inout_ PROOM_TABLE pTable, _In_ UINT RoomNumber)
+{
+    UINT Index = HashRoomNumber(pTable, RoomNumber);
+    for (UINT i = 0; i <= pTable->Mask; i++, Index = (Index + 1) & pTable->Mask)
+    {
+        UINT Key = pTable->SlotList[Index].Key;
+        if (Key == SLOT_EMPTY)
+            return;
+        if (Key == RoomNumber)
+        {
+            pTable->SlotList[Index].Key = SLOT_REMOVED;
+            pTable->SlotList[Index].pRoom = NULL;
+            return;
+        }
+    }
+}
+
+// Move up to SlotCnt slots of the old table, free it when all are moved.
+static VOID MigrateRoomTable(_In_ UINT SlotCnt)
+{
+    PROOM_TABLE pOld = pOldTable;
+    if (!pOld)
+        return;
+
+    for (; SlotCnt && MigrateCursor <= pOld->Mask; SlotCnt--, MigrateCursor++)
+    {
+        PROOM_SLOT pSlot = &pOld->SlotList[MigrateCursor];
+        if (pSlot->Key != SLOT_EMPTY && pSlot->Key != SLOT_REMOVED)
+            AddToTable(pCurTable, pSlot->Key, pSlot->pRoom);
+    }
+    if (MigrateCursor <= pOld->Mask)
+        return;
+
+    pOldTable = NULL;
+    WaitForReaders();
+    HeapFree(GetProcessHeap(), 0, pOld);
+}
+
+// Start moving to a table sized for the open rooms. Keeps the current table if out of memory.
+static VOID ResizeRoomTable(VOID)
+{
+    // finish the previous resize first, rare: a resize is far apart from the next one.
+    MigrateRoomTable(MAXUINT);
+
+    UINT Capacity = ROOM_INDEX_MIN_CAPACITY;
+    while (Capacity < LiveCnt * 4)
+        Capacity <<= 1;
+
+    PROOM_TABLE pNew = AllocRoomTable(Capacity);
+    if (!pNew)
+        return;
+
+    MigrateCursor = 0;
+    pOldTable = pCurTable; // before pCurTable, see LookupRoomIndex
+    pCurTable = pNew;
+}
+
+VOID InitRoomIndex(VOID)
+{
+    pCurTable = AllocRoomTable(ROOM_INDEX_MIN_CAPACITY);
+    pOldTable = NULL;
+    LiveCnt = 0;
+}
+
+BOOL InsertRoomIndex(_In_ UINT RoomNumber, _In_ PGAME_ROOM pRoom)
+{
+    MigrateRoomTable(ROOM_INDEX_MIGRATE_STEP);
+
+    // keep the load under 1/2, removed slots count as they make probes longer.
+    if ((pCurTable->UsedCnt + 1) * 2 > pCurTable->Mask + 1)
+        ResizeRoomTable();
+    if (pCurTable->UsedCnt == pCurTable->Mask) // out of memory and full, keep one empty slot to end probes
+        return FALSE;
+
+    AddToTable(pCurTable, RoomNumber, pRoom);
+    LiveCnt++;
+    return TRUE;
+}
+
+VOID RemoveRoomIndex(_In_ UINT RoomNumber)
+{
+    MigrateRoomTable(ROOM_INDEX_MIGRATE_STEP);
+
+    RemoveFromTable(pCurTable, RoomNumber);
+    if (pOldTable)
+        RemoveFromTable(pOldTable, RoomNumber);
+    LiveCnt--;
+
+    if (!pOldTable && pCurTable->Mask + 1 > ROOM_INDEX_MIN_CAPACITY && LiveCnt * 8 < pCurTable->Mask + 1)
+        ResizeRoomTable();
+}
+
+PGAME_ROOM LookupRoomIndex(_In_ UINT RoomNumber)
+{
+    UINT Token = EnterReader();
+    PROOM_TABLE pCur, pOld;
+
+    // a consistent pair: while pCurTable is unchanged, pCur and pOld together hold every open room.
+    do
+    {
+        pCur = pCurTable;
+        pOld = pOldTable;
+    } while (pCur != pCurTable);
+
+    PGAME_ROOM pRoom = FindInTable(pCur, RoomNumber);
+    if (!pRoom && pOld)
+        pRoom = FindInTable(pOld, RoomNumber);
+
+    LeaveReader(Token);
+    return pRoom;
+}
+
+// Insert into the sorted page, rooms being moved may be in both tables.
+static VOID AddToRoomPage(
+    _In_ UINT RoomNumber,
+    _In_ PGAME_ROOM pRoom,
+    _In_ UINT Max,
+    _Inout_ UINT* pCnt,
+    _Inout_updates_to_(Max, *pCnt) UINT NumberList[],
+    _Inout_updates_to_(Max, *pCnt) PGAME_ROOM RoomList[])
+{
+    UINT i = *pCnt;
+    for (; i > 0 && NumberList[i - 1] > RoomNumber; i--);
+    if (i > 0 && NumberList[i - 1] == RoomNumber)
+        return;
+    if (i == Max)
+        return; // all lower than this one
+
+    UINT Last = min(*pCnt, Max - 1);
+    for (UINT j = Last; j > i; j--)
+    {
+        NumberList[j] = NumberList[j - 1];
+        RoomList[j] = RoomList[j - 1];
+    }
+    NumberList[i] = RoomNumber;
+    RoomList[i] = pRoom;
+    *pCnt = Last + 1;
+}
+
+static VOID EnumRoomTable(
+    _In_ const ROOM_TABLE* pTable,
+    _In_ UINT MinNumber,
+    _In_ UINT Max,
+    _Inout_ UINT* pCnt,
+    _Inout_updates_to_(Max, *pCnt) UINT NumberList[],
+    _Inout_updates_to_(Max, *pCnt) PGAME_ROOM RoomList[])
+{
+    for (UINT i = 0; i <= pTable->Mask; i++)
+    {
+        UINT Key = pTable->SlotList[i].Key;
+        if (Key == SLOT_EMPTY || Key == SLOT_REMOVED || Key < MinNumber)
+            continue;
+
+        PGAME_ROOM pRoom = pTable->SlotList[i].pRoom;
+        if (pRoom)
+            AddToRoomPage(Key, pRoom, Max, pCnt, NumberList, RoomList);
+    }
+}
+
+UINT EnumRoomIndex(
+    _In_ UINT MinNumber,
+    _In_ UINT Max,
+    _Out_writes_to_(Max, return) UINT NumberList[],
+    _Out_writes_to_(Max, return) PGAME_ROOM RoomList[])
+{
+    UINT Token = EnterReader();
+    PROOM_TABLE pCur, pOld;
+    UINT Cnt = 0;
+
+    // same as LookupRoomIndex.
+    do
+    {
+        pCur = pCurTable;
+        pOld = pOldTable;
+    } while (pCur != pCurTable);
+
+    if (Max)
+    {
+        EnumRoomTable(pCur, MinNumber, Max, &Cnt, NumberList, RoomList);
+        if (pOld)
+            EnumRoomTable(pOld, MinNumber, Max, &Cnt, NumberList, RoomList);
+    }
+
+    LeaveReader(Token);
+    return Cnt;
+}
+
+UINT GetRoomIndexCount(VOID)
+{
+    return LiveCnt;
+}
+
+VOID PrintRoomIndexStats(VOID)
+{
+    Log(LOG_INFO, L"room index: %1!u! rooms, %2!u! slots, %3!u! used%4",
+        LiveCnt, pCurTable->Mask + 1, pCurTable->UsedCnt, pOldTable ? L", resizing" : L"");
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "common.h"
+#include "RoomManager.h"
+
+// Open rooms by room number (see RoomNumber.h), an open addressing hash table.
+//
+// Lookups take no lock. Inserts and removes are serialized by the caller (RoomPoolLock).
+// The table grows and shrinks with the number of open rooms: a new table is allocated and
+// every insert / remove moves a few slots of the old one into it, lookups search both meanwhile.
+// The old table is freed once no lookup can still be reading it.
+
+#define ROOM_INDEX_MIN_CAPACITY 64
+#define ROOM_INDEX_MIGRATE_STEP 32 // old slots moved per insert / remove while resizing
+
+VOID InitRoomIndex(VOID);
+
+// Returns FALSE if out of memory. RoomNumber must not be in the index.
+BOOL InsertRoomIndex(_In_ UINT RoomNumber, _In_ PGAME_ROOM pRoom);
+
+VOID RemoveRoomIndex(_In_ UINT RoomNumber);
+
+// Lock-free. The room may be closing or already reused for another number when this returns:
+// take a reference only if RefCnt is not 0, then check pRoom->RoomNumber again.
+// Room memory is never returned to the system (see SlabPool.h), so reading a closed room is safe.
+_Ret_maybenull_
+PGAME_ROOM LookupRoomIndex(_In_ UINT RoomNumber);
+
+// Lock-free. Open rooms numbered MinNumber or higher, the lowest Max of them in ascending order, for listing a page.
+// Same as LookupRoomIndex, the room may be closing or reused: compare pRoom->RoomNumber with NumberList.
+UINT EnumRoomIndex(
+    _In_ UINT MinNumber,
+    _In_ UINT Max,
+    _Out_writes_to_(Max, return) UINT NumberList[],
+    _Out_writes_to_(Max, return) PGAME_ROOM RoomList[]);
+
+UINT GetRoomIndexCount(VOID);
+
+VOID PrintRoomIndexStats(VOID);
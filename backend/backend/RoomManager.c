@@ -1,672 +1,1164 @@
-#define _CRT_RAND_S
-#include <stdlib.h>
-#include <strsafe.h>
-
-#include "common.h"
-#include "RoomManager.h"
-#include "HttpSendRecv.h"
-#include "MessageSender.h"
-// This lock must be acquired when creating / deleting / entering / leaving a room
-SRWLOCK RoomPoolLock = SRWLOCK_INIT;
-
-#define TOT_ROOM_CNT (ROOM_NUMBER_MAX - ROOM_NUMBER_MIN)
-
-UINT EmptyRoomList[TOT_ROOM_CNT];
-PGAME_ROOM RoomList[TOT_ROOM_CNT] = { 0 };
-UINT CurrentRoomNum;
-
-VOID InitRoomManager(VOID)
-{
-    for (int i = 0; i < TOT_ROOM_CNT; i++) EmptyRoomList[i] = i;
-    CurrentRoomNum = 0;
-}
-
-// return FALSE when not found in the room.
-// Index is stored in pIndex
-static BOOL GetGamingIndexByID(_In_ PGAME_ROOM pRoom, _In_ UINT ID, _Out_ UINT *pIndex)
-{
-    for (UINT i = 0; i < pRoom->PlayingCount; i++)
-    {
-        if (pRoom->PlayingList[i].GameID == ID)
-        {
-            *pIndex = i;
-            return TRUE;
-        }
-    }
-    *pIndex = 0;
-    return FALSE;
-}
-
-BOOL CreateRoom(
-    _Inout_ PCONNECTION_INFO pConnInfo,
-    _In_z_ const char* NickName,
-    _In_opt_z_ const char* Password)
-{
-    PGAME_ROOM pRoom = NULL;
-    BOOL bSuccess = TRUE;
-    if (pConnInfo->pRoom)
-    {
-        return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "You are already in a room.");
-    }
-    if (strlen(NickName) > PLAYER_NICK_MAXLEN)
-    {
-        return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "Nick name too long.");
-    }
-    if (Password)
-    {
-        if (strlen(Password) > ROOM_PASSWORD_MAXLEN)
-            return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "Password too long.");
-
-        if (Password[0] == '\0')
-            return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "Empty password field.");
-    }
-
-    AcquireSRWLockExclusive(&RoomPoolLock);
-    __try
-    {
-        if (CurrentRoomNum == TOT_ROOM_CNT) // all room is full.
-        {
-            bSuccess = ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "All room number is occupied, no room left.");
-            __leave;
-        }
-
-        pRoom = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(GAME_ROOM));
-        if (!pRoom)
-            __leave;
-
-        // randomly choose one unused room number in EmptyRoomList
-        // swap it with the last one in EmptyRoomList
-        // and take that as room number
-        UINT RandNum;
-        if (rand_s(&RandNum) != 0)
-            __leave;
-
-        RandNum %= (TOT_ROOM_CNT - CurrentRoomNum);
-        pRoom->RoomNumber = EmptyRoomList[RandNum];
-        EmptyRoomList[RandNum] = EmptyRoomList[TOT_ROOM_CNT - CurrentRoomNum];
-        CurrentRoomNum++;
-
-        InterlockedIncrement64(&(pRoom->RefCnt));
-
-        pConnInfo->pRoom = pRoom;
-        pConnInfo->WaitingIndex = pRoom->WaitingCount++;
-
-        PPLAYER_INFO pPlayerWaitingInfo = &pRoom->WaitingList[pConnInfo->WaitingIndex];
-        pPlayerWaitingInfo->pConnInfo = pConnInfo;
-        pPlayerWaitingInfo->GameID = pRoom->IDCount++;
-        pPlayerWaitingInfo->bIsRoomOwner = TRUE;
-        StringCbCopyA(pPlayerWaitingInfo->NickName, PLAYER_NICK_MAXLEN, NickName);
-        StringCbCopyA(pPlayerWaitingInfo->Avatar, PLAYER_NICK_MAXLEN, "");
-
-        if (Password)
-            StringCbCopyA(pRoom->Password, ROOM_PASSWORD_MAXLEN, Password);
-
-        InitializeSRWLock(&(pRoom->PlayerListLock));
-
-        RoomList[pRoom->RoomNumber] = pRoom;
-
-        Log(LOG_INFO, L"room %1!d! is opened.", pRoom->RoomNumber + ROOM_NUMBER_MIN);
-
-        if (!ReplyCreateRoom(pConnInfo, TRUE, pRoom->RoomNumber, 0, NULL))
-            __leave;
-
-        if (!BroadcastRoomStatus(pRoom))
-            __leave;
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        ReleaseSRWLockExclusive(&RoomPoolLock);
-    }
-
-    return bSuccess;
-}
-
-BOOL JoinRoom(
-    _In_ UINT RoomNum,
-    _Inout_ PCONNECTION_INFO pConnInfo,
-    _In_z_ const char* NickName,
-    _In_opt_z_ const char* Password)
-{
-    BOOL bSuccess = TRUE;
-    if (pConnInfo->pRoom)
-        return ReplyJoinRoom(pConnInfo, FALSE, 0, "You are already in a room.");
-
-    if (strlen(NickName) > PLAYER_NICK_MAXLEN)
-        return ReplyJoinRoom(pConnInfo, FALSE, 0, "Nick name too long.");
-
-    AcquireSRWLockShared(&RoomPoolLock);
-    __try
-    {
-        if (!RoomList[RoomNum])
-        {
-            ReplyJoinRoom(pConnInfo, FALSE, 0, "Room does not exist.");
-            __leave;
-        }
-
-        PGAME_ROOM pRoom = RoomList[RoomNum];
-
-        // check if password is correct, room is full, game is started, or NickName is duplicated.
-        if (pRoom->Password[0] != '\0')
-        {
-            if (!Password)
-            {
-                ReplyJoinRoom(pConnInfo, FALSE, 0, "Password is required.");
-                __leave;
-            }
-            if (strcmp(Password, pRoom->Password))
-            {
-                ReplyJoinRoom(pConnInfo, FALSE, 0, "Wrong password.");
-                __leave;
-            }
-        }
-
-        AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-
-        __try
-        {
-            if (pRoom->bGaming)
-            {
-                ReplyJoinRoom(pConnInfo, FALSE, 0, "The game has started already.");
-                __leave;
-            }
-
-            if (pRoom->WaitingCount == ROOM_PLAYER_MAX)
-            {
-                ReplyJoinRoom(pConnInfo, FALSE, 0, "The room is full.");
-                __leave;
-            }
-
-            for (UINT i = 0; i < pRoom->WaitingCount; i++)
-            {
-                if (strcmp(NickName, pRoom->WaitingList[i].NickName) == 0)
-                {
-                    ReplyJoinRoom(pConnInfo, FALSE, 0, "Duplicate nickname, try another.");
-                    __leave;
-                }
-            }
-
-            // pRoom is copied to pConnInfo from now on, add ref.
-            InterlockedIncrement64(&(pRoom->RefCnt));
-            pConnInfo->pRoom = pRoom;
-
-            pConnInfo->WaitingIndex = pRoom->WaitingCount++;
-
-            PPLAYER_INFO pPlayerWaitingInfo = &pRoom->WaitingList[pConnInfo->WaitingIndex];
-            pPlayerWaitingInfo->pConnInfo = pConnInfo;
-            pPlayerWaitingInfo->GameID = pRoom->IDCount++;
-            pPlayerWaitingInfo->bIsRoomOwner = FALSE;
-            StringCbCopyA(pPlayerWaitingInfo->NickName, PLAYER_NICK_MAXLEN, NickName);
-            StringCbCopyA(pPlayerWaitingInfo->Avatar, PLAYER_NICK_MAXLEN, "");
-
-            if (!ReplyJoinRoom(pConnInfo, TRUE, pPlayerWaitingInfo->GameID, NULL))
-                __leave;
-
-            if (!BroadcastRoomStatus(pRoom))
-                __leave;
-
-            bSuccess = TRUE;
-        }
-        __finally
-        {
-            ReleaseSRWLockExclusive(&pRoom->PlayerListLock);
-        }
-    }
-    __finally
-    {
-        ReleaseSRWLockShared(&RoomPoolLock);
-    }
-
-    return bSuccess;
-}
-
-// Leave the room if the current user is inside one.
-// And if there's no one in the room, it will be closed.
-// Room owner will be transferred if the current user is room owner
-// Will boardcast room status to the rest of player in room after leaving.
-VOID LeaveRoom(_Inout_ PCONNECTION_INFO pConnInfo)
-{
-    AcquireSRWLockExclusive(&RoomPoolLock);
-    __try
-    {
-        if (!pConnInfo->pRoom)
-            __leave;
-
-        LONG64 NewCnt = InterlockedDecrement64(&(pConnInfo->pRoom->RefCnt));
-        if (NewCnt == 0)
-        {
-            Log(LOG_INFO, L"room %1!d! is closed.", pConnInfo->pRoom->RoomNumber + ROOM_NUMBER_MIN);
-
-            EmptyRoomList[TOT_ROOM_CNT - CurrentRoomNum] = pConnInfo->pRoom->RoomNumber;
-            CurrentRoomNum--;
-            RoomList[pConnInfo->pRoom->RoomNumber] = NULL;
-            HeapFree(GetProcessHeap(), 0, pConnInfo->pRoom);
-        }
-        else
-        {
-            PGAME_ROOM pRoom = pConnInfo->pRoom;
-            AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-
-            for (UINT i = pConnInfo->WaitingIndex; i < pRoom->WaitingCount - 1; i++)
-            {
-                pRoom->WaitingList[i] = pRoom->WaitingList[i + 1];
-                pRoom->WaitingList[i].pConnInfo->WaitingIndex = i;
-            }
-            pRoom->WaitingCount--;
-
-            if (pConnInfo->WaitingIndex == 0) // transfer room owner if needed
-            {
-                pRoom->WaitingList[0].bIsRoomOwner = TRUE;
-            }
-
-            // Player is offline. set the corresponding field to NULL.
-            pRoom->PlayingList[pConnInfo->PlayingIndex].pConnInfo = NULL;
-
-            BroadcastRoomStatus(pRoom);
-            ReleaseSRWLockExclusive(&pRoom->PlayerListLock);
-        }
-    }
-    __finally
-    {
-        pConnInfo->pRoom = NULL;
-        ReleaseSRWLockExclusive(&RoomPoolLock);
-    }
-}
-
-BOOL ChangeAvatar(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const char* Avatar)
-{
-    // TODO: add response for ChangeAvatar?
-    if (strlen(Avatar) > PLAYER_AVATAR_MAXLEN)
-        return TRUE;
-
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    BOOL bSuccess = FALSE;
-
-    AcquireSRWLockShared(&pRoom->PlayerListLock);
-    __try
-    {
-        if (pRoom->bGaming) // You can't change avatar when game started.
-            __leave;
-
-        StringCbCopyA(pConnInfo->pRoom->WaitingList[pConnInfo->WaitingIndex].Avatar, PLAYER_AVATAR_MAXLEN, Avatar);
-        bSuccess = BroadcastRoomStatus(pRoom);
-    }
-    __finally
-    {
-        ReleaseSRWLockShared(&pRoom->PlayerListLock);
-    }
-    return bSuccess;
-}
-
-// assign a random role to RoleList based on PlayingCount
-static BOOL AssignRole(_Inout_ PGAME_ROOM pRoom)
-{
-    UINT RoleList5[] =  { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST,                                              ROLE_MORGANA,  ROLE_ASSASSIN };
-    UINT RoleList6[] =  { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST,                               ROLE_MORGANA,  ROLE_ASSASSIN };
-    UINT RoleList7[] =  { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST,                               ROLE_MORGANA,  ROLE_OBERON,   ROLE_ASSASSIN };
-    UINT RoleList8[] =  { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST,                ROLE_MORGANA,  ROLE_ASSASSIN, ROLE_MINIONS };
-    UINT RoleList9[] =  { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_MORDRED,  ROLE_MORGANA, ROLE_ASSASSIN };
-    UINT RoleList10[] = { ROLE_MERLIN, ROLE_PERCIVAL, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_LOYALIST, ROLE_MORDRED,  ROLE_MORGANA, ROLE_OBERON,  ROLE_ASSASSIN };
-
-    UINT* List[] = { RoleList5, RoleList6, RoleList7, RoleList8, RoleList9, RoleList10 };
-
-    // TODO: assert(pRoom->PlayingCount - ROOM_PLAYER_MIN < _countof(List))
-
-    UINT* pList = List[pRoom->PlayingCount - ROOM_PLAYER_MIN];
-    for (UINT i = 0; i < pRoom->PlayingCount; i++)
-    {
-        UINT RandNum;
-        if (rand_s(&RandNum) != 0)
-            return FALSE;
-
-        RandNum %= (pRoom->PlayingCount - i);
-        pRoom->RoleList[i] = pList[RandNum];
-        pList[RandNum] = pList[pRoom->PlayingCount - i - 1];
-    }
-    return TRUE;
-}
-
-BOOL StartGame(_Inout_ PCONNECTION_INFO pConnInfo)
-{
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    if (!pRoom)
-        return ReplyStartGame(pConnInfo, FALSE, "You are not in a room.");
-
-    BOOL bSuccess = FALSE;
-    AcquireSRWLockExclusive(&pConnInfo->pRoom->PlayerListLock);
-    __try
-    {
-        if (!pRoom->WaitingList[pConnInfo->WaitingIndex].bIsRoomOwner)
-        {
-            bSuccess = ReplyStartGame(pConnInfo, FALSE, "You are not room owner.");
-            __leave;
-        }
-        if (pRoom->WaitingCount < ROOM_PLAYER_MIN)
-        {
-            bSuccess = ReplyStartGame(pConnInfo, FALSE, "Too less player to start game.");
-            __leave;
-        }
-        if (pRoom->bGaming)
-        {
-            bSuccess = ReplyStartGame(pConnInfo, FALSE, "Game already started.");
-            __leave;
-        }
-
-        // copy WaitingList to PlayingList, update index as well.
-        for (UINT i = 0; i < pRoom->WaitingCount; i++)
-        {
-            pRoom->PlayingList[i] = pRoom->WaitingList[i];
-            pRoom->PlayingList[i].pConnInfo->PlayingIndex = i;
-        }
-        pRoom->PlayingCount = pRoom->WaitingCount;
-
-        if (!AssignRole(pRoom))
-        {
-            Log(LOG_ERROR, L"AssignRole failed.");
-            bSuccess = ReplyStartGame(pConnInfo, FALSE, "Server internal error. failed to assign role.");
-            __leave;
-        }
-
-        // rand a leader, and set fairy if needed.
-        UINT RandNum;
-        if (rand_s(&RandNum) != 0)
-            __leave;
-        pRoom->LeaderIndex = RandNum % (pRoom->PlayingCount);
-
-        if (pRoom->PlayingCount >= ENABLE_FAIRY_THRESHOLD)
-        {
-            pRoom->bFairyEnabled = TRUE;
-            pRoom->FairyIndex = (pRoom->LeaderIndex + pRoom->PlayingCount - 1) % (pRoom->PlayingCount);
-        }
-        else
-        {
-            pRoom->bFairyEnabled = FALSE;
-            pRoom->FairyIndex = 0;
-        }
-        pRoom->bGaming = TRUE;
-
-        bSuccess = ReplyStartGame(pConnInfo, TRUE, NULL);
-
-        for (UINT i = 0; i < pRoom->PlayingCount; i++)
-        {
-            UINT FairyID = pRoom->bFairyEnabled ? pRoom->PlayingList[pRoom->FairyIndex].GameID : 0;
-            SendBeginGame(pRoom->PlayingList[i].pConnInfo, pRoom->RoleList[i], pRoom->bFairyEnabled, FairyID);
-        }
-    }
-    __finally
-    {
-        ReleaseSRWLockExclusive(&pConnInfo->pRoom->PlayerListLock);
-    }
-
-    return bSuccess;
-}
-
-BOOL PlayerSelectTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT TeamMemberCnt, _In_ UINT32 TeamMemberList[])
-{
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    BOOL bSuccess = FALSE;
-    if (!pRoom)
-        return ReplyPlayerSelectTeam(pConnInfo, FALSE, "You are not in a room.");
-
-    AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-    __try {
-        // check bGaming
-        if (!pRoom->bGaming)
-        {
-            bSuccess = ReplyPlayerSelectTeam(pConnInfo, FALSE, "Game hasn't started yet.");
-            __leave;
-        }
-        // check the leader
-        if (pRoom->LeaderIndex != pConnInfo->PlayingIndex)
-        {
-            bSuccess = ReplyPlayerSelectTeam(pConnInfo, FALSE, "You are not the leader.");
-            __leave;
-        }
-        // check the number of people
-        if ( TeamMemberCnt > pRoom->PlayingCount )
-        {
-            bSuccess = ReplyPlayerSelectTeam(pConnInfo, FALSE, "The number of people selected exceeded the limit.");
-            __leave;
-        }
-        if (!ReplyPlayerSelectTeam(pConnInfo, TRUE, NULL))
-            __leave;
-        if (!BroadcastSelectTeam(pRoom, TeamMemberCnt, TeamMemberList ))
-            __leave;
-        pConnInfo->pRoom->TeamMemberCnt = TeamMemberCnt;
-        for (int i = 0; i < TeamMemberCnt; i++)
-            pConnInfo->pRoom->TeamMemberList[i] = TeamMemberList[i];
-        bSuccess = TRUE;
-    }
-    __finally{
-        ReleaseSRWLockExclusive(&pRoom->PlayerListLock);
-    }
-    return bSuccess;
-}
-
-BOOL PlayerConfirmTeam(_Inout_ PCONNECTION_INFO pConnInfo)
-{
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    BOOL bSuccess = FALSE;
-    if (!pRoom)
-        return ReplyPlayerConfirmTeam(pConnInfo, FALSE, "You are not in a room.");
-
-    AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-    __try {
-        // check bGaming
-        if (!pRoom->bGaming)
-        {
-            bSuccess = ReplyPlayerConfirmTeam(pConnInfo, FALSE, "Game hasn't started yet.");
-            __leave;
-        }
-
-        // check the leader
-        if (pRoom->LeaderIndex != pConnInfo->PlayingIndex)
-        {
-            bSuccess = ReplyPlayerConfirmTeam(pConnInfo, FALSE, "You are not the leader.");
-            __leave;
-        }
-
-        if (pRoom->TeamMemberCnt > pRoom->PlayingCount)
-        {
-            bSuccess = ReplyPlayerConfirmTeam(pConnInfo, FALSE, "The number of people selected exceeded the limit.");
-            __leave;
-        }
-
-        if (!ReplyPlayerConfirmTeam(pConnInfo, TRUE, NULL))
-            __leave;
-        if (!BroadcastConfirmTeam(pRoom))
-            __leave;
-        bSuccess = TRUE;
-    }
-    __finally {
-        ReleaseSRWLockExclusive(&pRoom->PlayerListLock);
-    }
-    return bSuccess;
-}
-
-BOOL PlayerVoteTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ BOOL bVote)
-{
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    BOOL bSuccess = FALSE;
-    if (!pRoom)
-        return ReplyPlayerVoteTeam(pConnInfo, FALSE, "You are not in a room.");
-
-    AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-    __try {
-        // check bGaming
-        if (!pRoom->bGaming)
-        {
-            bSuccess = ReplyPlayerVoteTeam(pConnInfo, FALSE, "Game hasn't started yet.");
-            __leave;
-        }
-
-        if (!ReplyPlayerVoteTeam(pConnInfo, TRUE, NULL))
-            __leave;
-       // if (!BroadcastVoteTeam(pRoom))
-         //   __leave;
-        
-        bSuccess = TRUE;
-    }
-    __finally {
-        ReleaseSRWLockExclusive(&pRoom->PlayerListLock);
-    }
-    return bSuccess;
-}
-
-BOOL PlayerConductMission(_Inout_ PCONNECTION_INFO pConnInfo, _In_ BOOL bPerform)
-{
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    BOOL bSuccess = FALSE;
-    if (!pRoom)
-        return ReplyPlayerConductMission(pConnInfo, FALSE, "You are not in a room.");
-
-    AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-    __try
-    {
-        if (!pRoom->bGaming)
-        {
-            bSuccess = ReplyPlayerConductMission(pConnInfo, FALSE, "Game hasn't started yet.");
-            __leave;
-        }
-
-        if (!ReplyPlayerConductMission(pConnInfo, TRUE, NULL))
-            __leave;
-        
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        ReleaseSRWLockExclusive(&pConnInfo->pRoom->PlayerListLock);
-    }
-    return bSuccess;
-}
-
-BOOL PlayerFairyInspect(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT ID)
-{
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    BOOL bSuccess = FALSE;
-    if (!pRoom)
-        return ReplyPlayerFairyInspect(pConnInfo, FALSE, "You are not in a room.");
-    if (!pRoom->bFairyEnabled)
-        return ReplyPlayerFairyInspect(pConnInfo, FALSE, "The room doesn't have the fairy.");
-    AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-    __try
-    {
-        if (!pRoom->bGaming)
-        {
-            bSuccess = ReplyPlayerFairyInspect(pConnInfo, FALSE, "Game hasn't started yet.");
-            __leave;
-        }
-        if (pConnInfo->PlayingIndex != pRoom->FairyIndex)
-        {
-            bSuccess = ReplyPlayerFairyInspect(pConnInfo, FALSE, "You are not fairy.");
-            __leave;
-        }
-
-        UINT CheckIndex;
-        if (!GetGamingIndexByID(pRoom, ID, &CheckIndex))
-        {
-            bSuccess = ReplyPlayerFairyInspect(pConnInfo, FALSE, "Invalid ID.");
-            __leave;
-        }
-
-        if (!ReplyPlayerFairyInspect(pConnInfo, TRUE, NULL))
-            __leave;
-        if (pRoom->RoleList[CheckIndex] == HINT_GOOD )
-        {
-
-        }
-        else
-        {
-
-        }
-        if(!BroadcastFairyInspect(pRoom,ID))
-            __leave;
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        ReleaseSRWLockExclusive(&pConnInfo->pRoom->PlayerListLock);
-    }
-    return bSuccess;
-}
-
-BOOL PlayerAssassinate(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT ID)
-{
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    BOOL bSuccess = FALSE;
-    if (!pRoom)
-        return ReplyPlayerAssassinate(pConnInfo, FALSE, "You are not in a room.");
-
-    AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-    __try
-    {
-        if (!pRoom->bGaming)
-        {
-            bSuccess = ReplyPlayerAssassinate(pConnInfo, FALSE, "Game hasn't started yet.");
-            __leave;
-        }
-        if (pRoom->RoleList[pConnInfo->PlayingIndex] != ROLE_ASSASSIN)
-        {
-            bSuccess = ReplyPlayerAssassinate(pConnInfo, FALSE, "You are not assassin.");
-            __leave;
-        }
-
-        UINT AssassinateIndex;
-        if (!GetGamingIndexByID(pRoom, ID, &AssassinateIndex))
-        {
-            bSuccess = ReplyPlayerAssassinate(pConnInfo, FALSE, "Invalid ID.");
-            __leave;
-        }
-
-        if (!ReplyPlayerAssassinate(pConnInfo, TRUE, NULL))
-            __leave;
-        if (pRoom->RoleList[AssassinateIndex] == ROLE_MERLIN)
-        {
-            if (!BroadcastEndGame(pRoom, FALSE, "merlin was assassinated."))
-                __leave;
-        }
-        else
-        {
-            if (!BroadcastEndGame(pRoom, TRUE, "assassin failed to kill merlin."))
-                __leave;
-        }
-        pRoom->bGaming = FALSE;
-        if (!BroadcastRoomStatus(pRoom))
-            __leave;
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        ReleaseSRWLockExclusive(&pConnInfo->pRoom->PlayerListLock);
-    }
-    return bSuccess;
-}
-
-BOOL PlayerTextMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const CHAR Message[])
-{
-    PGAME_ROOM pRoom = pConnInfo->pRoom;
-    BOOL bSuccess = FALSE;
-    if (!pRoom)
-        return ReplyPlayerTextMessage(pConnInfo, FALSE, "You are not in a room.");
-
-    AcquireSRWLockExclusive(&pRoom->PlayerListLock);
-    __try
-    {
-        if (!pRoom->bGaming)
-        {
-            bSuccess = ReplyPlayerTextMessage(pConnInfo, FALSE, "Game hasn't started yet.");
-            __leave;
-        }
-        if (!ReplyPlayerTextMessage(pConnInfo, TRUE, NULL))
-            __leave;
-        if (!BroadcastTextMessage(pRoom, pConnInfo->PlayingIndex , Message))
-            __leave;
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        ReleaseSRWLockExclusive(&pConnInfo->pRoom->PlayerListLock);
-    }
-    return bSuccess;
-}
+#include <stdlib.h>
+#include <strsafe.h>
+
+#include "common.h"
+#include "RoomManager.h"
+#include "HttpSendRecv.h"
+#include "MessageSender.h"
+#include "RoomSnapshot.h"
+#include "SlabPool.h"
+#include "RoomNumber.h"
+#include "RoomIndex.h"
+#include "Random.h"
+#include "RoleHint.h"
+#include "Metrics.h"
+#include "LockProfile.h"
+#include "Trace.h"
+#include "Probes.h"
+// This lock must be acquired when opening / closing a room. Joining looks rooms up without it, see RoomIndex.h
+SRWLOCK RoomPoolLock = SRWLOCK_INIT;
+
+static SLAB_POOL RoomPool; // GAME_ROOM
+
+ROOM_CONFIG RoomConfig = { ROOM_FLUSH_INTERVAL_DEFAULT, ROOM_PLAYER_MAX, 0 };
+volatile BOOL bRoomDraining = FALSE;
+
+VOID InitRoomManager(VOID)
+{
+    InitRoomNumbers();
+    InitRoomIndex();
+    InitSlabPool(&RoomPool, L"room", sizeof(GAME_ROOM));
+}
+
+// return FALSE when not found in the room.
+// Index is stored in pIndex
+static BOOL GetGamingIndexByID(_In_ PGAME_ROOM pRoom, _In_ UINT ID, _Out_ UINT *pIndex)
+{
+    for (UINT i = 0; i < pRoom->PlayingCount; i++)
+    {
+        if (pRoom->PlayingList[i].GameID == ID)
+        {
+            *pIndex = i;
+            return TRUE;
+        }
+    }
+    *pIndex = 0;
+    return FALSE;
+}
+
+// return NULL when not found in the waiting list.
+static PCONNECTION_INFO GetWaitingConnByID(_In_ PGAME_ROOM pRoom, _In_ UINT ID)
+{
+    for (UINT i = 0; i < pRoom->WaitingCount; i++)
+    {
+        if (pRoom->WaitingList[i].GameID == ID)
+            return pRoom->WaitingList[i].pConnInfo;
+    }
+    return NULL;
+}
+
+// Take the room's PlayerListLock exclusively. Messages sent while it is held go out after UnlockRoom,
+// sending may handle a received message on this thread, which would lock the room again (see BeginFlushDefer).
+// Profiled at the caller's site, see LockProfile.h
+static VOID LockRoomAt(_Inout_ PGAME_ROOM pRoom, _In_z_ PCSTR Function, _In_ UINT Line)
+{
+    TRACE_SPAN Span;
+    TraceBegin(&Span, NULL);
+    Span.RoomNumber = pRoom->RoomNumber;
+    BeginFlushDefer();
+    AcquireLockExclusiveAt(&pRoom->PlayerListLock, "PlayerListLock", Function, Line);
+    TraceEnd(&Span, TRACE_CAT_LOCK, "PlayerListLock");
+}
+
+#define LockRoom(pRoom) LockRoomAt((pRoom), __FUNCTION__, __LINE__)
+
+static VOID UnlockRoom(_Inout_ PGAME_ROOM pRoom)
+{
+    ReleaseLockExclusive(&pRoom->PlayerListLock);
+    EndFlushDefer();
+}
+
+// Shared for commands that only change the room with interlocked operations, see CastBallot.
+static VOID LockRoomSharedAt(_Inout_ PGAME_ROOM pRoom, _In_z_ PCSTR Function, _In_ UINT Line)
+{
+    TRACE_SPAN Span;
+    TraceBegin(&Span, NULL);
+    Span.RoomNumber = pRoom->RoomNumber;
+    BeginFlushDefer();
+    AcquireLockSharedAt(&pRoom->PlayerListLock, "PlayerListLock", Function, Line);
+    TraceEnd(&Span, TRACE_CAT_LOCK, "PlayerListLock shared");
+}
+
+#define LockRoomShared(pRoom) LockRoomSharedAt((pRoom), __FUNCTION__, __LINE__)
+
+static VOID UnlockRoomShared(_Inout_ PGAME_ROOM pRoom)
+{
+    ReleaseLockShared(&pRoom->PlayerListLock);
+    EndFlushDefer();
+}
+
+// Send the queued roomStatus changes now: a delta if there is only one, full roomStatus otherwise.
+// PlayerListLock must be held exclusively.
+static BOOL FlushRoomStatus(_Inout_ PGAME_ROOM pRoom)
+{
+    UINT PendingCnt = pRoom->PendingDeltaCnt;
+    if (PendingCnt == 0)
+        return TRUE;
+
+    pRoom->PendingDeltaCnt = 0;
+    CountMetric(METRIC_ROOM_STATUS_UPDATES);
+
+    if (PendingCnt > 1)
+        return BroadcastRoomStatus(pRoom);
+
+    // the new player got full roomStatus when joining
+    PCONNECTION_INFO pExclude = NULL;
+    if (pRoom->PendingDeltaOp == ROOM_DELTA_PLAYER_ADDED)
+        pExclude = GetWaitingConnByID(pRoom, pRoom->PendingDeltaPlayer.GameID);
+
+    return BroadcastRoomStatusDelta(pRoom, pRoom->PendingDeltaOp, &pRoom->PendingDeltaPlayer, pExclude);
+}
+
+// Bump the status version and tell the room what changed, at the next flush if the room coalesces.
+// pExclude already knows, only used when sent immediately.
+// PlayerListLock must be held exclusively.
+static BOOL RoomStatusChanged(_Inout_ PGAME_ROOM pRoom, _In_ UINT DeltaOp, _In_ const PLAYER_INFO* pPlayer, _In_opt_ PCONNECTION_INFO pExclude)
+{
+    pRoom->StatusVersion++;
+    CountMetric(METRIC_ROOM_STATUS_CHANGES);
+
+    if (!pRoom->pFlushTimer)
+    {
+        CountMetric(METRIC_ROOM_STATUS_UPDATES);
+        return BroadcastRoomStatusDelta(pRoom, DeltaOp, pPlayer, pExclude);
+    }
+
+    if (pRoom->PendingDeltaCnt++ == 0)
+    {
+        pRoom->PendingDeltaOp = DeltaOp;
+        pRoom->PendingDeltaPlayer = *pPlayer;
+
+        // relative due time, in 100ns
+        LARGE_INTEGER DueTime;
+        DueTime.QuadPart = -(LONGLONG)RoomConfig.FlushInterval * 10000;
+        FILETIME ftDueTime = { DueTime.LowPart, (DWORD)DueTime.HighPart };
+        SetThreadpoolTimer(pRoom->pFlushTimer, &ftDueTime, 0, 0);
+    }
+    return TRUE;
+}
+
+// Everyone needs the full list (game ended), drop whatever was queued.
+// PlayerListLock must be held exclusively.
+static BOOL RoomStatusReset(_Inout_ PGAME_ROOM pRoom)
+{
+    pRoom->StatusVersion++;
+    pRoom->PendingDeltaCnt = 0;
+    CountMetric(METRIC_ROOM_STATUS_CHANGES);
+    CountMetric(METRIC_ROOM_STATUS_UPDATES);
+    return BroadcastRoomStatus(pRoom);
+}
+
+// Drop a reference. TRUE if it was the last one: the room is out of the index and its number free,
+// the caller closes it with CloseRoom. Takes RoomPoolLock, no room lock may be held.
+static BOOL ReleaseRoomRef(_Inout_ PGAME_ROOM pRoom)
+{
+    if (InterlockedDecrement64(&pRoom->RefCnt) != 0)
+        return FALSE;
+
+    char szRoomNumber[ROOM_NAME_MAXLEN + 1];
+    FormatRoomNumber(pRoom->RoomNumber, szRoomNumber);
+    Log(LOG_INFO, L"room %1!S! is closed.", szRoomNumber);
+    PROBE_ROOM_CLOSE(pRoom);
+    if (pRoom->bGaming)
+    {
+        CountMetric(METRIC_GAMES_ENDED);
+        PROBE_GAME_END(pRoom, TRUE);
+    }
+
+    AcquireLockExclusive(&RoomPoolLock);
+    RemoveRoomIndex(pRoom->RoomNumber);
+    FreeRoomNumber(pRoom->RoomNumber);
+    ReleaseLockExclusive(&RoomPoolLock);
+    return TRUE;
+}
+
+// Stop the flush timer and free the room. Waits for a running timer callback, never call it from one.
+static VOID CloseRoom(_Inout_ PGAME_ROOM pRoom)
+{
+    if (pRoom->pFlushTimer)
+    {
+        SetThreadpoolTimer(pRoom->pFlushTimer, NULL, 0, 0);
+        WaitForThreadpoolTimerCallbacks(pRoom->pFlushTimer, TRUE);
+        CloseThreadpoolTimer(pRoom->pFlushTimer);
+    }
+    FreeRoomSnapshot(pRoom);
+    SlabFree(&RoomPool, pRoom);
+}
+
+static VOID CALLBACK CloseRoomCallback(_Inout_ PTP_CALLBACK_INSTANCE Instance, _Inout_opt_ PVOID Context)
+{
+    CloseRoom(Context);
+}
+
+// Close the room when the last reference is gone. Takes RoomPoolLock, no room lock may be held.
+static VOID ReleaseRoom(_Inout_ PGAME_ROOM pRoom)
+{
+    if (ReleaseRoomRef(pRoom))
+        CloseRoom(pRoom);
+}
+
+// Take another reference, FALSE if the room is closing (RefCnt is 0).
+static BOOL AddRoomRef(_Inout_ PGAME_ROOM pRoom)
+{
+    for (;;)
+    {
+        LONG64 RefCnt = pRoom->RefCnt;
+        if (RefCnt == 0)
+            return FALSE;
+        if (InterlockedCompareExchange64(&pRoom->RefCnt, RefCnt + 1, RefCnt) == RefCnt)
+            return TRUE;
+    }
+}
+
+// Take a reference on a room found by LookupRoomIndex.
+// FALSE if it was closed meanwhile, or closed and opened again with another number.
+static BOOL ReferenceRoom(_Inout_ PGAME_ROOM pRoom, _In_ UINT RoomNumber)
+{
+    if (!AddRoomRef(pRoom))
+        return FALSE;
+    if (pRoom->RoomNumber == RoomNumber)
+        return TRUE;
+
+    ReleaseRoom(pRoom);
+    return FALSE;
+}
+
+// The callback holds a reference of its own while it sends: a leaveRoom received meanwhile on this
+// thread (see BeginFlushDefer) may drop every other one, and the last ReleaseRoom would wait for
+// this callback from inside it. When the callback's reference is the last, a worker closes the room.
+static VOID CALLBACK RoomFlushTimerCallback(
+    _Inout_ PTP_CALLBACK_INSTANCE Instance,
+    _Inout_opt_ PVOID Context,
+    _Inout_ PTP_TIMER Timer)
+{
+    PGAME_ROOM pRoom = Context;
+
+    if (!AddRoomRef(pRoom))
+        return; // closing, CloseRoom is waiting for this callback
+
+    BeginConnRefScope();
+    LockRoom(pRoom);
+    FlushRoomStatus(pRoom);
+    UnlockRoom(pRoom);
+    EndConnRefScope();
+
+    if (ReleaseRoomRef(pRoom) && !TrySubmitThreadpoolCallback(CloseRoomCallback, pRoom, NULL))
+    {
+        // nothing can find the room any more, only stop the timer. the room itself is left allocated.
+        Log(LOG_ERROR, L"Failed to queue closing a room, its memory is kept.");
+        SetThreadpoolTimer(pRoom->pFlushTimer, NULL, 0, 0);
+        CloseThreadpoolTimer(pRoom->pFlushTimer);
+    }
+}
+
+VOID PrintRoomStats(VOID)
+{
+    Log(LOG_INFO, L"rooms: %1!u!, roomStatus changes: %2!I64u!, updates sent: %3!I64u!, flush interval: %4!u! ms",
+        GetRoomIndexCount(), GetMetric(METRIC_ROOM_STATUS_CHANGES), GetMetric(METRIC_ROOM_STATUS_UPDATES), RoomConfig.FlushInterval);
+    PrintRoomIndexStats();
+    PrintSlabPoolStats(&RoomPool);
+}
+
+BOOL CreateRoom(
+    _Inout_ PCONNECTION_INFO pConnInfo,
+    _In_z_ const char* NickName,
+    _In_opt_z_ const char* Password)
+{
+    PGAME_ROOM pRoom = NULL;
+    BOOL bSuccess = TRUE;
+    if (pConnInfo->pRoom)
+    {
+        return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "You are already in a room.");
+    }
+    if (Password && Password[0] == '\0')
+    {
+        return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "Empty password field.");
+    }
+    if (bRoomDraining)
+    {
+        return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "Server is going down for maintenance, no new room.");
+    }
+
+    // not exact while others create or close rooms, a few over the limit are fine.
+    if (RoomConfig.RoomLimit && GetRoomIndexCount() >= RoomConfig.RoomLimit)
+    {
+        return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "Too many rooms open, try again later.");
+    }
+
+    // the number and the room are taken without RoomPoolLock, see RoomNumber.h and SlabPool.h
+    UINT RoomNumber;
+    BOOL bNumberFound = AllocRoomNumber(&RoomNumber);
+
+    pRoom = SlabAlloc(&RoomPool);
+    if (!pRoom)
+    {
+        if (bNumberFound)
+            FreeRoomNumber(RoomNumber);
+        return TRUE;
+    }
+
+    pConnInfo->WaitingIndex = pRoom->WaitingCount++;
+
+    PPLAYER_INFO pPlayerWaitingInfo = &pRoom->WaitingList[pConnInfo->WaitingIndex];
+    pPlayerWaitingInfo->pConnInfo = pConnInfo;
+    pPlayerWaitingInfo->GameID = pRoom->IDCount++;
+    pPlayerWaitingInfo->bIsRoomOwner = TRUE;
+    StringCbCopyA(pPlayerWaitingInfo->NickName, PLAYER_NICK_MAXLEN, NickName);
+    StringCbCopyA(pPlayerWaitingInfo->Avatar, PLAYER_NICK_MAXLEN, "");
+
+    if (Password)
+        StringCbCopyA(pRoom->Password, ROOM_PASSWORD_MAXLEN, Password);
+
+    InitializeSRWLock(&(pRoom->PlayerListLock));
+    InitializeSRWLock(&(pRoom->SnapshotLock));
+
+    // without the timer, changes are just sent immediately.
+    if (RoomConfig.FlushInterval)
+        pRoom->pFlushTimer = CreateThreadpoolTimer(RoomFlushTimerCallback, pRoom, NULL);
+
+    // only the index insert is serialized. codes (all numbers in use) are drawn here as well:
+    // they are only checked against the index, two creators must not draw the same one.
+    AcquireLockExclusive(&RoomPoolLock);
+    for (UINT i = 0; !bNumberFound && i < ROOM_CODE_DRAW_MAX; i++)
+        bNumberFound = DrawRoomCode(&RoomNumber) && !LookupRoomIndex(RoomNumber);
+
+    pRoom->RoomNumber = RoomNumber;
+    BOOL bInserted = bNumberFound && InsertRoomIndex(RoomNumber, pRoom);
+    ReleaseLockExclusive(&RoomPoolLock);
+
+    if (!bInserted)
+    {
+        if (pRoom->pFlushTimer)
+            CloseThreadpoolTimer(pRoom->pFlushTimer);
+        SlabFree(&RoomPool, pRoom);
+
+        if (!bNumberFound) // all room is full.
+            return ReplyCreateRoom(pConnInfo, FALSE, 0, 0, "All room number is occupied, no room left.");
+        FreeRoomNumber(RoomNumber); // out of memory
+        return TRUE;
+    }
+
+    char szRoomNumber[ROOM_NAME_MAXLEN + 1];
+    FormatRoomNumber(RoomNumber, szRoomNumber);
+    Log(LOG_INFO, L"room %1!S! is opened.", szRoomNumber);
+    PROBE_ROOM_OPEN(pConnInfo, pRoom);
+
+    // locked before joiners can take references (see ReferenceRoom), so the owner hears of the room first.
+    // the messages go out after UnlockRoom.
+    LockRoom(pRoom);
+    InterlockedExchange64(&pRoom->RefCnt, 1);
+    pConnInfo->pRoom = pRoom;
+    bSuccess = ReplyCreateRoom(pConnInfo, TRUE, RoomNumber, 0, NULL) && BroadcastRoomStatus(pRoom);
+    UnlockRoom(pRoom);
+
+    return bSuccess;
+}
+
+BOOL JoinRoom(
+    _In_ UINT RoomNum,
+    _Inout_ PCONNECTION_INFO pConnInfo,
+    _In_z_ const char* NickName,
+    _In_opt_z_ const char* Password)
+{
+    BOOL bSuccess = TRUE;
+    BOOL bJoined = FALSE;
+    if (pConnInfo->pRoom)
+        return ReplyJoinRoom(pConnInfo, FALSE, 0, "You are already in a room.");
+
+    PGAME_ROOM pRoom = LookupRoomIndex(RoomNum);
+    if (!pRoom || !ReferenceRoom(pRoom, RoomNum))
+        return ReplyJoinRoom(pConnInfo, FALSE, 0, "Room does not exist.");
+
+    __try
+    {
+        LockRoom(pRoom);
+
+        __try
+        {
+            // the reference may have been taken just before the last player left, nobody to join.
+            if (pRoom->WaitingCount == 0)
+            {
+                ReplyJoinRoom(pConnInfo, FALSE, 0, "Room does not exist.");
+                __leave;
+            }
+
+            // check if password is correct, room is full, game is started, or NickName is duplicated.
+            if (pRoom->Password[0] != '\0')
+            {
+                if (!Password)
+                {
+                    ReplyJoinRoom(pConnInfo, FALSE, 0, "Password is required.");
+                    __leave;
+                }
+                if (strcmp(Password, pRoom->Password))
+                {
+                    ReplyJoinRoom(pConnInfo, FALSE, 0, "Wrong password.");
+                    __leave;
+                }
+            }
+
+            if (pRoom->bGaming)
+            {
+                ReplyJoinRoom(pConnInfo, FALSE, 0, "The game has started already.");
+                __leave;
+            }
+
+            if (pRoom->WaitingCount >= RoomConfig.PlayerLimit)
+            {
+                ReplyJoinRoom(pConnInfo, FALSE, 0, "The room is full.");
+                __leave;
+            }
+
+            for (UINT i = 0; i < pRoom->WaitingCount; i++)
+            {
+                if (strcmp(NickName, pRoom->WaitingList[i].NickName) == 0)
+                {
+                    ReplyJoinRoom(pConnInfo, FALSE, 0, "Duplicate nickname, try another.");
+                    __leave;
+                }
+            }
+
+            // pRoom is copied to pConnInfo from now on, it keeps the reference.
+            bJoined = TRUE;
+            pConnInfo->pRoom = pRoom;
+
+            pConnInfo->WaitingIndex = pRoom->WaitingCount++;
+
+            PPLAYER_INFO pPlayerWaitingInfo = &pRoom->WaitingList[pConnInfo->WaitingIndex];
+            pPlayerWaitingInfo->pConnInfo = pConnInfo;
+            pPlayerWaitingInfo->GameID = pRoom->IDCount++;
+            pPlayerWaitingInfo->bIsRoomOwner = FALSE;
+            StringCbCopyA(pPlayerWaitingInfo->NickName, PLAYER_NICK_MAXLEN, NickName);
+            StringCbCopyA(pPlayerWaitingInfo->Avatar, PLAYER_NICK_MAXLEN, "");
+
+            if (!ReplyJoinRoom(pConnInfo, TRUE, pPlayerWaitingInfo->GameID, NULL))
+                __leave;
+
+            // others only need the new player, the new player needs everything.
+            if (!RoomStatusChanged(pRoom, ROOM_DELTA_PLAYER_ADDED, pPlayerWaitingInfo, pConnInfo))
+                __leave;
+
+            if (!SendRoomStatus(pConnInfo, pRoom))
+                __leave;
+
+            bSuccess = TRUE;
+        }
+        __finally
+        {
+            UnlockRoom(pRoom);
+        }
+    }
+    __finally
+    {
+        if (!bJoined)
+            ReleaseRoom(pRoom);
+    }
+
+    return bSuccess;
+}
+
+static VOID CloseBallotsOfOffline(_Inout_ PGAME_ROOM pRoom);
+
+// Leave the room if the current user is inside one.
+// And if there's no one in the room, it will be closed.
+// Room owner will be transferred if the current user is room owner
+// Will boardcast room status to the rest of player in room after leaving.
+VOID LeaveRoom(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    if (!pRoom)
+        return;
+
+    LockRoom(pRoom);
+
+    PLAYER_INFO LeftPlayer = pRoom->WaitingList[pConnInfo->WaitingIndex];
+
+    for (UINT i = pConnInfo->WaitingIndex; i < pRoom->WaitingCount - 1; i++)
+    {
+        pRoom->WaitingList[i] = pRoom->WaitingList[i + 1];
+        pRoom->WaitingList[i].pConnInfo->WaitingIndex = i;
+    }
+    pRoom->WaitingCount--;
+
+    // Player is offline. set the corresponding field to NULL.
+    pRoom->PlayingList[pConnInfo->PlayingIndex].pConnInfo = NULL;
+
+    if (pRoom->WaitingCount) // the room closes otherwise, nobody to tell.
+    {
+        if (pConnInfo->WaitingIndex == 0) // transfer room owner if needed
+        {
+            pRoom->WaitingList[0].bIsRoomOwner = TRUE;
+        }
+
+        if (pRoom->bGaming) // roomStatus shows PlayingList when gaming, the player only goes offline there.
+        {
+            RoomStatusChanged(pRoom, ROOM_DELTA_PLAYER_OFFLINE, &pRoom->PlayingList[pConnInfo->PlayingIndex], NULL);
+            if (pConnInfo->WaitingIndex == 0) // the owner flag is shown from PlayingList too
+            {
+                PPLAYER_INFO pNewOwner = &pRoom->PlayingList[pRoom->WaitingList[0].pConnInfo->PlayingIndex];
+                pRoom->PlayingList[pConnInfo->PlayingIndex].bIsRoomOwner = FALSE;
+                pNewOwner->bIsRoomOwner = TRUE;
+                RoomStatusChanged(pRoom, ROOM_DELTA_OWNER_CHANGED, pNewOwner, NULL);
+            }
+            CloseBallotsOfOffline(pRoom);
+        }
+        else
+        {
+            RoomStatusChanged(pRoom, ROOM_DELTA_PLAYER_REMOVED, &LeftPlayer, NULL);
+            if (pConnInfo->WaitingIndex == 0)
+                RoomStatusChanged(pRoom, ROOM_DELTA_OWNER_CHANGED, &pRoom->WaitingList[0], NULL);
+        }
+    }
+    pConnInfo->pRoom = NULL;
+    UnlockRoom(pRoom);
+
+    ReleaseRoom(pRoom);
+}
+
+BOOL ChangeAvatar(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const char* Avatar)
+{
+    // TODO: add response for ChangeAvatar?
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    if (!pRoom) // no reply either, changeAvatar has none yet.
+        return TRUE;
+
+    BOOL bSuccess = FALSE;
+
+    // exclusive, so that StatusVersion is bumped in the same order as the deltas are sent.
+    LockRoom(pRoom);
+    __try
+    {
+        if (pRoom->bGaming) // You can't change avatar when game started.
+            __leave;
+
+        PPLAYER_INFO pPlayer = &pRoom->WaitingList[pConnInfo->WaitingIndex];
+        StringCbCopyA(pPlayer->Avatar, PLAYER_AVATAR_MAXLEN, Avatar);
+        bSuccess = RoomStatusChanged(pRoom, ROOM_DELTA_AVATAR_CHANGED, pPlayer, NULL);
+    }
+    __finally
+    {
+        UnlockRoom(pRoom);
+    }
+    return bSuccess;
+}
+
+// assign a random role to RoleList based on PlayingCount
+static BOOL AssignRole(_Inout_ PGAME_ROOM pRoom, _Inout_ PRANDOM_STREAM pRandom)
+{
+    UINT Deck[ROOM_PLAYER_MAX];
+    GetRoleDeck(pRoom->PlayingCount, Deck);
+
+    for (UINT i = 0; i < pRoom->PlayingCount; i++)
+    {
+        UINT RandNum;
+        if (!StreamRandomBelow(pRandom, pRoom->PlayingCount - i, &RandNum))
+            return FALSE;
+
+        pRoom->RoleList[i] = Deck[RandNum];
+        Deck[RandNum] = Deck[pRoom->PlayingCount - i - 1];
+    }
+    return TRUE;
+}
+
+BOOL StartGame(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    if (!pRoom)
+        return ReplyStartGame(pConnInfo, FALSE, "You are not in a room.");
+
+    BOOL bSuccess = FALSE;
+    LockRoom(pConnInfo->pRoom);
+    __try
+    {
+        if (!pRoom->WaitingList[pConnInfo->WaitingIndex].bIsRoomOwner)
+        {
+            bSuccess = ReplyStartGame(pConnInfo, FALSE, "You are not room owner.");
+            __leave;
+        }
+        if (pRoom->WaitingCount < ROOM_PLAYER_MIN)
+        {
+            bSuccess = ReplyStartGame(pConnInfo, FALSE, "Too less player to start game.");
+            __leave;
+        }
+        if (pRoom->bGaming)
+        {
+            bSuccess = ReplyStartGame(pConnInfo, FALSE, "Game already started.");
+            __leave;
+        }
+
+        // beginGame doesn't wait for the tick, send the queued lobby changes before it.
+        FlushRoomStatus(pRoom);
+
+        // copy WaitingList to PlayingList, update index as well.
+        for (UINT i = 0; i < pRoom->WaitingCount; i++)
+        {
+            pRoom->PlayingList[i] = pRoom->WaitingList[i];
+            pRoom->PlayingList[i].pConnInfo->PlayingIndex = i;
+        }
+        pRoom->PlayingCount = pRoom->WaitingCount;
+
+        RANDOM_STREAM Random;
+        InitGameRandom(&Random, pRoom->RoomNumber, pRoom->GameCnt++);
+        if (!AssignRole(pRoom, &Random))
+        {
+            Log(LOG_ERROR, L"AssignRole failed.");
+            bSuccess = ReplyStartGame(pConnInfo, FALSE, "Server internal error. failed to assign role.");
+            __leave;
+        }
+
+        // rand a leader, and set fairy if needed.
+        if (!StreamRandomBelow(&Random, pRoom->PlayingCount, &pRoom->LeaderIndex))
+            __leave;
+
+        if (pRoom->PlayingCount >= ENABLE_FAIRY_THRESHOLD)
+        {
+            pRoom->bFairyEnabled = TRUE;
+            pRoom->FairyIndex = (pRoom->LeaderIndex + pRoom->PlayingCount - 1) % (pRoom->PlayingCount);
+        }
+        else
+        {
+            pRoom->bFairyEnabled = FALSE;
+            pRoom->FairyIndex = 0;
+        }
+        pRoom->TeamMask = 0;
+        pRoom->VoteBallot = 0;
+        pRoom->MissionBallot = 0;
+        pRoom->bGaming = TRUE;
+        CountMetric(METRIC_GAMES_STARTED);
+        PROBE_GAME_START(pRoom);
+
+        bSuccess = ReplyStartGame(pConnInfo, TRUE, NULL);
+
+        for (UINT i = 0; i < pRoom->PlayingCount; i++)
+        {
+            UINT FairyID = pRoom->bFairyEnabled ? pRoom->PlayingList[pRoom->FairyIndex].GameID : 0;
+            SendBeginGame(pRoom->PlayingList[i].pConnInfo, pRoom->RoleList[i], pRoom->bFairyEnabled, FairyID);
+
+            HINTLIST HintList[ROOM_PLAYER_MAX];
+            UINT HintCnt = GetRoleHints(pRoom, i, HintList);
+            SendRoleHint(pRoom->PlayingList[i].pConnInfo, HintCnt, HintList);
+        }
+    }
+    __finally
+    {
+        UnlockRoom(pConnInfo->pRoom);
+    }
+
+    return bSuccess;
+}
+
+// A ballot packs a team vote or the mission cards of a round into one word, so casting is one compare-exchange:
+//     bits 0-15:  cast, one bit per PlayingIndex
+//     bits 16-31: marked, of those who cast: approved the team / played fail
+//     bit 63:     open
+#define BALLOT_OPEN ((LONG64)1 << 63)
+#define BALLOT_CAST(Index) ((LONG64)1 << (Index))
+#define BALLOT_MARK(Index) ((LONG64)1 << ((Index) + 16))
+#define BALLOT_CAST_MASK(Ballot) ((UINT)(Ballot) & 0xFFFF)
+#define BALLOT_MARK_MASK(Ballot) ((UINT)((Ballot) >> 16) & 0xFFFF)
+
+// PlayingIndex bits of the players still connected, the voters of a ballot.
+// Stable under the shared lock, players only go offline under the exclusive one (LeaveRoom).
+static UINT GetOnlineMask(_In_ const GAME_ROOM* pRoom)
+{
+    UINT Mask = 0;
+    for (UINT i = 0; i < pRoom->PlayingCount; i++)
+    {
+        if (pRoom->PlayingList[i].pConnInfo)
+            Mask |= 1u << i;
+    }
+    return Mask;
+}
+
+// Cast for the player at Index. Returns the ballot after the cast, 0 if it is closed or Index has cast already.
+// The cast that completes the ballot (every player of VoterMask has cast) also closes it,
+// so exactly one caller gets a closed ballot back and announces the result.
+static LONG64 CastBallot(_Inout_ LONG64 volatile* pBallot, _In_ UINT Index, _In_ BOOL bMark, _In_ UINT VoterMask)
+{
+    for (;;)
+    {
+        LONG64 Ballot = *pBallot;
+        if (!(Ballot & BALLOT_OPEN) || (Ballot & BALLOT_CAST(Index)))
+            return 0;
+
+        LONG64 NewBallot = Ballot | BALLOT_CAST(Index) | (bMark ? BALLOT_MARK(Index) : 0);
+        if ((BALLOT_CAST_MASK(NewBallot) & VoterMask) == VoterMask)
+            NewBallot &= ~BALLOT_OPEN;
+
+        if (InterlockedCompareExchange64(pBallot, NewBallot, Ballot) == Ballot)
+            return NewBallot;
+    }
+}
+
+// GameID of each player in Mask, returns the count.
+static UINT GetBallotIDList(_In_ const GAME_ROOM* pRoom, _In_ UINT Mask, _Out_writes_to_(ROOM_PLAYER_MAX, return) UINT32 IDList[])
+{
+    UINT Cnt = 0;
+    for (; Mask; Mask &= Mask - 1)
+    {
+        DWORD Index;
+        BitScanForward(&Index, Mask);
+        IDList[Cnt++] = pRoom->PlayingList[Index].GameID;
+    }
+    return Cnt;
+}
+
+BOOL PlayerSelectTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT TeamMemberCnt, _In_ const UINT32 TeamMemberList[])
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    BOOL bSuccess = FALSE;
+    if (!pRoom)
+        return ReplyPlayerSelectTeam(pConnInfo, FALSE, "You are not in a room.");
+
+    LockRoom(pRoom);
+    __try {
+        // check bGaming
+        if (!pRoom->bGaming)
+        {
+            bSuccess = ReplyPlayerSelectTeam(pConnInfo, FALSE, "Game hasn't started yet.");
+            __leave;
+        }
+        // check the leader
+        if (pRoom->LeaderIndex != pConnInfo->PlayingIndex)
+        {
+            bSuccess = ReplyPlayerSelectTeam(pConnInfo, FALSE, "You are not the leader.");
+            __leave;
+        }
+        // check the number of people
+        if ( TeamMemberCnt > pRoom->PlayingCount )
+        {
+            bSuccess = ReplyPlayerSelectTeam(pConnInfo, FALSE, "The number of people selected exceeded the limit.");
+            __leave;
+        }
+        if (!ReplyPlayerSelectTeam(pConnInfo, TRUE, NULL))
+            __leave;
+        if (!BroadcastSelectTeam(pRoom, TeamMemberCnt, TeamMemberList ))
+            __leave;
+        pConnInfo->pRoom->TeamMemberCnt = TeamMemberCnt;
+        for (int i = 0; i < TeamMemberCnt; i++)
+            pConnInfo->pRoom->TeamMemberList[i] = TeamMemberList[i];
+        bSuccess = TRUE;
+    }
+    __finally{
+        UnlockRoom(pRoom);
+    }
+    return bSuccess;
+}
+
+BOOL PlayerConfirmTeam(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    BOOL bSuccess = FALSE;
+    if (!pRoom)
+        return ReplyPlayerConfirmTeam(pConnInfo, FALSE, "You are not in a room.");
+
+    LockRoom(pRoom);
+    __try {
+        // check bGaming
+        if (!pRoom->bGaming)
+        {
+            bSuccess = ReplyPlayerConfirmTeam(pConnInfo, FALSE, "Game hasn't started yet.");
+            __leave;
+        }
+
+        // check the leader
+        if (pRoom->LeaderIndex != pConnInfo->PlayingIndex)
+        {
+            bSuccess = ReplyPlayerConfirmTeam(pConnInfo, FALSE, "You are not the leader.");
+            __leave;
+        }
+
+        if (pRoom->TeamMemberCnt > pRoom->PlayingCount)
+        {
+            bSuccess = ReplyPlayerConfirmTeam(pConnInfo, FALSE, "The number of people selected exceeded the limit.");
+            __leave;
+        }
+
+        UINT TeamMask = 0;
+        for (UINT i = 0; i < pRoom->TeamMemberCnt; i++)
+        {
+            UINT Index;
+            if (!GetGamingIndexByID(pRoom, pRoom->TeamMemberList[i], &Index))
+            {
+                bSuccess = ReplyPlayerConfirmTeam(pConnInfo, FALSE, "Invalid team member.");
+                __leave;
+            }
+            TeamMask |= 1u << Index;
+        }
+
+        // everyone votes on the team now.
+        pRoom->TeamMask = TeamMask;
+        InterlockedExchange64(&pRoom->MissionBallot, 0);
+        InterlockedExchange64(&pRoom->VoteBallot, BALLOT_OPEN);
+
+        if (!ReplyPlayerConfirmTeam(pConnInfo, TRUE, NULL))
+            __leave;
+        if (!BroadcastConfirmTeam(pRoom))
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally {
+        UnlockRoom(pRoom);
+    }
+    return bSuccess;
+}
+
+// Called by the player whose vote closed the ballot, or LeaveRoom. PlayerListLock held exclusively.
+// The team needs the approval of more than half of all the players of the game (PlayingCount), not only
+// of those still connected: who went offline before voting counts as rejecting, and a tie rejects.
+static BOOL FinishVote(_Inout_ PGAME_ROOM pRoom, _In_ LONG64 Ballot)
+{
+    VOTELIST VoteList[ROOM_PLAYER_MAX];
+    for (UINT i = 0; i < pRoom->PlayingCount; i++)
+    {
+        VoteList[i].ID = pRoom->PlayingList[i].GameID;
+        VoteList[i].VoteResult = (BALLOT_MARK_MASK(Ballot) >> i) & 1;
+    }
+
+    BOOL bApproved = __popcnt(BALLOT_MARK_MASK(Ballot)) * 2 > pRoom->PlayingCount;
+    if (bApproved)
+        InterlockedExchange64(&pRoom->MissionBallot, BALLOT_OPEN);
+
+    return BroadcastVoteTeam(pRoom, bApproved, pRoom->PlayingCount, VoteList);
+}
+
+// The ballot as it stands now, if it is still open and has the cast of Index. 0 once that round is over.
+// PlayerListLock held exclusively, so it can't close meanwhile.
+static LONG64 GetOpenBallotOf(_In_ const LONG64 volatile* pBallot, _In_ UINT Index)
+{
+    LONG64 Ballot = *pBallot;
+    if ((Ballot & BALLOT_OPEN) && (Ballot & BALLOT_CAST(Index)))
+        return Ballot;
+    return 0;
+}
+
+// Votes of different players are cast in parallel under the shared lock, each one is a single CastBallot.
+// Their broadcasts are not: each takes the exclusive lock and tells the ballot as it stands then,
+// so voteTeamProgress never goes back and never follows the voteTeam of its round.
+// The vote that closed the ballot announces the result, a progress of a round that is over is dropped.
+BOOL PlayerVoteTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ BOOL bVote)
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    BOOL bSuccess = FALSE;
+    LONG64 Ballot = 0;
+    if (!pRoom)
+        return ReplyPlayerVoteTeam(pConnInfo, FALSE, "You are not in a room.");
+
+    LockRoomShared(pRoom);
+    __try {
+        // check bGaming
+        if (!pRoom->bGaming)
+        {
+            bSuccess = ReplyPlayerVoteTeam(pConnInfo, FALSE, "Game hasn't started yet.");
+            __leave;
+        }
+
+        Ballot = CastBallot(&pRoom->VoteBallot, pConnInfo->PlayingIndex, bVote, GetOnlineMask(pRoom));
+        if (!Ballot)
+        {
+            bSuccess = ReplyPlayerVoteTeam(pConnInfo, FALSE, "No team to vote on, or you have voted.");
+            __leave;
+        }
+
+        bSuccess = ReplyPlayerVoteTeam(pConnInfo, TRUE, NULL);
+    }
+    __finally {
+        UnlockRoomShared(pRoom);
+    }
+    if (!bSuccess || !Ballot)
+        return bSuccess;
+
+    LockRoom(pRoom);
+    __try {
+        if (!(Ballot & BALLOT_OPEN))
+        {
+            // unless the leader has opened the next round meanwhile.
+            if (pRoom->VoteBallot == Ballot)
+                bSuccess = FinishVote(pRoom, Ballot);
+            __leave;
+        }
+
+        Ballot = GetOpenBallotOf(&pRoom->VoteBallot, pConnInfo->PlayingIndex);
+        if (Ballot)
+        {
+            UINT32 VotedIDList[ROOM_PLAYER_MAX];
+            UINT VotedCnt = GetBallotIDList(pRoom, BALLOT_CAST_MASK(Ballot), VotedIDList);
+            bSuccess = BroadcastVoteTeamProgress(pRoom, VotedCnt, VotedIDList);
+        }
+    }
+    __finally {
+        UnlockRoom(pRoom);
+    }
+    return bSuccess;
+}
+
+// Called by the team member whose card closed the ballot, or LeaveRoom. PlayerListLock held exclusively.
+// Only the cards played count, a member who went offline plays none.
+static BOOL FinishMission(_Inout_ PGAME_ROOM pRoom, _In_ LONG64 Ballot)
+{
+    // the card is marked when the mission is screwed.
+    UINT Screw = __popcnt(BALLOT_MARK_MASK(Ballot));
+    UINT Perform = __popcnt(BALLOT_CAST_MASK(Ballot)) - Screw;
+    return BroadcastMissionResult(pRoom, Screw == 0, Perform, Screw);
+}
+
+// Close *pBallot if every player of VoterMask has cast. FALSE if it stays open or was closed already.
+// The closed ballot may be 0, when nobody of a team is left to play a card.
+static BOOL CloseBallotIfComplete(_Inout_ LONG64 volatile* pBallot, _In_ UINT VoterMask, _Out_ LONG64* pClosedBallot)
+{
+    for (;;)
+    {
+        LONG64 Ballot = *pBallot;
+        if (!(Ballot & BALLOT_OPEN) || (BALLOT_CAST_MASK(Ballot) & VoterMask) != VoterMask)
+            return FALSE;
+
+        *pClosedBallot = Ballot & ~BALLOT_OPEN;
+        if (InterlockedCompareExchange64(pBallot, *pClosedBallot, Ballot) == Ballot)
+            return TRUE;
+    }
+}
+
+// LeaveRoom, PlayerListLock held exclusively: the one who left may have been the last one
+// not to vote or to play a card, announce the result the cast would have.
+static VOID CloseBallotsOfOffline(_Inout_ PGAME_ROOM pRoom)
+{
+    UINT OnlineMask = GetOnlineMask(pRoom);
+    LONG64 Ballot;
+
+    if (CloseBallotIfComplete(&pRoom->VoteBallot, OnlineMask, &Ballot))
+        FinishVote(pRoom, Ballot);
+    if (CloseBallotIfComplete(&pRoom->MissionBallot, pRoom->TeamMask & OnlineMask, &Ballot))
+        FinishMission(pRoom, Ballot);
+}
+
+// Same as PlayerVoteTeam, for the team members' mission cards.
+BOOL PlayerConductMission(_Inout_ PCONNECTION_INFO pConnInfo, _In_ BOOL bPerform)
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    BOOL bSuccess = FALSE;
+    LONG64 Ballot = 0;
+    if (!pRoom)
+        return ReplyPlayerConductMission(pConnInfo, FALSE, "You are not in a room.");
+
+    LockRoomShared(pRoom);
+    __try
+    {
+        if (!pRoom->bGaming)
+        {
+            bSuccess = ReplyPlayerConductMission(pConnInfo, FALSE, "Game hasn't started yet.");
+            __leave;
+        }
+
+        if (!(pRoom->TeamMask & (1u << pConnInfo->PlayingIndex)))
+        {
+            bSuccess = ReplyPlayerConductMission(pConnInfo, FALSE, "You are not in the team.");
+            __leave;
+        }
+
+        Ballot = CastBallot(&pRoom->MissionBallot, pConnInfo->PlayingIndex, !bPerform, pRoom->TeamMask & GetOnlineMask(pRoom));
+        if (!Ballot)
+        {
+            bSuccess = ReplyPlayerConductMission(pConnInfo, FALSE, "No mission to conduct, or you have decided.");
+            __leave;
+        }
+
+        bSuccess = ReplyPlayerConductMission(pConnInfo, TRUE, NULL);
+    }
+    __finally
+    {
+        UnlockRoomShared(pRoom);
+    }
+    if (!bSuccess || !Ballot)
+        return bSuccess;
+
+    LockRoom(pRoom);
+    __try
+    {
+        if (!(Ballot & BALLOT_OPEN))
+        {
+            // unless the next round was opened meanwhile.
+            if (pRoom->MissionBallot == Ballot)
+                bSuccess = FinishMission(pRoom, Ballot);
+            __leave;
+        }
+
+        Ballot = GetOpenBallotOf(&pRoom->MissionBallot, pConnInfo->PlayingIndex);
+        if (Ballot)
+        {
+            UINT32 DecidedIDList[ROOM_PLAYER_MAX];
+            UINT DecidedCnt = GetBallotIDList(pRoom, BALLOT_CAST_MASK(Ballot), DecidedIDList);
+            bSuccess = BroadcastMissionResultProgress(pRoom, DecidedCnt, DecidedIDList);
+        }
+    }
+    __finally
+    {
+        UnlockRoom(pRoom);
+    }
+    return bSuccess;
+}
+
+BOOL PlayerFairyInspect(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT ID)
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    BOOL bSuccess = FALSE;
+    if (!pRoom)
+        return ReplyPlayerFairyInspect(pConnInfo, FALSE, "You are not in a room.");
+    if (!pRoom->bFairyEnabled)
+        return ReplyPlayerFairyInspect(pConnInfo, FALSE, "The room doesn't have the fairy.");
+    LockRoom(pRoom);
+    __try
+    {
+        if (!pRoom->bGaming)
+        {
+            bSuccess = ReplyPlayerFairyInspect(pConnInfo, FALSE, "Game hasn't started yet.");
+            __leave;
+        }
+        if (pConnInfo->PlayingIndex != pRoom->FairyIndex)
+        {
+            bSuccess = ReplyPlayerFairyInspect(pConnInfo, FALSE, "You are not fairy.");
+            __leave;
+        }
+
+        UINT CheckIndex;
+        if (!GetGamingIndexByID(pRoom, ID, &CheckIndex))
+        {
+            bSuccess = ReplyPlayerFairyInspect(pConnInfo, FALSE, "Invalid ID.");
+            __leave;
+        }
+
+        if (!ReplyPlayerFairyInspect(pConnInfo, TRUE, NULL))
+            __leave;
+        if (pRoom->RoleList[CheckIndex] == HINT_GOOD )
+        {
+
+        }
+        else
+        {
+
+        }
+        if(!BroadcastFairyInspect(pRoom,ID))
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        UnlockRoom(pConnInfo->pRoom);
+    }
+    return bSuccess;
+}
+
+BOOL PlayerAssassinate(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT ID)
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    BOOL bSuccess = FALSE;
+    if (!pRoom)
+        return ReplyPlayerAssassinate(pConnInfo, FALSE, "You are not in a room.");
+
+    LockRoom(pRoom);
+    __try
+    {
+        if (!pRoom->bGaming)
+        {
+            bSuccess = ReplyPlayerAssassinate(pConnInfo, FALSE, "Game hasn't started yet.");
+            __leave;
+        }
+        if (pRoom->RoleList[pConnInfo->PlayingIndex] != ROLE_ASSASSIN)
+        {
+            bSuccess = ReplyPlayerAssassinate(pConnInfo, FALSE, "You are not assassin.");
+            __leave;
+        }
+
+        UINT AssassinateIndex;
+        if (!GetGamingIndexByID(pRoom, ID, &AssassinateIndex))
+        {
+            bSuccess = ReplyPlayerAssassinate(pConnInfo, FALSE, "Invalid ID.");
+            __leave;
+        }
+
+        if (!ReplyPlayerAssassinate(pConnInfo, TRUE, NULL))
+            __leave;
+        if (pRoom->RoleList[AssassinateIndex] == ROLE_MERLIN)
+        {
+            if (!BroadcastEndGame(pRoom, FALSE, "merlin was assassinated."))
+                __leave;
+        }
+        else
+        {
+            if (!BroadcastEndGame(pRoom, TRUE, "assassin failed to kill merlin."))
+                __leave;
+        }
+        pRoom->bGaming = FALSE;
+        CountMetric(METRIC_GAMES_ENDED);
+        PROBE_GAME_END(pRoom, FALSE);
+        if (!RoomStatusReset(pRoom)) // back to WaitingList, everyone needs the full list.
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        UnlockRoom(pConnInfo->pRoom);
+    }
+    return bSuccess;
+}
+
+BOOL PlayerTextMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const CHAR Message[])
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    BOOL bSuccess = FALSE;
+    if (!pRoom)
+        return ReplyPlayerTextMessage(pConnInfo, FALSE, "You are not in a room.");
+
+    LockRoom(pRoom);
+    __try
+    {
+        if (!pRoom->bGaming)
+        {
+            bSuccess = ReplyPlayerTextMessage(pConnInfo, FALSE, "Game hasn't started yet.");
+            __leave;
+        }
+        if (!ReplyPlayerTextMessage(pConnInfo, TRUE, NULL))
+            __leave;
+        if (!BroadcastTextMessage(pRoom, pConnInfo->PlayingIndex , Message))
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        UnlockRoom(pConnInfo->pRoom);
+    }
+    return bSuccess;
+}
+
+BOOL SyncRoomStatus(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    PGAME_ROOM pRoom = pConnInfo->pRoom;
+    if (!pRoom)
+    {
+        pConnInfo->bRoomStatusDelta = TRUE;
+        return TRUE;
+    }
+
+    BOOL bSuccess = FALSE;
+    LockRoom(pRoom);
+    __try
+    {
+        // set under the lock so no delta can be sent before the full roomStatus.
+        pConnInfo->bRoomStatusDelta = TRUE;
+        bSuccess = SendRoomStatus(pConnInfo, pRoom);
+    }
+    __finally
+    {
+        UnlockRoom(pRoom);
+    }
+    return bSuccess;
+}
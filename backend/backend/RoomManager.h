@@ -1,100 +1,142 @@
-#pragma once
-#include "common.h"
-
-#define ROOM_NUMBER_MIN 10000
-#define ROOM_NUMBER_MAX 99999
-
-#define ROOM_PLAYER_MAX 10
-#define ROOM_PLAYER_MIN 5
-
-#define PLAYER_NICK_MAXLEN 32
-#define PLAYER_AVATAR_MAXLEN 32
-#define ROOM_PASSWORD_MAXLEN 32
-
-// Role definition
-#define ROLE_MERLIN   1 // ÷
-#define ROLE_PERCIVAL 2 // ά
-#define ROLE_ASSASSIN 3 // ̿
-#define ROLE_MORDRED  4 // Ī׵
-#define ROLE_OBERON   5 // ²
-#define ROLE_MORGANA  6 // Ī
-#define ROLE_LOYALIST 7 // ɪҳ
-#define ROLE_MINIONS  8 // Ī׵µצ
-
-#define ENABLE_FAIRY_THRESHOLD 7 // fairy will be enabled when player >= ENABLE_FAIRY_THRESHOLD
-
-// Hint definition
-#define HINT_GOOD               1
-#define HINT_BAD                2
-#define HINT_MERLIN_OR_MORGANA  3
-#define HINT_ASSASSIN           4
-#define HINT_MORDRED            5
-#define HINT_MORGANA            6
-#define HINT_MINIONS            7
-
-typedef struct _CONNECTION_INFO CONNECTION_INFO, * PCONNECTION_INFO;
-
-typedef struct _PLAYER_INFO
-{
-    PCONNECTION_INFO pConnInfo;
-    UINT GameID;
-    BOOL bIsRoomOwner;
-    char NickName[PLAYER_NICK_MAXLEN + 1];
-    char Avatar[PLAYER_AVATAR_MAXLEN + 1];
-}PLAYER_INFO, *PPLAYER_INFO;
-
-typedef struct _GAME_ROOM
-{
-    UINT RoomNumber;
-    LONG64 RefCnt;
-
-    BOOL bGaming; // is game running. (or waiting otherwise)
-    UINT IDCount;
-
-    char Password[ROOM_PASSWORD_MAXLEN + 1];
-
-    SRWLOCK PlayerListLock; // Visiting / Writing following field needs this lock.
-
-    UINT WaitingCount;
-    UINT PlayingCount;
-    PLAYER_INFO WaitingList[ROOM_PLAYER_MAX]; // Stores only online player info. If a user is offline, will be removed from this list.
-    PLAYER_INFO PlayingList[ROOM_PLAYER_MAX]; // Copied from WaitingList when game starts, and not modified until game ends.
-                                              //     except pConnInfo field (will be set to NULL if a player is offline)
-
-    UINT RoleList[ROOM_PLAYER_MAX];
-
-    UINT Vote[ROOM_PLAYER_MAX];
-    UINT LeaderIndex; // current leader
-    BOOL bFairyEnabled;
-    UINT FairyIndex;
-
-    UINT TeamMemberCnt;
-    UINT TeamMemberList[ROOM_PLAYER_MAX];
-
-}GAME_ROOM, * PGAME_ROOM;
-
-VOID InitRoomManager(VOID);
-
-BOOL CreateRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const char* NickName, _In_opt_z_ const char* Password);
-
-BOOL JoinRoom(_In_ UINT RoomNum, _Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const char* NickName, _In_opt_z_ const char* Password);
-
-VOID LeaveRoom(_Inout_ PCONNECTION_INFO pConnInfo);
-
-BOOL ChangeAvatar(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const char* Avatar);
-
-BOOL StartGame(_Inout_ PCONNECTION_INFO pConnInfo);
-
-BOOL PlayerSelectTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT TeamMemberCnt, _In_ UINT32 TeamMemberList[]);
-
-BOOL PlayerConfirmTeam(_Inout_ PCONNECTION_INFO pConnInfo);
-
-BOOL PlayerVoteTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ BOOL bVote);
-
-BOOL PlayerConductMission(_Inout_ PCONNECTION_INFO pConnInfo, _In_ BOOL bPerform);
-
-BOOL PlayerFairyInspect(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT ID);
-
-BOOL PlayerAssassinate(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT AssassinateID);
-
-BOOL PlayerTextMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const CHAR Message[]);
+#pragma once
+#include "common.h"
+
+#define ROOM_NUMBER_MIN 10000
+#define ROOM_NUMBER_MAX 99999
+#define ROOM_NUMBER_MAXLEN 16 // longest room number string accepted from client
+#define ROOM_NUMBER_CNT (ROOM_NUMBER_MAX - ROOM_NUMBER_MIN + 1)
+#define ROOM_CODE_DRAW_MAX 8 // tries to find an unused room code, see RoomNumber.h
+
+#define ROOM_PLAYER_MAX 10
+#define ROOM_PLAYER_MIN 5
+
+#define PLAYER_NICK_MAXLEN 32
+#define PLAYER_AVATAR_MAXLEN 32
+#define ROOM_PASSWORD_MAXLEN 32
+#define PLAYER_MESSAGE_MAXLEN 256
+
+// Role definition
+#define ROLE_MERLIN   1 // ÷
+#define ROLE_PERCIVAL 2 // ά
+#define ROLE_ASSASSIN 3 // ̿
+#define ROLE_MORDRED  4 // Ī׵
+#define ROLE_OBERON   5 // ²
+#define ROLE_MORGANA  6 // Ī
+#define ROLE_LOYALIST 7 // ɪҳ
+#define ROLE_MINIONS  8 // Ī׵µצ
+
+#define ROOM_FLUSH_INTERVAL_DEFAULT 20 // ms, see RoomConfig
+
+#define ENABLE_FAIRY_THRESHOLD 7 // fairy will be enabled when player >= ENABLE_FAIRY_THRESHOLD
+
+// Hint definition
+#define HINT_GOOD               1
+#define HINT_BAD                2
+#define HINT_MERLIN_OR_MORGANA  3
+#define HINT_ASSASSIN           4
+#define HINT_MORDRED            5
+#define HINT_MORGANA            6
+#define HINT_MINIONS            7
+
+typedef struct _CONNECTION_INFO CONNECTION_INFO, * PCONNECTION_INFO;
+typedef struct _ROOM_SNAPSHOT ROOM_SNAPSHOT, * PROOM_SNAPSHOT;
+
+typedef struct _PLAYER_INFO
+{
+    PCONNECTION_INFO pConnInfo;
+    UINT GameID;
+    BOOL bIsRoomOwner;
+    char NickName[PLAYER_NICK_MAXLEN + 1];
+    char Avatar[PLAYER_AVATAR_MAXLEN + 1];
+}PLAYER_INFO, *PPLAYER_INFO;
+
+// Allocated from a slab pool (see SlabPool.h). Fields are grouped by how often they are touched,
+// each group starts on its own cache line so the state read by every action isn't mixed with lobby data.
+typedef struct DECLSPEC_CACHEALIGN _GAME_ROOM
+{
+    // hot: read or written by every action
+    SRWLOCK PlayerListLock; // Visiting / Writing following field needs this lock.
+    LONG64 volatile RefCnt; // players in the room, and joiners checking it. see ReferenceRoom
+
+    BOOL bGaming; // is game running. (or waiting otherwise)
+    UINT WaitingCount;
+    UINT PlayingCount;
+    UINT LeaderIndex; // current leader
+    BOOL bFairyEnabled;
+    UINT FairyIndex;
+    UINT StatusVersion; // bumped on every roomStatus change, sent with roomStatus / roomStatusDelta
+
+    UINT TeamMemberCnt;
+    UINT TeamMemberList[ROOM_PLAYER_MAX];
+    UINT TeamMask;                 // PlayingIndex bits of TeamMemberList, set when the team is confirmed
+    LONG64 volatile VoteBallot;    // team vote of the round, changed without the lock. see CastBallot
+    LONG64 volatile MissionBallot; // mission cards of the approved team, same as above
+
+    // warm: roomStatus cache and flush timer
+    DECLSPEC_CACHEALIGN SRWLOCK SnapshotLock; // only guards replacing pSnapshot, not the room
+    PROOM_SNAPSHOT pSnapshot; // cached full roomStatus, see RoomSnapshot.h
+    PTP_TIMER pFlushTimer; // sends queued roomStatus changes, NULL if changes are sent immediately
+    UINT PendingDeltaCnt;  // roomStatus changes since the last flush, protected by PlayerListLock
+    UINT PendingDeltaOp;   // the change when there is only one, sent as a delta. otherwise full roomStatus is sent
+
+    // cold: player lists and lobby data
+    DECLSPEC_CACHEALIGN PLAYER_INFO WaitingList[ROOM_PLAYER_MAX]; // Stores only online player info. If a user is offline, will be removed from this list.
+    PLAYER_INFO PlayingList[ROOM_PLAYER_MAX]; // Copied from WaitingList when game starts, and not modified until game ends.
+                                              //     except pConnInfo field (will be set to NULL if a player is offline)
+                                              //     and bIsRoomOwner (moves to the next online player when the owner leaves)
+    UINT RoleList[ROOM_PLAYER_MAX];
+    PLAYER_INFO PendingDeltaPlayer;
+
+    UINT RoomNumber;
+    UINT IDCount;
+    UINT GameCnt; // games started, numbers the random stream of each game (see RANDOM_STREAM)
+    char Password[ROOM_PASSWORD_MAXLEN + 1];
+}GAME_ROOM, * PGAME_ROOM;
+
+typedef struct _ROOM_CONFIG
+{
+    // Room status changes within this many ms are merged into one update per player, 0 sends every change immediately.
+    // Applies to rooms created afterwards.
+    UINT FlushInterval;
+    UINT PlayerLimit; // players a room takes, up to ROOM_PLAYER_MAX
+    UINT RoomLimit;   // open rooms at most, 0 for no limit
+} ROOM_CONFIG, * PROOM_CONFIG;
+
+extern ROOM_CONFIG RoomConfig;
+
+// While set, CreateRoom refuses new rooms. Open rooms carry on and close as usual.
+extern volatile BOOL bRoomDraining;
+
+VOID InitRoomManager(VOID);
+
+VOID PrintRoomStats(VOID);
+
+// Strings fit the limits of their message fields (MessageSchema.inl), the handlers refuse longer ones.
+BOOL CreateRoom(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const char* NickName, _In_opt_z_ const char* Password);
+
+// RoomNum as returned by ParseRoomNumber.
+BOOL JoinRoom(_In_ UINT RoomNum, _Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const char* NickName, _In_opt_z_ const char* Password);
+
+VOID LeaveRoom(_Inout_ PCONNECTION_INFO pConnInfo);
+
+BOOL ChangeAvatar(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const char* Avatar);
+
+BOOL StartGame(_Inout_ PCONNECTION_INFO pConnInfo);
+
+BOOL PlayerSelectTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT TeamMemberCnt, _In_ const UINT32 TeamMemberList[]);
+
+BOOL PlayerConfirmTeam(_Inout_ PCONNECTION_INFO pConnInfo);
+
+BOOL PlayerVoteTeam(_Inout_ PCONNECTION_INFO pConnInfo, _In_ BOOL bVote);
+
+BOOL PlayerConductMission(_Inout_ PCONNECTION_INFO pConnInfo, _In_ BOOL bPerform);
+
+BOOL PlayerFairyInspect(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT ID);
+
+BOOL PlayerAssassinate(_Inout_ PCONNECTION_INFO pConnInfo, _In_ UINT AssassinateID);
+
+BOOL PlayerTextMessage(_Inout_ PCONNECTION_INFO pConnInfo, _In_z_ const CHAR Message[]);
+
+// Switch the connection to roomStatusDelta and send it a full roomStatus if it is in a room.
+// Clients also send this to resync when they see a gap in the version.
+BOOL SyncRoomStatus(_Inout_ PCONNECTION_INFO pConnInfo);
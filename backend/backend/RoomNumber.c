@@ -0,0 +1,298 @@
+#include <ctype.h>
+
+#include "common.h"
+#include "RoomManager.h"
+#include "RoomNumber.h"
+#include "Random.h"
+
+#define BITMAP_WORD_CNT ((ROOM_NUMBER_CNT + 63) / 64)
+#define SHARD_WORD_CNT ((BITMAP_WORD_CNT + ROOM_NUMBER_SHARD_CNT - 1) / ROOM_NUMBER_SHARD_CNT)
+#define SHARD_SUMMARY_CNT ((SHARD_WORD_CNT + 63) / 64)
+
+typedef struct DECLSPEC_CACHEALIGN _ROOM_NUMBER_SHARD
+{
+    LONG64 volatile Summary[SHARD_SUMMARY_CNT]; // bit i set: word FirstWord + i may have a free number
+    UINT FirstWord;
+    UINT WordCnt;
+    LONG volatile InUseCnt;
+} ROOM_NUMBER_SHARD, * PROOM_NUMBER_SHARD;
+
+static LONG64 volatile FreeBitmap[BITMAP_WORD_CNT];
+static ROOM_NUMBER_SHARD ShardList[ROOM_NUMBER_SHARD_CNT];
+
+// Codes still open in the process being replaced, DrawRoomCode passes over them. Empty but during a handoff.
+static SRWLOCK ReservedCodeLock = SRWLOCK_INIT;
+static PUINT pReservedCodeList;
+static UINT volatile ReservedCodeCnt;
+static UINT ReservedCodeMax;
+
+static ULONG64 RotateRight(_In_ ULONG64 Value, _In_ UINT Shift)
+{
+    Shift &= 63;
+    return (Value >> Shift) | (Value << ((64 - Shift) & 63));
+}
+
+// Index of a set bit in Value, searching from a random position. Value must not be 0.
+static UINT PickBit(_In_ ULONG64 Value, _In_ UINT Start)
+{
+    DWORD Index;
+    BitScanForward64(&Index, RotateRight(Value, Start));
+    return (Index + Start) & 63;
+}
+
+VOID InitRoomNumbers(VOID)
+{
+    for (UINT i = 0; i < BITMAP_WORD_CNT; i++)
+    {
+        UINT Left = ROOM_NUMBER_CNT - i * 64;
+        FreeBitmap[i] = Left >= 64 ? -1LL : (LONG64)((1ULL << Left) - 1); // numbers past the end are never free
+    }
+
+    for (UINT s = 0; s < ROOM_NUMBER_SHARD_CNT; s++)
+    {
+        PROOM_NUMBER_SHARD pShard = &ShardList[s];
+        pShard->FirstWord = min(s * SHARD_WORD_CNT, BITMAP_WORD_CNT);
+        pShard->WordCnt = min(SHARD_WORD_CNT, BITMAP_WORD_CNT - pShard->FirstWord);
+        pShard->InUseCnt = 0;
+        for (UINT i = 0; i < SHARD_SUMMARY_CNT; i++)
+        {
+            UINT Left = pShard->WordCnt > i * 64 ? pShard->WordCnt - i * 64 : 0;
+            pShard->Summary[i] = Left >= 64 ? -1LL : (LONG64)((1ULL << Left) - 1);
+        }
+    }
+}
+
+// Drop a word from the summary once it is full. A number freed meanwhile sets the bit again,
+// either by itself or because we see it in the second read.
+static VOID ClearSummaryBit(_Inout_ PROOM_NUMBER_SHARD pShard, _In_ UINT WordIndex)
+{
+    LONG64 Bit = (LONG64)(1ULL << (WordIndex & 63));
+    InterlockedAnd64(&pShard->Summary[WordIndex / 64], ~Bit);
+    if (FreeBitmap[pShard->FirstWord + WordIndex])
+        InterlockedOr64(&pShard->Summary[WordIndex / 64], Bit);
+}
+
+static BOOL AllocFromShard(_Inout_ PROOM_NUMBER_SHARD pShard, _In_ UINT Rand, _Out_ UINT* pNumber)
+{
+    for (UINT j = 0; j < SHARD_SUMMARY_CNT; j++)
+    {
+        UINT SummaryIndex = (j + Rand) % SHARD_SUMMARY_CNT;
+        LONG64 Summary;
+        while ((Summary = pShard->Summary[SummaryIndex]) != 0)
+        {
+            UINT WordIndex = SummaryIndex * 64 + PickBit(Summary, Rand >> 8);
+            LONG64 volatile* pWord = &FreeBitmap[pShard->FirstWord + WordIndex];
+            LONG64 Word;
+            while ((Word = *pWord) != 0)
+            {
+                UINT Bit = PickBit(Word, Rand >> 16);
+                LONG64 NewWord = Word & ~(LONG64)(1ULL << Bit);
+                if (InterlockedCompareExchange64(pWord, NewWord, Word) != Word)
+                    continue;
+
+                if (NewWord == 0)
+                    ClearSummaryBit(pShard, WordIndex);
+                InterlockedIncrement(&pShard->InUseCnt);
+                *pNumber = (pShard->FirstWord + WordIndex) * 64 + Bit;
+                return TRUE;
+            }
+            ClearSummaryBit(pShard, WordIndex); // full, the summary was stale
+        }
+    }
+    return FALSE;
+}
+
+BOOL AllocRoomNumber(_Out_ UINT* pNumber)
+{
+    UINT Rand;
+    if (!RandomUInt32(&Rand))
+        return FALSE;
+
+    for (UINT s = 0; s < ROOM_NUMBER_SHARD_CNT; s++)
+    {
+        if (AllocFromShard(&ShardList[(s + Rand) % ROOM_NUMBER_SHARD_CNT], Rand, pNumber))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Index of Code in the reserved list, or ReservedCodeCnt. Hold ReservedCodeLock.
+static UINT FindReservedCode(_In_ UINT Code)
+{
+    UINT i = 0;
+    while (i < ReservedCodeCnt && pReservedCodeList[i] != Code)
+        i++;
+    return i;
+}
+
+static BOOL ReserveRoomCode(_In_ UINT Code)
+{
+    BOOL bSuccess = FALSE;
+
+    AcquireSRWLockExclusive(&ReservedCodeLock);
+    if (FindReservedCode(Code) == ReservedCodeCnt)
+    {
+        if (ReservedCodeCnt == ReservedCodeMax)
+        {
+            UINT NewMax = ReservedCodeMax ? ReservedCodeMax * 2 : 64;
+            PUINT pNewList = pReservedCodeList
+                ? HeapReAlloc(GetProcessHeap(), 0, pReservedCodeList, NewMax * sizeof(UINT))
+                : HeapAlloc(GetProcessHeap(), 0, NewMax * sizeof(UINT));
+            if (pNewList)
+            {
+                pReservedCodeList = pNewList;
+                ReservedCodeMax = NewMax;
+            }
+        }
+        if (ReservedCodeCnt < ReservedCodeMax)
+        {
+            pReservedCodeList[ReservedCodeCnt++] = Code;
+            bSuccess = TRUE;
+        }
+    }
+    ReleaseSRWLockExclusive(&ReservedCodeLock);
+    return bSuccess;
+}
+
+VOID FreeRoomNumber(_In_ UINT Number)
+{
+    if (Number & ROOM_CODE_FLAG)
+    {
+        if (!ReservedCodeCnt) // the usual case, a room of this process closing
+            return;
+
+        AcquireSRWLockExclusive(&ReservedCodeLock);
+        UINT i = FindReservedCode(Number);
+        if (i < ReservedCodeCnt)
+            pReservedCodeList[i] = pReservedCodeList[--ReservedCodeCnt];
+        if (!ReservedCodeCnt)
+        {
+            HeapFree(GetProcessHeap(), 0, pReservedCodeList);
+            pReservedCodeList = NULL;
+            ReservedCodeMax = 0;
+        }
+        ReleaseSRWLockExclusive(&ReservedCodeLock);
+        return;
+    }
+
+    UINT Word = Number / 64;
+    PROOM_NUMBER_SHARD pShard = &ShardList[Word / SHARD_WORD_CNT];
+    UINT WordIndex = Word - pShard->FirstWord;
+
+    InterlockedOr64(&FreeBitmap[Word], (LONG64)(1ULL << (Number & 63)));
+    InterlockedOr64(&pShard->Summary[WordIndex / 64], (LONG64)(1ULL << (WordIndex & 63)));
+    InterlockedDecrement(&pShard->InUseCnt);
+}
+
+BOOL ReserveRoomNumber(_In_ UINT Number)
+{
+    if (Number & ROOM_CODE_FLAG)
+        return ReserveRoomCode(Number);
+    if (Number >= ROOM_NUMBER_CNT)
+        return FALSE;
+
+    UINT Word = Number / 64;
+    PROOM_NUMBER_SHARD pShard = &ShardList[Word / SHARD_WORD_CNT];
+    LONG64 Bit = (LONG64)(1ULL << (Number & 63));
+
+    LONG64 OldWord = InterlockedAnd64(&FreeBitmap[Word], ~Bit);
+    if (!(OldWord & Bit))
+        return FALSE;
+
+    if ((OldWord & ~Bit) == 0)
+        ClearSummaryBit(pShard, Word - pShard->FirstWord);
+    InterlockedIncrement(&pShard->InUseCnt);
+    return TRUE;
+}
+
+UINT GetRoomNumbersInUse(VOID)
+{
+    LONG InUse = 0;
+    for (UINT s = 0; s < ROOM_NUMBER_SHARD_CNT; s++)
+        InUse += ShardList[s].InUseCnt;
+    return (UINT)InUse;
+}
+
+static const CHAR RoomCodeDigits[] = "0123456789ABCDEFGHJKMNPQRSTVWXYZ";
+
+BOOL DrawRoomCode(_Out_ UINT* pNumber)
+{
+    UINT Rand;
+    if (!RandomUInt32(&Rand))
+        return FALSE;
+
+    *pNumber = ROOM_CODE_FLAG | (Rand & ROOM_CODE_MASK);
+    if (!ReservedCodeCnt)
+        return TRUE;
+
+    AcquireSRWLockShared(&ReservedCodeLock);
+    BOOL bReserved = FindReservedCode(*pNumber) < ReservedCodeCnt;
+    ReleaseSRWLockShared(&ReservedCodeLock);
+    return !bReserved;
+}
+
+VOID FormatRoomNumber(_In_ UINT Number, _Out_writes_z_(ROOM_NAME_MAXLEN + 1) CHAR* szName)
+{
+    if (!(Number & ROOM_CODE_FLAG))
+    {
+        sprintf_s(szName, ROOM_NAME_MAXLEN + 1, "%u", Number + ROOM_NUMBER_MIN);
+        return;
+    }
+
+    for (INT i = ROOM_CODE_LEN - 1; i >= 0; i--)
+    {
+        szName[i] = RoomCodeDigits[Number & 31];
+        Number >>= 5;
+    }
+    szName[ROOM_CODE_LEN] = '\0';
+}
+
+// -1 if not a code digit. Letters easily misread are read as the digit they look like.
+static INT RoomCodeDigitValue(_In_ CHAR c)
+{
+    c = (CHAR)toupper((UCHAR)c);
+    if (c == 'O')
+        c = '0';
+    else if (c == 'I' || c == 'L')
+        c = '1';
+
+    for (INT i = 0; i < 32; i++)
+    {
+        if (RoomCodeDigits[i] == c)
+            return i;
+    }
+    return -1;
+}
+
+BOOL ParseRoomNumber(_In_z_ const CHAR* szName, _Out_ UINT* pNumber)
+{
+    SIZE_T Len = strlen(szName);
+    UINT Number = 0;
+
+    if (Len == ROOM_CODE_LEN)
+    {
+        for (SIZE_T i = 0; i < Len; i++)
+        {
+            INT Digit = RoomCodeDigitValue(szName[i]);
+            if (Digit < 0)
+                return FALSE;
+            Number = (Number << 5) | (UINT)Digit;
+        }
+        *pNumber = ROOM_CODE_FLAG | Number;
+        return TRUE;
+    }
+
+    if (Len == 0 || Len > 5)
+        return FALSE;
+    for (SIZE_T i = 0; i < Len; i++)
+    {
+        if (!isdigit((UCHAR)szName[i]))
+            return FALSE;
+        Number = Number * 10 + (szName[i] - '0');
+    }
+    if (Number < ROOM_NUMBER_MIN || Number > ROOM_NUMBER_MAX)
+        return FALSE;
+
+    *pNumber = Number - ROOM_NUMBER_MIN;
+    return TRUE;
+}
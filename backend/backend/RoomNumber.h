@@ -0,0 +1,46 @@
+#pragma once
+#include "common.h"
+
+// Free room numbers, kept as a two level bitmap split into shards.
+//
+// Number i is free when bit i of the bitmap is set. Each shard covers a contiguous range of bitmap words
+// and has a summary with one bit per word that may still have a free number, so a nearly full shard
+// is passed over in a couple of reads. Numbers are taken and given back with an interlocked operation
+// on their word, no lock is held.
+// Allocation starts at a random shard, word and bit, the next number can't be guessed from the last ones.
+
+#define ROOM_NUMBER_SHARD_CNT 16
+
+// When every number is in use, rooms get a code of ROOM_CODE_LEN characters in Crockford base 32 instead.
+// Its room number is ROOM_CODE_FLAG | the 30 bit value, drawn at random (see DrawRoomCode), the caller
+// checks it isn't open already.
+#define ROOM_CODE_LEN 6
+#define ROOM_CODE_FLAG 0x80000000
+#define ROOM_CODE_MASK ((1u << (5 * ROOM_CODE_LEN)) - 1)
+
+#define ROOM_NAME_MAXLEN ROOM_CODE_LEN // the number or code shown to players, the longer of the two
+
+VOID InitRoomNumbers(VOID);
+
+// Take a free room number (0 based, ROOM_NUMBER_MIN is added when shown).
+// Returns FALSE if every number is in use.
+BOOL AllocRoomNumber(_Out_ UINT* pNumber);
+
+// A code is only looked up among the reserved ones.
+VOID FreeRoomNumber(_In_ UINT Number);
+
+// Take the given number or code, e.g. one still open in the process being replaced.
+// FALSE if it is in use. Reserved codes are kept in a list, there are few of them and only for a while.
+BOOL ReserveRoomNumber(_In_ UINT Number);
+
+// FALSE if the code drawn is reserved, draw again.
+BOOL DrawRoomCode(_Out_ UINT* pNumber);
+
+// "12345" for a number, "7QX0KM" for a code.
+VOID FormatRoomNumber(_In_ UINT Number, _Out_writes_z_(ROOM_NAME_MAXLEN + 1) CHAR* szName);
+
+// Accepts both forms, codes are not case sensitive. Returns FALSE if malformed.
+BOOL ParseRoomNumber(_In_z_ const CHAR* szName, _Out_ UINT* pNumber);
+
+// Numbers in use, for stats. Not exact while others allocate.
+UINT GetRoomNumbersInUse(VOID);
@@ -0,0 +1,112 @@
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "BinaryHandler.h"
+#include "MessageSender.h"
+#include "RoomSnapshot.h"
+
+typedef struct _SNAPSHOT_SEND_BUF
+{
+    WEBSOCK_SEND_BUF SendBuf;
+    PROOM_SNAPSHOT pSnapshot; // referenced until the send completes
+} SNAPSHOT_SEND_BUF, * PSNAPSHOT_SEND_BUF;
+
+PROOM_SNAPSHOT ReferenceRoomSnapshot(_In_ PGAME_ROOM pRoom)
+{
+    // SnapshotLock only covers loading the pointer and adding the ref,
+    // so the snapshot can't be freed in between by the one replacing it.
+    AcquireSRWLockShared(&pRoom->SnapshotLock);
+    PROOM_SNAPSHOT pSnapshot = pRoom->pSnapshot;
+    if (pSnapshot)
+        InterlockedIncrement(&pSnapshot->RefCnt);
+    ReleaseSRWLockShared(&pRoom->SnapshotLock);
+    return pSnapshot;
+}
+
+VOID ReleaseRoomSnapshot(_In_ _Frees_ptr_ PROOM_SNAPSHOT pSnapshot)
+{
+    if (InterlockedDecrement(&pSnapshot->RefCnt) == 0)
+        HeapFree(GetProcessHeap(), 0, pSnapshot);
+}
+
+PROOM_SNAPSHOT GetRoomSnapshot(_Inout_ PGAME_ROOM pRoom)
+{
+    PROOM_SNAPSHOT pSnapshot = ReferenceRoomSnapshot(pRoom);
+    if (pSnapshot)
+    {
+        if (pSnapshot->Version == pRoom->StatusVersion)
+            return pSnapshot;
+        ReleaseRoomSnapshot(pSnapshot);
+    }
+
+    pSnapshot = BuildRoomSnapshot(pRoom);
+    if (!pSnapshot)
+        return NULL;
+
+    // another reader holding PlayerListLock shared may have published the same version meanwhile,
+    // keep that one so everyone shares a single buffer.
+    PROOM_SNAPSHOT pDrop;
+    AcquireSRWLockExclusive(&pRoom->SnapshotLock);
+    if (pRoom->pSnapshot && pRoom->pSnapshot->Version == pSnapshot->Version)
+    {
+        pDrop = pSnapshot;
+        pSnapshot = pRoom->pSnapshot;
+    }
+    else
+    {
+        pDrop = pRoom->pSnapshot;
+        pRoom->pSnapshot = pSnapshot;
+    }
+    InterlockedIncrement(&pSnapshot->RefCnt); // one for the room, one for the caller
+    ReleaseSRWLockExclusive(&pRoom->SnapshotLock);
+
+    if (pDrop)
+        ReleaseRoomSnapshot(pDrop);
+    return pSnapshot;
+}
+
+VOID FreeRoomSnapshot(_Inout_ PGAME_ROOM pRoom)
+{
+    AcquireSRWLockExclusive(&pRoom->SnapshotLock);
+    PROOM_SNAPSHOT pSnapshot = pRoom->pSnapshot;
+    pRoom->pSnapshot = NULL;
+    ReleaseSRWLockExclusive(&pRoom->SnapshotLock);
+
+    if (pSnapshot)
+        ReleaseRoomSnapshot(pSnapshot);
+}
+
+VOID SendSnapshotCompleteCallback(_In_ PCONNECTION_INFO pConnInfo, _In_ _Frees_ptr_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    PSNAPSHOT_SEND_BUF pSnapshotSendBuf = CONTAINING_RECORD(pWebsockSendBuf, SNAPSHOT_SEND_BUF, SendBuf);
+    ReleaseRoomSnapshot(pSnapshotSendBuf->pSnapshot);
+    HeapFree(GetProcessHeap(), 0, pSnapshotSendBuf);
+}
+
+BOOL SendRoomSnapshot(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PROOM_SNAPSHOT pSnapshot)
+{
+    PSNAPSHOT_SEND_BUF pSnapshotSendBuf = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(SNAPSHOT_SEND_BUF));
+    if (!pSnapshotSendBuf)
+        return FALSE;
+
+    InterlockedIncrement(&pSnapshot->RefCnt);
+    pSnapshotSendBuf->pSnapshot = pSnapshot;
+
+    PWEBSOCK_SEND_BUF pWebsockSendbuf = &pSnapshotSendBuf->SendBuf;
+    if (pConnInfo->Protocol == WIRE_PROTOCOL_BINARY)
+    {
+        pWebsockSendbuf->BufferType = WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE;
+        pWebsockSendbuf->WebsockBuf.Data.pbBuffer = pSnapshot->Data + pSnapshot->cbJsonLen;
+        pWebsockSendbuf->WebsockBuf.Data.ulBufferLength = pSnapshot->cbBinLen;
+    }
+    else
+    {
+        pWebsockSendbuf->BufferType = WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE;
+        pWebsockSendbuf->WebsockBuf.Data.pbBuffer = pSnapshot->Data;
+        pWebsockSendbuf->WebsockBuf.Data.ulBufferLength = pSnapshot->cbJsonLen;
+    }
+    pWebsockSendbuf->MessageType = BIN_OUT_ROOM_STATUS;
+    pWebsockSendbuf->Callback = SendSnapshotCompleteCallback;
+
+    WebsockSendMessage(pConnInfo, pWebsockSendbuf);
+    return TRUE;
+}
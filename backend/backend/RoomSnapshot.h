@@ -0,0 +1,35 @@
+#pragma once
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "RoomManager.h"
+
+// Serialized full roomStatus of a room, immutable once built.
+// The room keeps the latest one in pRoom->pSnapshot and rebuilds it only when
+// pRoom->StatusVersion has moved past it, so every full roomStatus sent between two
+// changes (broadcast, join, resync) is the same buffer.
+typedef struct _ROOM_SNAPSHOT
+{
+    LONG RefCnt;
+    UINT Version;    // pRoom->StatusVersion it was built from
+    ULONG cbJsonLen;
+    ULONG cbBinLen;
+    BYTE Data[];     // json text, followed by the binary message
+} ROOM_SNAPSHOT, * PROOM_SNAPSHOT;
+
+// Current snapshot of pRoom with a reference added, rebuilt first if stale. NULL if out of memory.
+// PlayerListLock must be held, shared is enough.
+_Ret_maybenull_
+PROOM_SNAPSHOT GetRoomSnapshot(_Inout_ PGAME_ROOM pRoom);
+
+// Latest published snapshot with a reference added, NULL if none was built yet.
+// Doesn't touch PlayerListLock, so it can be one version behind a change in progress.
+_Ret_maybenull_
+PROOM_SNAPSHOT ReferenceRoomSnapshot(_In_ PGAME_ROOM pRoom);
+
+VOID ReleaseRoomSnapshot(_In_ _Frees_ptr_ PROOM_SNAPSHOT pSnapshot);
+
+// Drop the room's own reference, called when the room is closed.
+VOID FreeRoomSnapshot(_Inout_ PGAME_ROOM pRoom);
+
+// Send the snapshot in the connection's wire protocol without copying it.
+BOOL SendRoomSnapshot(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PROOM_SNAPSHOT pSnapshot);
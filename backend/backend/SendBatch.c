@@ -0,0 +1,189 @@
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "BinaryHandler.h"
+#include "SendBatch.h"
+#include "Metrics.h"
+
+typedef struct _SEND_BATCH
+{
+    UINT Depth;
+    UINT ConnCnt;
+    PCONNECTION_INFO ConnList[SEND_BATCH_CONN_MAX]; // referenced until the batch ends
+} SEND_BATCH, * PSEND_BATCH;
+
+static __declspec(thread) SEND_BATCH ThreadBatch;
+
+VOID BeginSendBatch(VOID)
+{
+    ThreadBatch.Depth++;
+}
+
+VOID SendBatchCompleteCallback(_In_ PCONNECTION_INFO pConnInfo, _In_ _Frees_ptr_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    HeapFree(GetProcessHeap(), 0, pWebsockSendBuf); // data is in the same allocation
+}
+
+static ULONG WriteVarint(_Out_writes_bytes_to_(5, return) PBYTE pOut, _In_ UINT32 Value)
+{
+    ULONG cbLen = 0;
+    while (Value >= 0x80)
+    {
+        pOut[cbLen++] = (BYTE)(Value | 0x80);
+        Value >>= 7;
+    }
+    pOut[cbLen++] = (BYTE)Value;
+    return cbLen;
+}
+
+// Merge the held messages into one frame, NULL if out of memory.
+static PWEBSOCK_SEND_BUF BuildBatchFrame(_In_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pHead)
+{
+    BOOL bBinary = pConnInfo->Protocol == WIRE_PROTOCOL_BINARY;
+    SIZE_T cbTotal = 2; // [ ] or the binary header
+    for (PWEBSOCK_SEND_BUF p = pHead; p; p = p->pNext)
+        cbTotal += p->WebsockBuf.Data.ulBufferLength + (bBinary ? 5 : 1); // length varint or comma
+
+    PWEBSOCK_SEND_BUF pFrame = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(WEBSOCK_SEND_BUF) + cbTotal);
+    if (!pFrame)
+        return NULL;
+
+    PBYTE pOut = (PBYTE)(pFrame + 1);
+    ULONG cbOut = 0;
+    if (bBinary)
+    {
+        pOut[cbOut++] = BIN_PROTOCOL_VERSION;
+        pOut[cbOut++] = BIN_OUT_BATCH;
+    }
+    else
+    {
+        pOut[cbOut++] = '[';
+    }
+    for (PWEBSOCK_SEND_BUF p = pHead; p; p = p->pNext)
+    {
+        ULONG cbMessage = p->WebsockBuf.Data.ulBufferLength;
+        if (bBinary)
+            cbOut += WriteVarint(pOut + cbOut, cbMessage);
+        else if (p != pHead)
+            pOut[cbOut++] = ',';
+        memcpy(pOut + cbOut, p->WebsockBuf.Data.pbBuffer, cbMessage);
+        cbOut += cbMessage;
+    }
+    if (!bBinary)
+        pOut[cbOut++] = ']';
+
+    pFrame->BufferType = bBinary ? WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE : WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE;
+    pFrame->MessageType = BIN_OUT_BATCH;
+    pFrame->Callback = SendBatchCompleteCallback;
+    pFrame->WebsockBuf.Data.pbBuffer = pOut;
+    pFrame->WebsockBuf.Data.ulBufferLength = cbOut;
+    return pFrame;
+}
+
+// Send everything held for pConnInfo as one frame.
+static VOID FlushBatch(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    PWEBSOCK_SEND_BUF pFrame = NULL;
+
+    // held until the frame is queued, so a later batch can't overtake this one.
+    AcquireSRWLockExclusive(&pConnInfo->BatchLock);
+    PWEBSOCK_SEND_BUF pHead = pConnInfo->pBatchHead;
+    pConnInfo->pBatchHead = NULL;
+    pConnInfo->pBatchTail = NULL;
+
+    if (pHead && !pHead->pNext)
+    {
+        pFrame = pHead; // only one, send as is
+        CountMetric(METRIC_BATCH_RELEASED);
+    }
+    else if (pHead)
+    {
+        pFrame = BuildBatchFrame(pConnInfo, pHead);
+        UINT HeldCnt = 0;
+        while (pHead)
+        {
+            PWEBSOCK_SEND_BUF pNext = pHead->pNext;
+            pHead->Callback(pConnInfo, pHead);
+            pHead = pNext;
+            HeldCnt++;
+        }
+        AddMetric(METRIC_BATCH_RELEASED, HeldCnt);
+        if (!pFrame)
+        {
+            // the client has missed messages, it can't go on.
+            Log(LOG_ERROR, L"Failed to build a batched frame. disconnecting...");
+            WebSocketAbortHandle(pConnInfo->hWebSock);
+        }
+    }
+    if (pFrame)
+        WebsockQueueSend(pConnInfo, pFrame);
+    ReleaseSRWLockExclusive(&pConnInfo->BatchLock);
+
+    if (pFrame)
+        WebsockFlushSend(pConnInfo);
+}
+
+VOID EndSendBatch(VOID)
+{
+    if (--ThreadBatch.Depth)
+        return;
+
+    // take the list first, flushing runs websocket actions which may open another batch on this thread.
+    PCONNECTION_INFO ConnList[SEND_BATCH_CONN_MAX];
+    UINT ConnCnt = ThreadBatch.ConnCnt;
+    memcpy(ConnList, ThreadBatch.ConnList, ConnCnt * sizeof(PCONNECTION_INFO));
+    ThreadBatch.ConnCnt = 0;
+
+    for (UINT i = 0; i < ConnCnt; i++)
+    {
+        FlushBatch(ConnList[i]);
+        ConnInfoRelease(ConnList[i]);
+    }
+}
+
+BOOL HoldBatchedSend(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pWebsockSendBuf)
+{
+    PSEND_BATCH pBatch = &ThreadBatch;
+    BOOL bHeld = FALSE;
+    BOOL bFlushNow = FALSE;
+
+    if (pBatch->Depth)
+    {
+        UINT i;
+        for (i = 0; i < pBatch->ConnCnt; i++)
+        {
+            if (pBatch->ConnList[i] == pConnInfo)
+                break;
+        }
+        if (i == pBatch->ConnCnt)
+        {
+            if (pBatch->ConnCnt < SEND_BATCH_CONN_MAX)
+            {
+                ConnInfoAddRef(pConnInfo);
+                pBatch->ConnList[pBatch->ConnCnt++] = pConnInfo;
+            }
+            else
+            {
+                bFlushNow = TRUE;
+            }
+        }
+    }
+
+    AcquireSRWLockExclusive(&pConnInfo->BatchLock);
+    // without a batch, still hold it behind messages held by another thread, or it would overtake them.
+    if (pBatch->Depth || pConnInfo->pBatchHead)
+    {
+        pWebsockSendBuf->pNext = NULL;
+        if (pConnInfo->pBatchTail)
+            pConnInfo->pBatchTail->pNext = pWebsockSendBuf;
+        else
+            pConnInfo->pBatchHead = pWebsockSendBuf;
+        pConnInfo->pBatchTail = pWebsockSendBuf;
+        bHeld = TRUE;
+        CountMetric(METRIC_BATCH_HELD);
+    }
+    ReleaseSRWLockExclusive(&pConnInfo->BatchLock);
+
+    if (bFlushNow)
+        FlushBatch(pConnInfo);
+    return bHeld;
+}
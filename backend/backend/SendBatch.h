@@ -0,0 +1,23 @@
+#pragma once
+#include "common.h"
+#include "HttpSendRecv.h"
+
+// Batched frames, for connections that sent "batchEvents".
+//
+// While a batch is open on a thread (around handling one inbound message), messages for such
+// connections are held and go out as one frame per connection when the batch ends:
+//     json:   a JSON array of the messages, [{...},{...}]
+//     binary: [version][BIN_OUT_BATCH] then [varint length][message] for each message
+// A batch of a single message is sent as the message itself.
+// Messages are held per connection in send order, so batches ended by different threads stay in order.
+
+#define SEND_BATCH_CONN_MAX 16 // connections one batch holds messages for, messages to more are sent right away
+
+// Batches nest, messages go out when the outermost one ends.
+VOID BeginSendBatch(VOID);
+
+VOID EndSendBatch(VOID);
+
+// Called by WebsockSendMessage for connections that asked for batches.
+// Returns FALSE if the message was not held and should be sent now.
+BOOL HoldBatchedSend(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEBSOCK_SEND_BUF pWebsockSendBuf);
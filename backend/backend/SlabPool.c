@@ -0,0 +1,88 @@
+#include "common.h"
+#include "SlabPool.h"
+
+SIZE_T SlabSize = SLAB_SIZE_DEFAULT;
+
+static PSLAB_POOL volatile PoolList; // pools are never uninitialized
+
+VOID InitSlabPool(_Out_ PSLAB_POOL pPool, _In_z_ const WCHAR* Name, _In_ SIZE_T ObjectSize)
+{
+    InitializeSListHead(&pPool->FreeList);
+    pPool->ObjectSize = (ObjectSize + SYSTEM_CACHE_ALIGNMENT_SIZE - 1) & ~(SIZE_T)(SYSTEM_CACHE_ALIGNMENT_SIZE - 1);
+    pPool->ObjectsPerSlab = (UINT)max(1, SlabSize / pPool->ObjectSize);
+    InitializeSRWLock(&pPool->GrowLock);
+    pPool->SlabCnt = 0;
+    pPool->InUseCnt = 0;
+    pPool->Name = Name;
+
+    PSLAB_POOL pHead;
+    do
+    {
+        pHead = PoolList;
+        pPool->pNextPool = pHead;
+    } while (InterlockedCompareExchangePointer((PVOID volatile*)&PoolList, pPool, pHead) != pHead);
+}
+
+_Ret_maybenull_
+PSLAB_POOL NextSlabPool(_In_opt_ PSLAB_POOL pPool)
+{
+    return pPool ? pPool->pNextPool : PoolList;
+}
+
+// Add a slab, keep one object of it for the caller.
+static PSLIST_ENTRY GrowSlabPool(_Inout_ PSLAB_POOL pPool)
+{
+    PSLIST_ENTRY pEntry;
+
+    AcquireSRWLockExclusive(&pPool->GrowLock);
+    __try
+    {
+        // someone else may have grown the pool while we were waiting.
+        pEntry = InterlockedPopEntrySList(&pPool->FreeList);
+        if (pEntry)
+            __leave;
+
+        // page aligned, so every object is cache line aligned.
+        PBYTE pSlab = VirtualAlloc(NULL, pPool->ObjectSize * pPool->ObjectsPerSlab, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (!pSlab)
+        {
+            Log(LOG_ERROR, L"failed to add a slab to pool %1.", pPool->Name);
+            __leave;
+        }
+        InterlockedIncrement64(&pPool->SlabCnt);
+
+        for (UINT i = 1; i < pPool->ObjectsPerSlab; i++)
+            InterlockedPushEntrySList(&pPool->FreeList, (PSLIST_ENTRY)(pSlab + i * pPool->ObjectSize));
+        pEntry = (PSLIST_ENTRY)pSlab;
+    }
+    __finally
+    {
+        ReleaseSRWLockExclusive(&pPool->GrowLock);
+    }
+    return pEntry;
+}
+
+PVOID SlabAlloc(_Inout_ PSLAB_POOL pPool)
+{
+    PSLIST_ENTRY pEntry = InterlockedPopEntrySList(&pPool->FreeList);
+    if (!pEntry)
+        pEntry = GrowSlabPool(pPool);
+    if (!pEntry)
+        return NULL;
+
+    InterlockedIncrement64(&pPool->InUseCnt);
+    ZeroMemory(pEntry, pPool->ObjectSize);
+    return pEntry;
+}
+
+VOID SlabFree(_Inout_ PSLAB_POOL pPool, _In_ _Frees_ptr_ PVOID pObject)
+{
+    InterlockedDecrement64(&pPool->InUseCnt);
+    InterlockedPushEntrySList(&pPool->FreeList, (PSLIST_ENTRY)pObject);
+}
+
+VOID PrintSlabPoolStats(_In_ PSLAB_POOL pPool)
+{
+    Log(LOG_INFO, L"pool %1: %2!I64d! in use, %3!I64d! slabs of %4!u! x %5!I64u! bytes",
+        pPool->Name, pPool->InUseCnt, pPool->SlabCnt, pPool->ObjectsPerSlab, (UINT64)pPool->ObjectSize);
+}
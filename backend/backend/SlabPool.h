@@ -0,0 +1,35 @@
+#pragma once
+#include "common.h"
+
+// Fixed-size object pool. Objects are carved from SlabSize slabs and kept on a lock-free free list,
+// they are never returned to the system. Every object starts on a cache line.
+
+#define SLAB_SIZE_DEFAULT (64 * 1024)
+
+extern SIZE_T SlabSize; // bytes, for pools initialized afterwards
+
+typedef struct _SLAB_POOL
+{
+    SLIST_HEADER FreeList;
+    SIZE_T ObjectSize;     // rounded up to a cache line
+    UINT ObjectsPerSlab;
+    SRWLOCK GrowLock;      // only one thread adds a slab at a time
+    volatile LONG64 SlabCnt;
+    volatile LONG64 InUseCnt;
+    const WCHAR* Name;     // for stats
+    struct _SLAB_POOL* pNextPool; // every pool, see NextSlabPool
+} SLAB_POOL, * PSLAB_POOL;
+
+VOID InitSlabPool(_Out_ PSLAB_POOL pPool, _In_z_ const WCHAR* Name, _In_ SIZE_T ObjectSize);
+
+// Returns a zeroed object, or NULL if out of memory.
+_Ret_maybenull_
+PVOID SlabAlloc(_Inout_ PSLAB_POOL pPool);
+
+VOID SlabFree(_Inout_ PSLAB_POOL pPool, _In_ _Frees_ptr_ PVOID pObject);
+
+VOID PrintSlabPoolStats(_In_ PSLAB_POOL pPool);
+
+// Walk every initialized pool, for metrics. NULL gives the first one.
+_Ret_maybenull_
+PSLAB_POOL NextSlabPool(_In_opt_ PSLAB_POOL pPool);
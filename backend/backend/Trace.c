@@ -0,0 +1,311 @@
+#include <strsafe.h>
+
+#include "common.h"
+#include "Trace.h"
+#include "HttpSendRecv.h"
+#include "RoomNumber.h"
+
+typedef struct _TRACE_EVENT
+{
+    PCSTR Name;
+    LONG64 StartTick;
+    LONG64 DurTicks;
+    UINT ConnId;
+    UINT RoomNumber;
+    DWORD ThreadId;
+    BYTE Category; // TRACE_CAT_*
+} TRACE_EVENT, * PTRACE_EVENT;
+
+typedef struct _TRACE_RING TRACE_RING, * PTRACE_RING;
+
+typedef struct _TRACE_RING
+{
+    SLIST_ENTRY FreeEntry; // on RetiredRings after its thread exited
+    PTRACE_RING pNext;     // all rings, never unlinked
+    LONG64 volatile WriteCnt; // events ever written, the last TRACE_RING_EVENTS are kept
+    TRACE_EVENT EventList[TRACE_RING_EVENTS];
+} TRACE_RING, * PTRACE_RING;
+
+#define TRACE_WRITE_BUFFER_SIZE (64 * 1024)
+#define TRACE_EVENT_MAXLEN 512 // one formatted event, the buffer is flushed before it has less
+
+typedef struct _TRACE_WRITER
+{
+    HANDLE hFile;
+    SIZE_T cbLen;
+    BOOL bFailed;
+    CHAR Buffer[TRACE_WRITE_BUFFER_SIZE];
+} TRACE_WRITER, * PTRACE_WRITER;
+
+volatile BOOL bTracing = FALSE;
+volatile UINT TraceSlowUs = 0;
+
+static PTRACE_RING volatile RingList;
+static SLIST_HEADER RetiredRings;
+static DWORD TraceFlsIndex = FLS_OUT_OF_INDEXES;
+static LARGE_INTEGER TickFrequency;
+static ULONGLONG volatile LastSlowDumpTime; // GetTickCount64
+static SRWLOCK DumpLock = SRWLOCK_INIT; // one dump at a time
+
+static __declspec(thread) PTRACE_RING ThreadRing;
+
+static const CHAR* const CategoryNameList[TRACE_CAT_COUNT] =
+{
+    [TRACE_CAT_IO] = "io",
+    [TRACE_CAT_WEBSOCKET] = "websocket",
+    [TRACE_CAT_MESSAGE] = "message",
+    [TRACE_CAT_PARSE] = "parse",
+    [TRACE_CAT_HANDLER] = "handler",
+    [TRACE_CAT_LOCK] = "lock",
+    [TRACE_CAT_SERIALIZE] = "serialize",
+    [TRACE_CAT_SEND] = "send",
+};
+
+// Runs on thread exit, the ring keeps its spans for the dump and the next thread.
+static VOID NTAPI RetireTraceRing(_In_opt_ PVOID Data)
+{
+    PTRACE_RING pRing = Data;
+    if (!pRing)
+        return;
+    ThreadRing = NULL;
+    InterlockedPushEntrySList(&RetiredRings, &pRing->FreeEntry);
+}
+
+VOID InitTrace(VOID)
+{
+    QueryPerformanceFrequency(&TickFrequency);
+    InitializeSListHead(&RetiredRings);
+
+    TraceFlsIndex = FlsAlloc(RetireTraceRing);
+    if (TraceFlsIndex == FLS_OUT_OF_INDEXES)
+        LogErrorMessage(L"FlsAlloc", GetLastError()); // rings of exited threads are not reused then
+}
+
+VOID EnableTrace(_In_ BOOL bEnable)
+{
+    bTracing = bEnable;
+    Log(LOG_INFO, L"tracing is %1.", bEnable ? L"on" : L"off");
+}
+
+_Ret_maybenull_
+static PTRACE_RING AttachTraceRing(VOID)
+{
+    PTRACE_RING pRing = (PTRACE_RING)InterlockedPopEntrySList(&RetiredRings);
+    if (!pRing)
+    {
+        // page aligned, as SLIST_ENTRY needs.
+        pRing = VirtualAlloc(NULL, sizeof(TRACE_RING), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (!pRing)
+            return NULL; // try again on the next span
+
+        PTRACE_RING pHead;
+        do
+        {
+            pHead = RingList;
+            pRing->pNext = pHead;
+        } while (InterlockedCompareExchangePointer((PVOID volatile*)&RingList, pRing, pHead) != pHead);
+    }
+    if (TraceFlsIndex != FLS_OUT_OF_INDEXES)
+        FlsSetValue(TraceFlsIndex, pRing);
+    ThreadRing = pRing;
+    return pRing;
+}
+
+VOID BeginTraceSpan(_Out_ PTRACE_SPAN pSpan, _In_opt_ const struct _CONNECTION_INFO* pConnInfo)
+{
+    LARGE_INTEGER Tick;
+    QueryPerformanceCounter(&Tick);
+    pSpan->StartTick = Tick.QuadPart;
+    pSpan->ConnId = 0;
+    pSpan->RoomNumber = TRACE_NO_ROOM;
+
+    if (pConnInfo)
+    {
+        // rooms are never unmapped (see SlabPool.h), one closed meanwhile gives a stale number at worst.
+        PGAME_ROOM pRoom = pConnInfo->pRoom;
+        pSpan->ConnId = pConnInfo->ConnId;
+        if (pRoom)
+            pSpan->RoomNumber = pRoom->RoomNumber;
+    }
+}
+
+static VOID CALLBACK DumpTraceCallback(_Inout_ PTP_CALLBACK_INSTANCE Instance, _Inout_opt_ PVOID Context)
+{
+    DumpTrace(NULL);
+}
+
+// Dump from the thread pool, not on the thread that was slow.
+static VOID TraceSlowMessage(_In_ const TRACE_SPAN* pSpan, _In_ LONG64 DurTicks)
+{
+    ULONGLONG Now = GetTickCount64();
+    ULONGLONG Last = LastSlowDumpTime;
+    if (Last && Now - Last < TRACE_DUMP_INTERVAL)
+        return;
+    if (InterlockedCompareExchange64((LONG64 volatile*)&LastSlowDumpTime, Now, Last) != (LONG64)Last)
+        return; // someone else is dumping
+
+    Log(LOG_WARNING, L"a message of connection %1!u! took %2!I64u! us, dumping traces.",
+        pSpan->ConnId, (UINT64)DurTicks * 1000000 / TickFrequency.QuadPart);
+    if (!TrySubmitThreadpoolCallback(DumpTraceCallback, NULL, NULL))
+        LogErrorMessage(L"TrySubmitThreadpoolCallback", GetLastError());
+}
+
+VOID EndTraceSpan(_In_ const TRACE_SPAN* pSpan, _In_ TRACE_CATEGORY Category, _In_z_ PCSTR Name)
+{
+    LARGE_INTEGER Tick;
+    QueryPerformanceCounter(&Tick);
+
+    PTRACE_RING pRing = ThreadRing;
+    if (!pRing && !(pRing = AttachTraceRing()))
+        return;
+
+    LONG64 Index = pRing->WriteCnt;
+    PTRACE_EVENT pEvent = &pRing->EventList[Index & (TRACE_RING_EVENTS - 1)];
+    pEvent->Name = Name;
+    pEvent->StartTick = pSpan->StartTick;
+    pEvent->DurTicks = Tick.QuadPart - pSpan->StartTick;
+    pEvent->ConnId = pSpan->ConnId;
+    pEvent->RoomNumber = pSpan->RoomNumber;
+    pEvent->ThreadId = GetCurrentThreadId();
+    pEvent->Category = (BYTE)Category;
+    pRing->WriteCnt = Index + 1; // volatile write, the event is complete before it counts
+
+    if (Category == TRACE_CAT_MESSAGE && TraceSlowUs &&
+        (UINT64)pEvent->DurTicks * 1000000 > (UINT64)TraceSlowUs * TickFrequency.QuadPart)
+    {
+        TraceSlowMessage(pSpan, pEvent->DurTicks);
+    }
+}
+
+static VOID FlushTrace(_Inout_ PTRACE_WRITER pWriter)
+{
+    DWORD cbWritten;
+    if (!pWriter->bFailed && pWriter->cbLen &&
+        !WriteFile(pWriter->hFile, pWriter->Buffer, (DWORD)pWriter->cbLen, &cbWritten, NULL))
+    {
+        LogErrorMessage(L"WriteFile", GetLastError());
+        pWriter->bFailed = TRUE;
+    }
+    pWriter->cbLen = 0;
+}
+
+static VOID WriteTrace(_Inout_ PTRACE_WRITER pWriter, _In_z_ _Printf_format_string_ PCSTR Format, ...)
+{
+    if (TRACE_WRITE_BUFFER_SIZE - pWriter->cbLen < TRACE_EVENT_MAXLEN)
+        FlushTrace(pWriter);
+
+    va_list Args;
+    va_start(Args, Format);
+    PCHAR pEnd;
+    if (SUCCEEDED(StringCchVPrintfExA(pWriter->Buffer + pWriter->cbLen, TRACE_WRITE_BUFFER_SIZE - pWriter->cbLen, &pEnd, NULL, 0, Format, Args)))
+        pWriter->cbLen = pEnd - pWriter->Buffer;
+    va_end(Args);
+}
+
+static double TicksToUs(_In_ LONG64 Ticks)
+{
+    return (double)Ticks * 1000000 / TickFrequency.QuadPart;
+}
+
+// Copy what the ring still has, dropping spans its thread overwrote while copying. Returns the count.
+static UINT CopyTraceRing(_In_ const TRACE_RING* pRing, _Out_writes_(TRACE_RING_EVENTS) PTRACE_EVENT pCopy)
+{
+    LONG64 Before = pRing->WriteCnt;
+    LONG64 First = max(Before - TRACE_RING_EVENTS, 0);
+    for (LONG64 i = First; i < Before; i++)
+        pCopy[i - First] = pRing->EventList[i & (TRACE_RING_EVENTS - 1)];
+
+    // the span being written when we finished may have overwritten one more.
+    MemoryBarrier();
+    LONG64 Valid = pRing->WriteCnt - TRACE_RING_EVENTS + 1;
+    if (Valid <= First)
+        return (UINT)(Before - First);
+    if (Valid >= Before)
+        return 0;
+
+    UINT Dropped = (UINT)(Valid - First);
+    memmove(pCopy, pCopy + Dropped, (SIZE_T)(Before - Valid) * sizeof(TRACE_EVENT));
+    return (UINT)(Before - Valid);
+}
+
+static VOID WriteTraceEvent(_Inout_ PTRACE_WRITER pWriter, _In_ const TRACE_EVENT* pEvent, _In_ DWORD ProcessId, _In_ BOOL bFirst)
+{
+    WriteTrace(pWriter, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu,\"args\":{\"conn\":%u",
+        bFirst ? "" : ",\n", pEvent->Name, CategoryNameList[pEvent->Category],
+        TicksToUs(pEvent->StartTick), TicksToUs(pEvent->DurTicks), ProcessId, pEvent->ThreadId, pEvent->ConnId);
+
+    if (pEvent->RoomNumber != TRACE_NO_ROOM)
+    {
+        CHAR szRoomNumber[ROOM_NAME_MAXLEN + 1];
+        FormatRoomNumber(pEvent->RoomNumber, szRoomNumber);
+        WriteTrace(pWriter, ",\"room\":\"%s\"", szRoomNumber);
+    }
+    WriteTrace(pWriter, "}}");
+}
+
+BOOL DumpTrace(_In_opt_z_ LPCWSTR FileName)
+{
+    WCHAR DefaultName[MAX_PATH];
+    PTRACE_WRITER pWriter = NULL;
+    PTRACE_EVENT pCopy = NULL;
+    UINT SpanCnt = 0;
+    BOOL bSuccess = FALSE;
+
+    if (!FileName)
+    {
+        SYSTEMTIME Now;
+        GetLocalTime(&Now);
+        StringCchPrintfW(DefaultName, _countof(DefaultName), L"trace-%04u%02u%02u-%02u%02u%02u.json",
+            Now.wYear, Now.wMonth, Now.wDay, Now.wHour, Now.wMinute, Now.wSecond);
+        FileName = DefaultName;
+    }
+
+    AcquireSRWLockExclusive(&DumpLock);
+    __try
+    {
+        pWriter = HeapAlloc(GetProcessHeap(), 0, sizeof(TRACE_WRITER));
+        pCopy = HeapAlloc(GetProcessHeap(), 0, TRACE_RING_EVENTS * sizeof(TRACE_EVENT));
+        if (!pWriter || !pCopy)
+        {
+            Log(LOG_ERROR, L"out of memory dumping traces.");
+            __leave;
+        }
+
+        pWriter->cbLen = 0;
+        pWriter->bFailed = FALSE;
+        pWriter->hFile = CreateFileW(FileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (pWriter->hFile == INVALID_HANDLE_VALUE)
+        {
+            LogErrorMessage(L"CreateFileW", GetLastError());
+            __leave;
+        }
+
+        DWORD ProcessId = GetCurrentProcessId();
+        WriteTrace(pWriter, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (PTRACE_RING pRing = RingList; pRing; pRing = pRing->pNext)
+        {
+            UINT Cnt = CopyTraceRing(pRing, pCopy);
+            for (UINT i = 0; i < Cnt; i++)
+                WriteTraceEvent(pWriter, &pCopy[i], ProcessId, SpanCnt++ == 0);
+        }
+        WriteTrace(pWriter, "\n]}\n");
+        FlushTrace(pWriter);
+        CloseHandle(pWriter->hFile);
+
+        if (pWriter->bFailed)
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        ReleaseSRWLockExclusive(&DumpLock);
+        if (pWriter)
+            HeapFree(GetProcessHeap(), 0, pWriter);
+        if (pCopy)
+            HeapFree(GetProcessHeap(), 0, pCopy);
+    }
+
+    if (bSuccess)
+        Log(LOG_INFO, L"%1!u! spans written to %2.", SpanCnt, FileName);
+    return bSuccess;
+}
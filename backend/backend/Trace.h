@@ -0,0 +1,61 @@
+#pragma once
+#include "common.h"
+
+// Message tracing, dumped as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+// While tracing is on, spans over the life of a message (I/O completion, WebSocketGetAction, parse,
+// handler, lock wait, serialization, WebSocketSend, send completion) go into a ring of the thread that
+// recorded them, the oldest are overwritten. Each span carries the connection and the room it was for.
+// The rings are written without locks and read only when dumped, on demand or when a message took
+// longer than TraceSlowUs (see DumpTrace).
+// While tracing is off, a span costs one branch on bTracing.
+
+#define TRACE_RING_EVENTS 8192 // spans kept per thread, power of 2
+#define TRACE_DUMP_INTERVAL 10000 // ms, slow messages don't dump more often than this
+
+typedef enum _TRACE_CATEGORY
+{
+    TRACE_CAT_IO,        // I/O completion callbacks
+    TRACE_CAT_WEBSOCKET, // websocket.dll calls
+    TRACE_CAT_MESSAGE,   // one received message from start to end, checked against TraceSlowUs
+    TRACE_CAT_PARSE,
+    TRACE_CAT_HANDLER,
+    TRACE_CAT_LOCK,      // waiting for a lock
+    TRACE_CAT_SERIALIZE,
+    TRACE_CAT_SEND,
+    TRACE_CAT_COUNT
+} TRACE_CATEGORY;
+
+typedef struct _TRACE_SPAN
+{
+    LONG64 StartTick; // 0 if tracing was off when begun
+    UINT ConnId;
+    UINT RoomNumber; // TRACE_NO_ROOM if not in a room
+} TRACE_SPAN, * PTRACE_SPAN;
+
+#define TRACE_NO_ROOM MAXUINT
+
+struct _CONNECTION_INFO;
+
+extern volatile BOOL bTracing;
+
+// spans of received messages longer than this dump the rings, 0 never.
+extern volatile UINT TraceSlowUs;
+
+VOID InitTrace(VOID);
+
+VOID EnableTrace(_In_ BOOL bEnable);
+
+// The keys are taken when the span begins, the connection may be gone when it ends.
+VOID BeginTraceSpan(_Out_ PTRACE_SPAN pSpan, _In_opt_ const struct _CONNECTION_INFO* pConnInfo);
+
+// Name must outlive the dump: a literal or a schema's type name.
+VOID EndTraceSpan(_In_ const TRACE_SPAN* pSpan, _In_ TRACE_CATEGORY Category, _In_z_ PCSTR Name);
+
+#define TraceBegin(pSpan, pConnInfo) \
+    (bTracing ? BeginTraceSpan((pSpan), (pConnInfo)) : (VOID)((pSpan)->StartTick = 0))
+#define TraceEnd(pSpan, Category, Name) \
+    ((pSpan)->StartTick ? EndTraceSpan((pSpan), (Category), (Name)) : (VOID)0)
+
+// Write every ring to FileName, NULL for "trace-<local time>.json". Returns FALSE on failure.
+BOOL DumpTrace(_In_opt_z_ LPCWSTR FileName);
@@ -1,46 +1,161 @@
-#include "common.h"
-#include "HttpSendRecv.h"
-#include "JsonHandler.h"
-
-// functions to receive websocket events.
-
-VOID WebsockEventConnect(_In_ PCONNECTION_INFO pConnInfo)
-{
-    Log(LOG_INFO, L"a player connected");
-}
-
-VOID WebsockEventRecv(
-    _Inout_ PCONNECTION_INFO pConnInfo,
-    _In_ WEB_SOCKET_BUFFER_TYPE BufferType,
-    _In_ PWEB_SOCKET_BUFFER pBuffer)
-{
-    switch (BufferType)
-    {
-    case WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE:
-    {
-        if (!ParseAndDispatchJsonMessage(pConnInfo, pBuffer->Data.pbBuffer, pBuffer->Data.ulBufferLength))
-        {
-            Log(LOG_ERROR, L"Failed to handle json message. disconnecting...");
-            WebsockDisconnect(pConnInfo);
-        }
-        break;
-    }
-
-    case WEB_SOCKET_CLOSE_BUFFER_TYPE:
-        Log(LOG_DEBUG, L"Received a close buffer.");
-        break;
-
-    case WEB_SOCKET_UTF8_FRAGMENT_BUFFER_TYPE:
-    case WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE:
-    case WEB_SOCKET_BINARY_FRAGMENT_BUFFER_TYPE:
-    case WEB_SOCKET_PING_PONG_BUFFER_TYPE:
-    case WEB_SOCKET_UNSOLICITED_PONG_BUFFER_TYPE:
-        Log(LOG_ERROR, L"Received an unsupported websocket buffer type.");
-        break;
-    }
-}
-
-VOID WebsockEventDisconnect(_Inout_ PCONNECTION_INFO pConnInfo)
-{
-    Log(LOG_INFO, L"a player disconnected");
-}
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "JsonHandler.h"
+#include "BinaryHandler.h"
+#include "SendBatch.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Probes.h"
+#include "SlabPool.h"
+#include "MessageSchema.h"
+
+// functions to receive websocket events.
+
+// A message longer than the websocket.dll receive buffer arrives in fragments, put together here.
+// The buffer is taken from AssemblyPool with the first fragment and given back with the last one,
+// an idle connection holds none.
+typedef struct _WEBSOCK_ASSEMBLY
+{
+    ULONG cbLen;
+    BYTE Data[INBOUND_COMMANDS_MAXLEN]; // the longest frame accepted, see MessageSchema.h
+} WEBSOCK_ASSEMBLY, * PWEBSOCK_ASSEMBLY;
+
+static SLAB_POOL AssemblyPool;
+
+VOID InitWebsockEvent(VOID)
+{
+    InitSlabPool(&AssemblyPool, L"message assembly", sizeof(WEBSOCK_ASSEMBLY));
+}
+
+VOID WebsockEventConnect(_In_ PCONNECTION_INFO pConnInfo)
+{
+    CountMetric(METRIC_CONNECTIONS_OPENED);
+    Log(LOG_INFO, L"a player connected");
+}
+
+static VOID DispatchWebsockMessage(
+    _Inout_ PCONNECTION_INFO pConnInfo,
+    _In_ BOOL bBinary,
+    _In_reads_bytes_(cbLen) PBYTE pData,
+    _In_ ULONG cbLen)
+{
+    CountMetric(METRIC_FRAMES_RECEIVED);
+    AddMetric(METRIC_BYTES_RECEIVED, cbLen);
+
+    if (!bBinary)
+    {
+        if (!ParseAndDispatchJsonMessage(pConnInfo, pData, cbLen))
+        {
+            Log(LOG_ERROR, L"Failed to handle json message. disconnecting...");
+            WebsockDisconnect(pConnInfo);
+        }
+        return;
+    }
+
+    if (pConnInfo->Protocol != WIRE_PROTOCOL_BINARY)
+    {
+        Log(LOG_ERROR, L"Received a binary message without negotiating binary protocol. disconnecting...");
+        WebsockDisconnect(pConnInfo);
+        return;
+    }
+    if (!ParseAndDispatchBinaryMessage(pConnInfo, pData, cbLen))
+    {
+        Log(LOG_ERROR, L"Failed to handle binary message. disconnecting...");
+        WebsockDisconnect(pConnInfo);
+    }
+}
+
+// Receives of a connection run one at a time, pAssembly needs no lock.
+static BOOL AppendFragment(_Inout_ PCONNECTION_INFO pConnInfo, _In_ PWEB_SOCKET_BUFFER pBuffer)
+{
+    PWEBSOCK_ASSEMBLY pAssembly = pConnInfo->pAssembly;
+    if (!pAssembly)
+    {
+        pAssembly = SlabAlloc(&AssemblyPool);
+        if (!pAssembly)
+            return FALSE;
+        pConnInfo->pAssembly = pAssembly;
+    }
+
+    ULONG cbData = pBuffer->Data.ulBufferLength;
+    if (cbData > sizeof(pAssembly->Data) - pAssembly->cbLen)
+    {
+        Log(LOG_ERROR, L"Received a message longer than %1!u! bytes. disconnecting...", (UINT)sizeof(pAssembly->Data));
+        return FALSE;
+    }
+    CopyMemory(pAssembly->Data + pAssembly->cbLen, pBuffer->Data.pbBuffer, cbData);
+    pAssembly->cbLen += cbData;
+    return TRUE;
+}
+
+static VOID FreeAssembly(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    if (pConnInfo->pAssembly)
+    {
+        SlabFree(&AssemblyPool, pConnInfo->pAssembly);
+        pConnInfo->pAssembly = NULL;
+    }
+}
+
+VOID WebsockEventRecv(
+    _Inout_ PCONNECTION_INFO pConnInfo,
+    _In_ WEB_SOCKET_BUFFER_TYPE BufferType,
+    _In_ PWEB_SOCKET_BUFFER pBuffer)
+{
+    TRACE_SPAN Span;
+    TraceBegin(&Span, pConnInfo);
+    PROBE_FRAME_RECV(pConnInfo, BufferType, pBuffer->Data.ulBufferLength);
+
+    // everything sent while handling this message goes out as one frame per connection, see SendBatch.h
+    BeginSendBatch();
+
+    switch (BufferType)
+    {
+    case WEB_SOCKET_UTF8_FRAGMENT_BUFFER_TYPE:
+    case WEB_SOCKET_BINARY_FRAGMENT_BUFFER_TYPE:
+        if (!AppendFragment(pConnInfo, pBuffer))
+        {
+            FreeAssembly(pConnInfo);
+            WebsockDisconnect(pConnInfo);
+        }
+        break;
+
+    case WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE:
+    case WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE:
+    {
+        BOOL bBinary = BufferType == WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE;
+        if (!pConnInfo->pAssembly)
+        {
+            DispatchWebsockMessage(pConnInfo, bBinary, pBuffer->Data.pbBuffer, pBuffer->Data.ulBufferLength);
+            break;
+        }
+
+        // the last fragment
+        if (AppendFragment(pConnInfo, pBuffer))
+            DispatchWebsockMessage(pConnInfo, bBinary, pConnInfo->pAssembly->Data, pConnInfo->pAssembly->cbLen);
+        else
+            WebsockDisconnect(pConnInfo);
+        FreeAssembly(pConnInfo);
+        break;
+    }
+
+    case WEB_SOCKET_CLOSE_BUFFER_TYPE:
+        Log(LOG_DEBUG, L"Received a close buffer.");
+        break;
+
+    case WEB_SOCKET_PING_PONG_BUFFER_TYPE:
+    case WEB_SOCKET_UNSOLICITED_PONG_BUFFER_TYPE:
+        Log(LOG_ERROR, L"Received an unsupported websocket buffer type.");
+        break;
+    }
+
+    EndSendBatch();
+    TraceEnd(&Span, TRACE_CAT_MESSAGE, "message");
+}
+
+VOID WebsockEventDisconnect(_Inout_ PCONNECTION_INFO pConnInfo)
+{
+    FreeAssembly(pConnInfo); // closed in the middle of a message
+    CountMetric(METRIC_CONNECTIONS_CLOSED);
+    Log(LOG_INFO, L"a player disconnected");
+}
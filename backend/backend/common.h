@@ -1,10 +1,10 @@
-#pragma once
-
-#ifndef _WINSOCKAPI_
-#define _WINSOCKAPI_
-#endif
-
-#include <windows.h>
-#include <stdio.h>
-#include "Log.h"
-
+#pragma once
+
+#ifndef _WINSOCKAPI_
+#define _WINSOCKAPI_
+#endif
+
+#include <windows.h>
+#include <stdio.h>
+#include "Log.h"
+
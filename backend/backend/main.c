@@ -1,66 +1,84 @@
-#include "common.h"
-#include "HttpSendRecv.h"
-#include "RoomManager.h"
-#include <locale.h>
-
-#pragma comment(lib, "httpapi.lib")
-#pragma comment(lib, "Websocket.lib")
-
-// The number of requests for queueing, when
-#define OUTSTANDING_REQUESTS 8
-// The number of requests per processor
-#define REQUESTS_PER_PROCESSOR 2
-
-DWORD GetRequestCount()
-{
-    DWORD_PTR dwProcessAffinityMask, dwSystemAffinityMask;
-    WORD wRequestsCounter;
-    BOOL bGetProcessAffinityMaskSucceed;
-
-    bGetProcessAffinityMaskSucceed = GetProcessAffinityMask(
-        GetCurrentProcess(),
-        &dwProcessAffinityMask,
-        &dwSystemAffinityMask);
-
-    if (bGetProcessAffinityMaskSucceed)
-    {
-        for (wRequestsCounter = 0; dwProcessAffinityMask; dwProcessAffinityMask >>= 1)
-        {
-            if (dwProcessAffinityMask & 0x1) wRequestsCounter++;
-        }
-
-        wRequestsCounter = REQUESTS_PER_PROCESSOR * wRequestsCounter;
-    }
-    else
-    {
-        wRequestsCounter = OUTSTANDING_REQUESTS;
-    }
-
-    return wRequestsCounter;
-}
-
-int wmain()
-{
-    setlocale(LC_ALL, "");
-    InitLog();
-    Log(LOG_INFO, L"backend started.");
-    InitRoomManager();
-
-    if (!StartHTTPServer(GetRequestCount()))
-    {
-        return 1;
-    }
-    while (1)
-    {
-        WCHAR command[128] = { 0 };
-        wscanf_s(L"%s", command, (UINT)_countof(command));
-
-        if (wcscmp(command, L"stop") == 0)
-        {
-            break;
-        }
-        Log(LOG_ERROR, L"unknown command: %1", command);
-    }
-    StopHTTPServer();
-    return 0;
-}
+#include "common.h"
+#include "HttpSendRecv.h"
+#include "RoomManager.h"
+#include "Compression.h"
+#include "Metrics.h"
+#include "LockProfile.h"
+#include "Trace.h"
+#include "Probes.h"
+#include "Admin.h"
+#include "WebsockEvent.h"
+#include "Config.h"
+#include <locale.h>
+
+#pragma comment(lib, "httpapi.lib")
+#pragma comment(lib, "Websocket.lib")
+
+DWORD GetRequestCount()
+{
+    DWORD_PTR dwProcessAffinityMask, dwSystemAffinityMask;
+    WORD wRequestsCounter;
+    BOOL bGetProcessAffinityMaskSucceed;
+
+    bGetProcessAffinityMaskSucceed = GetProcessAffinityMask(
+        GetCurrentProcess(),
+        &dwProcessAffinityMask,
+        &dwSystemAffinityMask);
+
+    if (bGetProcessAffinityMaskSucceed)
+    {
+        for (wRequestsCounter = 0; dwProcessAffinityMask; dwProcessAffinityMask >>= 1)
+        {
+            if (dwProcessAffinityMask & 0x1) wRequestsCounter++;
+        }
+
+        wRequestsCounter = (WORD)(HttpServerConfig.RequestsPerProcessor * wRequestsCounter);
+    }
+    else
+    {
+        wRequestsCounter = (WORD)HttpServerConfig.OutstandingRequests;
+    }
+
+    return wRequestsCounter;
+}
+
+int wmain(int argc, WCHAR* argv[])
+{
+    BOOL bTakeOver = FALSE;
+    for (int i = 1; i < argc; i++)
+    {
+        if (wcscmp(argv[i], L"-takeover") == 0)
+            bTakeOver = TRUE;
+    }
+
+    setlocale(LC_ALL, "");
+    InitLog();
+    Log(LOG_INFO, L"backend started.");
+    if (!LoadConfig(argc, argv))
+    {
+        return 1;
+    }
+    InitMetrics();
+    InitLockProfile();
+    InitTrace();
+    InitProbes();
+    InitRoomManager();
+    InitCompression();
+    InitWebsockEvent();
+
+    if (!StartHTTPServer(GetRequestCount(), !bTakeOver))
+    {
+        return 1;
+    }
+    if (bTakeOver && !TakeOver())
+    {
+        StopHTTPServer();
+        return 1;
+    }
+    RunAdmin();
+
+    StopAdmin();
+    StopHTTPServer();
+    StopProbes();
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "common.h"
+#include "MessageSchema.h"
+
+// Benchmarks of the backend modules, and the checks that go with them.
+// Every benchmark also checks the results it times, a failed check is printed and makes bench exit with 1.
+// bench check stops at the first one instead, the build runs it that way.
+
+#define BENCH(Name, Proc, Iterations, Help) VOID Proc(_In_ ULONG IterationCnt);
+#include "Bench.inl"
+#undef BENCH
+
+#define BENCH_CHECK(Cond) ((Cond) ? TRUE : BenchFail(#Cond, __FILE__, __LINE__))
+
+// Count a failed check. Always returns FALSE, or doesn't return under bench check.
+BOOL BenchFail(_In_z_ PCSTR szCond, _In_z_ PCSTR szFile, _In_ int Line);
+
+// QueryPerformanceCounter ticks.
+LONGLONG BenchNow(VOID);
+
+// Nanoseconds per operation for Count operations between two BenchNow.
+double BenchNsPerOp(_In_ LONGLONG Start, _In_ LONGLONG End, _In_ ULONGLONG Count);
+
+// Run Proc on ThreadCnt threads at once, lpParameter is the thread index. Returns the ticks from
+// their start until the last one returned, 0 if they couldn't be started.
+#define BENCH_THREADS_MAX 64
+
+LONGLONG BenchRunThreads(_In_ UINT ThreadCnt, _In_ LPTHREAD_START_ROUTINE Proc);
+
+// Results are added here so the timed loops aren't optimized away.
+extern volatile ULONG_PTR BenchSink;
+
+// First field of pSchema present or oversized in only one of the messages or with different values, NULL if none.
+_Ret_maybenull_
+const MESSAGE_FIELD* BenchDiffMessage(_In_ const MESSAGE_SCHEMA* pSchema, _In_ const INBOUND_MESSAGE* pMessage, _In_ const INBOUND_MESSAGE* pOther);
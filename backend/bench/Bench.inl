@@ -0,0 +1,14 @@
+// Benchmarks and checks, run by name: bench [check] <name> [iterations]. Included by Bench.h and main.c
+// with different definitions of BENCH. No include guard on purpose.
+//
+// BENCH(L"name", Proc, Iterations, L"help")  -> VOID Proc(ULONG Iterations), Iterations is the default count
+
+BENCH(L"codec",      BenchCodec,      1000000,  L"round trip random messages of every type through json and binary, time both decoders")
+BENCH(L"parse",      BenchParse,      1000000,  L"decode inbound JSON messages, single pass against the yyjson DOM")
+BENCH(L"random",     BenchRandom,     10000000, L"ChaCha20 against RFC 8439, replay of a pinned game, histogram and cost of RandomBelow")
+BENCH(L"rolehint",   BenchRoleHint,   10000000, L"hints of the six role decks against the rules, cost of GetRoleHints")
+BENCH(L"roomnumber", BenchRoomNumber, 10000000, L"room numbers from the free bitmap: all of them once, reserved ones, alloc + free at 10/50/99% in use")
+BENCH(L"roomindex",  BenchRoomIndex,  10000000, L"room names formatted and parsed back, lookups while the index resizes, cost of LookupRoomIndex")
+BENCH(L"metrics",    BenchMetrics,    1000000,  L"8 threads counting at once, sums exact in GetMetric and /metrics, cost against one shared counter")
+BENCH(L"connref",    BenchConnRef,    10000000, L"connection references taken by threads broadcasting to one room: interlocked, in a ConnRefScope, false sharing")
+BENCH(L"slab",       BenchSlab,       100000,   L"100k rooms and connections from the heap and from their slab pools: private bytes per object, alloc + free, hot lines")
@@ -0,0 +1,286 @@
+#include "Bench.h"
+#include "MessageSchema.h"
+#include "BinaryHandler.h"
+#include "yyjson.h"
+
+// Random messages of every schema type are encoded in both wire formats, then decoded back.
+// Both decoders must return exactly the message that was encoded.
+
+#define CODEC_SAMPLE_COUNT 256
+#define CODEC_ROUND_TRIP_COUNT 20000
+
+typedef struct _CODEC_SAMPLE
+{
+    const MESSAGE_SCHEMA* pSchema;
+    UINT TypeIndex;
+    INBOUND_MESSAGE Message;
+    CHAR* pJson; // from yyjson_mut_write
+    SIZE_T cbJsonLen;
+    BIN_WRITER Binary;
+} CODEC_SAMPLE, * PCODEC_SAMPLE;
+
+// Pieces strings are made of: ASCII, the characters json has to escape, 2 / 3 / 4 byte UTF-8.
+static const CHAR* StringPieceList[] = { "a", "Z", "0", " ", "\"", "\\", "/", "\t", "\xc3\xa9", "\xe7\x8e\xa9", "\xf0\x9f\x98\x80" };
+
+// xorshift, the samples are the same on every run.
+static UINT32 NextRandom(_Inout_ UINT32* pState)
+{
+    UINT32 x = *pState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *pState = x;
+}
+
+// Mostly small values like the clients send, sometimes up to 32 bits to cover every varint length.
+static UINT32 RandomUint(_Inout_ UINT32* pState)
+{
+    UINT32 Value = NextRandom(pState);
+    return Value >> (NextRandom(pState) % 32);
+}
+
+static VOID RandomString(_Inout_ UINT32* pState, _Out_writes_z_(MaxLen + 1) CHAR* pOut, _In_ UINT MaxLen)
+{
+    UINT Target = NextRandom(pState) % (MaxLen + 1);
+    UINT cbLen = 0;
+
+    while (cbLen < Target)
+    {
+        const CHAR* pPiece = StringPieceList[NextRandom(pState) % _countof(StringPieceList)];
+        UINT cbPiece = (UINT)strlen(pPiece);
+        if (cbLen + cbPiece > MaxLen)
+            break;
+        memcpy(pOut + cbLen, pPiece, cbPiece);
+        cbLen += cbPiece;
+    }
+    pOut[cbLen] = '\0';
+}
+
+// Required fields are always there, optional ones half of the time.
+static VOID RandomMessage(_Inout_ UINT32* pState, _In_ const MESSAGE_SCHEMA* pSchema, _Out_ PINBOUND_MESSAGE pMessage)
+{
+    ZeroMemory(pMessage, sizeof(INBOUND_MESSAGE));
+    for (UINT i = 0; pSchema->FieldList[i].Key; i++)
+    {
+        const MESSAGE_FIELD* pField = &pSchema->FieldList[i];
+        BYTE* pValue = (BYTE*)pMessage + pField->Offset;
+
+        if (!pField->bRequired && (NextRandom(pState) & 1))
+            continue;
+        switch (pField->Type)
+        {
+        case FIELD_TYPE_STRING:
+            RandomString(pState, (CHAR*)pValue, pField->MaxLen);
+            break;
+        case FIELD_TYPE_BOOL:
+            *(BOOL*)pValue = NextRandom(pState) & 1;
+            break;
+        case FIELD_TYPE_UINT:
+            *(UINT*)pValue = RandomUint(pState);
+            break;
+        case FIELD_TYPE_UINT_ARRAY:
+        {
+            UINT Cnt = NextRandom(pState) % (pField->MaxLen + 1);
+            for (UINT j = 0; j < Cnt; j++)
+                ((UINT32*)pValue)[j] = RandomUint(pState);
+            *(UINT*)((BYTE*)pMessage + pField->CountOffset) = Cnt;
+            break;
+        }
+        }
+        pMessage->FieldMask |= 1u << i;
+    }
+}
+
+// Encode as a client would, fields in schema order. Written with \u escapes when bEscapeUnicode.
+static CHAR* EncodeJson(_In_ const MESSAGE_SCHEMA* pSchema, _In_ const INBOUND_MESSAGE* pMessage, _In_ BOOL bEscapeUnicode, _Out_ SIZE_T* pcbLen)
+{
+    CHAR* pJson = NULL;
+
+    *pcbLen = 0;
+    yyjson_mut_doc* doc = yyjson_mut_doc_new(NULL);
+    if (!doc)
+        return NULL;
+
+    __try
+    {
+        yyjson_mut_val* root = yyjson_mut_obj(doc);
+        yyjson_mut_doc_set_root(doc, root);
+        yyjson_mut_obj_add_str(doc, root, "type", pSchema->TypeName);
+
+        for (UINT i = 0; pSchema->FieldList[i].Key; i++)
+        {
+            const MESSAGE_FIELD* pField = &pSchema->FieldList[i];
+            const BYTE* pValue = (const BYTE*)pMessage + pField->Offset;
+
+            if (!((pMessage->FieldMask >> i) & 1))
+                continue;
+            switch (pField->Type)
+            {
+            case FIELD_TYPE_STRING:
+                yyjson_mut_obj_add_str(doc, root, pField->Key, (const CHAR*)pValue);
+                break;
+            case FIELD_TYPE_BOOL:
+                yyjson_mut_obj_add_bool(doc, root, pField->Key, *(const BOOL*)pValue);
+                break;
+            case FIELD_TYPE_UINT:
+                yyjson_mut_obj_add_uint(doc, root, pField->Key, *(const UINT*)pValue);
+                break;
+            case FIELD_TYPE_UINT_ARRAY:
+            {
+                UINT Cnt = *(const UINT*)((const BYTE*)pMessage + pField->CountOffset);
+                yyjson_mut_val* arr = yyjson_mut_arr(doc);
+                yyjson_mut_obj_add_val(doc, root, pField->Key, arr);
+                for (UINT j = 0; j < Cnt; j++)
+                    yyjson_mut_arr_add_uint(doc, arr, ((const UINT32*)pValue)[j]);
+                break;
+            }
+            }
+        }
+
+        pJson = yyjson_mut_write(doc, bEscapeUnicode ? YYJSON_WRITE_ESCAPE_UNICODE : 0, pcbLen);
+    }
+    __finally
+    {
+        yyjson_mut_doc_free(doc);
+    }
+    return pJson;
+}
+
+// Encode as a binary client would, see BinaryHandler.h. The type byte is the schema position.
+static VOID EncodeBinary(_In_ UINT TypeIndex, _In_ const MESSAGE_SCHEMA* pSchema, _In_ const INBOUND_MESSAGE* pMessage, _Out_ PBIN_WRITER pWriter)
+{
+    BinWriterInit(pWriter, (BIN_OUT_TYPE)TypeIndex);
+    BinWriteVarint(pWriter, pMessage->FieldMask);
+    for (UINT i = 0; pSchema->FieldList[i].Key; i++)
+    {
+        const MESSAGE_FIELD* pField = &pSchema->FieldList[i];
+        const BYTE* pValue = (const BYTE*)pMessage + pField->Offset;
+
+        if (!((pMessage->FieldMask >> i) & 1))
+            continue;
+        switch (pField->Type)
+        {
+        case FIELD_TYPE_STRING:
+            BinWriteString(pWriter, (const CHAR*)pValue);
+            break;
+        case FIELD_TYPE_BOOL:
+            BinWriteByte(pWriter, (BYTE)*(const BOOL*)pValue);
+            break;
+        case FIELD_TYPE_UINT:
+            BinWriteVarint(pWriter, *(const UINT*)pValue);
+            break;
+        case FIELD_TYPE_UINT_ARRAY:
+        {
+            UINT Cnt = *(const UINT*)((const BYTE*)pMessage + pField->CountOffset);
+            BinWriteVarint(pWriter, Cnt);
+            for (UINT j = 0; j < Cnt; j++)
+                BinWriteVarint(pWriter, ((const UINT32*)pValue)[j]);
+            break;
+        }
+        }
+    }
+}
+
+static BOOL MakeSample(_Inout_ UINT32* pState, _In_ UINT TypeIndex, _In_ BOOL bEscapeUnicode, _Out_ PCODEC_SAMPLE pSample)
+{
+    pSample->TypeIndex = TypeIndex;
+    pSample->pSchema = GetMessageSchema(TypeIndex);
+    RandomMessage(pState, pSample->pSchema, &pSample->Message);
+    EncodeBinary(TypeIndex, pSample->pSchema, &pSample->Message, &pSample->Binary);
+    pSample->pJson = EncodeJson(pSample->pSchema, &pSample->Message, bEscapeUnicode, &pSample->cbJsonLen);
+    return BENCH_CHECK(pSample->pJson != NULL) && BENCH_CHECK(!pSample->Binary.bOverflow);
+}
+
+// Both decodings of the sample give back the encoded message. Every shorter binary payload is refused.
+static VOID CheckSample(_In_ const CODEC_SAMPLE* pSample)
+{
+    INBOUND_MESSAGE Decoded;
+    const MESSAGE_FIELD* pField;
+
+    if (!BENCH_CHECK(DecodeJsonMessage((const BYTE*)pSample->pJson, (ULONG)pSample->cbJsonLen, &Decoded) == pSample->pSchema))
+        printf("    json %s\n", pSample->pJson);
+    else if (!BENCH_CHECK((pField = BenchDiffMessage(pSample->pSchema, &pSample->Message, &Decoded)) == NULL))
+        printf("    json field \"%s\" in %s\n", pField->Key, pSample->pJson);
+
+    const BYTE* pPayload = pSample->Binary.Buffer + 2;
+    ULONG cbPayloadLen = pSample->Binary.cbLen - 2;
+    if (!BENCH_CHECK(DecodeBinaryMessage(pSample->Binary.Buffer[1], pPayload, cbPayloadLen, &Decoded) == pSample->pSchema))
+        printf("    binary of %s\n", pSample->pJson);
+    else if (!BENCH_CHECK((pField = BenchDiffMessage(pSample->pSchema, &pSample->Message, &Decoded)) == NULL))
+        printf("    binary field \"%s\" of %s\n", pField->Key, pSample->pJson);
+
+    for (ULONG cbLen = 0; cbLen < cbPayloadLen; cbLen++)
+    {
+        if (!BENCH_CHECK(DecodeBinaryMessage(pSample->Binary.Buffer[1], pPayload, cbLen, &Decoded) == NULL))
+        {
+            printf("    binary of %s accepted cut at %lu bytes\n", pSample->pJson, cbLen);
+            break;
+        }
+    }
+}
+
+// A binary string over its MaxLen is cut like a json one: 31 ASCII bytes and a 2 byte character, for a name of 32.
+static VOID CheckBinaryOversize(VOID)
+{
+    static const BYTE Payload[] = { 0x01, 33,
+        'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a',
+        'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 'a', 0xC3, 0xA9 };
+    INBOUND_MESSAGE Decoded;
+
+    if (BENCH_CHECK(DecodeBinaryMessage(MESSAGE_TYPE_CREATE_ROOM, Payload, sizeof(Payload), &Decoded) == GetMessageSchema(MESSAGE_TYPE_CREATE_ROOM)))
+    {
+        BENCH_CHECK(MESSAGE_FIELD_OVERSIZE(&Decoded.CreateRoom, CREATE_ROOM, Name));
+        BENCH_CHECK(strlen(Decoded.CreateRoom.Name) == 31);
+    }
+}
+
+VOID BenchCodec(_In_ ULONG Iterations)
+{
+    static CODEC_SAMPLE SampleList[CODEC_SAMPLE_COUNT];
+    CODEC_SAMPLE Sample;
+    INBOUND_MESSAGE Message;
+    UINT32 State = 0x2545F491;
+    ULONGLONG cbJsonTotal = 0, cbBinaryTotal = 0;
+
+    for (UINT i = 0; i < CODEC_ROUND_TRIP_COUNT; i++)
+    {
+        if (MakeSample(&State, i % MESSAGE_TYPE_COUNT, i & 1, &Sample))
+            CheckSample(&Sample);
+        free(Sample.pJson);
+    }
+    printf("  %u random messages round tripped through json and binary\n", CODEC_ROUND_TRIP_COUNT);
+    CheckBinaryOversize();
+
+    // time the decoders on the mix of types a game sends most: votes, missions, teams and chat
+    static const UINT TimedTypeList[] = {
+        MESSAGE_TYPE_PLAYER_VOTE_TEAM, MESSAGE_TYPE_PLAYER_VOTE_TEAM, MESSAGE_TYPE_PLAYER_CONDUCT_MISSION,
+        MESSAGE_TYPE_PLAYER_SELECT_TEAM, MESSAGE_TYPE_PLAYER_TEXT_MESSAGE, MESSAGE_TYPE_JOIN_ROOM,
+    };
+    for (UINT i = 0; i < CODEC_SAMPLE_COUNT; i++)
+    {
+        if (!MakeSample(&State, TimedTypeList[i % _countof(TimedTypeList)], FALSE, &SampleList[i]))
+            return;
+        cbJsonTotal += SampleList[i].cbJsonLen;
+        cbBinaryTotal += SampleList[i].Binary.cbLen;
+    }
+
+    LONGLONG Start = BenchNow();
+    for (ULONG n = 0; n < Iterations; n++)
+    {
+        const CODEC_SAMPLE* pSample = &SampleList[n % CODEC_SAMPLE_COUNT];
+        BenchSink += (ULONG_PTR)DecodeJsonMessage((const BYTE*)pSample->pJson, (ULONG)pSample->cbJsonLen, &Message);
+    }
+    LONGLONG Mid = BenchNow();
+    for (ULONG n = 0; n < Iterations; n++)
+    {
+        const CODEC_SAMPLE* pSample = &SampleList[n % CODEC_SAMPLE_COUNT];
+        BenchSink += (ULONG_PTR)DecodeBinaryMessage(pSample->Binary.Buffer[1], pSample->Binary.Buffer + 2, pSample->Binary.cbLen - 2, &Message);
+    }
+    LONGLONG End = BenchNow();
+
+    printf("  json    %8.1f ns/message  %6.1f bytes/message\n", BenchNsPerOp(Start, Mid, Iterations), (double)cbJsonTotal / CODEC_SAMPLE_COUNT);
+    printf("  binary  %8.1f ns/message  %6.1f bytes/message\n", BenchNsPerOp(Mid, End, Iterations), (double)cbBinaryTotal / CODEC_SAMPLE_COUNT);
+
+    for (UINT i = 0; i < CODEC_SAMPLE_COUNT; i++)
+        free(SampleList[i].pJson);
+}
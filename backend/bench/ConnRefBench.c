@@ -0,0 +1,139 @@
+#include "Bench.h"
+#include "HttpSendRecv.h"
+
+#define CONN_REF_BENCH_THREADS 4
+#define CONN_REF_BENCH_CONNS ROOM_PLAYER_MAX // one room, every thread broadcasting to it
+
+#define CACHE_LINE_OF(Type, Field) (offsetof(Type, Field) / SYSTEM_CACHE_ALIGNMENT_SIZE)
+
+// The layout before RefCnt had a line of its own: senders bump it next to what broadcasts read.
+typedef struct DECLSPEC_CACHEALIGN _SHARED_LINE_CONN
+{
+    WEB_SOCKET_HANDLE hWebSock;
+    HTTP_REQUEST_ID RequestID;
+    PGAME_ROOM pRoom;
+    LONG64 volatile RefCnt;
+} SHARED_LINE_CONN;
+
+// RefCnt starts its line, away from what broadcasts read.
+C_ASSERT(offsetof(CONNECTION_INFO, RefCnt) % SYSTEM_CACHE_ALIGNMENT_SIZE == 0);
+C_ASSERT(CACHE_LINE_OF(CONNECTION_INFO, RefCnt) != CACHE_LINE_OF(CONNECTION_INFO, hWebSock));
+C_ASSERT(CACHE_LINE_OF(CONNECTION_INFO, RefCnt) != CACHE_LINE_OF(CONNECTION_INFO, RequestID));
+C_ASSERT(CACHE_LINE_OF(CONNECTION_INFO, RefCnt) != CACHE_LINE_OF(CONNECTION_INFO, pRoom));
+
+static CONNECTION_INFO ConnList[CONN_REF_BENCH_CONNS];
+static SHARED_LINE_CONN SharedLineList[CONN_REF_BENCH_CONNS];
+static ULONG ThreadIterations;
+
+// What a broadcast does per recipient: read the handle and room, take a reference for the send.
+// The completion of the previous send drops its reference, on this thread in the same I/O callback.
+static DWORD WINAPI AtomicRefThread(_In_ LPVOID lpParameter)
+{
+    for (ULONG n = 0; n < ThreadIterations; n++)
+    {
+        for (UINT i = 0; i < CONN_REF_BENCH_CONNS; i++)
+        {
+            BenchSink += (ULONG_PTR)ConnList[i].hWebSock + (ULONG_PTR)ConnList[i].pRoom;
+            InterlockedIncrement64(&ConnList[i].RefCnt);
+            InterlockedDecrement64(&ConnList[i].RefCnt);
+        }
+    }
+    return 0;
+}
+
+static DWORD WINAPI ScopedRefThread(_In_ LPVOID lpParameter)
+{
+    for (UINT i = 0; i < CONN_REF_BENCH_CONNS; i++)
+        ConnInfoAddRef(&ConnList[i]); // the send in flight when the loop starts
+
+    for (ULONG n = 0; n < ThreadIterations; n++)
+    {
+        BeginConnRefScope();
+        for (UINT i = 0; i < CONN_REF_BENCH_CONNS; i++)
+        {
+            BenchSink += (ULONG_PTR)ConnList[i].hWebSock + (ULONG_PTR)ConnList[i].pRoom;
+            ConnInfoRelease(&ConnList[i]);
+            ConnInfoAddRef(&ConnList[i]);
+        }
+        EndConnRefScope();
+    }
+
+    for (UINT i = 0; i < CONN_REF_BENCH_CONNS; i++)
+        ConnInfoRelease(&ConnList[i]);
+    return 0;
+}
+
+// Half the threads send, the other half only read the fields broadcasts read.
+static DWORD WINAPI SharedLineThread(_In_ LPVOID lpParameter)
+{
+    UINT ThreadIndex = (UINT)(ULONG_PTR)lpParameter;
+    for (ULONG n = 0; n < ThreadIterations; n++)
+    {
+        for (UINT i = 0; i < CONN_REF_BENCH_CONNS; i++)
+        {
+            if (ThreadIndex % 2)
+            {
+                InterlockedIncrement64(&SharedLineList[i].RefCnt);
+                InterlockedDecrement64(&SharedLineList[i].RefCnt);
+            }
+            else
+                BenchSink += (ULONG_PTR)SharedLineList[i].hWebSock + (ULONG_PTR)SharedLineList[i].pRoom;
+        }
+    }
+    return 0;
+}
+
+static DWORD WINAPI OwnLineThread(_In_ LPVOID lpParameter)
+{
+    UINT ThreadIndex = (UINT)(ULONG_PTR)lpParameter;
+    for (ULONG n = 0; n < ThreadIterations; n++)
+    {
+        for (UINT i = 0; i < CONN_REF_BENCH_CONNS; i++)
+        {
+            if (ThreadIndex % 2)
+            {
+                InterlockedIncrement64(&ConnList[i].RefCnt);
+                InterlockedDecrement64(&ConnList[i].RefCnt);
+            }
+            else
+                BenchSink += (ULONG_PTR)ConnList[i].hWebSock + (ULONG_PTR)ConnList[i].pRoom;
+        }
+    }
+    return 0;
+}
+
+static VOID CheckRefCnt(VOID)
+{
+    for (UINT i = 0; i < CONN_REF_BENCH_CONNS; i++)
+        BENCH_CHECK(ConnList[i].RefCnt == 1);
+}
+
+VOID BenchConnRef(_In_ ULONG Iterations)
+{
+    printf("  CONNECTION_INFO %u bytes, RefCnt at %u\n", (UINT)sizeof(CONNECTION_INFO), (UINT)offsetof(CONNECTION_INFO, RefCnt));
+
+    // the reference the connection holds on itself until it closes, the count never reaches 0 here.
+    for (UINT i = 0; i < CONN_REF_BENCH_CONNS; i++)
+    {
+        ConnList[i].RefCnt = 1;
+        ConnList[i].hWebSock = (WEB_SOCKET_HANDLE)(ULONG_PTR)(i + 1);
+        SharedLineList[i].hWebSock = ConnList[i].hWebSock;
+    }
+    ThreadIterations = Iterations / CONN_REF_BENCH_THREADS;
+
+    LONGLONG AtomicTicks = BenchRunThreads(CONN_REF_BENCH_THREADS, AtomicRefThread);
+    CheckRefCnt();
+    LONGLONG ScopedTicks = BenchRunThreads(CONN_REF_BENCH_THREADS, ScopedRefThread);
+    CheckRefCnt();
+    LONGLONG SharedLineTicks = BenchRunThreads(CONN_REF_BENCH_THREADS, SharedLineThread);
+    LONGLONG OwnLineTicks = BenchRunThreads(CONN_REF_BENCH_THREADS, OwnLineThread);
+    CheckRefCnt();
+
+    ULONGLONG RefCnt = (ULONGLONG)ThreadIterations * CONN_REF_BENCH_CONNS;
+    printf("  %u threads sending to the same %u connections, per recipient and thread:\n", CONN_REF_BENCH_THREADS, CONN_REF_BENCH_CONNS);
+    printf("    interlocked AddRef + Release     %6.1f ns\n", BenchNsPerOp(0, AtomicTicks, RefCnt));
+    printf("    in a ConnRefScope                %6.1f ns\n", BenchNsPerOp(0, ScopedTicks, RefCnt));
+    printf("  half sending, half reading the handle and room:\n");
+    printf("    RefCnt on the line they read     %6.1f ns\n", BenchNsPerOp(0, SharedLineTicks, RefCnt));
+    printf("    RefCnt on a line of its own      %6.1f ns\n", BenchNsPerOp(0, OwnLineTicks, RefCnt));
+}
@@ -0,0 +1,91 @@
+#include "Bench.h"
+#include "Metrics.h"
+#include "SlabPool.h"
+
+#define METRICS_BENCH_THREADS 8
+
+static ULONG ThreadIterations;
+static LONG64 volatile SharedCnt;
+
+static DWORD WINAPI CountThread(_In_ LPVOID lpParameter)
+{
+    for (ULONG n = 0; n < ThreadIterations; n++)
+    {
+        CountMetric(METRIC_FRAMES_RECEIVED);
+        AddMetric(METRIC_BYTES_RECEIVED, n % 64);
+        CountMessageIn(n % MESSAGE_TYPE_COUNT);
+        CountBroadcast(n % (ROOM_PLAYER_MAX + 1));
+    }
+    return 0;
+}
+
+// what per-thread blocks save: every thread adding to the same cache line.
+static DWORD WINAPI SharedCountThread(_In_ LPVOID lpParameter)
+{
+    for (ULONG n = 0; n < ThreadIterations; n++)
+        InterlockedIncrement64(&SharedCnt);
+    return 0;
+}
+
+static PSLAB_POOL FindMetricsPool(VOID)
+{
+    for (PSLAB_POOL pPool = NextSlabPool(NULL); pPool; pPool = NextSlabPool(pPool))
+    {
+        if (wcscmp(pPool->Name, L"metrics") == 0)
+            return pPool;
+    }
+    return NULL;
+}
+
+// The sums of Rounds runs of CountThread on every thread must be exact in GetMetric and in the scrape.
+static VOID CheckMetricSums(_In_ UINT Rounds)
+{
+    UINT64 Cnt = (UINT64)Rounds * METRICS_BENCH_THREADS * ThreadIterations;
+    UINT64 Bytes = 0;
+    CHAR szLine[128];
+    ULONG cbLen;
+
+    for (ULONG n = 0; n < ThreadIterations; n++)
+        Bytes += n % 64;
+    Bytes *= (UINT64)Rounds * METRICS_BENCH_THREADS;
+
+    BENCH_CHECK(GetMetric(METRIC_FRAMES_RECEIVED) == Cnt);
+    BENCH_CHECK(GetMetric(METRIC_BYTES_RECEIVED) == Bytes);
+    BENCH_CHECK(GetMetric(METRIC_BROADCASTS) == Cnt);
+
+    PCHAR pText = FormatMetrics(&cbLen);
+    if (!BENCH_CHECK(pText))
+        return;
+    sprintf_s(szLine, sizeof(szLine), "\navalon_frames_received_total %llu\n", Cnt);
+    BENCH_CHECK(strstr(pText, szLine));
+    sprintf_s(szLine, sizeof(szLine), "\navalon_broadcast_recipients_count %llu\n", Cnt);
+    BENCH_CHECK(strstr(pText, szLine));
+    sprintf_s(szLine, sizeof(szLine), "\navalon_messages_received_total{type=\"%s\"} %llu\n",
+        GetMessageSchema(0)->TypeName, (ThreadIterations + MESSAGE_TYPE_COUNT - 1) / MESSAGE_TYPE_COUNT * Rounds * METRICS_BENCH_THREADS);
+    BENCH_CHECK(strstr(pText, szLine));
+    HeapFree(GetProcessHeap(), 0, pText);
+}
+
+VOID BenchMetrics(_In_ ULONG Iterations)
+{
+    InitMetrics();
+    ThreadIterations = Iterations;
+
+    LONGLONG Ticks = BenchRunThreads(METRICS_BENCH_THREADS, CountThread);
+    CheckMetricSums(1);
+
+    // the blocks of the exited threads are taken over, counts carry on from where they were.
+    BenchRunThreads(METRICS_BENCH_THREADS, CountThread);
+    CheckMetricSums(2);
+    PSLAB_POOL pPool = FindMetricsPool();
+    if (BENCH_CHECK(pPool))
+        BENCH_CHECK(pPool->InUseCnt <= METRICS_BENCH_THREADS);
+
+    LONGLONG SharedTicks = BenchRunThreads(METRICS_BENCH_THREADS, SharedCountThread);
+    BENCH_CHECK(SharedCnt == (LONG64)METRICS_BENCH_THREADS * Iterations);
+
+    printf("  %u threads x %lu: %6.1f ns per round of 4 counts and thread\n",
+        METRICS_BENCH_THREADS, Iterations, BenchNsPerOp(0, Ticks, Iterations));
+    printf("  one shared interlocked counter instead: %6.1f ns per count and thread\n",
+        BenchNsPerOp(0, SharedTicks, Iterations));
+}
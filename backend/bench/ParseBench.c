@@ -0,0 +1,255 @@
+#include "Bench.h"
+#include "MessageSchema.h"
+#include "yyjson.h"
+
+// Typical client messages, the mix a room in game sends.
+static const CHAR* SampleList[] = {
+    "{\"type\":\"createRoom\",\"name\":\"player one\",\"password\":\"1234\"}",
+    "{\"type\":\"joinRoom\",\"name\":\"\\u73a9\\u5bb6\",\"roomNumber\":\"12345\"}",
+    "{\"type\":\"playerSelectTeam\",\"team\":[1,3,5,7]}",
+    "{\"type\":\"playerVoteTeam\",\"vote\":true}",
+    "{\"type\":\"playerConductMission\",\"perform\":false}",
+    "{\"type\":\"playerTextMessage\",\"message\":\"who is merlin? not me, I swear\"}",
+    "{\"vote\":false,\"a key longer than any field we know\":[{\"x\":null}],\"type\":\"playerVoteTeam\"}",
+};
+
+// Messages both decoders must refuse.
+static const CHAR* MalformedList[] = {
+    "{\"type\":\"createRoom\"}",
+    "{\"type\":\"createRoom\",\"name\":1}",
+    "{\"type\":\"createRoom\",\"name\":\"x\",}",
+    "{\"type\":\"playerSelectTeam\",\"team\":[1,-2]}",
+    "{\"type\":\"playerVoteTeam\",\"vote\":1}",
+    "{\"type\":\"unknown\"}",
+    "[]",
+};
+
+// Strings over the MaxLen of their field: the message decodes, the string is cut to what fits
+// and marked oversized, for the handler to answer with its error.
+typedef struct _OVERSIZE_SAMPLE
+{
+    const CHAR* Json;
+    UINT OversizeMask; // by CREATE_ROOM_FIELD_*
+    const CHAR* Name;  // what is kept of it
+} OVERSIZE_SAMPLE;
+
+static const OVERSIZE_SAMPLE OversizeList[] = {
+    { "{\"type\":\"createRoom\",\"name\":\"123456789012345678901234567890123\"}",
+        1u << CREATE_ROOM_FIELD_Name, "12345678901234567890123456789012" },
+    { "{\"type\":\"createRoom\",\"name\":\"x\",\"password\":\"123456789012345678901234567890123\"}",
+        1u << CREATE_ROOM_FIELD_Password, "x" },
+    // a character that doesn't fit whole is left out, escaped or not.
+    { "{\"type\":\"createRoom\",\"name\":\"1234567890123456789012345678901\\u00e9\"}",
+        1u << CREATE_ROOM_FIELD_Name, "1234567890123456789012345678901" },
+    { "{\"type\":\"createRoom\",\"name\":\"1234567890123456789012345678901\xc3\xa9\"}",
+        1u << CREATE_ROOM_FIELD_Name, "1234567890123456789012345678901" },
+};
+
+static const MESSAGE_SCHEMA* FindSchema(_In_z_ const CHAR* szType)
+{
+    const MESSAGE_SCHEMA* pSchema;
+    for (UINT i = 0; (pSchema = GetMessageSchema(i)) != NULL; i++)
+    {
+        if (strcmp(pSchema->TypeName, szType) == 0)
+            return pSchema;
+    }
+    return NULL;
+}
+
+// The decoding this replaced: build the yyjson DOM, then look every field of the schema up in it.
+static const MESSAGE_SCHEMA* DecodeWithDom(_In_reads_bytes_(cbLen) const BYTE* pJson, _In_ ULONG cbLen, _Out_ PINBOUND_MESSAGE pMessage)
+{
+    const MESSAGE_SCHEMA* pSchema = NULL;
+
+    pMessage->FieldMask = 0;
+    pMessage->OversizeMask = 0;
+    yyjson_doc* doc = yyjson_read((const char*)pJson, cbLen, 0);
+    if (!doc)
+        return NULL;
+
+    __try
+    {
+        yyjson_val* root = yyjson_doc_get_root(doc);
+        const CHAR* szType = yyjson_get_str(yyjson_obj_get(root, "type"));
+        if (!szType || !(pSchema = FindSchema(szType)))
+            __leave;
+
+        for (UINT i = 0; pSchema->FieldList[i].Key; i++)
+        {
+            const MESSAGE_FIELD* pField = &pSchema->FieldList[i];
+            BYTE* pValue = (BYTE*)pMessage + pField->Offset;
+            yyjson_val* val = yyjson_obj_getn(root, pField->Key, pField->KeyLen);
+            if (!val)
+            {
+                if (pField->bRequired)
+                    pSchema = NULL;
+                continue;
+            }
+
+            switch (pField->Type)
+            {
+            case FIELD_TYPE_STRING:
+                if (!yyjson_is_str(val) || yyjson_get_len(val) > pField->MaxLen)
+                    pSchema = NULL;
+                else
+                    memcpy(pValue, yyjson_get_str(val), yyjson_get_len(val) + 1);
+                break;
+            case FIELD_TYPE_BOOL:
+                if (!yyjson_is_bool(val))
+                    pSchema = NULL;
+                else
+                    *(BOOL*)pValue = yyjson_get_bool(val);
+                break;
+            case FIELD_TYPE_UINT:
+                if (!yyjson_is_uint(val) || yyjson_get_uint(val) > MAXUINT32)
+                    pSchema = NULL;
+                else
+                    *(UINT*)pValue = (UINT)yyjson_get_uint(val);
+                break;
+            case FIELD_TYPE_UINT_ARRAY:
+            {
+                UINT Cnt = 0;
+                yyjson_val* elem;
+                yyjson_arr_iter iter;
+                if (!yyjson_arr_iter_init(val, &iter) || yyjson_arr_size(val) > pField->MaxLen)
+                {
+                    pSchema = NULL;
+                    break;
+                }
+                while ((elem = yyjson_arr_iter_next(&iter)) != NULL)
+                {
+                    if (!yyjson_is_uint(elem) || yyjson_get_uint(elem) > MAXUINT32)
+                    {
+                        pSchema = NULL;
+                        break;
+                    }
+                    ((UINT32*)pValue)[Cnt++] = (UINT32)yyjson_get_uint(elem);
+                }
+                *(UINT*)((BYTE*)pMessage + pField->CountOffset) = Cnt;
+                break;
+            }
+            }
+            if (!pSchema)
+                __leave;
+            pMessage->FieldMask |= 1u << i;
+        }
+    }
+    __finally
+    {
+        yyjson_doc_free(doc);
+    }
+    return pSchema;
+}
+
+// First field of pSchema present or oversized in only one of the messages or with different values, NULL if none.
+const MESSAGE_FIELD* BenchDiffMessage(_In_ const MESSAGE_SCHEMA* pSchema, _In_ const INBOUND_MESSAGE* pMessage, _In_ const INBOUND_MESSAGE* pOther)
+{
+    for (UINT i = 0; pSchema->FieldList[i].Key; i++)
+    {
+        const MESSAGE_FIELD* pField = &pSchema->FieldList[i];
+        const BYTE* pValue = (const BYTE*)pMessage + pField->Offset;
+        const BYTE* pOtherValue = (const BYTE*)pOther + pField->Offset;
+        BOOL bSame = TRUE;
+
+        if ((((pMessage->FieldMask ^ pOther->FieldMask) | (pMessage->OversizeMask ^ pOther->OversizeMask)) >> i) & 1)
+            return pField;
+        if (!((pMessage->FieldMask >> i) & 1))
+            continue;
+        switch (pField->Type)
+        {
+        case FIELD_TYPE_STRING:
+            bSame = strcmp((const CHAR*)pValue, (const CHAR*)pOtherValue) == 0;
+            break;
+        case FIELD_TYPE_BOOL:
+            bSame = *(const BOOL*)pValue == *(const BOOL*)pOtherValue;
+            break;
+        case FIELD_TYPE_UINT:
+            bSame = *(const UINT*)pValue == *(const UINT*)pOtherValue;
+            break;
+        case FIELD_TYPE_UINT_ARRAY:
+        {
+            UINT Cnt = *(const UINT*)((const BYTE*)pMessage + pField->CountOffset);
+            bSame = Cnt == *(const UINT*)((const BYTE*)pOther + pField->CountOffset) &&
+                memcmp(pValue, pOtherValue, Cnt * sizeof(UINT32)) == 0;
+            break;
+        }
+        }
+        if (!bSame)
+            return pField;
+    }
+    return NULL;
+}
+
+// Both decoders must agree on every sample, field by field.
+static VOID CheckSamples(VOID)
+{
+    INBOUND_MESSAGE Message, DomMessage;
+
+    for (UINT i = 0; i < _countof(SampleList); i++)
+    {
+        ULONG cbLen = (ULONG)strlen(SampleList[i]);
+        const MESSAGE_SCHEMA* pSchema = DecodeJsonMessage((const BYTE*)SampleList[i], cbLen, &Message);
+        const MESSAGE_SCHEMA* pDomSchema = DecodeWithDom((const BYTE*)SampleList[i], cbLen, &DomMessage);
+        if (!BENCH_CHECK(pSchema != NULL && pSchema == pDomSchema))
+        {
+            printf("    in %s\n", SampleList[i]);
+            continue;
+        }
+
+        const MESSAGE_FIELD* pField = BenchDiffMessage(pSchema, &Message, &DomMessage);
+        if (!BENCH_CHECK(pField == NULL))
+            printf("    field \"%s\" in %s\n", pField->Key, SampleList[i]);
+    }
+
+    for (UINT i = 0; i < _countof(MalformedList); i++)
+    {
+        if (!BENCH_CHECK(DecodeJsonMessage((const BYTE*)MalformedList[i], (ULONG)strlen(MalformedList[i]), &Message) == NULL))
+            printf("    accepted %s\n", MalformedList[i]);
+    }
+
+    for (UINT i = 0; i < _countof(OversizeList); i++)
+    {
+        const OVERSIZE_SAMPLE* pSample = &OversizeList[i];
+        const MESSAGE_SCHEMA* pSchema = DecodeJsonMessage((const BYTE*)pSample->Json, (ULONG)strlen(pSample->Json), &Message);
+        if (!BENCH_CHECK(pSchema == GetMessageSchema(MESSAGE_TYPE_CREATE_ROOM)) ||
+            !BENCH_CHECK(Message.OversizeMask == pSample->OversizeMask) ||
+            !BENCH_CHECK(strcmp(Message.CreateRoom.Name, pSample->Name) == 0))
+            printf("    in %s\n", pSample->Json);
+    }
+}
+
+VOID BenchParse(_In_ ULONG Iterations)
+{
+    INBOUND_MESSAGE Message;
+    ULONG cbLenList[_countof(SampleList)];
+    ULONGLONG cbTotal = 0;
+
+    CheckSamples();
+
+    for (UINT i = 0; i < _countof(SampleList); i++)
+    {
+        cbLenList[i] = (ULONG)strlen(SampleList[i]);
+        cbTotal += cbLenList[i];
+    }
+    cbTotal *= Iterations;
+
+    LONGLONG Start = BenchNow();
+    for (ULONG n = 0; n < Iterations; n++)
+    {
+        for (UINT i = 0; i < _countof(SampleList); i++)
+            BenchSink += (ULONG_PTR)DecodeJsonMessage((const BYTE*)SampleList[i], cbLenList[i], &Message);
+    }
+    LONGLONG Mid = BenchNow();
+    for (ULONG n = 0; n < Iterations; n++)
+    {
+        for (UINT i = 0; i < _countof(SampleList); i++)
+            BenchSink += (ULONG_PTR)DecodeWithDom((const BYTE*)SampleList[i], cbLenList[i], &Message);
+    }
+    LONGLONG End = BenchNow();
+
+    ULONGLONG Count = (ULONGLONG)Iterations * _countof(SampleList);
+    double SinglePass = BenchNsPerOp(Start, Mid, Count);
+    double Dom = BenchNsPerOp(Mid, End, Count);
+    printf("  single pass  %8.1f ns/message  %7.1f MB/s\n", SinglePass, cbTotal / (SinglePass * Count / 1e3));
+    printf("  yyjson DOM   %8.1f ns/message  %7.1f MB/s\n", Dom, cbTotal / (Dom * Count / 1e3));
+}
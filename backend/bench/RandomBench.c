@@ -0,0 +1,112 @@
+#include "Bench.h"
+#include "Random.h"
+
+#define RANDOM_HISTOGRAM_BOUND 10 // the largest role list
+#define RANDOM_REPLAY_DRAWS 64
+
+// RFC 8439 2.3.2: key 00 01 .. 1f, nonce 00 00 00 09 00 00 00 4a 00 00 00 00, block counter 1.
+static VOID CheckChaChaVector(VOID)
+{
+    static const UINT32 Expected[16] = {
+        0xe4e7f110, 0x15593bd1, 0x1fdd0f50, 0xc47120a3, 0xc7f4d1c7, 0x0368c033, 0x9aaa2204, 0x4e6cd4c3,
+        0x466482d2, 0x09aa9f07, 0x05d7c214, 0xa2028bd9, 0xd19c12b5, 0xb94e16de, 0xe883d0cb, 0x4e3c50a2,
+    };
+    CHACHA_STATE State;
+    UINT32 Key[11];
+
+    for (UINT i = 0; i < 8; i++)
+        Key[i] = (4 * i) | (4 * i + 1) << 8 | (4 * i + 2) << 16 | (UINT32)(4 * i + 3) << 24;
+    Key[8] = 0x09000000;
+    Key[9] = 0x4a000000;
+    Key[10] = 0;
+
+    ChaChaSetKey(&State, Key);
+    State.Input[12] = 1;
+    ChaChaBlock(&State);
+    BENCH_CHECK(memcmp(State.Output, Expected, sizeof(Expected)) == 0);
+}
+
+// With a pinned seed, a game deals the same whoever draws before it, and games differ from each other.
+static VOID CheckGameReplay(VOID)
+{
+    RANDOM_STREAM Stream, Replay, NextGame;
+    UINT Value, ReplayValue, NextValue, SameCnt = 0;
+
+    SetRandomSeed(0x5EED);
+    InitGameRandom(&Stream, 12345, 3);
+    for (UINT i = 0; i < 1000; i++) // draws of other rooms on this thread
+        RandomBelow(7, &Value);
+    InitGameRandom(&Replay, 12345, 3);
+    InitGameRandom(&NextGame, 12345, 4);
+
+    for (UINT i = 0; i < RANDOM_REPLAY_DRAWS; i++)
+    {
+        BENCH_CHECK(StreamRandomBelow(&Stream, ROOM_PLAYER_MAX - i % 6, &Value));
+        BENCH_CHECK(StreamRandomBelow(&Replay, ROOM_PLAYER_MAX - i % 6, &ReplayValue));
+        BENCH_CHECK(StreamRandomBelow(&NextGame, ROOM_PLAYER_MAX - i % 6, &NextValue));
+        BENCH_CHECK(Value == ReplayValue);
+        SameCnt += Value == NextValue;
+    }
+    BENCH_CHECK(SameCnt < RANDOM_REPLAY_DRAWS / 2);
+
+    SetRandomSeed(0);
+    InitGameRandom(&Stream, 12345, 3);
+    BENCH_CHECK(!Stream.bPinned);
+}
+
+// Chi-square of RandomBelow over Bound buckets, from a pinned seed so the run is repeatable.
+static VOID CheckHistogram(_In_ ULONG DrawCnt)
+{
+    ULONG Histogram[RANDOM_HISTOGRAM_BOUND] = { 0 };
+    double Expected = (double)DrawCnt / RANDOM_HISTOGRAM_BOUND;
+    double ChiSquare = 0;
+    UINT Value;
+
+    SetRandomSeed(0x5EED);
+    for (ULONG n = 0; n < DrawCnt; n++)
+    {
+        if (!BENCH_CHECK(RandomBelow(RANDOM_HISTOGRAM_BOUND, &Value)))
+            break;
+        Histogram[Value]++;
+    }
+    SetRandomSeed(0);
+
+    printf("  RandomBelow(%u) over %lu draws:", RANDOM_HISTOGRAM_BOUND, DrawCnt);
+    for (UINT i = 0; i < RANDOM_HISTOGRAM_BOUND; i++)
+    {
+        printf(" %lu", Histogram[i]);
+        ChiSquare += (Histogram[i] - Expected) * (Histogram[i] - Expected) / Expected;
+    }
+    printf("\n  chi-square %.2f, 9 degrees of freedom\n", ChiSquare);
+    BENCH_CHECK(ChiSquare < 27.88); // p = 0.001
+}
+
+VOID BenchRandom(_In_ ULONG Iterations)
+{
+    RANDOM_STREAM Stream;
+    UINT Value;
+
+    CheckChaChaVector();
+    CheckGameReplay();
+    CheckHistogram(Iterations);
+
+    LONGLONG Start = BenchNow();
+    for (ULONG n = 0; n < Iterations; n++)
+    {
+        RandomBelow(ROOM_PLAYER_MAX, &Value);
+        BenchSink += Value;
+    }
+    LONGLONG Mid = BenchNow();
+    SetRandomSeed(0x5EED);
+    InitGameRandom(&Stream, 12345, 0);
+    for (ULONG n = 0; n < Iterations; n++)
+    {
+        StreamRandomBelow(&Stream, ROOM_PLAYER_MAX, &Value);
+        BenchSink += Value;
+    }
+    LONGLONG End = BenchNow();
+    SetRandomSeed(0);
+
+    printf("  RandomBelow        %6.1f ns/draw\n", BenchNsPerOp(Start, Mid, Iterations));
+    printf("  StreamRandomBelow  %6.1f ns/draw (pinned game stream)\n", BenchNsPerOp(Mid, End, Iterations));
+}
@@ -0,0 +1,97 @@
+#include "Bench.h"
+#include "RoleHint.h"
+
+// The rules RoleHint.inl encodes, written out again: what Viewer is told about a player holding Target.
+static UINT ExpectedHint(_In_ UINT Viewer, _In_ UINT Target)
+{
+    BOOL bTargetEvil = Target == ROLE_ASSASSIN || Target == ROLE_MORDRED || Target == ROLE_OBERON ||
+        Target == ROLE_MORGANA || Target == ROLE_MINIONS;
+
+    switch (Viewer)
+    {
+    case ROLE_MERLIN: // every evil player but Mordred
+        return bTargetEvil && Target != ROLE_MORDRED ? HINT_BAD : 0;
+    case ROLE_PERCIVAL:
+        return Target == ROLE_MERLIN || Target == ROLE_MORGANA ? HINT_MERLIN_OR_MORGANA : 0;
+    case ROLE_ASSASSIN:
+    case ROLE_MORDRED:
+    case ROLE_MORGANA:
+    case ROLE_MINIONS: // evil but Oberon see each other by role
+        switch (Target)
+        {
+        case ROLE_ASSASSIN: return HINT_ASSASSIN;
+        case ROLE_MORDRED:  return HINT_MORDRED;
+        case ROLE_MORGANA:  return HINT_MORGANA;
+        case ROLE_MINIONS:  return HINT_MINIONS;
+        }
+        return 0;
+    }
+    return 0; // loyalists and Oberon
+}
+
+// Deal each deck unshuffled, every player must get exactly the hints of the rules.
+static VOID CheckDecks(VOID)
+{
+    static GAME_ROOM Room;
+    static const UINT EvilCnt[] = { 2, 2, 3, 3, 3, 4 }; // 5 to 10 players
+    HINTLIST HintList[ROOM_PLAYER_MAX];
+
+    for (UINT PlayerCnt = ROOM_PLAYER_MIN; PlayerCnt <= ROOM_PLAYER_MAX; PlayerCnt++)
+    {
+        UINT RoleCnt[ROLE_CNT] = { 0 };
+
+        GetRoleDeck(PlayerCnt, Room.RoleList);
+        Room.PlayingCount = PlayerCnt;
+        for (UINT i = 0; i < PlayerCnt; i++)
+        {
+            Room.PlayingList[i].GameID = 100 + i;
+            if (BENCH_CHECK(Room.RoleList[i] >= ROLE_MERLIN && Room.RoleList[i] < ROLE_CNT))
+                RoleCnt[Room.RoleList[i]]++;
+        }
+        if (!BENCH_CHECK(RoleCnt[ROLE_MERLIN] == 1 && RoleCnt[ROLE_ASSASSIN] == 1) ||
+            !BENCH_CHECK(RoleCnt[ROLE_ASSASSIN] + RoleCnt[ROLE_MORDRED] + RoleCnt[ROLE_OBERON] + RoleCnt[ROLE_MORGANA] +
+                RoleCnt[ROLE_MINIONS] == EvilCnt[PlayerCnt - ROOM_PLAYER_MIN]))
+            printf("    deck of %u players\n", PlayerCnt);
+
+        for (UINT Viewer = 0; Viewer < PlayerCnt; Viewer++)
+        {
+            UINT HintCnt = GetRoleHints(&Room, Viewer, HintList);
+            UINT ExpectedCnt = 0;
+
+            for (UINT Target = 0; Target < PlayerCnt; Target++)
+            {
+                UINT Hint = Target == Viewer ? 0 : ExpectedHint(Room.RoleList[Viewer], Room.RoleList[Target]);
+                UINT Found = 0;
+
+                ExpectedCnt += Hint != 0;
+                for (UINT i = 0; i < HintCnt; i++)
+                {
+                    if (HintList[i].ID == Room.PlayingList[Target].GameID)
+                        Found = HintList[i].HintType;
+                }
+                if (!BENCH_CHECK(Found == Hint))
+                    printf("    %u players: role %u sees role %u as %u, expected %u\n",
+                        PlayerCnt, Room.RoleList[Viewer], Room.RoleList[Target], Found, Hint);
+            }
+            BENCH_CHECK(HintCnt == ExpectedCnt);
+        }
+    }
+}
+
+VOID BenchRoleHint(_In_ ULONG Iterations)
+{
+    static GAME_ROOM Room;
+    HINTLIST HintList[ROOM_PLAYER_MAX];
+
+    CheckDecks();
+
+    // the largest game, every player's hints as startGame sends them.
+    GetRoleDeck(ROOM_PLAYER_MAX, Room.RoleList);
+    Room.PlayingCount = ROOM_PLAYER_MAX;
+    LONGLONG Start = BenchNow();
+    for (ULONG n = 0; n < Iterations; n++)
+        BenchSink += GetRoleHints(&Room, n % ROOM_PLAYER_MAX, HintList);
+    LONGLONG End = BenchNow();
+
+    printf("  GetRoleHints  %6.1f ns/player, %u players\n", BenchNsPerOp(Start, End, Iterations), ROOM_PLAYER_MAX);
+}
@@ -0,0 +1,164 @@
+#include <ctype.h>
+
+#include "Bench.h"
+#include "RoomManager.h"
+#include "RoomNumber.h"
+#include "RoomIndex.h"
+
+#define ROOM_INDEX_BENCH_READERS 4
+#define ROOM_INDEX_FIXED_CNT 100     // rooms the readers look up while the writer resizes
+#define ROOM_INDEX_CHURN_CNT 200000  // rooms the writer opens, then closes
+#define ROOM_INDEX_CHURN_ROUNDS 6
+
+// The index never reads the rooms, a distinct made-up pointer per key is enough.
+#define BENCH_ROOM(Key) ((PGAME_ROOM)(ULONG_PTR)(((ULONG_PTR)(Key) + 1) << 6))
+
+static LONG volatile bChurnDone;
+static LONG volatile MissCnt;
+static LONG64 volatile LookupCnt;
+
+#define CHURN_CODE_MASK (ROOM_CODE_MASK >> 1) // the fixed rooms' codes have the top bit, churned ones don't
+
+// Codes from a fixed sequence, the same every run. They repeat now and then.
+static UINT NextBenchCode(_Inout_ UINT* pState)
+{
+    *pState ^= *pState << 13;
+    *pState ^= *pState >> 17;
+    *pState ^= *pState << 5;
+    return ROOM_CODE_FLAG | (*pState & CHURN_CODE_MASK);
+}
+
+// Numbers and codes.
+static UINT FixedRoomKey(_In_ UINT i)
+{
+    return i % 2 ? ROOM_CODE_FLAG | (ROOM_CODE_MASK & ~CHURN_CODE_MASK) | (i * 0x9E3779B1u & CHURN_CODE_MASK)
+        : i * 797 % ROOM_NUMBER_CNT;
+}
+
+static VOID CheckRoomNames(VOID)
+{
+    static const CHAR* MalformedList[] = { "", "9999", "00000", "1234a", "-1234", "ABCDEU", "ABCDE", "ABCDEFG", "12 45" };
+    CHAR szName[ROOM_NAME_MAXLEN + 1];
+    UINT Number, State = 0x5EED;
+
+    for (UINT i = 0; i < ROOM_NUMBER_CNT; i++)
+    {
+        FormatRoomNumber(i, szName);
+        if (!BENCH_CHECK(ParseRoomNumber(szName, &Number) && Number == i))
+            break;
+    }
+    for (UINT i = 0; i < 100000; i++)
+    {
+        UINT Code = NextBenchCode(&State);
+        FormatRoomNumber(Code, szName);
+        if (!BENCH_CHECK(strlen(szName) == ROOM_CODE_LEN && ParseRoomNumber(szName, &Number) && Number == Code))
+            break;
+        for (CHAR* p = szName; *p; p++)
+            *p = (CHAR)tolower((UCHAR)*p);
+        if (!BENCH_CHECK(ParseRoomNumber(szName, &Number) && Number == Code))
+            break;
+    }
+
+    // letters easily misread are read as the digit they look like
+    BENCH_CHECK(ParseRoomNumber("0ILOLI", &Number) && ParseRoomNumber("oi1011", &State) && Number == State);
+    FormatRoomNumber(Number, szName);
+    BENCH_CHECK(strcmp(szName, "011011") == 0);
+    for (UINT i = 0; i < _countof(MalformedList); i++)
+    {
+        if (!BENCH_CHECK(!ParseRoomNumber(MalformedList[i], &Number)))
+            printf("    \"%s\" parsed\n", MalformedList[i]);
+    }
+}
+
+static DWORD WINAPI RoomIndexThread(_In_ LPVOID lpParameter)
+{
+    UINT ThreadIndex = (UINT)(ULONG_PTR)lpParameter;
+    UINT State = 0x5EED;
+
+    if (ThreadIndex == 0) // the writer, as RoomPoolLock serializes them
+    {
+        for (UINT Round = 0; Round < ROOM_INDEX_CHURN_ROUNDS; Round++)
+        {
+            UINT RoundState = State;
+            for (UINT i = 0; i < ROOM_INDEX_CHURN_CNT; i++)
+            {
+                UINT Code = NextBenchCode(&State);
+                if (!LookupRoomIndex(Code))
+                    BENCH_CHECK(InsertRoomIndex(Code, BENCH_ROOM(Code)));
+            }
+            State = RoundState;
+            for (UINT i = 0; i < ROOM_INDEX_CHURN_CNT; i++)
+            {
+                UINT Code = NextBenchCode(&State);
+                if (LookupRoomIndex(Code) == BENCH_ROOM(Code))
+                    RemoveRoomIndex(Code);
+            }
+        }
+        InterlockedExchange(&bChurnDone, TRUE);
+        return 0;
+    }
+
+    ULONG64 Cnt = 0;
+    while (!bChurnDone)
+    {
+        UINT Key = FixedRoomKey((UINT)(Cnt++ % ROOM_INDEX_FIXED_CNT));
+        if (LookupRoomIndex(Key) != BENCH_ROOM(Key))
+            InterlockedIncrement(&MissCnt);
+    }
+    InterlockedAdd64(&LookupCnt, (LONG64)Cnt);
+    return 0;
+}
+
+// Fixed rooms must be found all along while the table grows to the churn size and shrinks back.
+static VOID CheckRoomIndex(VOID)
+{
+    UINT NumberList[ROOM_INDEX_FIXED_CNT];
+    PGAME_ROOM RoomList[ROOM_INDEX_FIXED_CNT];
+
+    for (UINT i = 0; i < ROOM_INDEX_FIXED_CNT; i++)
+        BENCH_CHECK(InsertRoomIndex(FixedRoomKey(i), BENCH_ROOM(FixedRoomKey(i))));
+
+    LONGLONG Ticks = BenchRunThreads(1 + ROOM_INDEX_BENCH_READERS, RoomIndexThread);
+    printf("  %u rounds of %u rooms opened and closed, %llu lookups by %u threads meanwhile, %ld missed\n",
+        ROOM_INDEX_CHURN_ROUNDS, ROOM_INDEX_CHURN_CNT, (ULONGLONG)LookupCnt, ROOM_INDEX_BENCH_READERS, MissCnt);
+    printf("  %6.1f ns per room opened or closed\n", BenchNsPerOp(0, Ticks, 2ull * ROOM_INDEX_CHURN_ROUNDS * ROOM_INDEX_CHURN_CNT));
+    BENCH_CHECK(MissCnt == 0);
+    BENCH_CHECK(GetRoomIndexCount() == ROOM_INDEX_FIXED_CNT);
+
+    // a page lists them in ascending order
+    UINT Cnt = EnumRoomIndex(0, ROOM_INDEX_FIXED_CNT, NumberList, RoomList);
+    BENCH_CHECK(Cnt == ROOM_INDEX_FIXED_CNT);
+    for (UINT i = 0; i < Cnt; i++)
+        BENCH_CHECK(RoomList[i] == BENCH_ROOM(NumberList[i]) && (i == 0 || NumberList[i - 1] < NumberList[i]));
+}
+
+VOID BenchRoomIndex(_In_ ULONG Iterations)
+{
+    CHAR szName[ROOM_NAME_MAXLEN + 1];
+    UINT Number, State = 0x5EED;
+
+    InitRoomIndex();
+    CheckRoomNames();
+    CheckRoomIndex();
+
+    // lookups of open rooms with the index at the churn size
+    for (UINT i = 0; i < ROOM_INDEX_CHURN_CNT; i++)
+    {
+        UINT Code = NextBenchCode(&State);
+        if (!LookupRoomIndex(Code))
+            InsertRoomIndex(Code, BENCH_ROOM(Code));
+    }
+    LONGLONG Start = BenchNow();
+    for (ULONG n = 0; n < Iterations; n++)
+        BenchSink += (ULONG_PTR)LookupRoomIndex(FixedRoomKey(n % ROOM_INDEX_FIXED_CNT));
+    LONGLONG Mid = BenchNow();
+    for (ULONG n = 0; n < Iterations; n++)
+    {
+        FormatRoomNumber(ROOM_CODE_FLAG | (n & ROOM_CODE_MASK), szName);
+        BenchSink += ParseRoomNumber(szName, &Number) + Number;
+    }
+    LONGLONG End = BenchNow();
+
+    printf("  LookupRoomIndex  %6.1f ns, %u rooms open\n", BenchNsPerOp(Start, Mid, Iterations), GetRoomIndexCount());
+    printf("  format + parse   %6.1f ns per code\n", BenchNsPerOp(Mid, End, Iterations));
+}
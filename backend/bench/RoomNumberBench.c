@@ -0,0 +1,112 @@
+#include "Bench.h"
+#include "RoomManager.h"
+#include "RoomNumber.h"
+
+#define ROOM_NUMBER_BENCH_THREADS 4
+
+static UINT HeldList[ROOM_NUMBER_CNT];
+static UINT HeldCnt;
+static ULONG ThreadIterations;
+
+// Every number comes out once, then the bitmap is full. Reserved numbers and codes are kept out.
+static VOID CheckRoomNumbers(VOID)
+{
+    static BYTE Seen[ROOM_NUMBER_CNT];
+    UINT Number, DupCnt = 0;
+
+    for (HeldCnt = 0; HeldCnt < ROOM_NUMBER_CNT && AllocRoomNumber(&Number); HeldCnt++)
+    {
+        if (!BENCH_CHECK(Number < ROOM_NUMBER_CNT))
+            return;
+        DupCnt += Seen[Number]++ != 0;
+        HeldList[HeldCnt] = Number;
+    }
+    BENCH_CHECK(HeldCnt == ROOM_NUMBER_CNT && DupCnt == 0);
+    BENCH_CHECK(!AllocRoomNumber(&Number));
+    BENCH_CHECK(GetRoomNumbersInUse() == ROOM_NUMBER_CNT);
+    BENCH_CHECK(!ReserveRoomNumber(HeldList[0]));
+
+    FreeRoomNumber(HeldList[0]);
+    BENCH_CHECK(AllocRoomNumber(&Number) && Number == HeldList[0]);
+    while (HeldCnt)
+        FreeRoomNumber(HeldList[--HeldCnt]);
+    BENCH_CHECK(GetRoomNumbersInUse() == 0);
+
+    // a number still open in the process being replaced
+    BENCH_CHECK(ReserveRoomNumber(12345 - ROOM_NUMBER_MIN));
+    BENCH_CHECK(!ReserveRoomNumber(12345 - ROOM_NUMBER_MIN));
+    for (UINT i = 0; i < ROOM_NUMBER_CNT - 1; i++)
+    {
+        if (!BENCH_CHECK(AllocRoomNumber(&Number) && Number != 12345 - ROOM_NUMBER_MIN))
+            break;
+        HeldList[HeldCnt++] = Number;
+    }
+    FreeRoomNumber(12345 - ROOM_NUMBER_MIN);
+    while (HeldCnt)
+        FreeRoomNumber(HeldList[--HeldCnt]);
+
+    // and a code, given back with FreeRoomNumber
+    UINT Code = ROOM_CODE_FLAG | 0x1234567;
+    BENCH_CHECK(ReserveRoomNumber(Code));
+    BENCH_CHECK(!ReserveRoomNumber(Code));
+    FreeRoomNumber(Code);
+    BENCH_CHECK(ReserveRoomNumber(Code));
+    FreeRoomNumber(Code);
+    for (UINT i = 0; i < 1000; i++)
+        BENCH_CHECK(DrawRoomCode(&Number) && (Number & ~ROOM_CODE_MASK) == ROOM_CODE_FLAG);
+}
+
+// Take numbers until Percent of them are in use.
+static VOID FillRoomNumbers(_In_ UINT Percent)
+{
+    UINT Number;
+    while (HeldCnt < ROOM_NUMBER_CNT / 100 * Percent && BENCH_CHECK(AllocRoomNumber(&Number)))
+        HeldList[HeldCnt++] = Number;
+}
+
+static DWORD WINAPI AllocFreeThread(_In_ LPVOID lpParameter)
+{
+    UINT Number;
+    for (ULONG n = 0; n < ThreadIterations; n++)
+    {
+        if (!BENCH_CHECK(AllocRoomNumber(&Number)))
+            break;
+        FreeRoomNumber(Number);
+    }
+    return 0;
+}
+
+VOID BenchRoomNumber(_In_ ULONG Iterations)
+{
+    static const UINT PercentList[] = { 10, 50, 99 };
+
+    InitRoomNumbers();
+    CheckRoomNumbers();
+
+    for (UINT i = 0; i < _countof(PercentList); i++)
+    {
+        UINT Number;
+        FillRoomNumbers(PercentList[i]);
+
+        LONGLONG Start = BenchNow();
+        for (ULONG n = 0; n < Iterations; n++)
+        {
+            AllocRoomNumber(&Number);
+            FreeRoomNumber(Number);
+        }
+        LONGLONG End = BenchNow();
+        printf("  alloc + free at %2u%% in use  %6.1f ns\n", PercentList[i], BenchNsPerOp(Start, End, Iterations));
+    }
+    while (HeldCnt)
+        FreeRoomNumber(HeldList[--HeldCnt]);
+
+    // rooms opening and closing on every worker thread at once, no lock between them.
+    FillRoomNumbers(50);
+    ThreadIterations = Iterations / ROOM_NUMBER_BENCH_THREADS;
+    LONGLONG Ticks = BenchRunThreads(ROOM_NUMBER_BENCH_THREADS, AllocFreeThread);
+    printf("  alloc + free at 50%% in use, %u threads  %6.1f ns per pair and thread\n",
+        ROOM_NUMBER_BENCH_THREADS, BenchNsPerOp(0, Ticks, ThreadIterations));
+    BENCH_CHECK(GetRoomNumbersInUse() == HeldCnt);
+    while (HeldCnt)
+        FreeRoomNumber(HeldList[--HeldCnt]);
+}
@@ -0,0 +1,149 @@
+#include "Bench.h"
+#include "RoomManager.h"
+#include "HttpSendRecv.h"
+#include "SlabPool.h"
+#include <psapi.h>
+
+#define CACHE_LINE_OF(Type, Field) (offsetof(Type, Field) / SYSTEM_CACHE_ALIGNMENT_SIZE)
+
+// Every action reads the hot group, it must not share a line with the snapshot or lobby data.
+C_ASSERT(offsetof(GAME_ROOM, SnapshotLock) % SYSTEM_CACHE_ALIGNMENT_SIZE == 0);
+C_ASSERT(offsetof(GAME_ROOM, WaitingList) % SYSTEM_CACHE_ALIGNMENT_SIZE == 0);
+C_ASSERT(CACHE_LINE_OF(GAME_ROOM, MissionBallot) < CACHE_LINE_OF(GAME_ROOM, SnapshotLock));
+C_ASSERT(CACHE_LINE_OF(GAME_ROOM, PendingDeltaOp) < CACHE_LINE_OF(GAME_ROOM, WaitingList));
+
+// An object of each size, the way the backend allocates it.
+typedef struct _SLAB_BENCH_TYPE
+{
+    const WCHAR* Name;
+    SIZE_T Size;
+} SLAB_BENCH_TYPE;
+
+static const SLAB_BENCH_TYPE SlabBenchTypeList[] = {
+    { L"room", sizeof(GAME_ROOM) },
+    { L"connection", sizeof(CONNECTION_INFO) },
+};
+
+// pools stay on the list of every pool, they can't live on the stack.
+static SLAB_POOL BenchPoolList[_countof(SlabBenchTypeList)];
+
+static SIZE_T GetPrivateBytes(VOID)
+{
+    PROCESS_MEMORY_COUNTERS_EX Counters = { sizeof(Counters) };
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PPROCESS_MEMORY_COUNTERS)&Counters, sizeof(Counters)))
+        return 0;
+    return Counters.PrivateUsage;
+}
+
+static double BytesPerObject(_In_ SIZE_T Before, _In_ SIZE_T After, _In_ ULONG Count)
+{
+    return ((double)After - (double)Before) / Count;
+}
+
+// Count objects of Size held at once, from a heap of their own as CreateRoom and the upgrade did
+// before the pools, and from a pool. Then the cost of one more alloc + free with all of them held.
+static VOID BenchSlabType(_In_ UINT TypeIndex, _In_ PVOID* pObjectList, _In_ ULONG Count)
+{
+    const SLAB_BENCH_TYPE* pType = &SlabBenchTypeList[TypeIndex];
+    PSLAB_POOL pPool = &BenchPoolList[TypeIndex];
+    HANDLE hHeap = NULL;
+    ULONG HeldCnt = 0;
+
+    __try
+    {
+        hHeap = HeapCreate(HEAP_NO_SERIALIZE, 0, 0);
+        if (!BENCH_CHECK(hHeap))
+            __leave;
+
+        SIZE_T Before = GetPrivateBytes();
+        for (; HeldCnt < Count; HeldCnt++)
+        {
+            pObjectList[HeldCnt] = HeapAlloc(hHeap, HEAP_ZERO_MEMORY, pType->Size);
+            if (!BENCH_CHECK(pObjectList[HeldCnt]))
+                __leave;
+        }
+        double HeapBytes = BytesPerObject(Before, GetPrivateBytes(), Count);
+
+        LONGLONG Start = BenchNow();
+        for (ULONG n = 0; n < Count; n++)
+        {
+            PVOID pObject = HeapAlloc(hHeap, HEAP_ZERO_MEMORY, pType->Size);
+            BenchSink += (ULONG_PTR)pObject;
+            HeapFree(hHeap, 0, pObject);
+        }
+        LONGLONG HeapTicks = BenchNow() - Start;
+
+        HeapDestroy(hHeap);
+        hHeap = NULL;
+        HeldCnt = 0;
+
+        InitSlabPool(pPool, pType->Name, pType->Size);
+        Before = GetPrivateBytes();
+        for (; HeldCnt < Count; HeldCnt++)
+        {
+            pObjectList[HeldCnt] = SlabAlloc(pPool);
+            if (!BENCH_CHECK(pObjectList[HeldCnt]))
+                __leave;
+            BENCH_CHECK((ULONG_PTR)pObjectList[HeldCnt] % SYSTEM_CACHE_ALIGNMENT_SIZE == 0);
+        }
+        double SlabBytes = BytesPerObject(Before, GetPrivateBytes(), Count);
+        BENCH_CHECK(pPool->InUseCnt == Count);
+        BENCH_CHECK(pPool->SlabCnt == (Count + pPool->ObjectsPerSlab - 1) / pPool->ObjectsPerSlab);
+
+        Start = BenchNow();
+        for (ULONG n = 0; n < Count; n++)
+        {
+            PVOID pObject = SlabAlloc(pPool);
+            BenchSink += (ULONG_PTR)pObject;
+            SlabFree(pPool, pObject);
+        }
+        LONGLONG SlabTicks = BenchNow() - Start;
+
+        // a freed object comes back zeroed, as from HEAP_ZERO_MEMORY.
+        FillMemory(pObjectList[0], pType->Size, 0xCC);
+        SlabFree(pPool, pObjectList[0]);
+        pObjectList[0] = SlabAlloc(pPool);
+        for (SIZE_T i = 0; i < pType->Size; i++)
+        {
+            if (!BENCH_CHECK(((PBYTE)pObjectList[0])[i] == 0))
+                break;
+        }
+
+        printf("  %ls: %llu bytes, slab objects of %llu, %u per slab, %llu slabs for %lu\n",
+            pType->Name, (ULONGLONG)pType->Size, (ULONGLONG)pPool->ObjectSize, pPool->ObjectsPerSlab, (ULONGLONG)pPool->SlabCnt, Count);
+        printf("    private bytes per object   heap %8.0f   slab %8.0f\n", HeapBytes, SlabBytes);
+        printf("    alloc + free, %lu held     heap %6.1f ns  slab %6.1f ns\n",
+            Count, BenchNsPerOp(0, HeapTicks, Count), BenchNsPerOp(0, SlabTicks, Count));
+
+        // slabs are never returned, objects go back to the free list.
+        while (HeldCnt)
+            SlabFree(pPool, pObjectList[--HeldCnt]);
+        BENCH_CHECK(pPool->InUseCnt == 0);
+    }
+    __finally
+    {
+        if (hHeap)
+            HeapDestroy(hHeap);
+    }
+}
+
+VOID BenchSlab(_In_ ULONG Iterations)
+{
+    PVOID* pObjectList = HeapAlloc(GetProcessHeap(), 0, Iterations * sizeof(PVOID));
+    if (!BENCH_CHECK(pObjectList))
+        return;
+
+    printf("  GAME_ROOM lines: hot 0-%u, warm %u-%u, cold %u-%u\n",
+        (UINT)CACHE_LINE_OF(GAME_ROOM, MissionBallot),
+        (UINT)CACHE_LINE_OF(GAME_ROOM, SnapshotLock), (UINT)CACHE_LINE_OF(GAME_ROOM, PendingDeltaOp),
+        (UINT)CACHE_LINE_OF(GAME_ROOM, WaitingList), (UINT)((sizeof(GAME_ROOM) - 1) / SYSTEM_CACHE_ALIGNMENT_SIZE));
+    printf("  CONNECTION_INFO lines: read by broadcasts 0-%u, RefCnt and send state %u-%u\n",
+        (UINT)CACHE_LINE_OF(CONNECTION_INFO, bRoomStatusDelta),
+        (UINT)CACHE_LINE_OF(CONNECTION_INFO, RefCnt), (UINT)((sizeof(CONNECTION_INFO) - 1) / SYSTEM_CACHE_ALIGNMENT_SIZE));
+
+    for (UINT i = 0; i < _countof(SlabBenchTypeList); i++)
+        BenchSlabType(i, pObjectList, Iterations);
+
+    HeapFree(GetProcessHeap(), 0, pObjectList);
+}
@@ -0,0 +1,160 @@
+#include "Bench.h"
+#include <stdlib.h>
+
+#pragma comment(lib, "httpapi.lib")
+#pragma comment(lib, "Websocket.lib")
+
+typedef VOID(*BENCH_PROC)(_In_ ULONG Iterations);
+
+typedef struct _BENCH_ENTRY
+{
+    LPCWSTR Name;
+    BENCH_PROC Proc;
+    ULONG Iterations; // default, when not given on the command line
+    LPCWSTR Help;
+} BENCH_ENTRY;
+
+#define BENCH(Name, Proc, Iterations, Help) { Name, Proc, Iterations, Help },
+static const BENCH_ENTRY BenchList[] = {
+#include "Bench.inl"
+};
+#undef BENCH
+
+static volatile LONG FailCnt;
+static BOOL bStopOnFail; // bench check: the first failed check ends the run
+static LARGE_INTEGER Frequency;
+volatile ULONG_PTR BenchSink;
+
+BOOL BenchFail(_In_z_ PCSTR szCond, _In_z_ PCSTR szFile, _In_ int Line)
+{
+    InterlockedIncrement(&FailCnt);
+    printf("  FAILED: %s (%s:%d)\n", szCond, szFile, Line);
+    if (bStopOnFail)
+    {
+        // the threads of a benchmark may still be running, exit ends them with the process.
+        printf("stopped at the first failed check\n");
+        exit(1);
+    }
+    return FALSE;
+}
+
+LONGLONG BenchNow(VOID)
+{
+    LARGE_INTEGER Now;
+    QueryPerformanceCounter(&Now);
+    return Now.QuadPart;
+}
+
+double BenchNsPerOp(_In_ LONGLONG Start, _In_ LONGLONG End, _In_ ULONGLONG Count)
+{
+    return Count ? (double)(End - Start) * 1e9 / (double)Frequency.QuadPart / (double)Count : 0;
+}
+
+typedef struct _BENCH_THREAD
+{
+    LPTHREAD_START_ROUTINE Proc;
+    HANDLE hStartEvent;
+    UINT Index;
+} BENCH_THREAD;
+
+static DWORD WINAPI BenchThreadProc(_In_ LPVOID lpParameter)
+{
+    BENCH_THREAD* pThread = lpParameter;
+    WaitForSingleObject(pThread->hStartEvent, INFINITE);
+    return pThread->Proc((LPVOID)(ULONG_PTR)pThread->Index);
+}
+
+LONGLONG BenchRunThreads(_In_ UINT ThreadCnt, _In_ LPTHREAD_START_ROUTINE Proc)
+{
+    BENCH_THREAD ThreadList[BENCH_THREADS_MAX];
+    HANDLE hThreadList[BENCH_THREADS_MAX];
+    UINT StartedCnt = 0;
+    LONGLONG Start = 0, End = 0;
+
+    HANDLE hStartEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!hStartEvent)
+        return 0;
+
+    // created first and released together, so thread creation isn't timed.
+    for (; StartedCnt < ThreadCnt; StartedCnt++)
+    {
+        ThreadList[StartedCnt].Proc = Proc;
+        ThreadList[StartedCnt].hStartEvent = hStartEvent;
+        ThreadList[StartedCnt].Index = StartedCnt;
+        hThreadList[StartedCnt] = CreateThread(NULL, 0, BenchThreadProc, &ThreadList[StartedCnt], 0, NULL);
+        if (!hThreadList[StartedCnt])
+            break;
+    }
+
+    Start = BenchNow();
+    SetEvent(hStartEvent);
+    if (StartedCnt)
+        WaitForMultipleObjects(StartedCnt, hThreadList, TRUE, INFINITE);
+    End = BenchNow();
+
+    for (UINT i = 0; i < StartedCnt; i++)
+        CloseHandle(hThreadList[i]);
+    CloseHandle(hStartEvent);
+    if (StartedCnt < ThreadCnt)
+    {
+        BenchFail("CreateThread", __FILE__, __LINE__);
+        return 0;
+    }
+    return End - Start;
+}
+
+static VOID RunBench(_In_ const BENCH_ENTRY* pEntry, _In_ ULONG Iterations)
+{
+    LONG FailBefore = FailCnt;
+
+    printf("%ls (%lu iterations)\n", pEntry->Name, Iterations);
+    pEntry->Proc(Iterations);
+    printf("%ls: %s\n\n", pEntry->Name, FailCnt == FailBefore ? "ok" : "FAILED");
+}
+
+static VOID PrintUsage(VOID)
+{
+    printf("usage: bench <name>|all [iterations]\n");
+    printf("       bench check <name>|all [iterations]   stop at the first failed check, for the build\n\n");
+    for (UINT i = 0; i < _countof(BenchList); i++)
+        printf("  %-12ls %ls\n", BenchList[i].Name, BenchList[i].Help);
+}
+
+int wmain(int argc, WCHAR* argv[])
+{
+    if (argc > 1 && wcscmp(argv[1], L"check") == 0)
+    {
+        bStopOnFail = TRUE;
+        argc--;
+        argv++;
+    }
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 2;
+    }
+    ULONG Iterations = argc > 2 ? wcstoul(argv[2], NULL, 10) : 0;
+
+    QueryPerformanceFrequency(&Frequency);
+    InitLog();
+    LogMinLevel = LOG_WARNING; // the modules under test log every room and connection
+
+    BOOL bFound = FALSE;
+    for (UINT i = 0; i < _countof(BenchList); i++)
+    {
+        if (wcscmp(argv[1], L"all") == 0 || wcscmp(argv[1], BenchList[i].Name) == 0)
+        {
+            RunBench(&BenchList[i], Iterations ? Iterations : BenchList[i].Iterations);
+            bFound = TRUE;
+        }
+    }
+    if (!bFound)
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    if (FailCnt)
+        printf("%ld checks failed\n", FailCnt);
+    return FailCnt ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+#include "LoadClient.h"
+
+#define IDLE_WARMUP_CNT 1000      // connections opened before the baseline, the server's one-time growth
+#define IDLE_SETTLE_MS 5000       // wait after the last connect before measuring
+#define IDLE_PROGRESS_CNT 20000
+
+// Open Count connections and keep them idle. The server's private bytes grow by the memory
+// idle connections hold: CONNECTION_INFO, websocket.dll handle and buffers, the posted receive.
+BOOL LoadIdle(_In_ ULONG Count)
+{
+    SOCKET* pSocketList = HeapAlloc(GetProcessHeap(), 0, Count * sizeof(SOCKET));
+    ULONG OpenCnt = 0;
+    SIZE_T BaseBytes = 0;
+    BOOL bSuccess = FALSE;
+
+    if (!pSocketList)
+    {
+        printf("  out of memory for %lu sockets\n", Count);
+        return FALSE;
+    }
+
+    __try
+    {
+        LONGLONG Start = LoadNow();
+        for (; OpenCnt < Count; OpenCnt++)
+        {
+            if (OpenCnt == min(IDLE_WARMUP_CNT, Count / 2))
+            {
+                Sleep(IDLE_SETTLE_MS);
+                BaseBytes = GetServerPrivateBytes();
+            }
+
+            pSocketList[OpenCnt] = LoadConnect();
+            if (pSocketList[OpenCnt] == INVALID_SOCKET)
+            {
+                printf("  connection %lu failed (%d)\n", OpenCnt, WSAGetLastError());
+                __leave;
+            }
+            if ((OpenCnt + 1) % IDLE_PROGRESS_CNT == 0)
+                printf("  %lu connected, %.0f ms\n", OpenCnt + 1, LoadMsBetween(Start, LoadNow()));
+        }
+
+        Sleep(IDLE_SETTLE_MS);
+        SIZE_T Bytes = GetServerPrivateBytes();
+        ULONG MeasuredCnt = Count - min(IDLE_WARMUP_CNT, Count / 2);
+        if (!BaseBytes || !Bytes)
+        {
+            printf("  %lu idle connections, server memory not measured (give -pid)\n", Count);
+        }
+        else
+        {
+            double PerConn = ((double)Bytes - (double)BaseBytes) / MeasuredCnt;
+            printf("  %lu idle connections, server private bytes %llu -> %llu\n", Count, (ULONGLONG)BaseBytes, (ULONGLONG)Bytes);
+            printf("  %.0f bytes per connection, target %lu\n", PerConn, LoadOptions.TargetBytes);
+            if (PerConn > LoadOptions.TargetBytes)
+                LoadFail("server memory per idle connection over target");
+        }
+
+        if (LoadOptions.HoldSeconds)
+        {
+            printf("  holding them %lu s\n", LoadOptions.HoldSeconds);
+            Sleep(LoadOptions.HoldSeconds * 1000);
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        while (OpenCnt)
+            closesocket(pSocketList[--OpenCnt]);
+        HeapFree(GetProcessHeap(), 0, pSocketList);
+    }
+    return bSuccess;
+}
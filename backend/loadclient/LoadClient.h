@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef _WINSOCKAPI_
+#define _WINSOCKAPI_
+#endif
+
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <stdio.h>
+
+// Load against a running server over loopback: many websocket clients from one process.
+// Run on the server's machine, loadclient <mode> <count> [options], "loadclient" alone lists the modes.
+// Like bench, a missed target is printed as FAILED and makes loadclient exit with 1.
+
+#define LOAD_MODE(Name, Proc, Count, Help) BOOL Proc(_In_ ULONG ClientCnt);
+#include "LoadClient.inl"
+#undef LOAD_MODE
+
+// Clients bind their own source address and port: 127.0.0.1, .2, ... LOAD_PORTS_PER_ADDR ports each,
+// so more connections fit than the ephemeral port range has.
+#define LOAD_PORT_FIRST 10000
+#define LOAD_PORTS_PER_ADDR 50000
+#define LOAD_SOURCE_ADDR_MAX 16
+
+#define LOAD_HANDSHAKE_MAXLEN 1024 // the server's 101 answer
+#define LOAD_SEND_MAXLEN 512       // a message sent by a client
+#define LOAD_RECV_MAXLEN 8192      // a frame received, with its header
+
+typedef struct _LOAD_OPTIONS
+{
+    CHAR szHost[64];     // server address, 127.0.0.1
+    USHORT Port;         // 80
+    CHAR szPath[128];    // websocket URL path, /api
+    DWORD ServerPid;     // for its memory, 0 if not given
+    ULONG TargetBytes;   // idle: most server memory per connection
+    ULONG HoldSeconds;   // idle: keep the connections open this long after measuring
+} LOAD_OPTIONS;
+
+extern LOAD_OPTIONS LoadOptions;
+
+// Connect from the next free source address and port and upgrade to websocket.
+// INVALID_SOCKET if the connect or the upgrade failed, or no source port is left.
+SOCKET LoadConnect(VOID);
+
+// Send szText as one masked text frame.
+BOOL WsSendText(_In_ SOCKET Socket, _In_z_ PCSTR szText);
+
+// Frames received on a connection, which may arrive several in one recv or split across them.
+typedef struct _WS_READER
+{
+    SOCKET Socket;
+    ULONG cbUsed;  // bytes in Buffer
+    ULONG cbFrame; // bytes of the frame returned last, dropped by the next WsRecvText
+    CHAR Buffer[LOAD_RECV_MAXLEN];
+    CHAR Text[LOAD_RECV_MAXLEN + 1]; // payload of that frame, NUL terminated
+} WS_READER, * PWS_READER;
+
+// Next text message, pings are answered on the way. FALSE on close, timeout, error or a frame over LOAD_RECV_MAXLEN.
+BOOL WsRecvText(_Inout_ PWS_READER pReader, _Outptr_ PCSTR* pszText);
+
+// Private bytes of the server process (LoadOptions.ServerPid), 0 if it can't be read.
+SIZE_T GetServerPrivateBytes(VOID);
+
+// QueryPerformanceCounter ticks, and milliseconds between two of them.
+LONGLONG LoadNow(VOID);
+
+double LoadMsBetween(_In_ LONGLONG Start, _In_ LONGLONG End);
+
+// Count a missed target. Always returns FALSE.
+BOOL LoadFail(_In_z_ PCSTR szWhat);
@@ -0,0 +1,7 @@
+// Load modes, run by name: loadclient <mode> [count]. Included by LoadClient.h and main.c
+// with different definitions of LOAD_MODE. No include guard on purpose.
+//
+// LOAD_MODE(L"name", Proc, Count, L"help")  -> BOOL Proc(ULONG Count), Count is the default
+
+LOAD_MODE(L"idle",  LoadIdle,  200000, L"hold idle connections, measure the server's private bytes per connection against -target")
+LOAD_MODE(L"rooms", LoadRooms, 200,    L"start games in rooms of 5, then text messages: ms until every player of the room has the broadcast")
@@ -0,0 +1,218 @@
+#include "LoadClient.h"
+#include <stdlib.h>
+
+#define ROOMS_PLAYER_CNT 5        // the fewest a game starts with
+#define ROOMS_ROUNDS 100          // text messages per room
+#define ROOMS_THREADS 8           // rooms acting at the same time
+#define ROOMS_RECV_TIMEOUT 10000  // ms a client waits for a message
+
+typedef struct _LOAD_ROOM
+{
+    WS_READER PlayerList[ROOMS_PLAYER_CNT]; // the owner first
+    CHAR szRoomNumber[32];
+    BOOL bFailed; // a message didn't arrive, the room is left out of the following rounds
+} LOAD_ROOM, * PLOAD_ROOM;
+
+static PLOAD_ROOM pRoomList;
+static ULONG RoomCnt;
+static double* pLatencyList; // ms, ROOMS_ROUNDS per room. negative where the room had failed
+static LONG volatile FailedRoomCnt;
+
+// Read messages until one contains szNeedle, skipping the room status and game messages in between.
+static BOOL WaitForText(_Inout_ PWS_READER pReader, _In_z_ PCSTR szNeedle, _Outptr_ PCSTR* pszText)
+{
+    while (WsRecvText(pReader, pszText))
+    {
+        if (strstr(*pszText, szNeedle))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Send szMessage from pReader, wait for the reply of szType and check it succeeded.
+static BOOL Request(_Inout_ PWS_READER pReader, _In_z_ PCSTR szMessage, _In_z_ PCSTR szType, _Outptr_ PCSTR* pszReply)
+{
+    CHAR szNeedle[64];
+
+    sprintf_s(szNeedle, sizeof(szNeedle), "\"type\":\"%s\"", szType);
+    if (!WsSendText(pReader->Socket, szMessage) || !WaitForText(pReader, szNeedle, pszReply))
+        return FALSE;
+    return strstr(*pszReply, "\"result\":\"success\"") != NULL;
+}
+
+// Connect the players, create the room, join it and start the game: text messages need a running game.
+static BOOL OpenRoom(_In_ ULONG RoomIndex)
+{
+    PLOAD_ROOM pRoom = &pRoomList[RoomIndex];
+    DWORD Timeout = ROOMS_RECV_TIMEOUT;
+    CHAR szMessage[LOAD_SEND_MAXLEN];
+    PCSTR szReply;
+
+    for (UINT i = 0; i < ROOMS_PLAYER_CNT; i++)
+    {
+        pRoom->PlayerList[i].Socket = LoadConnect();
+        if (pRoom->PlayerList[i].Socket == INVALID_SOCKET)
+            return FALSE;
+        setsockopt(pRoom->PlayerList[i].Socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&Timeout, sizeof(Timeout));
+    }
+
+    sprintf_s(szMessage, sizeof(szMessage), "{\"type\":\"createRoom\",\"name\":\"lc%lu-0\"}", RoomIndex);
+    if (!Request(&pRoom->PlayerList[0], szMessage, "createRoom", &szReply))
+        return FALSE;
+
+    PCSTR pNumber = strstr(szReply, "\"roomNumber\":\"");
+    if (!pNumber)
+        return FALSE;
+    pNumber += strlen("\"roomNumber\":\"");
+    size_t cbNumber = strcspn(pNumber, "\"");
+    if (cbNumber >= sizeof(pRoom->szRoomNumber))
+        return FALSE;
+    CopyMemory(pRoom->szRoomNumber, pNumber, cbNumber);
+    pRoom->szRoomNumber[cbNumber] = '\0';
+
+    for (UINT i = 1; i < ROOMS_PLAYER_CNT; i++)
+    {
+        sprintf_s(szMessage, sizeof(szMessage), "{\"type\":\"joinRoom\",\"name\":\"lc%lu-%u\",\"roomNumber\":\"%s\"}",
+            RoomIndex, i, pRoom->szRoomNumber);
+        if (!Request(&pRoom->PlayerList[i], szMessage, "joinRoom", &szReply))
+            return FALSE;
+    }
+
+    return Request(&pRoom->PlayerList[0], "{\"type\":\"startGame\"}", "startGame", &szReply);
+}
+
+// Each thread takes every ROOMS_THREADS-th room. A round sends one text message in each of them,
+// from the next player in turn, and times it until all players of the room have the broadcast.
+static DWORD WINAPI RoomsThread(_In_ LPVOID lpParameter)
+{
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)lpParameter;
+    CHAR szMarker[32];
+    CHAR szMessage[LOAD_SEND_MAXLEN];
+    PCSTR szText;
+
+    for (UINT Round = 0; Round < ROOMS_ROUNDS; Round++)
+    {
+        // only this round's broadcast has it, the sender's reply doesn't.
+        sprintf_s(szMarker, sizeof(szMarker), "\"lc#%u\"", Round);
+        sprintf_s(szMessage, sizeof(szMessage), "{\"type\":\"playerTextMessage\",\"message\":%s}", szMarker);
+
+        for (ULONG r = ThreadIndex; r < RoomCnt; r += ROOMS_THREADS)
+        {
+            PLOAD_ROOM pRoom = &pRoomList[r];
+            if (pRoom->bFailed)
+                continue;
+
+            LONGLONG Start = LoadNow();
+            BOOL bReceived = WsSendText(pRoom->PlayerList[Round % ROOMS_PLAYER_CNT].Socket, szMessage);
+            for (UINT i = 0; i < ROOMS_PLAYER_CNT && bReceived; i++)
+                bReceived = WaitForText(&pRoom->PlayerList[i], szMarker, &szText);
+
+            if (!bReceived)
+            {
+                pRoom->bFailed = TRUE;
+                InterlockedIncrement(&FailedRoomCnt);
+                continue;
+            }
+            pLatencyList[r * ROOMS_ROUNDS + Round] = LoadMsBetween(Start, LoadNow());
+        }
+    }
+    return 0;
+}
+
+static int CompareLatency(_In_ const void* pLeft, _In_ const void* pRight)
+{
+    double Left = *(const double*)pLeft, Right = *(const double*)pRight;
+    return Left < Right ? -1 : Left > Right;
+}
+
+BOOL LoadRooms(_In_ ULONG Count)
+{
+    HANDLE ThreadList[ROOMS_THREADS];
+    ULONG ThreadCnt = 0;
+    BOOL bSuccess = FALSE;
+
+    RoomCnt = Count;
+    pRoomList = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, Count * sizeof(LOAD_ROOM));
+    pLatencyList = HeapAlloc(GetProcessHeap(), 0, (SIZE_T)Count * ROOMS_ROUNDS * sizeof(double));
+    if (!pRoomList || !pLatencyList)
+    {
+        printf("  out of memory for %lu rooms\n", Count);
+        HeapFree(GetProcessHeap(), 0, pRoomList);
+        HeapFree(GetProcessHeap(), 0, pLatencyList);
+        return FALSE;
+    }
+
+    __try
+    {
+        for (ULONG r = 0; r < Count; r++)
+        {
+            for (UINT i = 0; i < ROOMS_PLAYER_CNT; i++)
+                pRoomList[r].PlayerList[i].Socket = INVALID_SOCKET;
+        }
+        for (ULONG n = 0; n < Count * ROOMS_ROUNDS; n++)
+            pLatencyList[n] = -1;
+
+        LONGLONG Start = LoadNow();
+        for (ULONG r = 0; r < Count; r++)
+        {
+            if (!OpenRoom(r))
+            {
+                printf("  room %lu failed to start (%d)\n", r, WSAGetLastError());
+                __leave;
+            }
+        }
+        printf("  %lu rooms of %u playing, %.0f ms\n", Count, ROOMS_PLAYER_CNT, LoadMsBetween(Start, LoadNow()));
+
+        for (; ThreadCnt < min(ROOMS_THREADS, Count); ThreadCnt++)
+        {
+            ThreadList[ThreadCnt] = CreateThread(NULL, 0, RoomsThread, (LPVOID)(ULONG_PTR)ThreadCnt, 0, NULL);
+            if (!ThreadList[ThreadCnt])
+            {
+                printf("  CreateThread failed (%lu)\n", GetLastError());
+                __leave;
+            }
+        }
+        WaitForMultipleObjects(ThreadCnt, ThreadList, TRUE, INFINITE);
+
+        // the rounds of failed rooms are left out.
+        ULONG SampleCnt = 0;
+        for (ULONG n = 0; n < Count * ROOMS_ROUNDS; n++)
+        {
+            if (pLatencyList[n] >= 0)
+                pLatencyList[SampleCnt++] = pLatencyList[n];
+        }
+        if (SampleCnt)
+        {
+            qsort(pLatencyList, SampleCnt, sizeof(double), CompareLatency);
+            printf("  %lu text messages, %u rooms at a time, ms until the last player has it:\n", SampleCnt, ROOMS_THREADS);
+            printf("    median %.3f  p99 %.3f  max %.3f\n",
+                pLatencyList[SampleCnt / 2], pLatencyList[(ULONGLONG)SampleCnt * 99 / 100], pLatencyList[SampleCnt - 1]);
+        }
+        if (FailedRoomCnt)
+        {
+            printf("  %ld rooms stopped receiving\n", FailedRoomCnt);
+            LoadFail("text messages lost or timed out");
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        // when a thread failed to start, the ones before it still run their rounds to the end.
+        while (ThreadCnt)
+        {
+            WaitForSingleObject(ThreadList[--ThreadCnt], INFINITE);
+            CloseHandle(ThreadList[ThreadCnt]);
+        }
+        for (ULONG r = 0; r < Count; r++)
+        {
+            for (UINT i = 0; i < ROOMS_PLAYER_CNT; i++)
+            {
+                if (pRoomList[r].PlayerList[i].Socket != INVALID_SOCKET)
+                    closesocket(pRoomList[r].PlayerList[i].Socket);
+            }
+        }
+        HeapFree(GetProcessHeap(), 0, pRoomList);
+        HeapFree(GetProcessHeap(), 0, pLatencyList);
+    }
+    return bSuccess;
+}
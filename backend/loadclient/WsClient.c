@@ -0,0 +1,196 @@
+#include "LoadClient.h"
+
+// The next source address and port to bind, see LOAD_PORT_FIRST.
+static UINT SourceAddrIndex;
+static UINT SourcePortIndex;
+
+// Bind Socket to the next free source. FALSE once every address and port was tried.
+static BOOL BindNextSource(_In_ SOCKET Socket)
+{
+    SOCKADDR_IN Addr = { AF_INET };
+
+    while (SourceAddrIndex < LOAD_SOURCE_ADDR_MAX)
+    {
+        Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + SourceAddrIndex);
+        Addr.sin_port = htons((USHORT)(LOAD_PORT_FIRST + SourcePortIndex));
+        if (++SourcePortIndex == LOAD_PORTS_PER_ADDR)
+        {
+            SourcePortIndex = 0;
+            SourceAddrIndex++;
+        }
+
+        if (bind(Socket, (SOCKADDR*)&Addr, sizeof(Addr)) == 0)
+            return TRUE;
+        if (WSAGetLastError() != WSAEADDRINUSE)
+            return FALSE;
+    }
+    return FALSE;
+}
+
+static BOOL SendAll(_In_ SOCKET Socket, _In_reads_bytes_(cbLen) const CHAR* pData, _In_ int cbLen)
+{
+    while (cbLen > 0)
+    {
+        int cbSent = send(Socket, pData, cbLen, 0);
+        if (cbSent == SOCKET_ERROR)
+            return FALSE;
+        pData += cbSent;
+        cbLen -= cbSent;
+    }
+    return TRUE;
+}
+
+// Send the upgrade request and read the answer up to its blank line, the server sends nothing after it
+// until the client does.
+static BOOL Upgrade(_In_ SOCKET Socket)
+{
+    CHAR Request[512];
+    CHAR Response[LOAD_HANDSHAKE_MAXLEN + 1];
+    int cbUsed = 0;
+
+    // the key is checked by the server for its form only, a fixed one does.
+    int cbLen = sprintf_s(Request, sizeof(Request),
+        "GET %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "\r\n",
+        LoadOptions.szPath, LoadOptions.szHost);
+    if (cbLen < 0 || !SendAll(Socket, Request, cbLen))
+        return FALSE;
+
+    for (;;)
+    {
+        int cbRecv = recv(Socket, Response + cbUsed, LOAD_HANDSHAKE_MAXLEN - cbUsed, 0);
+        if (cbRecv <= 0)
+            return FALSE;
+        cbUsed += cbRecv;
+        Response[cbUsed] = '\0';
+
+        if (strstr(Response, "\r\n\r\n"))
+            return strncmp(Response, "HTTP/1.1 101", 12) == 0;
+        if (cbUsed == LOAD_HANDSHAKE_MAXLEN)
+            return FALSE;
+    }
+}
+
+SOCKET LoadConnect(VOID)
+{
+    SOCKADDR_IN Server = { AF_INET };
+
+    Server.sin_port = htons(LoadOptions.Port);
+    if (inet_pton(AF_INET, LoadOptions.szHost, &Server.sin_addr) != 1)
+        return INVALID_SOCKET;
+
+    SOCKET Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (Socket == INVALID_SOCKET)
+        return INVALID_SOCKET;
+
+    if (!BindNextSource(Socket) ||
+        connect(Socket, (SOCKADDR*)&Server, sizeof(Server)) == SOCKET_ERROR ||
+        !Upgrade(Socket))
+    {
+        closesocket(Socket);
+        return INVALID_SOCKET;
+    }
+    return Socket;
+}
+
+// Client frames must be masked. The mask is zero, the payload goes out as it is.
+static BOOL SendFrame(_In_ SOCKET Socket, _In_ BYTE Opcode, _In_reads_bytes_(cbLen) const CHAR* pData, _In_ ULONG cbLen)
+{
+    CHAR Frame[LOAD_SEND_MAXLEN + 8];
+    ULONG cbHeader;
+
+    if (cbLen > LOAD_SEND_MAXLEN)
+        return FALSE;
+
+    Frame[0] = (CHAR)(0x80 | Opcode); // FIN
+    if (cbLen < 126)
+    {
+        Frame[1] = (CHAR)(0x80 | cbLen);
+        cbHeader = 2;
+    }
+    else
+    {
+        Frame[1] = (CHAR)(0x80 | 126);
+        Frame[2] = (CHAR)(cbLen >> 8);
+        Frame[3] = (CHAR)cbLen;
+        cbHeader = 4;
+    }
+    ZeroMemory(Frame + cbHeader, 4);
+    cbHeader += 4;
+
+    CopyMemory(Frame + cbHeader, pData, cbLen);
+    return SendAll(Socket, Frame, (int)(cbHeader + cbLen));
+}
+
+BOOL WsSendText(_In_ SOCKET Socket, _In_z_ PCSTR szText)
+{
+    return SendFrame(Socket, 0x1, szText, (ULONG)strlen(szText));
+}
+
+BOOL WsRecvText(_Inout_ PWS_READER pReader, _Outptr_ PCSTR* pszText)
+{
+    *pszText = pReader->Text;
+
+    for (;;)
+    {
+        // drop the frame returned last, keep what came after it.
+        MoveMemory(pReader->Buffer, pReader->Buffer + pReader->cbFrame, pReader->cbUsed - pReader->cbFrame);
+        pReader->cbUsed -= pReader->cbFrame;
+        pReader->cbFrame = 0;
+
+        const BYTE* pHeader = (const BYTE*)pReader->Buffer;
+        ULONG cbHeader = 2;
+        if (pReader->cbUsed >= 2)
+        {
+            if ((pHeader[1] & 0x7F) == 126)
+                cbHeader = 4;
+            else if ((pHeader[1] & 0x7F) == 127)
+                cbHeader = 10;
+        }
+
+        if (pReader->cbUsed >= cbHeader)
+        {
+            // server frames aren't masked.
+            if (pHeader[1] & 0x80)
+                return FALSE;
+
+            ULONGLONG cbPayload = pHeader[1] & 0x7F;
+            if (cbHeader > 2)
+            {
+                cbPayload = 0;
+                for (ULONG i = 2; i < cbHeader; i++)
+                    cbPayload = (cbPayload << 8) | pHeader[i];
+            }
+            if (cbPayload > LOAD_RECV_MAXLEN - cbHeader)
+                return FALSE;
+
+            if (pReader->cbUsed >= cbHeader + cbPayload)
+            {
+                BYTE Opcode = pHeader[0] & 0x0F;
+                pReader->cbFrame = cbHeader + (ULONG)cbPayload;
+
+                if (Opcode == 0x8) // close
+                    return FALSE;
+                if (Opcode == 0x9 && !SendFrame(pReader->Socket, 0xA, pReader->Buffer + cbHeader, (ULONG)cbPayload))
+                    return FALSE;
+                if (Opcode > 0x1) // binary and control frames
+                    continue;
+
+                CopyMemory(pReader->Text, pReader->Buffer + cbHeader, (SIZE_T)cbPayload);
+                pReader->Text[cbPayload] = '\0';
+                return TRUE;
+            }
+        }
+
+        // the frame isn't complete, it fits in what is left of Buffer.
+        int cbRecv = recv(pReader->Socket, pReader->Buffer + pReader->cbUsed, LOAD_RECV_MAXLEN - pReader->cbUsed, 0);
+        if (cbRecv <= 0)
+            return FALSE;
+        pReader->cbUsed += cbRecv;
+    }
+}
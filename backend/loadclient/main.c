@@ -0,0 +1,137 @@
+#include "LoadClient.h"
+#include <psapi.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+typedef BOOL(*LOAD_PROC)(_In_ ULONG Count);
+
+typedef struct _LOAD_MODE_ENTRY
+{
+    LPCWSTR Name;
+    LOAD_PROC Proc;
+    ULONG Count; // default, when not given on the command line
+    LPCWSTR Help;
+} LOAD_MODE_ENTRY;
+
+#define LOAD_MODE(Name, Proc, Count, Help) { Name, Proc, Count, Help },
+static const LOAD_MODE_ENTRY LoadModeList[] = {
+#include "LoadClient.inl"
+};
+#undef LOAD_MODE
+
+LOAD_OPTIONS LoadOptions = { "127.0.0.1", 80, "/api", 0, 2048, 0 };
+
+static LONG FailCnt;
+static LARGE_INTEGER Frequency;
+static HANDLE hServerProcess;
+
+BOOL LoadFail(_In_z_ PCSTR szWhat)
+{
+    FailCnt++;
+    printf("  FAILED: %s\n", szWhat);
+    return FALSE;
+}
+
+LONGLONG LoadNow(VOID)
+{
+    LARGE_INTEGER Now;
+    QueryPerformanceCounter(&Now);
+    return Now.QuadPart;
+}
+
+double LoadMsBetween(_In_ LONGLONG Start, _In_ LONGLONG End)
+{
+    return (double)(End - Start) * 1000.0 / (double)Frequency.QuadPart;
+}
+
+SIZE_T GetServerPrivateBytes(VOID)
+{
+    PROCESS_MEMORY_COUNTERS_EX Counters = { sizeof(Counters) };
+
+    if (!hServerProcess ||
+        !GetProcessMemoryInfo(hServerProcess, (PPROCESS_MEMORY_COUNTERS)&Counters, sizeof(Counters)))
+        return 0;
+    return Counters.PrivateUsage;
+}
+
+static VOID PrintUsage(VOID)
+{
+    printf("usage: loadclient <mode> [count] [-host <ip>] [-port <n>] [-path <url path>]\n");
+    printf("                  [-pid <server pid>] [-target <bytes>] [-hold <seconds>]\n\n");
+    for (UINT i = 0; i < _countof(LoadModeList); i++)
+        printf("  %-8ls %ls\n", LoadModeList[i].Name, LoadModeList[i].Help);
+}
+
+// Options after the mode and count. FALSE if one is unknown or has no value.
+static BOOL ParseOptions(_In_ int argc, _In_reads_(argc) WCHAR* argv[])
+{
+    for (int i = 0; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+            return FALSE;
+
+        if (wcscmp(argv[i], L"-host") == 0)
+            WideCharToMultiByte(CP_UTF8, 0, argv[i + 1], -1, LoadOptions.szHost, sizeof(LoadOptions.szHost), NULL, NULL);
+        else if (wcscmp(argv[i], L"-port") == 0)
+            LoadOptions.Port = (USHORT)wcstoul(argv[i + 1], NULL, 10);
+        else if (wcscmp(argv[i], L"-path") == 0)
+            WideCharToMultiByte(CP_UTF8, 0, argv[i + 1], -1, LoadOptions.szPath, sizeof(LoadOptions.szPath), NULL, NULL);
+        else if (wcscmp(argv[i], L"-pid") == 0)
+            LoadOptions.ServerPid = wcstoul(argv[i + 1], NULL, 10);
+        else if (wcscmp(argv[i], L"-target") == 0)
+            LoadOptions.TargetBytes = wcstoul(argv[i + 1], NULL, 10);
+        else if (wcscmp(argv[i], L"-hold") == 0)
+            LoadOptions.HoldSeconds = wcstoul(argv[i + 1], NULL, 10);
+        else
+            return FALSE;
+    }
+    return TRUE;
+}
+
+int wmain(int argc, WCHAR* argv[])
+{
+    WSADATA WsaData;
+
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    const LOAD_MODE_ENTRY* pMode = NULL;
+    for (UINT i = 0; i < _countof(LoadModeList); i++)
+    {
+        if (wcscmp(argv[1], LoadModeList[i].Name) == 0)
+            pMode = &LoadModeList[i];
+    }
+    int FirstOption = argc > 2 && argv[2][0] != L'-' ? 3 : 2;
+    if (!pMode || !ParseOptions(argc - FirstOption, argv + FirstOption))
+    {
+        PrintUsage();
+        return 2;
+    }
+    ULONG Count = FirstOption == 3 ? wcstoul(argv[2], NULL, 10) : pMode->Count;
+
+    QueryPerformanceFrequency(&Frequency);
+    int ret = WSAStartup(MAKEWORD(2, 2), &WsaData);
+    if (ret)
+    {
+        printf("WSAStartup failed: %d\n", ret);
+        return 2;
+    }
+    if (LoadOptions.ServerPid)
+    {
+        hServerProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, LoadOptions.ServerPid);
+        if (!hServerProcess)
+            printf("can't open process %lu (%lu), server memory isn't measured.\n", LoadOptions.ServerPid, GetLastError());
+    }
+
+    printf("%ls (%lu) against %s:%u%s\n", pMode->Name, Count, LoadOptions.szHost, LoadOptions.Port, LoadOptions.szPath);
+    BOOL bSuccess = pMode->Proc(Count);
+    printf("%ls: %s\n", pMode->Name, bSuccess && !FailCnt ? "ok" : "FAILED");
+
+    if (hServerProcess)
+        CloseHandle(hServerProcess);
+    WSACleanup();
+    return bSuccess && !FailCnt ? 0 : 1;
+}